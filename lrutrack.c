@@ -3,71 +3,64 @@
 // Created (yyyy-mm-dd): 2025-03-10
 
 #include "lrutrack.h"
+#include "lrutrack_hash.h"
 
 #include <string.h>
 #include <assert.h>
 
+#if LRUTRACK_HUGE_PAGES && defined(__linux__)
+#   include <sys/mman.h>
+#endif
+
+#if !defined(_WIN32)
+#   include <pthread.h>
+#   define LRUTRACK_HAS_PTHREADS 1
+#else
+#   define LRUTRACK_HAS_PTHREADS 0
+#endif
+
 #if !defined(NDEBUG)
 #   define LRUTRACK_ONLY_IN_DEBUG(x) x
 #else
 #   define LRUTRACK_ONLY_IN_DEBUG(x)
 #endif
 
+#if defined(__GNUC__) || defined(__clang__)
+#   define LRUTRACK_PREFETCH(ptr) __builtin_prefetch(ptr)
+#else
+#   define LRUTRACK_PREFETCH(ptr) ((void)(ptr))
+#endif
+
+#define LRUTRACK_ALIGNMENT 16
+#define LRUTRACK_HUGE_PAGE_SIZE ((size_t)2 << 20)
+
 static int lrutrack_is_power_of_two(uint32_t x) {
     return x > 0 && (x & (x - 1)) == 0;
 }
 
+// Asks the kernel to back the 2 MB aligned part of a large array with
+// transparent huge pages. Failure is harmless, the array just stays on
+// regular pages.
+static void lrutrack_advise_huge_pages(void *ptr, size_t bytesize) {
+#if LRUTRACK_HUGE_PAGES && defined(__linux__) && defined(MADV_HUGEPAGE)
+    const uintptr_t huge_page_size = LRUTRACK_HUGE_PAGE_SIZE;
+    uintptr_t begin = ((uintptr_t)ptr + huge_page_size - 1) &
+        ~(huge_page_size - 1);
+    uintptr_t end = ((uintptr_t)ptr + bytesize) & ~(huge_page_size - 1);
+    if (end > begin)
+        madvise((void *)begin, end - begin, MADV_HUGEPAGE);
+#else
+    (void)ptr;
+    (void)bytesize;
+#endif
+}
+
 #if !LRUTRACK_32BIT_KEY
 
 static uint32_t lrutrack_hash(const void *key, uint32_t len, uint32_t seed,
     uint32_t hash_table_size) {
     assert(lrutrack_is_power_of_two(hash_table_size));
-
-    const uint32_t m = 0x5bd1e995;
-    const uint32_t r = 24;
-
-    uint32_t h = seed ^ (uint32_t)len;
-
-    const uint8_t *data = (const uint8_t *)key;
-
-    while (len >= 4) {
-        uint32_t k;
-        k = data[0];
-        k |= (uint32_t)data[1] << 8;
-        k |= (uint32_t)data[2] << 16;
-        k |= (uint32_t)data[3] << 24;
-
-        k *= m;
-        k ^= k >> r;
-        k *= m;
-
-        h *= m;
-        h ^= k;
-
-        data += 4;
-        len -= 4;
-    }
-
-    switch (len) {
-        case 3:
-            h ^= (uint32_t)data[2] << 16;
-        case 2:
-            h ^= (uint32_t)data[1] << 8;
-        case 1:
-            h ^= data[0];
-            h *= m;
-    };
-
-    h ^= h >> 13;
-    h *= m;
-    h ^= h >> 15;
-    return h & (hash_table_size - 1);
-}
-
-static int lrutrack_cmp_keys(const void *a, uint32_t a_length,
-    const void *b, uint32_t b_length) {
-    if (a_length != b_length) return 0;
-    return memcmp(a, b, a_length) == 0 ? 1 : 0;
+    return lrutrack_murmur2(key, len, seed) & (hash_table_size - 1);
 }
 
 #endif
@@ -83,65 +76,195 @@ typedef struct lrutrack_item_t {
 #endif
     lrutrack_value_t value;
     uint32_t next; // Next item index (hash table row or free list)
+    uint32_t generation; // Of the insert, checked by handles
 } lrutrack_item_t;
 
+_Static_assert(sizeof(lrutrack_item_t) ==
+    (LRUTRACK_32BIT_KEY ? 16 : sizeof(void *) + 16),
+    "Pins and priorities live in item_attrs, not in the items");
+
+// Free items do not need a key, its storage holds the previous free item
+#if !LRUTRACK_32BIT_KEY
+#   define LRUTRACK_FREE_PREV(item) ((item)->key_length)
+#else
+#   define LRUTRACK_FREE_PREV(item) ((item)->key)
+#endif
+
+// Per item, allocated along with the items once tenants are enabled
+typedef struct lrutrack_tenant_link_t {
+    uint32_t prev; // Item index toward the tenant's most recently used
+    uint32_t next;
+    uint32_t tenant;
+    uint32_t weight;
+} lrutrack_tenant_link_t;
+
+// Per item, allocated once an entry is pinned or given a priority
+typedef struct lrutrack_item_attr_t {
+    uint16_t pins; // Eviction is held off while nonzero
+    uint8_t priority;
+} lrutrack_item_attr_t;
+
+typedef struct lrutrack_tenant_t {
+    uint64_t quota;
+    uint64_t usage; // Weight of the tenant's items
+    uint32_t head; // Item index, most recently used
+    uint32_t tail;
+    uint32_t over_prev; // Over quota list, tenant index
+    uint32_t over_next;
+} lrutrack_tenant_t;
+
 typedef struct lrutrack_t {
     void *evict_user;
     lrutrack_evict_func_t evict_func;
-    lrutrack_malloc_func_t malloc_func;
+    lrutrack_malloc_func_t malloc_func; // Used when allocator is not set
     lrutrack_free_func_t free_func;
+    lrutrack_allocator_t allocator;
     uint32_t *hash_table; // First item index on a row
     uint32_t *hash_table_lru_links; // 2 * hash_table_size, 0 = prev, 1 = next
+    uint8_t *row_priorities; // LRU list of each row, 0 on empty rows
     lrutrack_item_t *items;
+    lrutrack_item_attr_t *item_attrs; // num_items, NULL until first used
+#if !LRUTRACK_32BIT_KEY
+    uint8_t *key_slots; // In-place trackers: max_key_length bytes per item
+    uint32_t max_key_length;
+#endif
     uint32_t num_items;
+    uint32_t num_used; // Live items
+    uint32_t num_pinned; // Live items with pins
     uint32_t hash_table_size;
-    uint32_t lru_head; // Hash table index
-    uint32_t lru_tail;
-    uint32_t first_free; // Item index
+    uint32_t lru_head[LRUTRACK_NUM_PRIORITIES]; // Hash table index
+    uint32_t lru_tail[LRUTRACK_NUM_PRIORITIES];
+    uint32_t priority_aging[LRUTRACK_NUM_PRIORITIES]; // Evictions below, 0 = off
+    uint32_t priority_credit[LRUTRACK_NUM_PRIORITIES];
+    uint32_t first_free; // Item index, free list is doubly linked
+    uint32_t compact_row; // Next hash table row of a compaction pass
+    uint32_t compact_priority; // LRU list compact_row is on
+    uint32_t compact_cursor; // Next item index to pack into
+    int compacting;
     uint32_t seed;
+    uint32_t generation; // Of the next insert
     lrutrack_value_t invalid_value;
+    int in_place; // Fixed capacity in a caller-provided buffer, no allocation
+    int defer_evictions;
+    lrutrack_value_t *deferred; // Evicted values not yet delivered
+    uint32_t num_deferred;
+    uint32_t deferred_capacity;
+    lrutrack_tenant_t *tenants; // NULL until tenants are enabled
+    lrutrack_tenant_link_t *tenant_links; // num_items
+    uint32_t num_tenants;
+    uint32_t first_over; // Tenant index, over quota list
+    const uint32_t *clock; // Stamps rows moving to an LRU head when set
+    uint32_t *row_stamps;
 } lrutrack_t;
 
 //
 // Private functions
 
+static void *lrutrack_alloc(lrutrack_t *t, size_t bytesize, size_t alignment) {
+    if (t->allocator.alloc_func)
+        return t->allocator.alloc_func(t->allocator.user, bytesize, alignment);
+    return t->malloc_func(bytesize);
+}
+
+static void lrutrack_dealloc(lrutrack_t *t, void *ptr, size_t bytesize) {
+    if (!ptr)
+        return;
+    if (t->allocator.dealloc_func)
+        t->allocator.dealloc_func(t->allocator.user, ptr, bytesize);
+    else
+        t->free_func(ptr);
+}
+
+// Arrays large enough for huge pages are requested huge page aligned so that
+// none of them is left on regular pages.
+static size_t lrutrack_array_alignment(size_t bytesize) {
+    if (LRUTRACK_HUGE_PAGES && bytesize >= LRUTRACK_HUGE_PAGE_SIZE)
+        return LRUTRACK_HUGE_PAGE_SIZE;
+    return LRUTRACK_ALIGNMENT;
+}
+
+static void *lrutrack_alloc_array(lrutrack_t *t, size_t bytesize) {
+    void *ptr = lrutrack_alloc(t, bytesize, lrutrack_array_alignment(bytesize));
+    if (ptr)
+        lrutrack_advise_huge_pages(ptr, bytesize);
+    return ptr;
+}
+
+// Trackers that never pin or prioritize have all items at 0
+static uint32_t lrutrack_item_pins(const lrutrack_t *t, uint32_t index) {
+    return t->item_attrs ? t->item_attrs[index].pins : 0;
+}
+
+static uint32_t lrutrack_item_priority(const lrutrack_t *t, uint32_t index) {
+    return t->item_attrs ? t->item_attrs[index].priority : 0;
+}
+
+static int lrutrack_alloc_item_attrs(lrutrack_t *t) {
+    if (t->item_attrs)
+        return LRUTRACK_OK;
+
+    assert(!t->in_place);
+    size_t bytesize = sizeof(*t->item_attrs) * t->num_items;
+    lrutrack_item_attr_t *item_attrs = lrutrack_alloc_array(t, bytesize);
+    if (!item_attrs)
+        return LRUTRACK_OOM;
+
+    memset(item_attrs, 0, bytesize);
+    t->item_attrs = item_attrs;
+    return LRUTRACK_OK;
+}
+
 static void lrutrack_check_internal_state(const lrutrack_t *t) {
     assert(t);
-    assert(t->malloc_func);
-    assert(t->free_func);
+    assert(t->in_place || t->malloc_func || t->allocator.alloc_func);
+    assert(t->in_place || t->free_func || t->allocator.dealloc_func);
     assert(t->hash_table_size != 0);
     assert(lrutrack_is_power_of_two(t->hash_table_size));
 
     assert(t->first_free == UINT32_MAX ||
         t->first_free < t->num_items);
-
-    assert(t->lru_head == UINT32_MAX ||
-        t->lru_head < t->hash_table_size);
-    assert(t->lru_tail == UINT32_MAX ||
-        t->lru_tail < t->hash_table_size);
-    assert(t->lru_head == UINT32_MAX ||
-        t->hash_table_lru_links[t->lru_head * 2 + 0] == UINT32_MAX);
-    assert(t->lru_tail == UINT32_MAX ||
-        t->hash_table_lru_links[t->lru_tail * 2 + 1] == UINT32_MAX);
+    assert(t->first_free == UINT32_MAX ||
+        LRUTRACK_FREE_PREV(&t->items[t->first_free]) == UINT32_MAX);
+    assert(t->compact_row == UINT32_MAX ||
+        (t->compacting && t->compact_row < t->hash_table_size));
+    assert(t->compact_priority < LRUTRACK_NUM_PRIORITIES);
+
+    for (uint32_t p = 0; p < LRUTRACK_NUM_PRIORITIES; ++p) {
+        assert(t->lru_head[p] == UINT32_MAX ||
+            t->lru_head[p] < t->hash_table_size);
+        assert(t->lru_tail[p] == UINT32_MAX ||
+            t->lru_tail[p] < t->hash_table_size);
+        assert(t->lru_head[p] == UINT32_MAX ||
+            t->hash_table_lru_links[t->lru_head[p] * 2 + 0] == UINT32_MAX);
+        assert(t->lru_tail[p] == UINT32_MAX ||
+            t->hash_table_lru_links[t->lru_tail[p] * 2 + 1] == UINT32_MAX);
+    }
 
 #if LRUTRACK_HC_TESTS
-    uint32_t prev_iter = UINT32_MAX;
-    uint32_t iter = t->lru_head;
-    while (iter != UINT32_MAX) {
-        assert(iter < t->hash_table_size);
-        assert(t->hash_table_lru_links[iter * 2 + 0] == prev_iter);
-        prev_iter = iter;
-        iter = t->hash_table_lru_links[iter * 2 + 1];
-    }
+    uint32_t prev_iter;
+    uint32_t iter;
+    for (uint32_t p = 0; p < LRUTRACK_NUM_PRIORITIES; ++p) {
+        prev_iter = UINT32_MAX;
+        iter = t->lru_head[p];
+        while (iter != UINT32_MAX) {
+            assert(iter < t->hash_table_size);
+            assert(t->hash_table_lru_links[iter * 2 + 0] == prev_iter);
+            assert(t->row_priorities[iter] == p);
+            prev_iter = iter;
+            iter = t->hash_table_lru_links[iter * 2 + 1];
+        }
 
-    assert(prev_iter == t->lru_tail);
+        assert(prev_iter == t->lru_tail[p]);
+    }
 
     for (uint32_t i = 0; i < t->hash_table_size; ++i) {
         assert(t->hash_table_lru_links[i * 2 + 0] != i);
         assert(t->hash_table_lru_links[i * 2 + 1] != i);
+        assert(t->row_priorities[i] < LRUTRACK_NUM_PRIORITIES);
         if (t->hash_table[i] == UINT32_MAX) {
             assert(t->hash_table_lru_links[i * 2 + 0] == UINT32_MAX);
             assert(t->hash_table_lru_links[i * 2 + 1] == UINT32_MAX);
+            assert(t->row_priorities[i] == 0);
         }
     }
 
@@ -149,18 +272,117 @@ static void lrutrack_check_internal_state(const lrutrack_t *t) {
         assert(t->hash_table[i] == UINT32_MAX ||
             t->hash_table[i] < t->num_items);
 
-        uint32_t iter = 0;
+        uint32_t max_priority = 0;
+        uint32_t iter = t->hash_table[i];
         while (iter != UINT32_MAX) {
+            assert(iter < t->num_items);
             const lrutrack_item_t *item = &t->items[iter];
+            assert(item->value != t->invalid_value);
+            uint32_t priority = lrutrack_item_priority(t, iter);
+            assert(priority < LRUTRACK_NUM_PRIORITIES);
+            if (priority > max_priority)
+                max_priority = priority;
 
             iter = item->next;
         }
+
+        // Aging may leave a row below its items
+        assert(t->row_priorities[i] <= max_priority);
+    }
+
+    uint32_t num_pinned = 0;
+    for (uint32_t i = 0; i < t->num_items; ++i) {
+        if (t->items[i].value != t->invalid_value &&
+            lrutrack_item_pins(t, i) != 0)
+            ++num_pinned;
+    }
+
+    assert(num_pinned == t->num_pinned);
+
+    uint32_t num_free = 0;
+    prev_iter = UINT32_MAX;
+    iter = t->first_free;
+    while (iter != UINT32_MAX) {
+        assert(iter < t->num_items);
+        const lrutrack_item_t *item = &t->items[iter];
+        assert(item->value == t->invalid_value);
+        assert(LRUTRACK_FREE_PREV(item) == prev_iter);
+        prev_iter = iter;
+        iter = item->next;
+        ++num_free;
+    }
+
+    assert(num_free + t->num_used == t->num_items);
+
+    if (t->tenants) {
+        uint32_t num_linked = 0;
+        for (uint32_t id = 0; id < t->num_tenants; ++id) {
+            const lrutrack_tenant_t *tenant = &t->tenants[id];
+            uint64_t usage = 0;
+            prev_iter = UINT32_MAX;
+            iter = tenant->head;
+            while (iter != UINT32_MAX) {
+                assert(iter < t->num_items);
+                assert(t->items[iter].value != t->invalid_value);
+                assert(t->tenant_links[iter].tenant == id);
+                assert(t->tenant_links[iter].prev == prev_iter);
+                usage += t->tenant_links[iter].weight;
+                ++num_linked;
+                prev_iter = iter;
+                iter = t->tenant_links[iter].next;
+            }
+
+            assert(prev_iter == tenant->tail);
+            assert(usage == tenant->usage);
+        }
+
+        assert(num_linked == t->num_used);
+
+        uint32_t num_over = 0;
+        for (uint32_t id = 0; id < t->num_tenants; ++id) {
+            if (t->tenants[id].usage > t->tenants[id].quota)
+                ++num_over;
+        }
+
+        iter = t->first_over;
+        while (iter != UINT32_MAX) {
+            assert(t->tenants[iter].usage > t->tenants[iter].quota);
+            --num_over;
+            iter = t->tenants[iter].over_next;
+        }
+
+        assert(num_over == 0);
     }
 #endif
 }
 
 #if !LRUTRACK_32BIT_KEY
 
+static uint8_t *lrutrack_key_slot(const lrutrack_t *t, uint32_t index) {
+    return t->key_slots + (size_t)index * t->max_key_length;
+}
+
+static void *lrutrack_alloc_key(lrutrack_t *t, uint32_t index,
+    uint32_t key_length) {
+    if (t->in_place) {
+        if (key_length > t->max_key_length)
+            return NULL;
+        return lrutrack_key_slot(t, index);
+    }
+
+    return lrutrack_alloc(t, key_length, 1);
+}
+
+static void lrutrack_free_key(lrutrack_t *t, lrutrack_item_t *item) {
+    if (!t->in_place)
+        lrutrack_dealloc(t, item->key, item->key_length);
+    item->key = NULL;
+}
+
+#endif
+
+#if !LRUTRACK_32BIT_KEY
+
 static uint32_t lrutrack_find_index(const lrutrack_t *t, const void *key,
     uint32_t key_length, uint32_t hash) {
     assert(key != NULL && key_length != 0);
@@ -196,29 +418,61 @@ static uint32_t lrutrack_find_index(const lrutrack_t *t, uint32_t key,
 
 #endif
 
+static uint32_t lrutrack_item_row(const lrutrack_t *t,
+    const lrutrack_item_t *item) {
+#if !LRUTRACK_32BIT_KEY
+    return lrutrack_hash(item->key, item->key_length, t->seed,
+        t->hash_table_size);
+#else
+    return item->key & (t->hash_table_size - 1);
+#endif
+}
+
+static void lrutrack_stop_compaction(lrutrack_t *t) {
+    t->compacting = 0;
+    t->compact_row = UINT32_MAX;
+    t->compact_priority = 0;
+}
+
+// Keeps a compaction pass going when its next row leaves its LRU position
+static void lrutrack_compaction_skip_row(lrutrack_t *t, uint32_t i) {
+    if (t->compact_row == i)
+        t->compact_row = t->hash_table_lru_links[i * 2 + 1];
+}
+
+// The list functions act on the LRU list of row i's priority
 static void lrutrack_insert_to_lru_head(lrutrack_t *t, uint32_t i) {
-    if (t->lru_head != UINT32_MAX) {
-        t->hash_table_lru_links[t->lru_head * 2 + 0] = i;
-        t->hash_table_lru_links[i * 2 + 1] = t->lru_head;
-        t->lru_head = i;
+    uint32_t *head = &t->lru_head[t->row_priorities[i]];
+    uint32_t *tail = &t->lru_tail[t->row_priorities[i]];
+    if (t->row_stamps)
+        t->row_stamps[i] = *t->clock;
+    if (*head != UINT32_MAX) {
+        t->hash_table_lru_links[*head * 2 + 0] = i;
+        t->hash_table_lru_links[i * 2 + 1] = *head;
+        *head = i;
     } else {
-        t->lru_head = i;
-        t->lru_tail = i;
+        *head = i;
+        *tail = i;
     }
 }
 
 static void lrutrack_remove_from_lru(lrutrack_t *t, uint32_t i) {
-    if (t->lru_head == t->lru_tail) {
-        t->lru_head = UINT32_MAX;
-        t->lru_tail = UINT32_MAX;
+    uint32_t *head = &t->lru_head[t->row_priorities[i]];
+    uint32_t *tail = &t->lru_tail[t->row_priorities[i]];
+
+    lrutrack_compaction_skip_row(t, i);
+
+    if (*head == *tail) {
+        *head = UINT32_MAX;
+        *tail = UINT32_MAX;
     } else {
-        if (i == t->lru_head) {
-            t->lru_head = t->hash_table_lru_links[i * 2 + 1];
-            t->hash_table_lru_links[t->lru_head * 2 + 0] = UINT32_MAX;
+        if (i == *head) {
+            *head = t->hash_table_lru_links[i * 2 + 1];
+            t->hash_table_lru_links[*head * 2 + 0] = UINT32_MAX;
             t->hash_table_lru_links[i * 2 + 1] = UINT32_MAX;
-        } else if (i == t->lru_tail) {
-            t->lru_tail = t->hash_table_lru_links[i * 2 + 0];
-            t->hash_table_lru_links[t->lru_tail * 2 + 1] = UINT32_MAX;
+        } else if (i == *tail) {
+            *tail = t->hash_table_lru_links[i * 2 + 0];
+            t->hash_table_lru_links[*tail * 2 + 1] = UINT32_MAX;
             t->hash_table_lru_links[i * 2 + 0] = UINT32_MAX;
         } else {
             uint32_t prev = t->hash_table_lru_links[i * 2 + 0];
@@ -232,260 +486,733 @@ static void lrutrack_remove_from_lru(lrutrack_t *t, uint32_t i) {
 }
 
 static void lrutrack_move_to_lru_head(lrutrack_t *t, uint32_t i) {
-    if (t->lru_head != t->lru_tail) {
-        if (i == t->lru_tail) {
-            t->lru_tail = t->hash_table_lru_links[i * 2 + 0];
+    uint32_t *head = &t->lru_head[t->row_priorities[i]];
+    uint32_t *tail = &t->lru_tail[t->row_priorities[i]];
+    if (t->row_stamps)
+        t->row_stamps[i] = *t->clock;
+
+    if (i != *head)
+        lrutrack_compaction_skip_row(t, i);
+
+    if (*head != *tail) {
+        if (i == *tail) {
+            *tail = t->hash_table_lru_links[i * 2 + 0];
             t->hash_table_lru_links[i * 2 + 0] = UINT32_MAX;
-            t->hash_table_lru_links[t->lru_tail * 2 + 1] = UINT32_MAX;
-            t->hash_table_lru_links[t->lru_head * 2 + 0] = i;
-            t->hash_table_lru_links[i * 2 + 1] = t->lru_head;
-            t->lru_head = i;
-        } else if (i != t->lru_head) {
+            t->hash_table_lru_links[*tail * 2 + 1] = UINT32_MAX;
+            t->hash_table_lru_links[*head * 2 + 0] = i;
+            t->hash_table_lru_links[i * 2 + 1] = *head;
+            *head = i;
+        } else if (i != *head) {
             uint32_t prev = t->hash_table_lru_links[i * 2 + 0];
             uint32_t next = t->hash_table_lru_links[i * 2 + 1];
             t->hash_table_lru_links[next * 2 + 0] = prev;
             t->hash_table_lru_links[prev * 2 + 1] = next;
             t->hash_table_lru_links[i * 2 + 0] = UINT32_MAX;
-            t->hash_table_lru_links[i * 2 + 1] = t->lru_head;
-            t->hash_table_lru_links[t->lru_head * 2 + 0] = i;
-            t->lru_head = i;
+            t->hash_table_lru_links[i * 2 + 1] = *head;
+            t->hash_table_lru_links[*head * 2 + 0] = i;
+            *head = i;
         }
     }
 }
 
-//
-// Public functions
+// Moves non-empty row i to the head of another priority's LRU list
+static void lrutrack_set_row_priority(lrutrack_t *t, uint32_t i,
+    uint32_t priority) {
+    assert(priority < LRUTRACK_NUM_PRIORITIES);
+    if (t->row_priorities[i] == priority) {
+        lrutrack_move_to_lru_head(t, i);
+        return;
+    }
 
-lrutrack_t *lrutrack_create(uint32_t hash_table_size,
-    uint32_t num_initial_items, uint32_t hash_seed,
-    lrutrack_value_t invalid_value,
-    void *evict_user, lrutrack_evict_func_t evict_func,
-    lrutrack_malloc_func_t malloc_func, lrutrack_free_func_t free_func) {
-    assert(hash_table_size != 0);
-    assert(lrutrack_is_power_of_two(hash_table_size));
-    assert(evict_func && malloc_func && free_func);
+    lrutrack_remove_from_lru(t, i);
+    t->row_priorities[i] = (uint8_t)priority;
+    lrutrack_insert_to_lru_head(t, i);
+}
 
-    lrutrack_t *t = malloc_func(sizeof(lrutrack_t));
-    if (!t)
-        return NULL;
+// Recency update of row i for a use of an item, which lifts the row to the
+// item's priority
+static void lrutrack_use_row(lrutrack_t *t, uint32_t i, uint32_t index) {
+    uint32_t priority = lrutrack_item_priority(t, index);
+    if (priority > t->row_priorities[i])
+        lrutrack_set_row_priority(t, i, priority);
+    else
+        lrutrack_move_to_lru_head(t, i);
+}
 
-    memset(t, 0, sizeof(*t));
+// Highest priority of the items on row i
+static uint32_t lrutrack_items_priority(const lrutrack_t *t, uint32_t i) {
+    uint32_t priority = 0;
+    uint32_t iter = t->hash_table[i];
+    while (iter != UINT32_MAX) {
+        if (lrutrack_item_priority(t, iter) > priority)
+            priority = lrutrack_item_priority(t, iter);
+        iter = t->items[iter].next;
+    }
+    return priority;
+}
 
-    t->evict_user = evict_user;
-    t->evict_func = evict_func;
+//
+// Tenant lists, item granular
+
+static void lrutrack_tenant_insert(lrutrack_t *t, uint32_t index) {
+    lrutrack_tenant_link_t *link = &t->tenant_links[index];
+    lrutrack_tenant_t *tenant = &t->tenants[link->tenant];
+    link->prev = UINT32_MAX;
+    link->next = tenant->head;
+    if (tenant->head != UINT32_MAX)
+        t->tenant_links[tenant->head].prev = index;
+    else
+        tenant->tail = index;
+    tenant->head = index;
+}
 
-    t->malloc_func = malloc_func;
-    t->free_func = free_func;
+static void lrutrack_tenant_remove(lrutrack_t *t, uint32_t index) {
+    lrutrack_tenant_link_t *link = &t->tenant_links[index];
+    lrutrack_tenant_t *tenant = &t->tenants[link->tenant];
+    if (link->prev != UINT32_MAX)
+        t->tenant_links[link->prev].next = link->next;
+    else
+        tenant->head = link->next;
+    if (link->next != UINT32_MAX)
+        t->tenant_links[link->next].prev = link->prev;
+    else
+        tenant->tail = link->prev;
+}
 
-    t->seed = hash_seed;
-    t->invalid_value = invalid_value;
+// Points the neighbours of index, or its tenant's ends, back at it
+static void lrutrack_tenant_relink(lrutrack_t *t, uint32_t index) {
+    lrutrack_tenant_link_t *link = &t->tenant_links[index];
+    lrutrack_tenant_t *tenant = &t->tenants[link->tenant];
+    if (link->prev != UINT32_MAX)
+        t->tenant_links[link->prev].next = index;
+    else
+        tenant->head = index;
+    if (link->next != UINT32_MAX)
+        t->tenant_links[link->next].prev = index;
+    else
+        tenant->tail = index;
+}
 
-    size_t hash_table_bytesize = sizeof(*t->hash_table) * hash_table_size;
-    t->hash_table = t->malloc_func(hash_table_bytesize);
-    if (!t->hash_table) {
-        lrutrack_destroy(t);
-        return NULL;
+// Moves a tenant on or off the over quota list after its usage or quota
+// changed
+static void lrutrack_tenant_update_over(lrutrack_t *t, uint32_t id,
+    int was_over) {
+    lrutrack_tenant_t *tenant = &t->tenants[id];
+    int over = tenant->usage > tenant->quota;
+    if (over == was_over)
+        return;
+
+    if (over) {
+        tenant->over_prev = UINT32_MAX;
+        tenant->over_next = t->first_over;
+        if (t->first_over != UINT32_MAX)
+            t->tenants[t->first_over].over_prev = id;
+        t->first_over = id;
+    } else {
+        if (tenant->over_prev != UINT32_MAX)
+            t->tenants[tenant->over_prev].over_next = tenant->over_next;
+        else
+            t->first_over = tenant->over_next;
+        if (tenant->over_next != UINT32_MAX)
+            t->tenants[tenant->over_next].over_prev = tenant->over_prev;
     }
+}
 
-    memset(t->hash_table, 0xff, hash_table_bytesize);
+// Adds weight, negative to take it away
+static void lrutrack_tenant_charge(lrutrack_t *t, uint32_t id,
+    int64_t weight) {
+    lrutrack_tenant_t *tenant = &t->tenants[id];
+    int was_over = tenant->usage > tenant->quota;
+    tenant->usage += (uint64_t)weight;
+    lrutrack_tenant_update_over(t, id, was_over);
+}
 
-    size_t hash_table_lru_links_bytesize =
-        sizeof(*t->hash_table_lru_links) * hash_table_size * 2;
-    t->hash_table_lru_links = t->malloc_func(hash_table_lru_links_bytesize);
-    if (!t->hash_table_lru_links) {
-        lrutrack_destroy(t);
-        return NULL;
-    }
+static void lrutrack_tenant_link(lrutrack_t *t, uint32_t index) {
+    lrutrack_tenant_insert(t, index);
+    lrutrack_tenant_charge(t, t->tenant_links[index].tenant,
+        t->tenant_links[index].weight);
+}
 
-    memset(t->hash_table_lru_links, 0xff, hash_table_lru_links_bytesize);
+static void lrutrack_tenant_unlink(lrutrack_t *t, uint32_t index) {
+    lrutrack_tenant_remove(t, index);
+    lrutrack_tenant_charge(t, t->tenant_links[index].tenant,
+        -(int64_t)t->tenant_links[index].weight);
+}
 
-    t->hash_table_size = hash_table_size;
-    t->lru_head = UINT32_MAX;
-    t->lru_tail = UINT32_MAX;
-
-    if (num_initial_items != 0) {
-        uint32_t items_bytesize = sizeof(*t->items) * num_initial_items;
-        t->items = t->malloc_func(items_bytesize);
-        if (!t->items) {
-            lrutrack_destroy(t);
-            return NULL;
-        }
+static void lrutrack_tenant_touch(lrutrack_t *t, uint32_t index) {
+    if (t->tenants[t->tenant_links[index].tenant].head == index)
+        return;
+    lrutrack_tenant_remove(t, index);
+    lrutrack_tenant_insert(t, index);
+}
 
-        memset(t->items, 0, items_bytesize);
+static void lrutrack_reset_tenants(lrutrack_t *t) {
+    for (uint32_t i = 0; i < t->num_tenants; ++i) {
+        t->tenants[i].usage = 0;
+        t->tenants[i].head = UINT32_MAX;
+        t->tenants[i].tail = UINT32_MAX;
+    }
+    t->first_over = UINT32_MAX;
+}
 
-        for (uint32_t i = 0; i < num_initial_items - 1; ++i) {
-            t->items[i].value = t->invalid_value;
-            t->items[i].next = i + 1;
-        }
+static void lrutrack_reset_lru(lrutrack_t *t) {
+    for (uint32_t p = 0; p < LRUTRACK_NUM_PRIORITIES; ++p) {
+        t->lru_head[p] = UINT32_MAX;
+        t->lru_tail[p] = UINT32_MAX;
+        t->priority_credit[p] = 0;
+    }
+}
 
-        t->items[num_initial_items - 1].value = t->invalid_value;
-        t->items[num_initial_items - 1].next = UINT32_MAX;
+// Pushes the unused items [begin, end) to the front of the free list
+static void lrutrack_link_free_items(lrutrack_t *t, uint32_t begin,
+    uint32_t end) {
+    assert(begin < end && end <= t->num_items);
 
-        t->num_items = num_initial_items;
-        t->first_free = 0;
-    } else {
-        t->first_free = UINT32_MAX;
+    for (uint32_t i = begin; i < end; ++i) {
+        t->items[i].value = t->invalid_value;
+        t->items[i].next = i + 1;
+        LRUTRACK_FREE_PREV(&t->items[i]) = i - 1;
     }
 
-    lrutrack_check_internal_state(t);
+    LRUTRACK_FREE_PREV(&t->items[begin]) = UINT32_MAX;
+    t->items[end - 1].next = t->first_free;
+    if (t->first_free != UINT32_MAX)
+        LRUTRACK_FREE_PREV(&t->items[t->first_free]) = end - 1;
 
-    return t;
+    t->first_free = begin;
 }
 
-void lrutrack_destroy(lrutrack_t *t) {
-    lrutrack_check_internal_state(t);
+static void lrutrack_push_free(lrutrack_t *t, uint32_t index) {
+    lrutrack_item_t *item = &t->items[index];
+    item->value = t->invalid_value;
+    item->next = t->first_free;
+    LRUTRACK_FREE_PREV(item) = UINT32_MAX;
+    if (t->first_free != UINT32_MAX)
+        LRUTRACK_FREE_PREV(&t->items[t->first_free]) = index;
+    t->first_free = index;
+}
 
-    for (uint32_t i = 0; i < t->num_items; ++i) {
-        lrutrack_item_t *item = &t->items[i];
-        if (item->value != t->invalid_value) {
-#if !LRUTRACK_32BIT_KEY
-            t->free_func(t->items[i].key);
-#endif
-            t->evict_func(t->evict_user, item->value);
-        } else {
-#if !LRUTRACK_32BIT_KEY
-            assert(item->key == NULL);
-#endif
-            assert(item->value == t->invalid_value);
-        }
+static void lrutrack_unlink_free(lrutrack_t *t, uint32_t index) {
+    lrutrack_item_t *item = &t->items[index];
+    assert(item->value == t->invalid_value);
+    uint32_t prev = LRUTRACK_FREE_PREV(item);
+    if (prev != UINT32_MAX) {
+        assert(t->items[prev].next == index);
+        t->items[prev].next = item->next;
+    } else {
+        assert(t->first_free == index);
+        t->first_free = item->next;
     }
 
-    t->free_func(t->items);
-    t->free_func(t->hash_table_lru_links);
-    t->free_func(t->hash_table);
-    t->free_func(t);
+    if (item->next != UINT32_MAX)
+        LRUTRACK_FREE_PREV(&t->items[item->next]) = prev;
 }
 
-#if !LRUTRACK_32BIT_KEY
-int lrutrack_insert(lrutrack_t *t, const void *key, uint32_t key_length,
-    lrutrack_value_t value)
-#else
-int lrutrack_insert(lrutrack_t *t, uint32_t key, lrutrack_value_t value)
-#endif
-{
-    lrutrack_check_internal_state(t);
-    assert(value != t->invalid_value);
+static int lrutrack_grow_items(lrutrack_t *t, uint32_t num_items) {
+    assert(!t->in_place);
+    assert(num_items > t->num_items);
 
-#if !LRUTRACK_32BIT_KEY
-    assert(key && key_length != 0);
-    uint32_t hash = lrutrack_hash(key, key_length, t->seed,
-        t->hash_table_size);
-    assert(lrutrack_find_index(t, key, key_length, hash) == UINT32_MAX);
-#else
-    uint32_t hash = key & (t->hash_table_size - 1);
-#endif
+    lrutrack_tenant_link_t *tenant_links = NULL;
+    if (t->tenants) {
+        tenant_links = lrutrack_alloc_array(t,
+            sizeof(*tenant_links) * num_items);
+        if (!tenant_links)
+            return LRUTRACK_OOM;
+    }
 
-    if (t->first_free == UINT32_MAX) {
-        if (t->num_items == 0) {
-            uint32_t num_items = t->hash_table_size;
-            assert(lrutrack_is_power_of_two(num_items));
+    size_t attrs_bytesize = sizeof(*t->item_attrs) * num_items;
+    lrutrack_item_attr_t *item_attrs = NULL;
+    if (t->item_attrs) {
+        item_attrs = lrutrack_alloc_array(t, attrs_bytesize);
+        if (!item_attrs) {
+            lrutrack_dealloc(t, tenant_links,
+                sizeof(*tenant_links) * num_items);
+            return LRUTRACK_OOM;
+        }
+    }
 
-            t->items = t->malloc_func(sizeof(*t->items) *
-                num_items);
-            if (!t->items)
-                return LRUTRACK_OOM;
+    size_t items_bytesize = sizeof(*t->items) * num_items;
+    lrutrack_item_t *items = lrutrack_alloc_array(t, items_bytesize);
+    if (!items) {
+        lrutrack_dealloc(t, item_attrs, attrs_bytesize);
+        lrutrack_dealloc(t, tenant_links, sizeof(*tenant_links) * num_items);
+        return LRUTRACK_OOM;
+    }
 
-            t->num_items = num_items;
+    size_t old_items_bytesize = sizeof(*t->items) * t->num_items;
+    if (t->items) {
+        memcpy(items, t->items, old_items_bytesize);
+        lrutrack_dealloc(t, t->items, old_items_bytesize);
+    }
 
-            for (uint32_t i = 0; i < t->num_items - 1; ++i)
-                t->items[i].next = i + 1;
+    if (t->tenants) {
+        size_t old_links_bytesize = sizeof(*tenant_links) * t->num_items;
+        if (t->num_items != 0)
+            memcpy(tenant_links, t->tenant_links, old_links_bytesize);
+        lrutrack_dealloc(t, t->tenant_links, old_links_bytesize);
+        t->tenant_links = tenant_links;
+    }
 
-            t->items[t->num_items - 1].next = UINT32_MAX;
-            t->first_free = 0;
-        } else {
-            lrutrack_item_t *old_items = t->items;
-            uint32_t old_num_items = t->num_items;
-            t->num_items *= 2;
+    if (t->item_attrs) {
+        size_t old_attrs_bytesize = sizeof(*item_attrs) * t->num_items;
+        memcpy(item_attrs, t->item_attrs, old_attrs_bytesize);
+        memset((uint8_t *)item_attrs + old_attrs_bytesize, 0,
+            attrs_bytesize - old_attrs_bytesize);
+        lrutrack_dealloc(t, t->item_attrs, old_attrs_bytesize);
+        t->item_attrs = item_attrs;
+    }
 
-            uint32_t items_bytesize = sizeof(*t->items) * t->num_items;
-            t->items = t->malloc_func(items_bytesize);
-            if (!t->items)
-                return LRUTRACK_OOM;
+    memset((uint8_t *)items + old_items_bytesize, 0,
+        items_bytesize - old_items_bytesize);
 
-            uint32_t old_items_bytesize = sizeof(*t->items) * old_num_items;
-            memcpy(t->items, old_items, old_items_bytesize);
-            t->free_func(old_items);
+    uint32_t old_num_items = t->num_items;
+    t->items = items;
+    t->num_items = num_items;
+    lrutrack_link_free_items(t, old_num_items, num_items);
 
-            memset(t->items + old_num_items, 0,
-                items_bytesize - old_items_bytesize);
+    return LRUTRACK_OK;
+}
 
-            for (uint32_t i = old_num_items; i < t->num_items - 1; ++i) {
-                t->items[i].value = t->invalid_value;
-                t->items[i].next = i + 1;
-            }
+// Releases the memory of an allocated tracker, also a partially created one
+static void lrutrack_release(lrutrack_t *t) {
+    assert(!t->in_place);
+    lrutrack_dealloc(t, t->deferred,
+        sizeof(*t->deferred) * t->deferred_capacity);
+    lrutrack_dealloc(t, t->tenant_links,
+        sizeof(*t->tenant_links) * t->num_items);
+    lrutrack_dealloc(t, t->tenants, sizeof(*t->tenants) * t->num_tenants);
+    lrutrack_dealloc(t, t->item_attrs,
+        sizeof(*t->item_attrs) * t->num_items);
+    lrutrack_dealloc(t, t->row_stamps,
+        sizeof(*t->row_stamps) * t->hash_table_size);
+    lrutrack_dealloc(t, t->items, sizeof(*t->items) * t->num_items);
+    lrutrack_dealloc(t, t->row_priorities,
+        sizeof(*t->row_priorities) * t->hash_table_size);
+    lrutrack_dealloc(t, t->hash_table_lru_links,
+        sizeof(*t->hash_table_lru_links) * t->hash_table_size * 2);
+    lrutrack_dealloc(t, t->hash_table,
+        sizeof(*t->hash_table) * t->hash_table_size);
+
+    if (t->allocator.dealloc_func)
+        t->allocator.dealloc_func(t->allocator.user, t, sizeof(*t));
+    else
+        t->free_func(t);
+}
 
-            t->items[t->num_items - 1].value = t->invalid_value;
-            t->items[t->num_items - 1].next = UINT32_MAX;
+// Queues value with deferral on, otherwise or when the queue is full hands
+// it to evict_func
+static void lrutrack_evict_value(lrutrack_t *t, lrutrack_value_t value) {
+    assert(t->evict_func);
+
+    if (t->defer_evictions) {
+        if (t->num_deferred == t->deferred_capacity && !t->in_place) {
+            uint32_t capacity = t->deferred_capacity ?
+                t->deferred_capacity * 2 : 16;
+            lrutrack_value_t *deferred = lrutrack_alloc(t,
+                sizeof(*deferred) * capacity, sizeof(*deferred));
+            if (deferred) {
+                if (t->num_deferred != 0) {
+                    memcpy(deferred, t->deferred,
+                        sizeof(*deferred) * t->num_deferred);
+                }
+                lrutrack_dealloc(t, t->deferred,
+                    sizeof(*deferred) * t->deferred_capacity);
+                t->deferred = deferred;
+                t->deferred_capacity = capacity;
+            }
+        }
 
-            t->first_free = old_num_items;
+        if (t->num_deferred < t->deferred_capacity) {
+            t->deferred[t->num_deferred++] = value;
+            return;
         }
     }
 
-    uint32_t index = t->first_free; // Take first free
-    assert(index < t->num_items);
-    lrutrack_item_t *item = &t->items[index];
+    t->evict_func(t->evict_user, value);
+}
 
-    assert(item->value == t->invalid_value);
+// Sets up a zeroed tracker whose allocation functions are already set
+static lrutrack_t *lrutrack_init(lrutrack_t *t, uint32_t hash_table_size,
+    uint32_t num_initial_items, uint32_t hash_seed,
+    lrutrack_value_t invalid_value,
+    void *evict_user, lrutrack_evict_func_t evict_func) {
+    t->evict_user = evict_user;
+    t->evict_func = evict_func;
 
-#if !LRUTRACK_32BIT_KEY
-    item->key = t->malloc_func(key_length);
-    if (!item->key)
-        return LRUTRACK_OOM;
+    t->seed = hash_seed;
+    t->invalid_value = invalid_value;
 
-    memcpy(item->key, key, key_length);
-    item->key_length = key_length;
-#else
-    item->key = key;
-#endif
+    t->hash_table_size = hash_table_size;
+    lrutrack_reset_lru(t);
+    t->first_free = UINT32_MAX;
+    t->compact_row = UINT32_MAX;
 
-    item->value = value;
+    size_t hash_table_bytesize = sizeof(*t->hash_table) * hash_table_size;
+    t->hash_table = lrutrack_alloc_array(t, hash_table_bytesize);
+    if (!t->hash_table) {
+        lrutrack_release(t);
+        return NULL;
+    }
 
-    if (t->hash_table[hash] == UINT32_MAX) {
-        // Hash table row not in LRU list yet
-        assert(t->hash_table_lru_links[hash * 2 + 0] == UINT32_MAX);
-        assert(t->hash_table_lru_links[hash * 2 + 1] == UINT32_MAX);
-        lrutrack_insert_to_lru_head(t, hash);
-    } else {
-        lrutrack_move_to_lru_head(t, hash);
+    memset(t->hash_table, 0xff, hash_table_bytesize);
+
+    size_t hash_table_lru_links_bytesize =
+        sizeof(*t->hash_table_lru_links) * hash_table_size * 2;
+    t->hash_table_lru_links = lrutrack_alloc_array(t,
+        hash_table_lru_links_bytesize);
+    if (!t->hash_table_lru_links) {
+        lrutrack_release(t);
+        return NULL;
     }
 
-    // Update links
-    t->first_free = item->next;
-    item->next = t->hash_table[hash];
-    t->hash_table[hash] = index;
+    memset(t->hash_table_lru_links, 0xff, hash_table_lru_links_bytesize);
+
+    size_t row_priorities_bytesize =
+        sizeof(*t->row_priorities) * hash_table_size;
+    t->row_priorities = lrutrack_alloc_array(t, row_priorities_bytesize);
+    if (!t->row_priorities) {
+        lrutrack_release(t);
+        return NULL;
+    }
+
+    memset(t->row_priorities, 0, row_priorities_bytesize);
+
+    if (num_initial_items != 0 &&
+        lrutrack_grow_items(t, num_initial_items) != LRUTRACK_OK) {
+        lrutrack_release(t);
+        return NULL;
+    }
 
     lrutrack_check_internal_state(t);
 
-    return LRUTRACK_OK;
+    return t;
+}
+
+//
+// Public functions
+
+lrutrack_t *lrutrack_create(uint32_t hash_table_size,
+    uint32_t num_initial_items, uint32_t hash_seed,
+    lrutrack_value_t invalid_value,
+    void *evict_user, lrutrack_evict_func_t evict_func,
+    lrutrack_malloc_func_t malloc_func, lrutrack_free_func_t free_func) {
+    assert(hash_table_size != 0);
+    assert(lrutrack_is_power_of_two(hash_table_size));
+    assert(evict_func && malloc_func && free_func);
+
+    lrutrack_t *t = malloc_func(sizeof(lrutrack_t));
+    if (!t)
+        return NULL;
+
+    memset(t, 0, sizeof(*t));
+
+    t->malloc_func = malloc_func;
+    t->free_func = free_func;
+
+    return lrutrack_init(t, hash_table_size, num_initial_items, hash_seed,
+        invalid_value, evict_user, evict_func);
+}
+
+lrutrack_t *lrutrack_create_with_allocator(uint32_t hash_table_size,
+    uint32_t num_initial_items, uint32_t hash_seed,
+    lrutrack_value_t invalid_value,
+    void *evict_user, lrutrack_evict_func_t evict_func,
+    const lrutrack_allocator_t *allocator) {
+    assert(hash_table_size != 0);
+    assert(lrutrack_is_power_of_two(hash_table_size));
+    assert(evict_func && allocator);
+    assert(allocator->alloc_func && allocator->dealloc_func);
+
+    lrutrack_t *t = allocator->alloc_func(allocator->user, sizeof(lrutrack_t),
+        LRUTRACK_ALIGNMENT);
+    if (!t)
+        return NULL;
+
+    memset(t, 0, sizeof(*t));
+
+    t->allocator = *allocator;
+
+    return lrutrack_init(t, hash_table_size, num_initial_items, hash_seed,
+        invalid_value, evict_user, evict_func);
+}
+
+static size_t lrutrack_align_up(size_t x) {
+    return (x + LRUTRACK_ALIGNMENT - 1) &
+        ~(size_t)(LRUTRACK_ALIGNMENT - 1);
+}
+
+// Returns the total size, offsets are relative to the start of the buffer
+static size_t lrutrack_in_place_layout(const lrutrack_config_t *config,
+    size_t *hash_table_offset, size_t *hash_table_lru_links_offset,
+    size_t *row_priorities_offset, size_t *items_offset,
+    size_t *item_attrs_offset, size_t *key_slots_offset,
+    size_t *deferred_offset) {
+    size_t offset = lrutrack_align_up(sizeof(lrutrack_t));
+
+    *hash_table_offset = offset;
+    offset = lrutrack_align_up(offset +
+        sizeof(uint32_t) * config->hash_table_size);
+
+    *hash_table_lru_links_offset = offset;
+    offset = lrutrack_align_up(offset +
+        sizeof(uint32_t) * config->hash_table_size * 2);
+
+    *row_priorities_offset = offset;
+    offset = lrutrack_align_up(offset +
+        sizeof(uint8_t) * config->hash_table_size);
+
+    *items_offset = offset;
+    offset = lrutrack_align_up(offset +
+        sizeof(lrutrack_item_t) * config->num_items);
+
+    // Reserved up front, an in-place tracker cannot allocate it on first use
+    *item_attrs_offset = offset;
+    offset = lrutrack_align_up(offset +
+        sizeof(lrutrack_item_attr_t) * config->num_items);
+
+    *key_slots_offset = offset;
+#if !LRUTRACK_32BIT_KEY
+    offset = lrutrack_align_up(offset +
+        (size_t)config->max_key_length * config->num_items);
+#endif
+
+    *deferred_offset = offset;
+    offset = lrutrack_align_up(offset +
+        sizeof(lrutrack_value_t) * config->max_deferred);
+
+    return offset;
 }
 
+size_t lrutrack_required_bytes(const lrutrack_config_t *config) {
+    assert(config);
+    size_t hash_table_offset, hash_table_lru_links_offset,
+        row_priorities_offset, items_offset, item_attrs_offset,
+        key_slots_offset, deferred_offset;
+    return lrutrack_in_place_layout(config, &hash_table_offset,
+        &hash_table_lru_links_offset, &row_priorities_offset, &items_offset,
+        &item_attrs_offset, &key_slots_offset, &deferred_offset);
+}
+
+lrutrack_t *lrutrack_create_in_place(void *buffer, size_t buffer_size,
+    const lrutrack_config_t *config, uint32_t hash_seed,
+    lrutrack_value_t invalid_value,
+    void *evict_user, lrutrack_evict_func_t evict_func) {
+    assert(buffer && config && evict_func);
+    assert(((uintptr_t)buffer & (LRUTRACK_ALIGNMENT - 1)) == 0);
+    assert(config->hash_table_size != 0);
+    assert(lrutrack_is_power_of_two(config->hash_table_size));
+    assert(config->num_items != 0);
 #if !LRUTRACK_32BIT_KEY
-int lrutrack_remove(lrutrack_t *t, const void *key, uint32_t key_length)
+    assert(config->max_key_length != 0);
+#endif
+
+    size_t hash_table_offset, hash_table_lru_links_offset,
+        row_priorities_offset, items_offset, item_attrs_offset,
+        key_slots_offset, deferred_offset;
+    size_t required_bytes = lrutrack_in_place_layout(config,
+        &hash_table_offset, &hash_table_lru_links_offset,
+        &row_priorities_offset, &items_offset, &item_attrs_offset,
+        &key_slots_offset, &deferred_offset);
+    if (buffer_size < required_bytes)
+        return NULL;
+
+    uint8_t *base = buffer;
+    lrutrack_t *t = buffer;
+    memset(t, 0, sizeof(*t));
+
+    t->evict_user = evict_user;
+    t->evict_func = evict_func;
+    t->in_place = 1;
+
+    t->seed = hash_seed;
+    t->invalid_value = invalid_value;
+
+    t->hash_table = (uint32_t *)(base + hash_table_offset);
+    memset(t->hash_table, 0xff,
+        sizeof(*t->hash_table) * config->hash_table_size);
+
+    t->hash_table_lru_links = (uint32_t *)(base + hash_table_lru_links_offset);
+    memset(t->hash_table_lru_links, 0xff,
+        sizeof(*t->hash_table_lru_links) * config->hash_table_size * 2);
+
+    t->row_priorities = base + row_priorities_offset;
+    memset(t->row_priorities, 0,
+        sizeof(*t->row_priorities) * config->hash_table_size);
+
+    t->hash_table_size = config->hash_table_size;
+    lrutrack_reset_lru(t);
+
+#if !LRUTRACK_32BIT_KEY
+    t->key_slots = base + key_slots_offset;
+    t->max_key_length = config->max_key_length;
 #else
-int lrutrack_remove(lrutrack_t *t, uint32_t key)
+    (void)key_slots_offset;
+#endif
+
+    t->items = (lrutrack_item_t *)(base + items_offset);
+    memset(t->items, 0, sizeof(*t->items) * config->num_items);
+    t->item_attrs = (lrutrack_item_attr_t *)(base + item_attrs_offset);
+    memset(t->item_attrs, 0, sizeof(*t->item_attrs) * config->num_items);
+    t->num_items = config->num_items;
+    t->first_free = UINT32_MAX;
+    t->compact_row = UINT32_MAX;
+    lrutrack_link_free_items(t, 0, config->num_items);
+
+    t->deferred = (lrutrack_value_t *)(base + deferred_offset);
+    t->deferred_capacity = config->max_deferred;
+
+    lrutrack_check_internal_state(t);
+
+    return t;
+}
+
+void lrutrack_destroy(lrutrack_t *t) {
+    lrutrack_check_internal_state(t);
+
+    lrutrack_flush_evicted(t);
+
+    for (uint32_t i = 0; i < t->num_items; ++i) {
+        lrutrack_item_t *item = &t->items[i];
+        if (item->value != t->invalid_value) {
+#if !LRUTRACK_32BIT_KEY
+            lrutrack_free_key(t, item);
+#endif
+            t->evict_func(t->evict_user, item->value);
+        } else {
+#if !LRUTRACK_32BIT_KEY
+            assert(item->key == NULL);
+#endif
+            assert(item->value == t->invalid_value);
+        }
+    }
+
+    if (!t->in_place)
+        lrutrack_release(t);
+}
+
+#if !LRUTRACK_32BIT_KEY
+int lrutrack_insert(lrutrack_t *t, const void *key, uint32_t key_length,
+    lrutrack_value_t value) {
+    return lrutrack_insert_handle(t, key, key_length, value, NULL);
+}
+#else
+int lrutrack_insert(lrutrack_t *t, uint32_t key, lrutrack_value_t value) {
+    return lrutrack_insert_handle(t, key, value, NULL);
+}
+#endif
+
+#if !LRUTRACK_32BIT_KEY
+int lrutrack_insert_handle(lrutrack_t *t, const void *key,
+    uint32_t key_length, lrutrack_value_t value, lrutrack_handle_t *handle)
+#else
+int lrutrack_insert_handle(lrutrack_t *t, uint32_t key,
+    lrutrack_value_t value, lrutrack_handle_t *handle)
 #endif
 {
     lrutrack_check_internal_state(t);
+    assert(value != t->invalid_value);
 
 #if !LRUTRACK_32BIT_KEY
-    assert(key != NULL && key_length != 0);
+    assert(key && key_length != 0);
     uint32_t hash = lrutrack_hash(key, key_length, t->seed,
         t->hash_table_size);
-    uint32_t index = lrutrack_find_index(t, key, key_length, hash);
+    assert(lrutrack_find_index(t, key, key_length, hash) == UINT32_MAX);
+
+    // Rejected before making room, so that nothing is evicted for it
+    if (t->in_place && key_length > t->max_key_length)
+        return LRUTRACK_ERROR;
 #else
     uint32_t hash = key & (t->hash_table_size - 1);
-    uint32_t index = lrutrack_find_index(t, key, hash);
 #endif
 
-    if (index == UINT32_MAX)
-        return LRUTRACK_NOT_FOUND;
+    if (t->first_free == UINT32_MAX && t->in_place) {
+        // Fixed capacity, make room by evicting instead of growing
+        if (lrutrack_remove_lru(t) != LRUTRACK_OK)
+            return LRUTRACK_OOM; // All entries pinned
+        assert(t->first_free != UINT32_MAX);
+    }
+
+    if (t->first_free == UINT32_MAX) {
+        uint32_t num_items = t->num_items != 0 ? t->num_items * 2 :
+            t->hash_table_size;
+        if (lrutrack_grow_items(t, num_items) != LRUTRACK_OK)
+            return LRUTRACK_OOM;
+    }
+
+    uint32_t index = t->first_free; // Take first free
+    assert(index < t->num_items);
+    lrutrack_item_t *item = &t->items[index];
+
+    assert(item->value == t->invalid_value);
+
+#if !LRUTRACK_32BIT_KEY
+    void *key_copy = lrutrack_alloc_key(t, index, key_length);
+    if (!key_copy)
+        return t->in_place ? LRUTRACK_ERROR : LRUTRACK_OOM;
+
+    memcpy(key_copy, key, key_length);
+#endif
+
+    lrutrack_unlink_free(t, index);
+    t->num_used++;
+
+#if !LRUTRACK_32BIT_KEY
+    item->key = key_copy;
+    item->key_length = key_length;
+#else
+    item->key = key;
+#endif
+
+    item->value = value;
+    item->generation = t->generation++;
+    if (t->item_attrs) {
+        t->item_attrs[index].pins = 0;
+        t->item_attrs[index].priority = 0;
+    }
+
+    if (handle) {
+        handle->index = index;
+        handle->generation = item->generation;
+        handle->row = hash;
+    }
+
+    if (t->hash_table[hash] == UINT32_MAX) {
+        // Hash table row not in LRU list yet
+        assert(t->hash_table_lru_links[hash * 2 + 0] == UINT32_MAX);
+        assert(t->hash_table_lru_links[hash * 2 + 1] == UINT32_MAX);
+        lrutrack_insert_to_lru_head(t, hash);
+    } else {
+        lrutrack_move_to_lru_head(t, hash);
+    }
+
+    // Update links
+    item->next = t->hash_table[hash];
+    t->hash_table[hash] = index;
+
+    if (t->tenants) {
+        t->tenant_links[index].tenant = 0;
+        t->tenant_links[index].weight = 1;
+        lrutrack_tenant_link(t, index);
+    }
+
+    lrutrack_check_internal_state(t);
+
+    return LRUTRACK_OK;
+}
 
+// Unlinks the live item index from row hash, evicts and frees it
+static void lrutrack_remove_index(lrutrack_t *t, uint32_t hash,
+    uint32_t index) {
     assert(index < t->num_items);
     lrutrack_item_t *item = &t->items[index];
     assert(item->value != t->invalid_value);
 
-    assert(t->evict_func);
-    t->evict_func(t->evict_user, item->value);
+    lrutrack_evict_value(t, item->value);
+
+    if (lrutrack_item_pins(t, index) != 0)
+        t->num_pinned--;
+    if (t->tenants)
+        lrutrack_tenant_unlink(t, index);
 
     uint32_t prev_index = UINT32_MAX;
     uint32_t iter = t->hash_table[hash];
@@ -499,24 +1226,53 @@ int lrutrack_remove(lrutrack_t *t, uint32_t key)
     if (prev_index == UINT32_MAX) {
         assert(t->hash_table[hash] == index);
         t->hash_table[hash] = item->next;
-        if (t->hash_table[hash] == UINT32_MAX) {
-            // Hash table row is empty
-            lrutrack_remove_from_lru(t, hash);
-        }
     } else {
         assert(t->items[prev_index].next == index);
         t->items[prev_index].next = item->next;
     }
 
-    item->next = t->first_free;
-    t->first_free = index;
+    if (t->hash_table[hash] == UINT32_MAX) {
+        // Hash table row is empty
+        lrutrack_remove_from_lru(t, hash);
+        t->row_priorities[hash] = 0;
+    } else if (lrutrack_item_priority(t, index) != 0 &&
+        lrutrack_item_priority(t, index) == t->row_priorities[hash]) {
+        // The row may have lost its highest priority item
+        uint32_t priority = lrutrack_items_priority(t, hash);
+        if (priority < t->row_priorities[hash])
+            lrutrack_set_row_priority(t, hash, priority);
+    }
 
 #if !LRUTRACK_32BIT_KEY
-    t->free_func(item->key);
-    item->key = NULL;
+    lrutrack_free_key(t, item);
 #endif
 
-    item->value = t->invalid_value;
+    lrutrack_push_free(t, index);
+    t->num_used--;
+}
+
+#if !LRUTRACK_32BIT_KEY
+int lrutrack_remove(lrutrack_t *t, const void *key, uint32_t key_length)
+#else
+int lrutrack_remove(lrutrack_t *t, uint32_t key)
+#endif
+{
+    lrutrack_check_internal_state(t);
+
+#if !LRUTRACK_32BIT_KEY
+    assert(key != NULL && key_length != 0);
+    uint32_t hash = lrutrack_hash(key, key_length, t->seed,
+        t->hash_table_size);
+    uint32_t index = lrutrack_find_index(t, key, key_length, hash);
+#else
+    uint32_t hash = key & (t->hash_table_size - 1);
+    uint32_t index = lrutrack_find_index(t, key, hash);
+#endif
+
+    if (index == UINT32_MAX)
+        return LRUTRACK_NOT_FOUND;
+
+    lrutrack_remove_index(t, hash, index);
 
     lrutrack_check_internal_state(t);
 
@@ -545,125 +1301,1514 @@ lrutrack_value_t lrutrack_use(lrutrack_t *t, uint32_t key)
     if (index == UINT32_MAX)
         return t->invalid_value;
 
-    lrutrack_move_to_lru_head(t, hash);
-
     assert(index < t->num_items);
-    lrutrack_item_t *item = &t->items[index];
-    return item->value;
+    lrutrack_use_row(t, hash, index);
+    if (t->tenants)
+        lrutrack_tenant_touch(t, index);
+    return t->items[index].value;
 }
 
-#if !LRUTRACK_32BIT_KEY
-
 //
-// c-string key helper functions
+// Handle functions
 
-int lrutrack_insert_strkey(lrutrack_t *t, const char *key,
-    lrutrack_value_t value) {
-    assert(key != NULL && strlen(key) <= UINT32_MAX);
-    return lrutrack_insert(t, key, (uint32_t)strlen(key), value);
-}
+static int lrutrack_handle_is_live(const lrutrack_t *t,
+    lrutrack_handle_t handle) {
+    if (handle.index >= t->num_items)
+        return 0;
 
-int lrutrack_remove_strkey(lrutrack_t *t, const char *key) {
-    assert(key != NULL && strlen(key) <= UINT32_MAX);
-    return lrutrack_remove(t, key, (uint32_t)strlen(key));
-}
+    const lrutrack_item_t *item = &t->items[handle.index];
+    if (item->value == t->invalid_value ||
+        item->generation != handle.generation)
+        return 0;
 
-lrutrack_value_t lrutrack_use_strkey(lrutrack_t *t, const char *key) {
-    assert(key != NULL && strlen(key) <= UINT32_MAX);
-    return lrutrack_use(t, key, (uint32_t)strlen(key));
+    assert(handle.row < t->hash_table_size);
+    assert(handle.row == lrutrack_item_row(t, item));
+    return 1;
 }
 
-#endif
+lrutrack_value_t lrutrack_use_handle(lrutrack_t *t, lrutrack_handle_t handle) {
+    lrutrack_check_internal_state(t);
 
-//
+    if (!lrutrack_handle_is_live(t, handle))
+        return t->invalid_value;
 
-void lrutrack_remove_all(lrutrack_t *t) {
-    lrutrack_check_internal_state(t);
+    lrutrack_use_row(t, handle.row, handle.index);
+    if (t->tenants)
+        lrutrack_tenant_touch(t, handle.index);
 
-    for (uint32_t i = 0; i < t->hash_table_size; ++i) {
-        uint32_t iter = t->hash_table[i];
-        while (iter != UINT32_MAX) {
-            assert(iter < t->num_items);
-            lrutrack_item_t *item = &t->items[iter];
-            assert(item->value != t->invalid_value);
+    return t->items[handle.index].value;
+}
 
-            assert(t->evict_func);
-            t->evict_func(t->evict_user, item->value);
+int lrutrack_remove_handle(lrutrack_t *t, lrutrack_handle_t handle) {
+    lrutrack_check_internal_state(t);
 
-#if !LRUTRACK_32BIT_KEY
-            t->free_func(item->key);
-            item->key = NULL;
-#endif
+    if (!lrutrack_handle_is_live(t, handle))
+        return LRUTRACK_NOT_FOUND;
 
-            item->value = t->invalid_value;
+    lrutrack_remove_index(t, handle.row, handle.index);
+
+    lrutrack_check_internal_state(t);
+
+    return LRUTRACK_OK;
+}
+
+//
+// Pinning functions
+
+static int lrutrack_pin_index(lrutrack_t *t, uint32_t index) {
+    if (lrutrack_alloc_item_attrs(t) != LRUTRACK_OK)
+        return LRUTRACK_OOM;
+
+    lrutrack_item_attr_t *attr = &t->item_attrs[index];
+    if (attr->pins == UINT16_MAX)
+        return LRUTRACK_ERROR;
+    if (attr->pins++ == 0)
+        t->num_pinned++;
+    return LRUTRACK_OK;
+}
+
+static int lrutrack_unpin_index(lrutrack_t *t, uint32_t index) {
+    if (lrutrack_item_pins(t, index) == 0)
+        return LRUTRACK_ERROR;
+
+    if (--t->item_attrs[index].pins == 0)
+        t->num_pinned--;
+    return LRUTRACK_OK;
+}
+
+#if !LRUTRACK_32BIT_KEY
+int lrutrack_pin(lrutrack_t *t, const void *key, uint32_t key_length)
+#else
+int lrutrack_pin(lrutrack_t *t, uint32_t key)
+#endif
+{
+    lrutrack_check_internal_state(t);
+
+#if !LRUTRACK_32BIT_KEY
+    assert(key != NULL && key_length != 0);
+    uint32_t hash = lrutrack_hash(key, key_length, t->seed,
+        t->hash_table_size);
+    uint32_t index = lrutrack_find_index(t, key, key_length, hash);
+#else
+    uint32_t hash = key & (t->hash_table_size - 1);
+    uint32_t index = lrutrack_find_index(t, key, hash);
+#endif
+
+    if (index == UINT32_MAX)
+        return LRUTRACK_NOT_FOUND;
+
+    return lrutrack_pin_index(t, index);
+}
+
+#if !LRUTRACK_32BIT_KEY
+int lrutrack_unpin(lrutrack_t *t, const void *key, uint32_t key_length)
+#else
+int lrutrack_unpin(lrutrack_t *t, uint32_t key)
+#endif
+{
+    lrutrack_check_internal_state(t);
+
+#if !LRUTRACK_32BIT_KEY
+    assert(key != NULL && key_length != 0);
+    uint32_t hash = lrutrack_hash(key, key_length, t->seed,
+        t->hash_table_size);
+    uint32_t index = lrutrack_find_index(t, key, key_length, hash);
+#else
+    uint32_t hash = key & (t->hash_table_size - 1);
+    uint32_t index = lrutrack_find_index(t, key, hash);
+#endif
+
+    if (index == UINT32_MAX)
+        return LRUTRACK_NOT_FOUND;
+
+    return lrutrack_unpin_index(t, index);
+}
+
+int lrutrack_pin_handle(lrutrack_t *t, lrutrack_handle_t handle) {
+    lrutrack_check_internal_state(t);
+
+    if (!lrutrack_handle_is_live(t, handle))
+        return LRUTRACK_NOT_FOUND;
+
+    return lrutrack_pin_index(t, handle.index);
+}
+
+int lrutrack_unpin_handle(lrutrack_t *t, lrutrack_handle_t handle) {
+    lrutrack_check_internal_state(t);
+
+    if (!lrutrack_handle_is_live(t, handle))
+        return LRUTRACK_NOT_FOUND;
+
+    return lrutrack_unpin_index(t, handle.index);
+}
+
+uint32_t lrutrack_num_pinned(const lrutrack_t *t) {
+    lrutrack_check_internal_state(t);
+    return t->num_pinned;
+}
+
+//
+// Priority functions
+
+static int lrutrack_set_item_priority(lrutrack_t *t, uint32_t row,
+    uint32_t index, uint32_t priority) {
+    if (lrutrack_alloc_item_attrs(t) != LRUTRACK_OK)
+        return LRUTRACK_OOM;
+
+    t->item_attrs[index].priority = (uint8_t)priority;
+
+    uint32_t row_priority = t->row_priorities[row];
+    if (priority > row_priority)
+        lrutrack_set_row_priority(t, row, priority);
+    else if (priority < row_priority)
+        lrutrack_set_row_priority(t, row, lrutrack_items_priority(t, row));
+    return LRUTRACK_OK;
+}
+
+#if !LRUTRACK_32BIT_KEY
+int lrutrack_set_priority(lrutrack_t *t, const void *key,
+    uint32_t key_length, uint32_t priority)
+#else
+int lrutrack_set_priority(lrutrack_t *t, uint32_t key, uint32_t priority)
+#endif
+{
+    lrutrack_check_internal_state(t);
+    assert(priority < LRUTRACK_NUM_PRIORITIES);
+
+#if !LRUTRACK_32BIT_KEY
+    assert(key != NULL && key_length != 0);
+    uint32_t hash = lrutrack_hash(key, key_length, t->seed,
+        t->hash_table_size);
+    uint32_t index = lrutrack_find_index(t, key, key_length, hash);
+#else
+    uint32_t hash = key & (t->hash_table_size - 1);
+    uint32_t index = lrutrack_find_index(t, key, hash);
+#endif
+
+    if (index == UINT32_MAX)
+        return LRUTRACK_NOT_FOUND;
+
+    int result = lrutrack_set_item_priority(t, hash, index, priority);
+
+    lrutrack_check_internal_state(t);
+
+    return result;
+}
+
+int lrutrack_set_priority_handle(lrutrack_t *t, lrutrack_handle_t handle,
+    uint32_t priority) {
+    lrutrack_check_internal_state(t);
+    assert(priority < LRUTRACK_NUM_PRIORITIES);
+
+    if (!lrutrack_handle_is_live(t, handle))
+        return LRUTRACK_NOT_FOUND;
+
+    int result = lrutrack_set_item_priority(t, handle.row, handle.index,
+        priority);
+
+    lrutrack_check_internal_state(t);
+
+    return result;
+}
+
+void lrutrack_set_priority_aging(lrutrack_t *t, uint32_t priority,
+    uint32_t num_evictions) {
+    lrutrack_check_internal_state(t);
+    assert(priority != 0 && priority < LRUTRACK_NUM_PRIORITIES);
+
+    t->priority_aging[priority] = num_evictions;
+    t->priority_credit[priority] = 0;
+}
+
+//
+// Tenant functions
+
+int lrutrack_enable_tenants(lrutrack_t *t, uint32_t num_tenants) {
+    lrutrack_check_internal_state(t);
+    assert(num_tenants != 0);
+
+    if (t->in_place || t->tenants)
+        return LRUTRACK_ERROR;
+
+    lrutrack_tenant_t *tenants = lrutrack_alloc(t,
+        sizeof(*tenants) * num_tenants, LRUTRACK_ALIGNMENT);
+    if (!tenants)
+        return LRUTRACK_OOM;
+
+    lrutrack_tenant_link_t *tenant_links = NULL;
+    if (t->num_items != 0) {
+        tenant_links = lrutrack_alloc_array(t,
+            sizeof(*tenant_links) * t->num_items);
+        if (!tenant_links) {
+            lrutrack_dealloc(t, tenants, sizeof(*tenants) * num_tenants);
+            return LRUTRACK_OOM;
+        }
+    }
+
+    t->tenants = tenants;
+    t->tenant_links = tenant_links;
+    t->num_tenants = num_tenants;
+    for (uint32_t i = 0; i < num_tenants; ++i)
+        t->tenants[i].quota = UINT64_MAX;
+    lrutrack_reset_tenants(t);
+
+    // Present items join tenant 0, least recently used row first
+    for (uint32_t p = 0; p < LRUTRACK_NUM_PRIORITIES; ++p) {
+        uint32_t row = t->lru_tail[p];
+        while (row != UINT32_MAX) {
+            uint32_t iter = t->hash_table[row];
+            while (iter != UINT32_MAX) {
+                t->tenant_links[iter].tenant = 0;
+                t->tenant_links[iter].weight = 1;
+                lrutrack_tenant_link(t, iter);
+                iter = t->items[iter].next;
+            }
+            row = t->hash_table_lru_links[row * 2 + 0];
+        }
+    }
+
+    lrutrack_check_internal_state(t);
+
+    return LRUTRACK_OK;
+}
+
+static void lrutrack_set_item_tenant(lrutrack_t *t, uint32_t index,
+    uint32_t tenant, uint32_t weight) {
+    lrutrack_tenant_unlink(t, index);
+    t->tenant_links[index].tenant = tenant;
+    t->tenant_links[index].weight = weight;
+    lrutrack_tenant_link(t, index);
+}
+
+#if !LRUTRACK_32BIT_KEY
+int lrutrack_set_tenant(lrutrack_t *t, const void *key, uint32_t key_length,
+    uint32_t tenant, uint32_t weight)
+#else
+int lrutrack_set_tenant(lrutrack_t *t, uint32_t key, uint32_t tenant,
+    uint32_t weight)
+#endif
+{
+    lrutrack_check_internal_state(t);
+    assert(t->tenants && tenant < t->num_tenants);
+
+#if !LRUTRACK_32BIT_KEY
+    assert(key != NULL && key_length != 0);
+    uint32_t hash = lrutrack_hash(key, key_length, t->seed,
+        t->hash_table_size);
+    uint32_t index = lrutrack_find_index(t, key, key_length, hash);
+#else
+    uint32_t hash = key & (t->hash_table_size - 1);
+    uint32_t index = lrutrack_find_index(t, key, hash);
+#endif
+
+    if (index == UINT32_MAX)
+        return LRUTRACK_NOT_FOUND;
+
+    lrutrack_set_item_tenant(t, index, tenant, weight);
+
+    lrutrack_check_internal_state(t);
+
+    return LRUTRACK_OK;
+}
+
+int lrutrack_set_tenant_handle(lrutrack_t *t, lrutrack_handle_t handle,
+    uint32_t tenant, uint32_t weight) {
+    lrutrack_check_internal_state(t);
+    assert(t->tenants && tenant < t->num_tenants);
+
+    if (!lrutrack_handle_is_live(t, handle))
+        return LRUTRACK_NOT_FOUND;
+
+    lrutrack_set_item_tenant(t, handle.index, tenant, weight);
+
+    lrutrack_check_internal_state(t);
+
+    return LRUTRACK_OK;
+}
+
+void lrutrack_set_tenant_quota(lrutrack_t *t, uint32_t tenant,
+    uint64_t quota) {
+    lrutrack_check_internal_state(t);
+    assert(t->tenants && tenant < t->num_tenants);
+
+    int was_over = t->tenants[tenant].usage > t->tenants[tenant].quota;
+    t->tenants[tenant].quota = quota;
+    lrutrack_tenant_update_over(t, tenant, was_over);
+
+    lrutrack_check_internal_state(t);
+}
+
+uint64_t lrutrack_tenant_usage(const lrutrack_t *t, uint32_t tenant) {
+    lrutrack_check_internal_state(t);
+    assert(t->tenants && tenant < t->num_tenants);
+    return t->tenants[tenant].usage;
+}
+
+#if !LRUTRACK_32BIT_KEY
+lrutrack_value_t lrutrack_peek(const lrutrack_t *t, const void *key,
+    uint32_t key_length, uint32_t *row)
+#else
+lrutrack_value_t lrutrack_peek(const lrutrack_t *t, uint32_t key,
+    uint32_t *row)
+#endif
+{
+    // No state check: a concurrent writer may be halfway through a change
+    assert(t);
+
+#if !LRUTRACK_32BIT_KEY
+    assert(key != NULL && key_length != 0);
+    uint32_t hash = lrutrack_hash(key, key_length, t->seed,
+        t->hash_table_size);
+#else
+    uint32_t hash = key & (t->hash_table_size - 1);
+#endif
+
+    if (row)
+        *row = hash;
+
+    // Torn reads can leave an index out of range or a cycle, so the walk
+    // is checked and bounded. In-place keys are found by index instead of
+    // following the stored pointer.
+    uint32_t iter = t->hash_table[hash];
+    for (uint32_t steps = 0; iter < t->num_items && steps < t->num_items;
+        ++steps) {
+        const lrutrack_item_t *item = &t->items[iter];
+#if !LRUTRACK_32BIT_KEY
+        uint32_t item_key_length = item->key_length;
+        if (item_key_length == key_length && (t->in_place ?
+            key_length <= t->max_key_length &&
+                memcmp(lrutrack_key_slot(t, iter), key, key_length) == 0 :
+            lrutrack_cmp_keys(key, key_length, item->key, item_key_length)))
+            return item->value;
+#else
+        if (item->key == key)
+            return item->value;
+#endif
+        iter = item->next;
+    }
+
+    return t->invalid_value;
+}
+
+void lrutrack_touch_row(lrutrack_t *t, uint32_t row) {
+    lrutrack_check_internal_state(t);
+    assert(row < t->hash_table_size);
+
+    if (t->hash_table[row] != UINT32_MAX)
+        lrutrack_move_to_lru_head(t, row);
+}
+
+void lrutrack_prefetch_row(const lrutrack_t *t, uint32_t row) {
+    assert(t && row < t->hash_table_size);
+    LRUTRACK_PREFETCH(&t->hash_table[row]);
+    LRUTRACK_PREFETCH(&t->hash_table_lru_links[row * 2]);
+}
+
+void lrutrack_prefetch_row_items(const lrutrack_t *t, uint32_t row) {
+    assert(t && row < t->hash_table_size);
+    uint32_t index = t->hash_table[row];
+    if (index < t->num_items)
+        LRUTRACK_PREFETCH(&t->items[index]);
+}
+
+#if !LRUTRACK_32BIT_KEY
+
+//
+// c-string key helper functions
+
+int lrutrack_insert_strkey(lrutrack_t *t, const char *key,
+    lrutrack_value_t value) {
+    assert(key != NULL && strlen(key) <= UINT32_MAX);
+    return lrutrack_insert(t, key, (uint32_t)strlen(key), value);
+}
+
+int lrutrack_remove_strkey(lrutrack_t *t, const char *key) {
+    assert(key != NULL && strlen(key) <= UINT32_MAX);
+    return lrutrack_remove(t, key, (uint32_t)strlen(key));
+}
+
+lrutrack_value_t lrutrack_use_strkey(lrutrack_t *t, const char *key) {
+    assert(key != NULL && strlen(key) <= UINT32_MAX);
+    return lrutrack_use(t, key, (uint32_t)strlen(key));
+}
+
+#endif
+
+//
+
+void lrutrack_remove_all(lrutrack_t *t) {
+    lrutrack_check_internal_state(t);
+
+    for (uint32_t i = 0; i < t->hash_table_size; ++i) {
+        uint32_t iter = t->hash_table[i];
+        while (iter != UINT32_MAX) {
+            assert(iter < t->num_items);
+            lrutrack_item_t *item = &t->items[iter];
+            assert(item->value != t->invalid_value);
+
+            lrutrack_evict_value(t, item->value);
+
+#if !LRUTRACK_32BIT_KEY
+            lrutrack_free_key(t, item);
+#endif
+
+            item->value = t->invalid_value;
 
             iter = item->next;
         }
     }
 
-    memset(t->hash_table, 0xff, sizeof(*t->hash_table) * t->hash_table_size);
-    memset(t->hash_table_lru_links, 0xff, sizeof(*t->hash_table_lru_links) * t->hash_table_size * 2);
+    memset(t->hash_table, 0xff, sizeof(*t->hash_table) * t->hash_table_size);
+    memset(t->hash_table_lru_links, 0xff, sizeof(*t->hash_table_lru_links) * t->hash_table_size * 2);
+    memset(t->row_priorities, 0, sizeof(*t->row_priorities) * t->hash_table_size);
+
+    t->first_free = UINT32_MAX;
+    if (t->num_items != 0)
+        lrutrack_link_free_items(t, 0, t->num_items);
+    t->num_used = 0;
+    t->num_pinned = 0;
+
+    lrutrack_stop_compaction(t);
+    lrutrack_reset_lru(t);
+    if (t->tenants)
+        lrutrack_reset_tenants(t);
+
+    lrutrack_check_internal_state(t);
+}
+
+// Evicts the unpinned items of a row holding pinned ones, returns the number
+// evicted. The row stays non-empty and in the LRU list.
+static uint32_t lrutrack_remove_unpinned(lrutrack_t *t, uint32_t row) {
+    uint32_t num_evicted = 0;
+    uint32_t *ref = &t->hash_table[row];
+    while (*ref != UINT32_MAX) {
+        uint32_t index = *ref;
+        assert(index < t->num_items);
+        lrutrack_item_t *item = &t->items[index];
+        assert(item->value != t->invalid_value);
+
+        if (lrutrack_item_pins(t, index) != 0) {
+            ref = &item->next;
+            continue;
+        }
+
+        *ref = item->next;
+
+#if !LRUTRACK_32BIT_KEY
+        lrutrack_free_key(t, item);
+#endif
+
+        lrutrack_evict_value(t, item->value);
+        if (t->tenants)
+            lrutrack_tenant_unlink(t, index);
+
+        lrutrack_push_free(t, index);
+        t->num_used--;
+        ++num_evicted;
+    }
+
+    assert(t->hash_table[row] != UINT32_MAX);
+    return num_evicted;
+}
+
+static int lrutrack_row_has_pins(const lrutrack_t *t, uint32_t row) {
+    uint32_t iter = t->hash_table[row];
+    while (iter != UINT32_MAX) {
+        if (lrutrack_item_pins(t, iter) != 0)
+            return 1;
+        iter = t->items[iter].next;
+    }
+    return 0;
+}
+
+// Evicts from the LRU list of one priority, LRUTRACK_NOT_FOUND when it is
+// empty or only holds pinned items
+static int lrutrack_remove_lru_priority(lrutrack_t *t, uint32_t priority) {
+    uint32_t *head = &t->lru_head[priority];
+    uint32_t *tail = &t->lru_tail[priority];
+
+    if (*tail == UINT32_MAX) {
+        assert(*head == UINT32_MAX);
+        return LRUTRACK_NOT_FOUND;
+    }
+
+    if (t->num_pinned != 0) {
+        // Rows with pinned items lose their unpinned ones and move to the
+        // head, so that later calls do not scan them again right away.
+        // Meeting the first row moved means only pinned items are left.
+        uint32_t first_moved = UINT32_MAX;
+        while (*tail != UINT32_MAX && *tail != first_moved &&
+            lrutrack_row_has_pins(t, *tail)) {
+            uint32_t row = *tail;
+            lrutrack_compaction_skip_row(t, row);
+            uint32_t num_evicted = lrutrack_remove_unpinned(t, row);
+            uint32_t items_priority = lrutrack_items_priority(t, row);
+            lrutrack_set_row_priority(t, row, items_priority < priority ?
+                items_priority : priority);
+            if (num_evicted != 0)
+                return LRUTRACK_OK;
+            if (first_moved == UINT32_MAX)
+                first_moved = row;
+        }
+
+        if (*tail == UINT32_MAX || *tail == first_moved)
+            return LRUTRACK_NOT_FOUND;
+    }
+
+    uint32_t row = *tail;
+    lrutrack_compaction_skip_row(t, row);
+
+    uint32_t new_tail = t->hash_table_lru_links[row * 2 + 0];
+    t->hash_table_lru_links[row * 2 + 0] = UINT32_MAX;
+    assert(t->hash_table_lru_links[row * 2 + 1] == UINT32_MAX);
+
+    if (new_tail != UINT32_MAX)
+        t->hash_table_lru_links[new_tail * 2 + 1] = UINT32_MAX;
+
+    uint32_t iter = t->hash_table[row];
+    t->hash_table[row] = UINT32_MAX;
+    t->row_priorities[row] = 0;
+
+    if (*head == row)
+        *head = new_tail;
+    *tail = new_tail;
+
+    while (iter != UINT32_MAX) {
+        assert(iter < t->num_items);
+        lrutrack_item_t *item = &t->items[iter];
+        assert(item->value != t->invalid_value);
+
+#if !LRUTRACK_32BIT_KEY
+        lrutrack_free_key(t, item);
+#endif
+
+        lrutrack_evict_value(t, item->value);
+        if (t->tenants)
+            lrutrack_tenant_unlink(t, iter);
+
+        uint32_t next = item->next;
+        lrutrack_push_free(t, iter);
+        t->num_used--;
+        iter = next;
+    }
+
+    return LRUTRACK_OK;
+}
+
+// After an eviction below them, higher priorities with aging on count it
+// and drop their least recently used row one priority when due
+static void lrutrack_age_priorities(lrutrack_t *t, uint32_t evicted) {
+    for (uint32_t p = evicted + 1; p < LRUTRACK_NUM_PRIORITIES; ++p) {
+        if (t->priority_aging[p] == 0 || t->lru_tail[p] == UINT32_MAX)
+            continue;
+
+        if (++t->priority_credit[p] < t->priority_aging[p])
+            continue;
+
+        t->priority_credit[p] = 0;
+        lrutrack_set_row_priority(t, t->lru_tail[p], p - 1);
+    }
+}
+
+// Evicts the least recently used unpinned item of a tenant over quota,
+// moving pinned ones it passes to the head of their tenant's list
+static int lrutrack_remove_over_quota(lrutrack_t *t) {
+    for (uint32_t id = t->first_over; id != UINT32_MAX;
+        id = t->tenants[id].over_next) {
+        lrutrack_tenant_t *tenant = &t->tenants[id];
+        uint32_t first_moved = UINT32_MAX;
+        while (tenant->tail != UINT32_MAX && tenant->tail != first_moved) {
+            uint32_t index = tenant->tail;
+            if (lrutrack_item_pins(t, index) == 0) {
+                lrutrack_remove_index(t,
+                    lrutrack_item_row(t, &t->items[index]), index);
+                return LRUTRACK_OK;
+            }
+
+            lrutrack_tenant_touch(t, index);
+            if (first_moved == UINT32_MAX)
+                first_moved = index;
+        }
+    }
+
+    return LRUTRACK_NOT_FOUND;
+}
+
+int lrutrack_remove_lru(lrutrack_t *t) {
+    lrutrack_check_internal_state(t);
+
+    if (t->tenants && t->first_over != UINT32_MAX &&
+        lrutrack_remove_over_quota(t) == LRUTRACK_OK) {
+        lrutrack_check_internal_state(t);
+        return LRUTRACK_OK;
+    }
+
+    for (uint32_t p = 0; p < LRUTRACK_NUM_PRIORITIES; ++p) {
+        if (lrutrack_remove_lru_priority(t, p) == LRUTRACK_OK) {
+            lrutrack_age_priorities(t, p);
+            lrutrack_check_internal_state(t);
+            return LRUTRACK_OK;
+        }
+    }
+
+    lrutrack_check_internal_state(t);
+
+    return LRUTRACK_NOT_FOUND;
+}
+
+int lrutrack_set_clock(lrutrack_t *t, const uint32_t *clock) {
+    lrutrack_check_internal_state(t);
+
+    size_t row_stamps_bytesize = sizeof(*t->row_stamps) * t->hash_table_size;
+    if (!clock) {
+        lrutrack_dealloc(t, t->row_stamps, row_stamps_bytesize);
+        t->row_stamps = NULL;
+        t->clock = NULL;
+        return LRUTRACK_OK;
+    }
+
+    if (t->in_place)
+        return LRUTRACK_ERROR;
+
+    if (!t->row_stamps) {
+        t->row_stamps = lrutrack_alloc_array(t, row_stamps_bytesize);
+        if (!t->row_stamps)
+            return LRUTRACK_OOM;
+    }
+
+    // Rows present so far count as used now
+    t->clock = clock;
+    for (uint32_t i = 0; i < t->hash_table_size; ++i)
+        t->row_stamps[i] = *clock;
+
+    return LRUTRACK_OK;
+}
+
+int lrutrack_lru_stamp(const lrutrack_t *t, uint32_t *stamp) {
+    assert(stamp);
+    uint32_t row = lrutrack_lru_row(t);
+    if (row == UINT32_MAX || !t->row_stamps)
+        return LRUTRACK_NOT_FOUND;
+
+    *stamp = t->row_stamps[row];
+    return LRUTRACK_OK;
+}
+
+uint32_t lrutrack_lru_row(const lrutrack_t *t) {
+    lrutrack_check_internal_state(t);
+
+    for (uint32_t p = 0; p < LRUTRACK_NUM_PRIORITIES; ++p) {
+        if (t->lru_tail[p] != UINT32_MAX)
+            return t->lru_tail[p];
+    }
+
+    return UINT32_MAX;
+}
+
+//
+// Parallel teardown
+
+typedef struct lrutrack_teardown_t {
+    lrutrack_t *t;
+    uint32_t num_tasks;
+    int clear; // Leave an empty tracker behind
+} lrutrack_teardown_t;
+
+static uint32_t lrutrack_task_range_begin(uint32_t n, uint32_t index,
+    uint32_t num_tasks) {
+    return (uint32_t)((uint64_t)n * index / num_tasks);
+}
+
+// Evicts the live items in the task's range. When clearing, also links the
+// range as free items, to be joined with the neighbouring ranges, and
+// empties the task's range of hash table rows.
+static void lrutrack_teardown_task(void *user, uint32_t index) {
+    const lrutrack_teardown_t *teardown = user;
+    lrutrack_t *t = teardown->t;
+    assert(index < teardown->num_tasks);
+
+    uint32_t begin = lrutrack_task_range_begin(t->num_items, index,
+        teardown->num_tasks);
+    uint32_t end = lrutrack_task_range_begin(t->num_items, index + 1,
+        teardown->num_tasks);
+    for (uint32_t i = begin; i < end; ++i) {
+        lrutrack_item_t *item = &t->items[i];
+        if (item->value != t->invalid_value) {
+#if !LRUTRACK_32BIT_KEY
+            lrutrack_free_key(t, item);
+#endif
+            t->evict_func(t->evict_user, item->value);
+        }
+
+        if (teardown->clear) {
+            item->value = t->invalid_value;
+            item->next = i + 1;
+            LRUTRACK_FREE_PREV(item) = i - 1;
+        }
+    }
+
+    if (!teardown->clear)
+        return;
+
+    begin = lrutrack_task_range_begin(t->hash_table_size, index,
+        teardown->num_tasks);
+    end = lrutrack_task_range_begin(t->hash_table_size, index + 1,
+        teardown->num_tasks);
+    if (begin < end) {
+        memset(t->hash_table + begin, 0xff,
+            sizeof(*t->hash_table) * (end - begin));
+        memset(t->hash_table_lru_links + (size_t)begin * 2, 0xff,
+            sizeof(*t->hash_table_lru_links) * (end - begin) * 2);
+        memset(t->row_priorities + begin, 0,
+            sizeof(*t->row_priorities) * (end - begin));
+    }
+}
 
-    if (t->num_items != 0) {
-        for (uint32_t i = 0; i < t->num_items - 1; ++i)
-            t->items[i].next = i + 1;
+#if LRUTRACK_HAS_PTHREADS
 
-        t->items[t->num_items - 1].next = UINT32_MAX;
+typedef struct lrutrack_thread_task_t {
+    lrutrack_task_func_t task;
+    void *task_user;
+    uint32_t index;
+} lrutrack_thread_task_t;
+
+static void *lrutrack_thread_task_main(void *arg) {
+    const lrutrack_thread_task_t *thread_task = arg;
+    thread_task->task(thread_task->task_user, thread_task->index);
+    return NULL;
+}
+
+#endif
+
+// Default runner: task 0 on the calling thread, the others on threads of
+// their own, or also on the calling thread when one cannot be started
+static void lrutrack_run_tasks_on_threads(lrutrack_task_func_t task,
+    void *task_user, uint32_t num_tasks) {
+    assert(num_tasks <= LRUTRACK_MAX_TASK_THREADS);
+
+#if LRUTRACK_HAS_PTHREADS
+    pthread_t threads[LRUTRACK_MAX_TASK_THREADS];
+    lrutrack_thread_task_t thread_tasks[LRUTRACK_MAX_TASK_THREADS];
+    int started[LRUTRACK_MAX_TASK_THREADS];
+
+    for (uint32_t i = 1; i < num_tasks; ++i) {
+        thread_tasks[i].task = task;
+        thread_tasks[i].task_user = task_user;
+        thread_tasks[i].index = i;
+        started[i] = pthread_create(&threads[i], NULL,
+            lrutrack_thread_task_main, &thread_tasks[i]) == 0;
+        if (!started[i])
+            task(task_user, i);
+    }
+
+    task(task_user, 0);
+
+    for (uint32_t i = 1; i < num_tasks; ++i) {
+        if (started[i])
+            pthread_join(threads[i], NULL);
+    }
+#else
+    for (uint32_t i = 0; i < num_tasks; ++i)
+        task(task_user, i);
+#endif
+}
+
+// Tasks the default runner can take
+static uint32_t lrutrack_clamp_num_tasks(uint32_t num_tasks,
+    const lrutrack_task_runner_t *runner) {
+    if (num_tasks == 0)
+        return 1;
+    if (!runner && num_tasks > LRUTRACK_MAX_TASK_THREADS)
+        return LRUTRACK_MAX_TASK_THREADS;
+    return num_tasks;
+}
+
+static void lrutrack_run_tasks(const lrutrack_task_runner_t *runner,
+    lrutrack_task_func_t task, void *task_user, uint32_t num_tasks) {
+    if (runner) {
+        assert(runner->run_tasks);
+        runner->run_tasks(runner->user, task, task_user, num_tasks);
+    } else {
+        lrutrack_run_tasks_on_threads(task, task_user, num_tasks);
     }
+}
+
+static void lrutrack_teardown(lrutrack_t *t, uint32_t num_tasks,
+    const lrutrack_task_runner_t *runner, int clear) {
+    lrutrack_flush_evicted(t);
+
+    num_tasks = lrutrack_clamp_num_tasks(num_tasks, runner);
+    lrutrack_teardown_t teardown = { t, num_tasks, clear };
+    lrutrack_run_tasks(runner, lrutrack_teardown_task, &teardown, num_tasks);
+}
+
+void lrutrack_remove_all_parallel(lrutrack_t *t, uint32_t num_tasks,
+    const lrutrack_task_runner_t *runner) {
+    lrutrack_check_internal_state(t);
+
+    lrutrack_teardown(t, num_tasks, runner, 1);
 
-    t->lru_head = UINT32_MAX;
-    t->lru_tail = UINT32_MAX;
+    // The tasks linked their ranges up to the next one
+    t->first_free = UINT32_MAX;
+    if (t->num_items != 0) {
+        t->items[t->num_items - 1].next = UINT32_MAX;
+        t->first_free = 0;
+    }
+    t->num_used = 0;
+    t->num_pinned = 0;
 
-    t->first_free = 0;
+    lrutrack_stop_compaction(t);
+    lrutrack_reset_lru(t);
+    if (t->tenants)
+        lrutrack_reset_tenants(t);
 
     lrutrack_check_internal_state(t);
 }
 
-int lrutrack_remove_lru(lrutrack_t *t) {
+void lrutrack_destroy_parallel(lrutrack_t *t, uint32_t num_tasks,
+    const lrutrack_task_runner_t *runner) {
     lrutrack_check_internal_state(t);
 
-    if (t->lru_tail == UINT32_MAX) {
-        assert(t->lru_head == UINT32_MAX);
-        return LRUTRACK_NOT_FOUND;
+    lrutrack_teardown(t, num_tasks, runner, 0);
+
+    if (!t->in_place)
+        lrutrack_release(t);
+}
+
+//
+// Parallel bulk build
+// Four task passes over num_tasks chunks of the entries: set up the items
+// and count their rows per partition (a range of rows), group the entry
+// indices by partition, chain each partition's rows, link the rows in LRU
+// order within each chunk. The chunks' row lists are then joined.
+
+typedef struct lrutrack_build_t {
+    lrutrack_t *t;
+#if !LRUTRACK_32BIT_KEY
+    const void *const *keys;
+    const uint32_t *key_lengths;
+#else
+    const uint32_t *keys;
+#endif
+    const lrutrack_value_t *values;
+    uint32_t num_entries;
+    uint32_t num_tasks;
+    uint32_t generation; // Of entry 0
+    uint32_t *rows; // Of each entry
+    uint32_t *order; // Entry indices grouped by partition
+    uint32_t *offsets; // Per chunk and partition: count, then position
+    uint32_t *chunk_rows; // Per chunk: most and least recent row
+    uint32_t *results; // Per chunk
+} lrutrack_build_t;
+
+static uint32_t lrutrack_build_partition(const lrutrack_build_t *build,
+    uint32_t row) {
+    return (uint32_t)((uint64_t)row * build->num_tasks /
+        build->t->hash_table_size);
+}
+
+static void lrutrack_build_items_task(void *user, uint32_t chunk) {
+    lrutrack_build_t *build = user;
+    lrutrack_t *t = build->t;
+    uint32_t *counts = build->offsets + (size_t)chunk * build->num_tasks;
+
+    uint32_t begin = lrutrack_task_range_begin(build->num_entries, chunk,
+        build->num_tasks);
+    uint32_t end = lrutrack_task_range_begin(build->num_entries, chunk + 1,
+        build->num_tasks);
+    for (uint32_t i = begin; i < end; ++i) {
+        lrutrack_item_t *item = &t->items[i];
+        assert(build->values[i] != t->invalid_value);
+
+#if !LRUTRACK_32BIT_KEY
+        const void *key = build->keys[i];
+        uint32_t key_length = build->key_lengths[i];
+        assert(key && key_length != 0);
+        void *key_copy = lrutrack_alloc_key(t, i, key_length);
+        if (!key_copy) {
+            build->results[chunk] = LRUTRACK_OOM;
+            return;
+        }
+
+        memcpy(key_copy, key, key_length);
+        item->key = key_copy;
+        item->key_length = key_length;
+        uint32_t row = lrutrack_hash(key, key_length, t->seed,
+            t->hash_table_size);
+#else
+        item->key = build->keys[i];
+        uint32_t row = item->key & (t->hash_table_size - 1);
+#endif
+
+        item->value = build->values[i];
+        item->next = UINT32_MAX;
+        item->generation = build->generation + i;
+        if (t->item_attrs) {
+            t->item_attrs[i].pins = 0;
+            t->item_attrs[i].priority = 0;
+        }
+        build->rows[i] = row;
+        counts[lrutrack_build_partition(build, row)]++;
+    }
+}
+
+static void lrutrack_build_group_task(void *user, uint32_t chunk) {
+    lrutrack_build_t *build = user;
+    uint32_t *positions = build->offsets + (size_t)chunk * build->num_tasks;
+
+    uint32_t begin = lrutrack_task_range_begin(build->num_entries, chunk,
+        build->num_tasks);
+    uint32_t end = lrutrack_task_range_begin(build->num_entries, chunk + 1,
+        build->num_tasks);
+    for (uint32_t i = begin; i < end; ++i) {
+        uint32_t partition = lrutrack_build_partition(build, build->rows[i]);
+        build->order[positions[partition]++] = i;
     }
+}
 
-    uint32_t new_tail = t->hash_table_lru_links[t->lru_tail * 2 + 0];
-    t->hash_table_lru_links[t->lru_tail * 2 + 0] = UINT32_MAX;
-    assert(t->hash_table_lru_links[t->lru_tail * 2 + 1] == UINT32_MAX);
+// Entries in increasing order, so that as with inserting, the most recent
+// one ends up first on its row
+static void lrutrack_build_chain_task(void *user, uint32_t partition) {
+    lrutrack_build_t *build = user;
+    lrutrack_t *t = build->t;
+
+    // Grouping left each position at the end of its chunk's share
+    const uint32_t *last_chunk = build->offsets +
+        (size_t)(build->num_tasks - 1) * build->num_tasks;
+    uint32_t begin = partition != 0 ? last_chunk[partition - 1] : 0;
+    uint32_t end = last_chunk[partition];
+    for (uint32_t k = begin; k < end; ++k) {
+        uint32_t i = build->order[k];
+        uint32_t row = build->rows[i];
+        t->items[i].next = t->hash_table[row];
+        t->hash_table[row] = i;
+    }
+}
 
-    if (new_tail != UINT32_MAX)
-        t->hash_table_lru_links[new_tail * 2 + 1] = UINT32_MAX;
+// A row's place in the LRU order is that of its most recent entry, the one
+// at its head
+static void lrutrack_build_lru_task(void *user, uint32_t chunk) {
+    lrutrack_build_t *build = user;
+    lrutrack_t *t = build->t;
+
+    uint32_t begin = lrutrack_task_range_begin(build->num_entries, chunk,
+        build->num_tasks);
+    uint32_t end = lrutrack_task_range_begin(build->num_entries, chunk + 1,
+        build->num_tasks);
+    uint32_t first = UINT32_MAX;
+    uint32_t prev = UINT32_MAX;
+    for (uint32_t i = end; i-- > begin;) {
+        uint32_t row = build->rows[i];
+        if (t->hash_table[row] != i)
+            continue;
+
+        if (prev != UINT32_MAX) {
+            t->hash_table_lru_links[prev * 2 + 1] = row;
+            t->hash_table_lru_links[row * 2 + 0] = prev;
+        } else {
+            first = row;
+        }
+        prev = row;
+    }
 
-    uint32_t iter = t->hash_table[t->lru_tail];
-    t->hash_table[t->lru_tail] = UINT32_MAX;
+    build->chunk_rows[chunk * 2 + 0] = first;
+    build->chunk_rows[chunk * 2 + 1] = prev;
+}
 
-    if (t->lru_head == t->lru_tail)
-        t->lru_head = new_tail;
-    t->lru_tail = new_tail;
+// Returns the tracker to empty after a failed build
+static void lrutrack_build_undo(lrutrack_t *t, uint32_t num_entries) {
+    for (uint32_t i = 0; i < num_entries; ++i) {
+#if !LRUTRACK_32BIT_KEY
+        if (t->items[i].key)
+            lrutrack_free_key(t, &t->items[i]);
+#endif
+        t->items[i].value = t->invalid_value;
+    }
 
-    while (iter != UINT32_MAX) {
-        assert(iter < t->num_items);
-        lrutrack_item_t *item = &t->items[iter];
-        assert(item->value != t->invalid_value);
+    t->first_free = UINT32_MAX;
+    lrutrack_link_free_items(t, 0, t->num_items);
+}
 
 #if !LRUTRACK_32BIT_KEY
-        t->free_func(item->key);
-        item->key = NULL;
+int lrutrack_build_parallel(lrutrack_t *t, const void *const *keys,
+    const uint32_t *key_lengths, const lrutrack_value_t *values,
+    uint32_t num_entries, uint32_t num_tasks,
+    const lrutrack_task_runner_t *runner)
+#else
+int lrutrack_build_parallel(lrutrack_t *t, const uint32_t *keys,
+    const lrutrack_value_t *values, uint32_t num_entries, uint32_t num_tasks,
+    const lrutrack_task_runner_t *runner)
+#endif
+{
+    lrutrack_check_internal_state(t);
+    assert(keys && values);
+#if !LRUTRACK_32BIT_KEY
+    assert(key_lengths);
 #endif
 
-        assert(t->evict_func);
-        t->evict_func(t->evict_user, item->value);
+    if (t->num_used != 0 || t->in_place)
+        return LRUTRACK_ERROR;
 
-        item->value = t->invalid_value;
+    if (num_entries == 0)
+        return LRUTRACK_OK;
 
-        uint32_t next = item->next;
-        item->next = t->first_free;
+    if (num_entries > t->num_items &&
+        lrutrack_grow_items(t, num_entries) != LRUTRACK_OK)
+        return LRUTRACK_OOM;
 
-        t->first_free = iter;
-        iter = next;
+    num_tasks = lrutrack_clamp_num_tasks(num_tasks, runner);
+
+    // rows, order, offsets, chunk_rows, results
+    size_t scratch_count = (size_t)num_entries * 2 +
+        (size_t)num_tasks * num_tasks + (size_t)num_tasks * 3;
+    size_t scratch_bytesize = sizeof(uint32_t) * scratch_count;
+    uint32_t *scratch = lrutrack_alloc_array(t, scratch_bytesize);
+    if (!scratch)
+        return LRUTRACK_OOM;
+
+    memset(scratch, 0, scratch_bytesize);
+
+    lrutrack_build_t build;
+    build.t = t;
+    build.keys = keys;
+#if !LRUTRACK_32BIT_KEY
+    build.key_lengths = key_lengths;
+#endif
+    build.values = values;
+    build.num_entries = num_entries;
+    build.num_tasks = num_tasks;
+    build.generation = t->generation;
+    build.rows = scratch;
+    build.order = build.rows + num_entries;
+    build.offsets = build.order + num_entries;
+    build.chunk_rows = build.offsets + (size_t)num_tasks * num_tasks;
+    build.results = build.chunk_rows + (size_t)num_tasks * 2;
+
+    lrutrack_stop_compaction(t);
+
+    lrutrack_run_tasks(runner, lrutrack_build_items_task, &build, num_tasks);
+
+    int result = LRUTRACK_OK;
+    for (uint32_t c = 0; c < num_tasks; ++c) {
+        if (build.results[c] != LRUTRACK_OK)
+            result = (int)build.results[c];
+    }
+
+    if (result != LRUTRACK_OK) {
+        lrutrack_build_undo(t, num_entries);
+        lrutrack_dealloc(t, scratch, scratch_bytesize);
+        lrutrack_check_internal_state(t);
+        return result;
+    }
+
+    // Counts to start positions, partition by partition
+    uint32_t position = 0;
+    for (uint32_t p = 0; p < num_tasks; ++p) {
+        for (uint32_t c = 0; c < num_tasks; ++c) {
+            uint32_t *offset = &build.offsets[(size_t)c * num_tasks + p];
+            uint32_t count = *offset;
+            *offset = position;
+            position += count;
+        }
+    }
+
+    assert(position == num_entries);
+
+    lrutrack_run_tasks(runner, lrutrack_build_group_task, &build, num_tasks);
+    lrutrack_run_tasks(runner, lrutrack_build_chain_task, &build, num_tasks);
+    lrutrack_run_tasks(runner, lrutrack_build_lru_task, &build, num_tasks);
+
+    // Join the chunks' row lists, most recent chunk first
+    uint32_t prev = UINT32_MAX;
+    for (uint32_t c = num_tasks; c-- > 0;) {
+        uint32_t first = build.chunk_rows[c * 2 + 0];
+        if (first == UINT32_MAX)
+            continue;
+
+        if (prev != UINT32_MAX) {
+            t->hash_table_lru_links[prev * 2 + 1] = first;
+            t->hash_table_lru_links[first * 2 + 0] = prev;
+        } else {
+            t->lru_head[0] = first;
+        }
+        prev = build.chunk_rows[c * 2 + 1];
+    }
+    t->lru_tail[0] = prev;
+
+    t->first_free = UINT32_MAX;
+    if (num_entries < t->num_items)
+        lrutrack_link_free_items(t, num_entries, t->num_items);
+    t->num_used = num_entries;
+    t->generation += num_entries;
+
+    if (t->row_stamps) {
+        for (uint32_t i = 0; i < t->hash_table_size; ++i)
+            t->row_stamps[i] = *t->clock;
+    }
+
+    // Serial, the tenant lists are item granular
+    if (t->tenants) {
+        for (uint32_t i = 0; i < num_entries; ++i) {
+            t->tenant_links[i].tenant = 0;
+            t->tenant_links[i].weight = 1;
+            lrutrack_tenant_link(t, i);
+        }
+    }
+
+    lrutrack_dealloc(t, scratch, scratch_bytesize);
+
+    lrutrack_check_internal_state(t);
+
+    return LRUTRACK_OK;
+}
+
+//
+// Deferred eviction
+
+void lrutrack_set_deferred_eviction(lrutrack_t *t, int enabled) {
+    lrutrack_check_internal_state(t);
+
+    t->defer_evictions = enabled != 0;
+    if (!enabled)
+        lrutrack_flush_evicted(t);
+}
+
+uint32_t lrutrack_num_evicted(const lrutrack_t *t) {
+    lrutrack_check_internal_state(t);
+    return t->num_deferred;
+}
+
+uint32_t lrutrack_take_evicted(lrutrack_t *t, lrutrack_value_t *values,
+    uint32_t max_values) {
+    lrutrack_check_internal_state(t);
+    assert(values || max_values == 0);
+
+    uint32_t n = t->num_deferred < max_values ? t->num_deferred : max_values;
+    if (n == 0)
+        return 0;
+
+    memcpy(values, t->deferred, sizeof(*values) * n);
+    t->num_deferred -= n;
+    memmove(t->deferred, t->deferred + n, sizeof(*values) * t->num_deferred);
+
+    return n;
+}
+
+void lrutrack_flush_evicted(lrutrack_t *t) {
+    lrutrack_check_internal_state(t);
+
+    // The callback may queue more through reentrant calls
+    for (uint32_t i = 0; i < t->num_deferred; ++i)
+        t->evict_func(t->evict_user, t->deferred[i]);
+    t->num_deferred = 0;
+}
+
+//
+// Capacity functions
+
+int lrutrack_reserve(lrutrack_t *t, uint32_t num_items) {
+    lrutrack_check_internal_state(t);
+
+    if (num_items <= t->num_items)
+        return LRUTRACK_OK;
+
+    if (t->in_place)
+        return LRUTRACK_ERROR;
+
+    int result = lrutrack_grow_items(t, num_items);
+
+    lrutrack_check_internal_state(t);
+
+    return result;
+}
+
+int lrutrack_shrink_to_fit(lrutrack_t *t) {
+    lrutrack_check_internal_state(t);
+
+    if (t->in_place)
+        return LRUTRACK_ERROR;
+
+    uint32_t num_used = t->num_used;
+    if (num_used == t->num_items)
+        return LRUTRACK_OK;
+
+    lrutrack_stop_compaction(t);
+
+    size_t old_items_bytesize = sizeof(*t->items) * t->num_items;
+
+    size_t old_links_bytesize = sizeof(*t->tenant_links) * t->num_items;
+
+    size_t old_attrs_bytesize = sizeof(*t->item_attrs) * t->num_items;
+
+    if (num_used == 0) {
+        lrutrack_dealloc(t, t->items, old_items_bytesize);
+        lrutrack_dealloc(t, t->tenant_links, old_links_bytesize);
+        lrutrack_dealloc(t, t->item_attrs, old_attrs_bytesize);
+        t->items = NULL;
+        t->tenant_links = NULL;
+        t->item_attrs = NULL;
+        t->num_items = 0;
+        t->first_free = UINT32_MAX;
+        lrutrack_check_internal_state(t);
+        return LRUTRACK_OK;
+    }
+
+    lrutrack_item_t *items = lrutrack_alloc_array(t,
+        sizeof(*t->items) * num_used);
+    if (!items)
+        return LRUTRACK_OOM;
+
+    lrutrack_item_attr_t *item_attrs = NULL;
+    if (t->item_attrs) {
+        item_attrs = lrutrack_alloc_array(t, sizeof(*item_attrs) * num_used);
+        if (!item_attrs) {
+            lrutrack_dealloc(t, items, sizeof(*t->items) * num_used);
+            return LRUTRACK_OOM;
+        }
+    }
+
+    // The tenant links follow the renumbering through an index map
+    lrutrack_tenant_link_t *tenant_links = NULL;
+    uint32_t *new_index = NULL;
+    if (t->tenants) {
+        tenant_links = lrutrack_alloc_array(t,
+            sizeof(*tenant_links) * num_used);
+        new_index = lrutrack_alloc_array(t,
+            sizeof(*new_index) * t->num_items);
+        if (!tenant_links || !new_index) {
+            lrutrack_dealloc(t, new_index, sizeof(*new_index) * t->num_items);
+            lrutrack_dealloc(t, tenant_links,
+                sizeof(*tenant_links) * num_used);
+            lrutrack_dealloc(t, item_attrs, sizeof(*item_attrs) * num_used);
+            lrutrack_dealloc(t, items, sizeof(*t->items) * num_used);
+            return LRUTRACK_OOM;
+        }
+    }
+
+    // Renumber the live items row by row, keeping the chain order
+    uint32_t index = 0;
+    for (uint32_t i = 0; i < t->hash_table_size; ++i) {
+        uint32_t iter = t->hash_table[i];
+        if (iter == UINT32_MAX)
+            continue;
+
+        t->hash_table[i] = index;
+        while (iter != UINT32_MAX) {
+            items[index] = t->items[iter];
+            if (item_attrs)
+                item_attrs[index] = t->item_attrs[iter];
+            if (new_index)
+                new_index[iter] = index;
+            iter = t->items[iter].next;
+            items[index].next = iter != UINT32_MAX ? index + 1 : UINT32_MAX;
+            ++index;
+        }
+    }
+
+    assert(index == num_used);
+
+    if (t->tenants) {
+        for (uint32_t i = 0; i < t->num_items; ++i) {
+            if (t->items[i].value == t->invalid_value)
+                continue;
+            lrutrack_tenant_link_t *link = &tenant_links[new_index[i]];
+            *link = t->tenant_links[i];
+            if (link->prev != UINT32_MAX)
+                link->prev = new_index[link->prev];
+            if (link->next != UINT32_MAX)
+                link->next = new_index[link->next];
+        }
+
+        for (uint32_t i = 0; i < t->num_tenants; ++i) {
+            lrutrack_tenant_t *tenant = &t->tenants[i];
+            if (tenant->head != UINT32_MAX) {
+                tenant->head = new_index[tenant->head];
+                tenant->tail = new_index[tenant->tail];
+            }
+        }
+
+        lrutrack_dealloc(t, new_index, sizeof(*new_index) * t->num_items);
+        lrutrack_dealloc(t, t->tenant_links, old_links_bytesize);
+        t->tenant_links = tenant_links;
+    }
+
+    if (item_attrs) {
+        lrutrack_dealloc(t, t->item_attrs, old_attrs_bytesize);
+        t->item_attrs = item_attrs;
     }
 
+    lrutrack_dealloc(t, t->items, old_items_bytesize);
+    t->items = items;
+    t->num_items = num_used;
+    t->first_free = UINT32_MAX;
+
     lrutrack_check_internal_state(t);
 
     return LRUTRACK_OK;
 }
+
+uint32_t lrutrack_count(const lrutrack_t *t) {
+    assert(t);
+    return t->num_used;
+}
+
+//
+// Compaction
+
+// Returns the location that holds the index of a live item
+static uint32_t *lrutrack_find_ref(lrutrack_t *t, uint32_t index) {
+    uint32_t *ref = &t->hash_table[lrutrack_item_row(t, &t->items[index])];
+    while (*ref != index) {
+        assert(*ref != UINT32_MAX);
+        ref = &t->items[*ref].next;
+    }
+    return ref;
+}
+
+// Moves the live item a to index b. A live item at b moves to a, a free
+// item at b takes the place of a in the free list. ref_a holds the index a.
+static void lrutrack_move_item(lrutrack_t *t, uint32_t a, uint32_t b,
+    uint32_t *ref_a) {
+    assert(a != b);
+    assert(*ref_a == a);
+
+    lrutrack_item_t *item_a = &t->items[a];
+    lrutrack_item_t *item_b = &t->items[b];
+
+    if (item_b->value == t->invalid_value) {
+        lrutrack_unlink_free(t, b);
+        *item_b = *item_a;
+        *ref_a = b;
+
+        if (t->item_attrs)
+            t->item_attrs[b] = t->item_attrs[a];
+
+        if (t->tenants) {
+            t->tenant_links[b] = t->tenant_links[a];
+            lrutrack_tenant_relink(t, b);
+        }
+
+#if !LRUTRACK_32BIT_KEY
+        if (t->in_place) {
+            memcpy(lrutrack_key_slot(t, b), item_a->key, item_a->key_length);
+            item_b->key = lrutrack_key_slot(t, b);
+        }
+
+        item_a->key = NULL;
+#endif
+
+        lrutrack_push_free(t, a);
+        return;
+    }
+
+    uint32_t *ref_b = lrutrack_find_ref(t, b);
+
+    lrutrack_item_t tmp = *item_a;
+    *item_a = *item_b;
+    *item_b = tmp;
+
+    // A reference stored in one of the swapped items moved with it
+    if (ref_a == &item_a->next)
+        ref_a = &item_b->next;
+    else if (ref_a == &item_b->next)
+        ref_a = &item_a->next;
+
+    if (ref_b == &item_a->next)
+        ref_b = &item_b->next;
+    else if (ref_b == &item_b->next)
+        ref_b = &item_a->next;
+
+    *ref_a = b;
+    *ref_b = a;
+
+    if (t->item_attrs) {
+        lrutrack_item_attr_t attr = t->item_attrs[a];
+        t->item_attrs[a] = t->item_attrs[b];
+        t->item_attrs[b] = attr;
+    }
+
+    if (t->tenants) {
+        // Swap the links, then the indices the pair refer to each other by
+        lrutrack_tenant_link_t link = t->tenant_links[a];
+        t->tenant_links[a] = t->tenant_links[b];
+        t->tenant_links[b] = link;
+
+        uint32_t swapped[2] = { a, b };
+        for (uint32_t i = 0; i < 2; ++i) {
+            lrutrack_tenant_link_t *l = &t->tenant_links[swapped[i]];
+            if (l->prev == a || l->prev == b)
+                l->prev ^= a ^ b;
+            if (l->next == a || l->next == b)
+                l->next ^= a ^ b;
+        }
+
+        lrutrack_tenant_relink(t, a);
+        lrutrack_tenant_relink(t, b);
+    }
+
+#if !LRUTRACK_32BIT_KEY
+    if (t->in_place) {
+        uint8_t *slot_a = lrutrack_key_slot(t, a);
+        uint8_t *slot_b = lrutrack_key_slot(t, b);
+        for (uint32_t i = 0; i < t->max_key_length; ++i) {
+            uint8_t byte = slot_a[i];
+            slot_a[i] = slot_b[i];
+            slot_b[i] = byte;
+        }
+
+        item_a->key = slot_a;
+        item_b->key = slot_b;
+    }
+#endif
+}
+
+int lrutrack_compact(lrutrack_t *t, uint32_t max_items) {
+    lrutrack_check_internal_state(t);
+
+    if (!t->compacting) {
+        // Highest priority first, each from its most recently used row
+        t->compacting = 1;
+        t->compact_priority = LRUTRACK_NUM_PRIORITIES - 1;
+        t->compact_row = t->lru_head[t->compact_priority];
+        t->compact_cursor = 0;
+    }
+
+    uint32_t num_visited = 0;
+    while (num_visited < max_items) {
+        if (t->compact_row == UINT32_MAX) {
+            if (t->compact_priority == 0)
+                break;
+            t->compact_row = t->lru_head[--t->compact_priority];
+            continue;
+        }
+
+        uint32_t row = t->compact_row;
+        t->compact_row = t->hash_table_lru_links[row * 2 + 1];
+
+        uint32_t *ref = &t->hash_table[row];
+        while (*ref != UINT32_MAX) {
+            uint32_t index = *ref;
+            if (index >= t->compact_cursor) {
+                // Not packed yet, renumber to the next position
+                uint32_t target = t->compact_cursor++;
+                if (index != target) {
+                    lrutrack_move_item(t, index, target, ref);
+                    index = target;
+                }
+            }
+
+            ref = &t->items[index].next;
+            ++num_visited;
+        }
+    }
+
+    int result = LRUTRACK_IN_PROGRESS;
+    if (t->compact_row == UINT32_MAX && t->compact_priority == 0) {
+        lrutrack_stop_compaction(t);
+        result = LRUTRACK_OK;
+    }
+
+    lrutrack_check_internal_state(t);
+
+    return result;
+}
@@ -16,6 +16,10 @@ extern "C" {
 #   define LRUTRACK_32BIT_KEY 0
 #endif
 
+#if !defined(LRUTRACK_HUGE_PAGES)
+#   define LRUTRACK_HUGE_PAGES 0
+#endif
+
 #if !defined(LRUTRACK_HC_TESTS)
 #   define LRUTRACK_HC_TESTS 0
 #endif
@@ -24,6 +28,7 @@ extern "C" {
 #define LRUTRACK_ERROR 1
 #define LRUTRACK_OOM 2
 #define LRUTRACK_NOT_FOUND 3
+#define LRUTRACK_IN_PROGRESS 4
 
 //
 // Types:
@@ -35,8 +40,46 @@ typedef void (*lrutrack_evict_func_t)(void *user, lrutrack_value_t value);
 typedef void *(*lrutrack_malloc_func_t)(size_t num_bytes);
 typedef void (*lrutrack_free_func_t)(void *ptr);
 
+// Allocator hooks with a user context. Deallocation gets back the size that
+// was allocated. The alignment is a power of two.
+typedef void *(*lrutrack_alloc_func_t)(void *user, size_t num_bytes,
+    size_t alignment);
+typedef void (*lrutrack_dealloc_func_t)(void *user, void *ptr,
+    size_t num_bytes);
+
+typedef struct lrutrack_allocator_t {
+    void *user;
+    lrutrack_alloc_func_t alloc_func;
+    lrutrack_dealloc_func_t dealloc_func;
+} lrutrack_allocator_t;
+
+// Task runner for parallel work: calls task(task_user, i) once for every
+// i < num_tasks, possibly concurrently, and returns when all are done
+typedef void (*lrutrack_task_func_t)(void *task_user, uint32_t index);
+typedef void (*lrutrack_run_tasks_func_t)(void *user,
+    lrutrack_task_func_t task, void *task_user, uint32_t num_tasks);
+
+typedef struct lrutrack_task_runner_t {
+    void *user;
+    lrutrack_run_tasks_func_t run_tasks;
+} lrutrack_task_runner_t;
+
 typedef struct lrutrack_t lrutrack_t;
 
+// Refers to one inserted entry, see handle functions
+typedef struct lrutrack_handle_t {
+    uint32_t index; // Item
+    uint32_t generation; // Of the insert, unique per tracker
+    uint32_t row;
+} lrutrack_handle_t;
+
+typedef struct lrutrack_config_t {
+    uint32_t hash_table_size; // Power of two
+    uint32_t num_items; // Fixed capacity
+    uint32_t max_key_length; // Key byte budget per item, unused with 32-bit keys
+    uint32_t max_deferred; // Deferred eviction queue length, 0 = none
+} lrutrack_config_t;
+
 //
 //
 
@@ -45,8 +88,28 @@ lrutrack_t *lrutrack_create(uint32_t hash_table_size,
     lrutrack_value_t invalid_value,
     void *evict_user, lrutrack_evict_func_t evict_func,
     lrutrack_malloc_func_t malloc_func, lrutrack_free_func_t free_func);
+lrutrack_t *lrutrack_create_with_allocator(uint32_t hash_table_size,
+    uint32_t num_initial_items, uint32_t hash_seed,
+    lrutrack_value_t invalid_value,
+    void *evict_user, lrutrack_evict_func_t evict_func,
+    const lrutrack_allocator_t *allocator);
 void lrutrack_destroy(lrutrack_t *t);
 
+//
+// Fixed-memory trackers:
+// The tracker lives in a caller-provided buffer (16-byte aligned) and never
+// allocates. When all items are in use, inserting evicts the least recently
+// used hash table row instead of growing. Keys longer than max_key_length are
+// rejected with LRUTRACK_ERROR. lrutrack_destroy evicts the remaining values,
+// the buffer stays owned by the caller.
+
+size_t lrutrack_required_bytes(const lrutrack_config_t *config);
+
+lrutrack_t *lrutrack_create_in_place(void *buffer, size_t buffer_size,
+    const lrutrack_config_t *config, uint32_t hash_seed,
+    lrutrack_value_t invalid_value,
+    void *evict_user, lrutrack_evict_func_t evict_func);
+
 #if !LRUTRACK_32BIT_KEY
 
 //
@@ -81,12 +144,234 @@ lrutrack_value_t lrutrack_use(lrutrack_t *t, uint32_t key);
 
 #endif // LRUTRACK_32BIT_KEY
 
+//
+// Handle functions:
+// lrutrack_insert_handle also returns a handle to the new entry, which
+// lrutrack_use_handle and lrutrack_remove_handle act on in O(1), without
+// hashing or comparing keys. A handle goes stale when its entry is removed
+// or evicted, or moved by lrutrack_compact or lrutrack_shrink_to_fit;
+// use then returns invalid_value and remove LRUTRACK_NOT_FOUND, and the
+// caller falls back to the key.
+
+#if !LRUTRACK_32BIT_KEY
+int lrutrack_insert_handle(lrutrack_t *t, const void *key,
+    uint32_t key_length, lrutrack_value_t value, lrutrack_handle_t *handle);
+#else
+int lrutrack_insert_handle(lrutrack_t *t, uint32_t key,
+    lrutrack_value_t value, lrutrack_handle_t *handle);
+#endif
+
+lrutrack_value_t lrutrack_use_handle(lrutrack_t *t, lrutrack_handle_t handle);
+int lrutrack_remove_handle(lrutrack_t *t, lrutrack_handle_t handle);
+
+//
+// Pinning:
+// A pinned entry is not evicted: lrutrack_remove_lru evicts the unpinned
+// entries of the least recently used row and moves a row left with pinned
+// ones to the LRU head, so it is not scanned again until the rest has aged
+// past it. When only pinned entries are left it returns LRUTRACK_NOT_FOUND,
+// and inserting into a full in-place tracker LRUTRACK_OOM. Pins nest up to
+// UINT16_MAX deep (LRUTRACK_ERROR beyond), each lrutrack_pin is undone by one
+// lrutrack_unpin (LRUTRACK_ERROR when not pinned). Explicit removal still
+// removes a pinned entry, dropping its pins. Pins and priorities are kept
+// apart from the entries, 4 bytes per capacity entry allocated on the first
+// pin or priority set (LRUTRACK_OOM when that fails); in-place trackers
+// always reserve them in the buffer.
+
+#if !LRUTRACK_32BIT_KEY
+int lrutrack_pin(lrutrack_t *t, const void *key, uint32_t key_length);
+int lrutrack_unpin(lrutrack_t *t, const void *key, uint32_t key_length);
+#else
+int lrutrack_pin(lrutrack_t *t, uint32_t key);
+int lrutrack_unpin(lrutrack_t *t, uint32_t key);
+#endif
+
+int lrutrack_pin_handle(lrutrack_t *t, lrutrack_handle_t handle);
+int lrutrack_unpin_handle(lrutrack_t *t, lrutrack_handle_t handle);
+
+// Number of entries with pins
+uint32_t lrutrack_num_pinned(const lrutrack_t *t);
+
+//
+// Priorities:
+// Entries start at priority 0, the cheapest to rebuild. Each priority has
+// its own LRU list of hash table rows, a row being on the list of its
+// highest priority entry, and lrutrack_remove_lru evicts from the lowest
+// non-empty list first. With aging set for a priority, every num_evictions
+// evictions from lower priorities move its least recently used row down
+// one priority, so that idle expensive entries are eventually given up;
+// using an entry lifts its row back. Aging 0 (the default) keeps strict
+// priority order.
+
+#define LRUTRACK_NUM_PRIORITIES 4
+
+#if !LRUTRACK_32BIT_KEY
+int lrutrack_set_priority(lrutrack_t *t, const void *key,
+    uint32_t key_length, uint32_t priority);
+#else
+int lrutrack_set_priority(lrutrack_t *t, uint32_t key, uint32_t priority);
+#endif
+
+int lrutrack_set_priority_handle(lrutrack_t *t, lrutrack_handle_t handle,
+    uint32_t priority);
+void lrutrack_set_priority_aging(lrutrack_t *t, uint32_t priority,
+    uint32_t num_evictions);
+
+//
+// Tenants:
+// With tenants enabled, every entry belongs to one of num_tenants tenants
+// (0 on insert, including the entries present when enabling) with a
+// weight (1 on insert). Each tenant keeps its own entry granular LRU list,
+// the hash table and items stay shared. While any tenant's total weight is
+// above its quota, lrutrack_remove_lru evicts that tenant's least recently
+// used unpinned entry instead of the LRU row, so one tenant filling the
+// tracker evicts its own entries rather than everyone else's. Quotas start
+// unlimited, with the default weight they count entries. lrutrack_touch_row
+// does not update tenant recency. Enabling fails with LRUTRACK_ERROR on
+// in-place trackers or when already enabled.
+
+int lrutrack_enable_tenants(lrutrack_t *t, uint32_t num_tenants);
+
+#if !LRUTRACK_32BIT_KEY
+int lrutrack_set_tenant(lrutrack_t *t, const void *key, uint32_t key_length,
+    uint32_t tenant, uint32_t weight);
+#else
+int lrutrack_set_tenant(lrutrack_t *t, uint32_t key, uint32_t tenant,
+    uint32_t weight);
+#endif
+
+int lrutrack_set_tenant_handle(lrutrack_t *t, lrutrack_handle_t handle,
+    uint32_t tenant, uint32_t weight);
+void lrutrack_set_tenant_quota(lrutrack_t *t, uint32_t tenant,
+    uint64_t quota);
+uint64_t lrutrack_tenant_usage(const lrutrack_t *t, uint32_t tenant);
+
+//
+// Optimistic reads:
+// lrutrack_peek looks a key up without updating recency and reports its
+// hash table row. On a fixed-memory tracker it only reads the tracker's
+// buffer, so it may race with a writer as long as the caller validates the
+// result afterwards, e.g. with a sequence counter; an invalidated read may
+// return any value. lrutrack_touch_row applies the recency update later,
+// under the writer's lock.
+
+#if !LRUTRACK_32BIT_KEY
+lrutrack_value_t lrutrack_peek(const lrutrack_t *t, const void *key,
+    uint32_t key_length, uint32_t *row);
+#else
+lrutrack_value_t lrutrack_peek(const lrutrack_t *t, uint32_t key,
+    uint32_t *row);
+#endif
+
+void lrutrack_touch_row(lrutrack_t *t, uint32_t row);
+
+//
+// Prefetching:
+// lrutrack_prefetch_row brings a row's hash table slot and LRU links into
+// the cache, lrutrack_prefetch_row_items the first item on the row, reading
+// the slot. For a group of operations, prefetching all their rows, then
+// their items, then running them overlaps the cache misses. Rows are those
+// reported by lrutrack_peek.
+
+void lrutrack_prefetch_row(const lrutrack_t *t, uint32_t row);
+void lrutrack_prefetch_row_items(const lrutrack_t *t, uint32_t row);
+
+//
+// Deferred eviction:
+// With deferral on, evicted and removed values are queued instead of passed
+// to evict_func, so that a caller holding a lock around the tracker can run
+// the callback after releasing it. lrutrack_take_evicted moves up to
+// max_values queued values out, oldest first. lrutrack_flush_evicted passes
+// the queued values to evict_func. When the queue is full (in-place
+// trackers hold config max_deferred values) or cannot grow, evict_func is
+// called right away as without deferral. Turning deferral off flushes, and
+// lrutrack_destroy delivers what is still queued.
+
+void lrutrack_set_deferred_eviction(lrutrack_t *t, int enabled);
+uint32_t lrutrack_num_evicted(const lrutrack_t *t);
+uint32_t lrutrack_take_evicted(lrutrack_t *t, lrutrack_value_t *values,
+    uint32_t max_values);
+void lrutrack_flush_evicted(lrutrack_t *t);
+
 //
 // Cleaning functions:
 
 void lrutrack_remove_all(lrutrack_t *t);
 int lrutrack_remove_lru(lrutrack_t *t);
 
+// Hash table row lrutrack_remove_lru evicts next when nothing is pinned,
+// UINT32_MAX when empty
+uint32_t lrutrack_lru_row(const lrutrack_t *t);
+
+// With a clock set, a row moving to an LRU head records the clock's value,
+// for comparing recency across trackers that share the clock (see
+// lrutrack_group.h). NULL turns stamping off. LRUTRACK_ERROR on in-place
+// trackers.
+int lrutrack_set_clock(lrutrack_t *t, const uint32_t *clock);
+
+// Stamp of lrutrack_lru_row, LRUTRACK_NOT_FOUND when empty or unstamped
+int lrutrack_lru_stamp(const lrutrack_t *t, uint32_t *stamp);
+
+//
+// Parallel teardown:
+// Same as lrutrack_remove_all and lrutrack_destroy, with the items split
+// into num_tasks ranges that are evicted concurrently. evict_func and the
+// allocator (freeing keys) must then be thread safe. Queued deferred
+// values are delivered first, the rest goes to evict_func directly. With
+// runner NULL the tasks run on new threads and the calling thread, at most
+// LRUTRACK_MAX_TASK_THREADS of them.
+
+#define LRUTRACK_MAX_TASK_THREADS 64
+
+void lrutrack_remove_all_parallel(lrutrack_t *t, uint32_t num_tasks,
+    const lrutrack_task_runner_t *runner);
+void lrutrack_destroy_parallel(lrutrack_t *t, uint32_t num_tasks,
+    const lrutrack_task_runner_t *runner);
+
+//
+// Parallel bulk build:
+// Fills an empty tracker as if the entries were inserted in order, the last
+// one most recently used, with keys copied and rows built by num_tasks
+// concurrent tasks (see parallel teardown for the runner). The tasks copy
+// keys concurrently, so the allocator must be thread safe. The keys must be
+// distinct; their order does not matter otherwise. Entry i takes item i,
+// growing the items first if needed. Fails with LRUTRACK_ERROR if the
+// tracker is not empty or is an in-place tracker, as the build needs
+// scratch memory, and leaves the tracker empty on any failure.
+
+#if !LRUTRACK_32BIT_KEY
+int lrutrack_build_parallel(lrutrack_t *t, const void *const *keys,
+    const uint32_t *key_lengths, const lrutrack_value_t *values,
+    uint32_t num_entries, uint32_t num_tasks,
+    const lrutrack_task_runner_t *runner);
+#else
+int lrutrack_build_parallel(lrutrack_t *t, const uint32_t *keys,
+    const lrutrack_value_t *values, uint32_t num_entries, uint32_t num_tasks,
+    const lrutrack_task_runner_t *runner);
+#endif
+
+//
+// Capacity functions:
+// lrutrack_reserve grows the item storage to hold at least num_items entries.
+// lrutrack_shrink_to_fit compacts the live entries into an item array of
+// exactly their count. Both fail with LRUTRACK_ERROR on in-place trackers.
+
+int lrutrack_reserve(lrutrack_t *t, uint32_t num_items);
+int lrutrack_shrink_to_fit(lrutrack_t *t);
+
+// Live entries
+uint32_t lrutrack_count(const lrutrack_t *t);
+
+//
+// Compaction:
+// Renumbers the live entries in LRU order, most recently used rows first, so
+// hot entries share cache lines and pages. Each call visits at most about
+// max_items entries (whole rows at a time) and returns LRUTRACK_IN_PROGRESS
+// until the pass is complete, then LRUTRACK_OK. Other operations can be
+// interleaved freely between the steps.
+
+int lrutrack_compact(lrutrack_t *t, uint32_t max_items);
+
 #ifdef __cplusplus
 }
 #endif
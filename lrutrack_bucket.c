@@ -0,0 +1,521 @@
+// Least-recently-used tracking helper in C
+// Cache-line bucket variant with in-bucket LRU
+
+#include "lrutrack_bucket.h"
+#include "lrutrack_hash.h"
+
+#include <string.h>
+#include <assert.h>
+
+#define LRUTRACK_BUCKET_CACHE_LINE 64
+
+static int lrutrack_bucket_is_power_of_two(uint32_t x) {
+    return x > 0 && (x & (x - 1)) == 0;
+}
+
+//
+
+// One cache line. Occupied slots are packed at the front.
+typedef struct lrutrack_bucket_line_t {
+    uint32_t index[LRUTRACK_BUCKET_SLOTS]; // Item indices
+    uint16_t tag[LRUTRACK_BUCKET_SLOTS]; // Upper 16 bits of the key hash
+    uint8_t age[LRUTRACK_BUCKET_SLOTS]; // Recency rank, 0 = most recent
+    uint8_t count;
+    uint8_t referenced; // CLOCK bit for lrutrack_bucket_remove_lru
+    uint8_t padding[LRUTRACK_BUCKET_CACHE_LINE - 7 * LRUTRACK_BUCKET_SLOTS -
+        2];
+} lrutrack_bucket_line_t;
+
+_Static_assert(sizeof(lrutrack_bucket_line_t) == LRUTRACK_BUCKET_CACHE_LINE,
+    "A bucket must fill exactly one cache line");
+
+typedef struct lrutrack_bucket_item_t {
+#if !LRUTRACK_32BIT_KEY
+    void *key;
+    uint32_t key_length;
+#else
+    uint32_t key;
+#endif
+    lrutrack_value_t value;
+    uint32_t next_free;
+} lrutrack_bucket_item_t;
+
+typedef struct lrutrack_bucket_t {
+    void *evict_user;
+    lrutrack_evict_func_t evict_func;
+    lrutrack_allocator_t allocator;
+    lrutrack_bucket_line_t *lines;
+    lrutrack_bucket_item_t *items;
+    uint64_t num_conflict_evictions;
+    uint32_t num_buckets;
+    uint32_t num_items;
+    uint32_t count; // Items in use
+    uint32_t first_free; // Item index
+    uint32_t clock_hand; // Bucket index
+    uint32_t seed;
+    lrutrack_value_t invalid_value;
+} lrutrack_bucket_t;
+
+//
+// Private functions
+
+static void lrutrack_bucket_check_internal_state(const lrutrack_bucket_t *t) {
+    assert(t);
+    assert(lrutrack_bucket_is_power_of_two(t->num_buckets));
+    assert(t->count <= t->num_items);
+    assert(t->first_free == UINT32_MAX || t->first_free < t->num_items);
+    assert(t->clock_hand < t->num_buckets);
+
+#if LRUTRACK_HC_TESTS
+    uint32_t num_used = 0;
+    for (uint32_t b = 0; b < t->num_buckets; ++b) {
+        const lrutrack_bucket_line_t *line = &t->lines[b];
+        assert(line->count <= LRUTRACK_BUCKET_SLOTS);
+
+        // Ages are a permutation of 0..count-1
+        uint32_t ages_seen = 0;
+        for (uint32_t s = 0; s < line->count; ++s) {
+            assert(line->age[s] < line->count);
+            assert((ages_seen & (1u << line->age[s])) == 0);
+            ages_seen |= 1u << line->age[s];
+
+            assert(line->index[s] < t->num_items);
+            assert(t->items[line->index[s]].value != t->invalid_value);
+        }
+
+        num_used += line->count;
+    }
+
+    assert(num_used == t->count);
+
+    uint32_t num_free = 0;
+    for (uint32_t iter = t->first_free; iter != UINT32_MAX;
+        iter = t->items[iter].next_free) {
+        assert(iter < t->num_items);
+        assert(t->items[iter].value == t->invalid_value);
+        ++num_free;
+    }
+
+    assert(num_free + t->count == t->num_items);
+#endif
+}
+
+static void *lrutrack_bucket_alloc(lrutrack_bucket_t *t, size_t bytesize,
+    size_t alignment) {
+    return t->allocator.alloc_func(t->allocator.user, bytesize, alignment);
+}
+
+static void lrutrack_bucket_dealloc(lrutrack_bucket_t *t, void *ptr,
+    size_t bytesize) {
+    if (ptr)
+        t->allocator.dealloc_func(t->allocator.user, ptr, bytesize);
+}
+
+#if !LRUTRACK_32BIT_KEY
+static uint32_t lrutrack_bucket_hash(const lrutrack_bucket_t *t,
+    const void *key, uint32_t key_length) {
+    return lrutrack_murmur2(key, key_length, t->seed);
+}
+#endif
+
+static lrutrack_bucket_line_t *lrutrack_bucket_line(lrutrack_bucket_t *t,
+    uint32_t hash) {
+    return &t->lines[hash & (t->num_buckets - 1)];
+}
+
+static uint16_t lrutrack_bucket_tag(uint32_t hash) {
+    return (uint16_t)(hash >> 16);
+}
+
+// Returns the slot of a key in its bucket, UINT32_MAX if not found
+#if !LRUTRACK_32BIT_KEY
+static uint32_t lrutrack_bucket_find_slot(const lrutrack_bucket_t *t,
+    const lrutrack_bucket_line_t *line, const void *key, uint32_t key_length,
+    uint32_t hash)
+#else
+static uint32_t lrutrack_bucket_find_slot(const lrutrack_bucket_t *t,
+    const lrutrack_bucket_line_t *line, uint32_t key, uint32_t hash)
+#endif
+{
+    uint16_t tag = lrutrack_bucket_tag(hash);
+    for (uint32_t s = 0; s < line->count; ++s) {
+        if (line->tag[s] != tag)
+            continue;
+
+        const lrutrack_bucket_item_t *item = &t->items[line->index[s]];
+#if !LRUTRACK_32BIT_KEY
+        if (lrutrack_cmp_keys(key, key_length, item->key, item->key_length))
+            return s;
+#else
+        if (item->key == key)
+            return s;
+#endif
+    }
+
+    return UINT32_MAX;
+}
+
+static void lrutrack_bucket_touch_slot(lrutrack_bucket_line_t *line,
+    uint32_t slot) {
+    uint8_t age = line->age[slot];
+    for (uint32_t s = 0; s < line->count; ++s) {
+        if (line->age[s] < age)
+            ++line->age[s];
+    }
+
+    line->age[slot] = 0;
+    line->referenced = 1;
+}
+
+static uint32_t lrutrack_bucket_lru_slot(const lrutrack_bucket_line_t *line) {
+    assert(line->count != 0);
+    for (uint32_t s = 0; s < line->count; ++s) {
+        if (line->age[s] == line->count - 1)
+            return s;
+    }
+
+    assert(0 && "Bucket ages are not a permutation");
+    return 0;
+}
+
+static int lrutrack_bucket_grow_items(lrutrack_bucket_t *t,
+    uint32_t num_items) {
+    assert(num_items > t->num_items);
+
+    size_t items_bytesize = sizeof(*t->items) * num_items;
+    lrutrack_bucket_item_t *items = lrutrack_bucket_alloc(t, items_bytesize,
+        sizeof(void *));
+    if (!items)
+        return LRUTRACK_OOM;
+
+    size_t old_items_bytesize = sizeof(*t->items) * t->num_items;
+    if (t->items) {
+        memcpy(items, t->items, old_items_bytesize);
+        lrutrack_bucket_dealloc(t, t->items, old_items_bytesize);
+    }
+
+    memset((uint8_t *)items + old_items_bytesize, 0,
+        items_bytesize - old_items_bytesize);
+
+    for (uint32_t i = t->num_items; i < num_items; ++i) {
+        items[i].value = t->invalid_value;
+        items[i].next_free = i + 1;
+    }
+
+    items[num_items - 1].next_free = t->first_free;
+    t->first_free = t->num_items;
+
+    t->items = items;
+    t->num_items = num_items;
+
+    return LRUTRACK_OK;
+}
+
+// Removes a slot from its bucket and evicts the item's value
+static void lrutrack_bucket_evict_slot(lrutrack_bucket_t *t,
+    lrutrack_bucket_line_t *line, uint32_t slot) {
+    assert(slot < line->count);
+
+    uint32_t index = line->index[slot];
+    lrutrack_bucket_item_t *item = &t->items[index];
+    assert(item->value != t->invalid_value);
+
+    uint8_t age = line->age[slot];
+    for (uint32_t s = 0; s < line->count; ++s) {
+        if (line->age[s] > age)
+            --line->age[s];
+    }
+
+    // Keep slots packed
+    uint32_t last = line->count - 1;
+    line->index[slot] = line->index[last];
+    line->tag[slot] = line->tag[last];
+    line->age[slot] = line->age[last];
+    line->count = (uint8_t)last;
+
+    assert(t->evict_func);
+    t->evict_func(t->evict_user, item->value);
+
+#if !LRUTRACK_32BIT_KEY
+    lrutrack_bucket_dealloc(t, item->key, item->key_length);
+    item->key = NULL;
+#endif
+
+    item->value = t->invalid_value;
+    item->next_free = t->first_free;
+    t->first_free = index;
+    --t->count;
+}
+
+//
+// Public functions
+
+lrutrack_bucket_t *lrutrack_bucket_create(uint32_t num_buckets,
+    uint32_t num_initial_items, uint32_t hash_seed,
+    lrutrack_value_t invalid_value,
+    void *evict_user, lrutrack_evict_func_t evict_func,
+    const lrutrack_allocator_t *allocator) {
+    assert(lrutrack_bucket_is_power_of_two(num_buckets));
+    assert(num_buckets <= UINT32_MAX / LRUTRACK_BUCKET_SLOTS);
+    assert(num_initial_items <= num_buckets * LRUTRACK_BUCKET_SLOTS);
+    assert(evict_func && allocator);
+    assert(allocator->alloc_func && allocator->dealloc_func);
+
+    lrutrack_bucket_t *t = allocator->alloc_func(allocator->user,
+        sizeof(lrutrack_bucket_t), sizeof(void *));
+    if (!t)
+        return NULL;
+
+    memset(t, 0, sizeof(*t));
+
+    t->evict_user = evict_user;
+    t->evict_func = evict_func;
+    t->allocator = *allocator;
+
+    t->seed = hash_seed;
+    t->invalid_value = invalid_value;
+    t->first_free = UINT32_MAX;
+
+    size_t lines_bytesize = sizeof(*t->lines) * num_buckets;
+    t->lines = lrutrack_bucket_alloc(t, lines_bytesize,
+        LRUTRACK_BUCKET_CACHE_LINE);
+    if (!t->lines) {
+        lrutrack_bucket_destroy(t);
+        return NULL;
+    }
+
+    memset(t->lines, 0, lines_bytesize);
+    t->num_buckets = num_buckets;
+
+    if (num_initial_items != 0 &&
+        lrutrack_bucket_grow_items(t, num_initial_items) != LRUTRACK_OK) {
+        lrutrack_bucket_destroy(t);
+        return NULL;
+    }
+
+    lrutrack_bucket_check_internal_state(t);
+
+    return t;
+}
+
+void lrutrack_bucket_destroy(lrutrack_bucket_t *t) {
+    assert(t);
+
+    for (uint32_t i = 0; i < t->num_items; ++i) {
+        lrutrack_bucket_item_t *item = &t->items[i];
+        if (item->value != t->invalid_value) {
+#if !LRUTRACK_32BIT_KEY
+            lrutrack_bucket_dealloc(t, item->key, item->key_length);
+#endif
+            t->evict_func(t->evict_user, item->value);
+        }
+    }
+
+    lrutrack_bucket_dealloc(t, t->items, sizeof(*t->items) * t->num_items);
+    lrutrack_bucket_dealloc(t, t->lines, sizeof(*t->lines) * t->num_buckets);
+    t->allocator.dealloc_func(t->allocator.user, t, sizeof(*t));
+}
+
+#if !LRUTRACK_32BIT_KEY
+int lrutrack_bucket_insert(lrutrack_bucket_t *t, const void *key,
+    uint32_t key_length, lrutrack_value_t value)
+#else
+int lrutrack_bucket_insert(lrutrack_bucket_t *t, uint32_t key,
+    lrutrack_value_t value)
+#endif
+{
+    lrutrack_bucket_check_internal_state(t);
+    assert(value != t->invalid_value);
+
+#if !LRUTRACK_32BIT_KEY
+    assert(key && key_length != 0);
+    uint32_t hash = lrutrack_bucket_hash(t, key, key_length);
+    lrutrack_bucket_line_t *line = lrutrack_bucket_line(t, hash);
+    assert(lrutrack_bucket_find_slot(t, line, key, key_length, hash) ==
+        UINT32_MAX);
+#else
+    uint32_t hash = key;
+    lrutrack_bucket_line_t *line = lrutrack_bucket_line(t, hash);
+    assert(lrutrack_bucket_find_slot(t, line, key, hash) == UINT32_MAX);
+#endif
+
+    // A full bucket makes room by itself, which also frees an item
+    if (line->count == LRUTRACK_BUCKET_SLOTS) {
+        lrutrack_bucket_evict_slot(t, line, lrutrack_bucket_lru_slot(line));
+        ++t->num_conflict_evictions;
+    }
+
+    if (t->first_free == UINT32_MAX) {
+        uint32_t capacity = t->num_buckets * LRUTRACK_BUCKET_SLOTS;
+        uint32_t num_items = t->num_items != 0 ? t->num_items * 2 :
+            t->num_buckets;
+        if (num_items > capacity || num_items < t->num_items)
+            num_items = capacity;
+        if (lrutrack_bucket_grow_items(t, num_items) != LRUTRACK_OK)
+            return LRUTRACK_OOM;
+    }
+
+    uint32_t index = t->first_free;
+    lrutrack_bucket_item_t *item = &t->items[index];
+    assert(item->value == t->invalid_value);
+
+#if !LRUTRACK_32BIT_KEY
+    item->key = lrutrack_bucket_alloc(t, key_length, 1);
+    if (!item->key)
+        return LRUTRACK_OOM;
+
+    memcpy(item->key, key, key_length);
+    item->key_length = key_length;
+#else
+    item->key = key;
+#endif
+
+    t->first_free = item->next_free;
+    item->value = value;
+
+    uint32_t slot = line->count++;
+    line->index[slot] = index;
+    line->tag[slot] = lrutrack_bucket_tag(hash);
+    line->age[slot] = (uint8_t)slot;
+    lrutrack_bucket_touch_slot(line, slot);
+    ++t->count;
+
+    lrutrack_bucket_check_internal_state(t);
+
+    return LRUTRACK_OK;
+}
+
+#if !LRUTRACK_32BIT_KEY
+int lrutrack_bucket_remove(lrutrack_bucket_t *t, const void *key,
+    uint32_t key_length)
+#else
+int lrutrack_bucket_remove(lrutrack_bucket_t *t, uint32_t key)
+#endif
+{
+    lrutrack_bucket_check_internal_state(t);
+
+#if !LRUTRACK_32BIT_KEY
+    assert(key != NULL && key_length != 0);
+    uint32_t hash = lrutrack_bucket_hash(t, key, key_length);
+    lrutrack_bucket_line_t *line = lrutrack_bucket_line(t, hash);
+    uint32_t slot = lrutrack_bucket_find_slot(t, line, key, key_length, hash);
+#else
+    lrutrack_bucket_line_t *line = lrutrack_bucket_line(t, key);
+    uint32_t slot = lrutrack_bucket_find_slot(t, line, key, key);
+#endif
+
+    if (slot == UINT32_MAX)
+        return LRUTRACK_NOT_FOUND;
+
+    lrutrack_bucket_evict_slot(t, line, slot);
+
+    lrutrack_bucket_check_internal_state(t);
+
+    return LRUTRACK_OK;
+}
+
+#if !LRUTRACK_32BIT_KEY
+lrutrack_value_t lrutrack_bucket_use(lrutrack_bucket_t *t, const void *key,
+    uint32_t key_length)
+#else
+lrutrack_value_t lrutrack_bucket_use(lrutrack_bucket_t *t, uint32_t key)
+#endif
+{
+    lrutrack_bucket_check_internal_state(t);
+
+#if !LRUTRACK_32BIT_KEY
+    assert(key != NULL && key_length != 0);
+    uint32_t hash = lrutrack_bucket_hash(t, key, key_length);
+    lrutrack_bucket_line_t *line = lrutrack_bucket_line(t, hash);
+    uint32_t slot = lrutrack_bucket_find_slot(t, line, key, key_length, hash);
+#else
+    lrutrack_bucket_line_t *line = lrutrack_bucket_line(t, key);
+    uint32_t slot = lrutrack_bucket_find_slot(t, line, key, key);
+#endif
+
+    if (slot == UINT32_MAX)
+        return t->invalid_value;
+
+    lrutrack_bucket_touch_slot(line, slot);
+
+    return t->items[line->index[slot]].value;
+}
+
+#if !LRUTRACK_32BIT_KEY
+
+//
+// c-string key helper functions
+
+int lrutrack_bucket_insert_strkey(lrutrack_bucket_t *t, const char *key,
+    lrutrack_value_t value) {
+    assert(key != NULL && strlen(key) <= UINT32_MAX);
+    return lrutrack_bucket_insert(t, key, (uint32_t)strlen(key), value);
+}
+
+int lrutrack_bucket_remove_strkey(lrutrack_bucket_t *t, const char *key) {
+    assert(key != NULL && strlen(key) <= UINT32_MAX);
+    return lrutrack_bucket_remove(t, key, (uint32_t)strlen(key));
+}
+
+lrutrack_value_t lrutrack_bucket_use_strkey(lrutrack_bucket_t *t,
+    const char *key) {
+    assert(key != NULL && strlen(key) <= UINT32_MAX);
+    return lrutrack_bucket_use(t, key, (uint32_t)strlen(key));
+}
+
+#endif
+
+//
+
+void lrutrack_bucket_remove_all(lrutrack_bucket_t *t) {
+    lrutrack_bucket_check_internal_state(t);
+
+    for (uint32_t b = 0; b < t->num_buckets; ++b) {
+        lrutrack_bucket_line_t *line = &t->lines[b];
+        while (line->count != 0)
+            lrutrack_bucket_evict_slot(t, line, line->count - 1);
+        line->referenced = 0;
+    }
+
+    assert(t->count == 0);
+
+    lrutrack_bucket_check_internal_state(t);
+}
+
+int lrutrack_bucket_remove_lru(lrutrack_bucket_t *t) {
+    lrutrack_bucket_check_internal_state(t);
+
+    if (t->count == 0)
+        return LRUTRACK_NOT_FOUND;
+
+    // Second chance for recently touched buckets, at most two sweeps
+    for (;;) {
+        lrutrack_bucket_line_t *line = &t->lines[t->clock_hand];
+        t->clock_hand = (t->clock_hand + 1) & (t->num_buckets - 1);
+
+        if (line->count == 0)
+            continue;
+
+        if (line->referenced) {
+            line->referenced = 0;
+            continue;
+        }
+
+        lrutrack_bucket_evict_slot(t, line, lrutrack_bucket_lru_slot(line));
+        break;
+    }
+
+    lrutrack_bucket_check_internal_state(t);
+
+    return LRUTRACK_OK;
+}
+
+//
+
+uint32_t lrutrack_bucket_count(const lrutrack_bucket_t *t) {
+    return t->count;
+}
+
+uint64_t lrutrack_bucket_num_conflict_evictions(const lrutrack_bucket_t *t) {
+    return t->num_conflict_evictions;
+}
@@ -0,0 +1,94 @@
+// Least-recently-used tracking helper in C
+// Cache-line bucket variant with in-bucket LRU
+
+#ifndef LRUTRACK_BUCKET_H
+#define LRUTRACK_BUCKET_H
+
+#include "lrutrack.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Slots per 64-byte bucket
+#define LRUTRACK_BUCKET_SLOTS 8
+
+//
+// Types:
+// A key maps to a single 64-byte bucket holding up to eight 16-bit tags and
+// item indices, plus the recency rank of each slot within the bucket.
+// Lookups and updates touch that one cache line and the matching item.
+// An insert into a full bucket evicts the bucket's least recently used
+// entry. lrutrack_bucket_remove_lru picks the bucket with a CLOCK hand and
+// evicts the least recently used entry of that bucket.
+
+typedef struct lrutrack_bucket_t lrutrack_bucket_t;
+
+//
+//
+
+// num_buckets is a power of two, capacity is
+// num_buckets * LRUTRACK_BUCKET_SLOTS entries
+lrutrack_bucket_t *lrutrack_bucket_create(uint32_t num_buckets,
+    uint32_t num_initial_items, uint32_t hash_seed,
+    lrutrack_value_t invalid_value,
+    void *evict_user, lrutrack_evict_func_t evict_func,
+    const lrutrack_allocator_t *allocator);
+void lrutrack_bucket_destroy(lrutrack_bucket_t *t);
+
+#if !LRUTRACK_32BIT_KEY
+
+//
+// Variable-length key functions:
+
+int lrutrack_bucket_insert(lrutrack_bucket_t *t, const void *key,
+    uint32_t key_length, lrutrack_value_t value);
+
+int lrutrack_bucket_remove(lrutrack_bucket_t *t, const void *key,
+    uint32_t key_length);
+
+lrutrack_value_t lrutrack_bucket_use(lrutrack_bucket_t *t, const void *key,
+    uint32_t key_length);
+
+//
+// Null-terminated string key helper functions:
+
+int lrutrack_bucket_insert_strkey(lrutrack_bucket_t *t, const char *key,
+    lrutrack_value_t value);
+
+int lrutrack_bucket_remove_strkey(lrutrack_bucket_t *t, const char *key);
+
+lrutrack_value_t lrutrack_bucket_use_strkey(lrutrack_bucket_t *t,
+    const char *key);
+
+#else
+
+//
+// 32-bit key functions:
+
+int lrutrack_bucket_insert(lrutrack_bucket_t *t, uint32_t key,
+    lrutrack_value_t value);
+int lrutrack_bucket_remove(lrutrack_bucket_t *t, uint32_t key);
+lrutrack_value_t lrutrack_bucket_use(lrutrack_bucket_t *t, uint32_t key);
+
+#endif // LRUTRACK_32BIT_KEY
+
+//
+// Cleaning functions:
+
+void lrutrack_bucket_remove_all(lrutrack_bucket_t *t);
+int lrutrack_bucket_remove_lru(lrutrack_bucket_t *t);
+
+//
+// Statistics:
+
+uint32_t lrutrack_bucket_count(const lrutrack_bucket_t *t);
+
+// Entries evicted by inserts into full buckets
+uint64_t lrutrack_bucket_num_conflict_evictions(const lrutrack_bucket_t *t);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,981 @@
+// Least-recently-used tracking helper in C
+// Bucketized cuckoo hashing variant with optimistic concurrent reads
+
+#include "lrutrack_cuckoo.h"
+#include "lrutrack_hash.h"
+#include "lrutrack_epoch.h"
+
+#include <stdatomic.h>
+#include <pthread.h>
+#include <string.h>
+#include <assert.h>
+
+#define LRUTRACK_CUCKOO_SLOTS 4
+#define LRUTRACK_CUCKOO_CACHE_LINE 64
+#define LRUTRACK_CUCKOO_MAX_BFS_NODES 256
+#define LRUTRACK_CUCKOO_TAG_MULTIPLIER 0x5bd1e995u
+
+static int lrutrack_cuckoo_is_power_of_two(uint32_t x) {
+    return x > 0 && (x & (x - 1)) == 0;
+}
+
+//
+
+// One cache line. A slot is tag << 32 | entry index, 0 = empty.
+typedef struct lrutrack_cuckoo_bucket_t {
+    _Atomic uint32_t version; // Odd while a writer modifies the bucket
+    uint32_t padding;
+    _Atomic uint64_t slots[LRUTRACK_CUCKOO_SLOTS];
+    uint8_t padding2[LRUTRACK_CUCKOO_CACHE_LINE - 8 -
+        8 * LRUTRACK_CUCKOO_SLOTS];
+} lrutrack_cuckoo_bucket_t;
+
+// Everything a lookup touches. Writers build a new table on resize and
+// publish it, readers that still hold the old one finish on it.
+typedef struct lrutrack_cuckoo_table_t {
+    lrutrack_epoch_node_t retire;
+    lrutrack_cuckoo_bucket_t *buckets;
+
+    // Entries, four per bucket. Readers may look at an entry while it is
+    // rewritten, the bucket versions tell them to retry.
+#if !LRUTRACK_32BIT_KEY
+    uint8_t *keys; // max_key_length bytes per entry
+    _Atomic uint32_t *key_lengths;
+#else
+    _Atomic uint32_t *keys;
+#endif
+    _Atomic lrutrack_value_t *values;
+    _Atomic uint8_t *ref_bits; // CLOCK reference bits
+    uint32_t *next_free; // Free entry list, writers only
+
+    void *evict_user;
+    lrutrack_evict_func_t evict_func;
+    uint32_t num_buckets;
+    uint32_t num_entries;
+    uint32_t max_key_length;
+    uint32_t first_free;
+    uint32_t clock_hand;
+    _Atomic uint32_t count;
+    uint32_t seed;
+    lrutrack_value_t invalid_value;
+} lrutrack_cuckoo_table_t;
+
+typedef struct lrutrack_cuckoo_t {
+    _Atomic(lrutrack_cuckoo_table_t *) table;
+    lrutrack_allocator_t allocator;
+    pthread_mutex_t lock; // Serializes writers
+    lrutrack_epoch_t epoch; // Reclaims replaced tables
+    _Atomic uint32_t count; // Copy of the table's, updated by writers
+} lrutrack_cuckoo_t;
+
+typedef struct lrutrack_cuckoo_location_t {
+    uint32_t hash;
+    uint32_t tag;
+    uint32_t bucket1;
+    uint32_t bucket2;
+} lrutrack_cuckoo_location_t;
+
+//
+// Private functions
+
+static void *lrutrack_cuckoo_alloc(lrutrack_cuckoo_t *t, size_t bytesize,
+    size_t alignment) {
+    return t->allocator.alloc_func(t->allocator.user, bytesize, alignment);
+}
+
+static void lrutrack_cuckoo_dealloc(lrutrack_cuckoo_t *t, void *ptr,
+    size_t bytesize) {
+    if (ptr)
+        t->allocator.dealloc_func(t->allocator.user, ptr, bytesize);
+}
+
+// The alternate bucket only depends on the current bucket and the tag, so an
+// entry can be moved without knowing its key
+static uint32_t lrutrack_cuckoo_alt_bucket(const lrutrack_cuckoo_table_t *t,
+    uint32_t bucket, uint32_t tag) {
+    return (bucket ^ (tag * LRUTRACK_CUCKOO_TAG_MULTIPLIER)) &
+        (t->num_buckets - 1);
+}
+
+static lrutrack_cuckoo_location_t lrutrack_cuckoo_locate(
+    const lrutrack_cuckoo_table_t *t, uint32_t hash) {
+    lrutrack_cuckoo_location_t loc;
+    loc.hash = hash;
+    loc.tag = hash >> 16;
+    if (loc.tag == 0)
+        loc.tag = 1;
+    loc.bucket1 = hash & (t->num_buckets - 1);
+    loc.bucket2 = lrutrack_cuckoo_alt_bucket(t, loc.bucket1, loc.tag);
+    return loc;
+}
+
+#if !LRUTRACK_32BIT_KEY
+
+static uint32_t lrutrack_cuckoo_hash(const lrutrack_cuckoo_table_t *t,
+    const void *key, uint32_t key_length) {
+    return lrutrack_murmur2(key, key_length, t->seed);
+}
+
+static const uint8_t *lrutrack_cuckoo_entry_key(
+    const lrutrack_cuckoo_table_t *t, uint32_t entry) {
+    return t->keys + (size_t)entry * t->max_key_length;
+}
+
+static uint32_t lrutrack_cuckoo_entry_hash(const lrutrack_cuckoo_table_t *t,
+    uint32_t entry) {
+    return lrutrack_cuckoo_hash(t, lrutrack_cuckoo_entry_key(t, entry),
+        atomic_load_explicit(&t->key_lengths[entry], memory_order_relaxed));
+}
+
+#else
+
+static uint32_t lrutrack_cuckoo_entry_hash(const lrutrack_cuckoo_table_t *t,
+    uint32_t entry) {
+    return atomic_load_explicit(&t->keys[entry], memory_order_relaxed);
+}
+
+#endif
+
+static uint64_t lrutrack_cuckoo_slot_word(uint32_t tag, uint32_t entry) {
+    return (uint64_t)tag << 32 | entry;
+}
+
+static void lrutrack_cuckoo_write_begin(lrutrack_cuckoo_bucket_t *b) {
+    uint32_t v = atomic_load_explicit(&b->version, memory_order_relaxed);
+    assert((v & 1) == 0);
+    atomic_store_explicit(&b->version, v + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+}
+
+static void lrutrack_cuckoo_write_end(lrutrack_cuckoo_bucket_t *b) {
+    uint32_t v = atomic_load_explicit(&b->version, memory_order_relaxed);
+    assert((v & 1) == 1);
+    atomic_store_explicit(&b->version, v + 1, memory_order_release);
+}
+
+static void lrutrack_cuckoo_set_slot(lrutrack_cuckoo_table_t *t,
+    uint32_t bucket, uint32_t slot, uint64_t word) {
+    lrutrack_cuckoo_bucket_t *b = &t->buckets[bucket];
+    lrutrack_cuckoo_write_begin(b);
+    atomic_store_explicit(&b->slots[slot], word, memory_order_relaxed);
+    lrutrack_cuckoo_write_end(b);
+}
+
+static uint64_t lrutrack_cuckoo_get_slot(const lrutrack_cuckoo_table_t *t,
+    uint32_t bucket, uint32_t slot) {
+    return atomic_load_explicit(&t->buckets[bucket].slots[slot],
+        memory_order_relaxed);
+}
+
+// Scans one bucket, the result is only meaningful if the bucket version
+// did not change meanwhile
+#if !LRUTRACK_32BIT_KEY
+static uint32_t lrutrack_cuckoo_scan(const lrutrack_cuckoo_table_t *t,
+    uint32_t bucket, uint32_t tag, const void *key, uint32_t key_length,
+    uint32_t *slot_out)
+#else
+static uint32_t lrutrack_cuckoo_scan(const lrutrack_cuckoo_table_t *t,
+    uint32_t bucket, uint32_t tag, uint32_t key, uint32_t *slot_out)
+#endif
+{
+    for (uint32_t s = 0; s < LRUTRACK_CUCKOO_SLOTS; ++s) {
+        uint64_t word = lrutrack_cuckoo_get_slot(t, bucket, s);
+        if ((uint32_t)(word >> 32) != tag)
+            continue;
+
+        uint32_t entry = (uint32_t)word;
+        if (entry >= t->num_entries)
+            continue;
+
+#if !LRUTRACK_32BIT_KEY
+        uint32_t entry_key_length = atomic_load_explicit(
+            &t->key_lengths[entry], memory_order_relaxed);
+        if (entry_key_length == key_length &&
+            memcmp(lrutrack_cuckoo_entry_key(t, entry), key, key_length) == 0)
+#else
+        if (atomic_load_explicit(&t->keys[entry], memory_order_relaxed) ==
+            key)
+#endif
+        {
+            *slot_out = s;
+            return entry;
+        }
+    }
+
+    return UINT32_MAX;
+}
+
+// Optimistic lookup, returns the entry index or UINT32_MAX
+#if !LRUTRACK_32BIT_KEY
+static uint32_t lrutrack_cuckoo_lookup(const lrutrack_cuckoo_table_t *t,
+    const lrutrack_cuckoo_location_t *loc, const void *key,
+    uint32_t key_length, lrutrack_value_t *value_out, uint32_t *bucket_out,
+    uint32_t *slot_out)
+#else
+static uint32_t lrutrack_cuckoo_lookup(const lrutrack_cuckoo_table_t *t,
+    const lrutrack_cuckoo_location_t *loc, uint32_t key,
+    lrutrack_value_t *value_out, uint32_t *bucket_out, uint32_t *slot_out)
+#endif
+{
+    lrutrack_cuckoo_bucket_t *b1 = &t->buckets[loc->bucket1];
+    lrutrack_cuckoo_bucket_t *b2 = &t->buckets[loc->bucket2];
+
+    for (;;) {
+        uint32_t v1 = atomic_load_explicit(&b1->version, memory_order_acquire);
+        uint32_t v2 = atomic_load_explicit(&b2->version, memory_order_acquire);
+        if ((v1 | v2) & 1)
+            continue; // Writer in progress
+
+        uint32_t bucket = loc->bucket1;
+#if !LRUTRACK_32BIT_KEY
+        uint32_t entry = lrutrack_cuckoo_scan(t, bucket, loc->tag, key,
+            key_length, slot_out);
+        if (entry == UINT32_MAX) {
+            bucket = loc->bucket2;
+            entry = lrutrack_cuckoo_scan(t, bucket, loc->tag, key,
+                key_length, slot_out);
+        }
+#else
+        uint32_t entry = lrutrack_cuckoo_scan(t, bucket, loc->tag, key,
+            slot_out);
+        if (entry == UINT32_MAX) {
+            bucket = loc->bucket2;
+            entry = lrutrack_cuckoo_scan(t, bucket, loc->tag, key, slot_out);
+        }
+#endif
+
+        lrutrack_value_t value = t->invalid_value;
+        if (entry != UINT32_MAX) {
+            value = atomic_load_explicit(&t->values[entry],
+                memory_order_relaxed);
+        }
+
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&b1->version, memory_order_relaxed) != v1 ||
+            atomic_load_explicit(&b2->version, memory_order_relaxed) != v2)
+            continue;
+
+        *value_out = value;
+        *bucket_out = bucket;
+        return entry;
+    }
+}
+
+static int lrutrack_cuckoo_find_empty_slot(const lrutrack_cuckoo_table_t *t,
+    uint32_t bucket) {
+    for (uint32_t s = 0; s < LRUTRACK_CUCKOO_SLOTS; ++s) {
+        if (lrutrack_cuckoo_get_slot(t, bucket, s) == 0)
+            return (int)s;
+    }
+    return -1;
+}
+
+// Writer side removal of an entry from its slot, followed by eviction
+static void lrutrack_cuckoo_evict_entry(lrutrack_cuckoo_table_t *t,
+    uint32_t bucket, uint32_t slot, uint32_t entry) {
+    assert((uint32_t)lrutrack_cuckoo_get_slot(t, bucket, slot) == entry);
+
+    lrutrack_cuckoo_set_slot(t, bucket, slot, 0);
+
+    lrutrack_value_t value = atomic_load_explicit(&t->values[entry],
+        memory_order_relaxed);
+    assert(value != t->invalid_value);
+
+    atomic_store_explicit(&t->values[entry], t->invalid_value,
+        memory_order_relaxed);
+    t->next_free[entry] = t->first_free;
+    t->first_free = entry;
+    atomic_fetch_sub_explicit(&t->count, 1, memory_order_relaxed);
+
+    assert(t->evict_func);
+    t->evict_func(t->evict_user, value);
+}
+
+// Finds the bucket and slot of a live entry, LRUTRACK_NOT_FOUND if it is in
+// neither of its buckets
+static int lrutrack_cuckoo_find_entry_slot(const lrutrack_cuckoo_table_t *t,
+    uint32_t entry, uint32_t *bucket_out, uint32_t *slot_out) {
+    lrutrack_cuckoo_location_t loc = lrutrack_cuckoo_locate(t,
+        lrutrack_cuckoo_entry_hash(t, entry));
+    uint64_t word = lrutrack_cuckoo_slot_word(loc.tag, entry);
+    for (uint32_t s = 0; s < LRUTRACK_CUCKOO_SLOTS; ++s) {
+        if (lrutrack_cuckoo_get_slot(t, loc.bucket1, s) == word) {
+            *bucket_out = loc.bucket1;
+            *slot_out = s;
+            return LRUTRACK_OK;
+        }
+
+        if (lrutrack_cuckoo_get_slot(t, loc.bucket2, s) == word) {
+            *bucket_out = loc.bucket2;
+            *slot_out = s;
+            return LRUTRACK_OK;
+        }
+    }
+
+    assert(0 && "Live entry is not in its buckets");
+    return LRUTRACK_NOT_FOUND;
+}
+
+static int lrutrack_cuckoo_evict_clock(lrutrack_cuckoo_table_t *t) {
+    if (atomic_load_explicit(&t->count, memory_order_relaxed) == 0)
+        return LRUTRACK_NOT_FOUND;
+
+    // Two rounds: the first may only clear reference bits
+    for (uint32_t i = 0; i < t->num_entries * 2; ++i) {
+        uint32_t entry = t->clock_hand;
+        t->clock_hand = (t->clock_hand + 1) & (t->num_entries - 1);
+
+        if (atomic_load_explicit(&t->values[entry], memory_order_relaxed) ==
+            t->invalid_value)
+            continue;
+
+        if (atomic_load_explicit(&t->ref_bits[entry], memory_order_relaxed)) {
+            atomic_store_explicit(&t->ref_bits[entry], 0,
+                memory_order_relaxed);
+            continue;
+        }
+
+        uint32_t bucket, slot;
+        if (lrutrack_cuckoo_find_entry_slot(t, entry, &bucket, &slot) !=
+            LRUTRACK_OK)
+            return LRUTRACK_NOT_FOUND;
+
+        lrutrack_cuckoo_evict_entry(t, bucket, slot, entry);
+        return LRUTRACK_OK;
+    }
+
+    assert(0 && "CLOCK found nothing to evict");
+    return LRUTRACK_NOT_FOUND;
+}
+
+// Breadth-first search for a chain of moves that frees a slot in one of the
+// candidate buckets. Entries are copied to their alternate bucket before
+// being cleared from the old one, so a reader always finds them in one of
+// the two buckets it validates. Each bucket is expanded once, a path never
+// passes through a bucket twice.
+typedef struct lrutrack_cuckoo_bfs_node_t {
+    uint32_t bucket;
+    uint16_t slot;
+    int16_t parent;
+} lrutrack_cuckoo_bfs_node_t;
+
+static int lrutrack_cuckoo_bfs_visited(const lrutrack_cuckoo_bfs_node_t *nodes,
+    int num_nodes, uint32_t bucket) {
+    for (int i = 0; i < num_nodes; i += LRUTRACK_CUCKOO_SLOTS) {
+        if (nodes[i].bucket == bucket)
+            return 1;
+    }
+    return 0;
+}
+
+static int lrutrack_cuckoo_make_room(lrutrack_cuckoo_table_t *t,
+    const lrutrack_cuckoo_location_t *loc, uint32_t *bucket_out,
+    uint32_t *slot_out) {
+    lrutrack_cuckoo_bfs_node_t nodes[LRUTRACK_CUCKOO_MAX_BFS_NODES];
+    int num_nodes = 0;
+
+    // Bucket by bucket, a run of LRUTRACK_CUCKOO_SLOTS nodes each
+    uint32_t num_candidates = loc->bucket2 != loc->bucket1 ? 2 : 1;
+    for (uint32_t c = 0; c < num_candidates; ++c) {
+        for (uint32_t s = 0; s < LRUTRACK_CUCKOO_SLOTS; ++s) {
+            nodes[num_nodes].bucket = c == 0 ? loc->bucket1 : loc->bucket2;
+            nodes[num_nodes].slot = (uint16_t)s;
+            nodes[num_nodes].parent = -1;
+            ++num_nodes;
+        }
+    }
+
+    for (int head = 0; head < num_nodes; ++head) {
+        const lrutrack_cuckoo_bfs_node_t *node = &nodes[head];
+        uint64_t word = lrutrack_cuckoo_get_slot(t, node->bucket, node->slot);
+        uint32_t alt = lrutrack_cuckoo_alt_bucket(t, node->bucket,
+            (uint32_t)(word >> 32));
+
+        int empty = lrutrack_cuckoo_find_empty_slot(t, alt);
+        if (empty < 0) {
+            if (num_nodes + LRUTRACK_CUCKOO_SLOTS <=
+                LRUTRACK_CUCKOO_MAX_BFS_NODES &&
+                !lrutrack_cuckoo_bfs_visited(nodes, num_nodes, alt)) {
+                for (uint32_t s = 0; s < LRUTRACK_CUCKOO_SLOTS; ++s) {
+                    nodes[num_nodes].bucket = alt;
+                    nodes[num_nodes].slot = (uint16_t)s;
+                    nodes[num_nodes].parent = (int16_t)head;
+                    ++num_nodes;
+                }
+            }
+            continue;
+        }
+
+        // Walk the path back to a candidate bucket, each move fills the
+        // hole left by the previous one. The checks abandon a path that no
+        // longer holds half way, which still leaves every entry in one of
+        // its buckets but may leave a hole outside the candidate buckets.
+        uint32_t dst_bucket = alt;
+        uint32_t dst_slot = (uint32_t)empty;
+        int iter = head;
+        while (iter >= 0) {
+            const lrutrack_cuckoo_bfs_node_t *n = &nodes[iter];
+            uint64_t w = lrutrack_cuckoo_get_slot(t, n->bucket, n->slot);
+            if (w == 0 ||
+                lrutrack_cuckoo_get_slot(t, dst_bucket, dst_slot) != 0 ||
+                lrutrack_cuckoo_alt_bucket(t, n->bucket,
+                    (uint32_t)(w >> 32)) != dst_bucket)
+                return 0;
+
+            lrutrack_cuckoo_set_slot(t, dst_bucket, dst_slot, w);
+            lrutrack_cuckoo_set_slot(t, n->bucket, n->slot, 0);
+
+            dst_bucket = n->bucket;
+            dst_slot = n->slot;
+            iter = n->parent;
+        }
+
+        *bucket_out = dst_bucket;
+        *slot_out = dst_slot;
+        return 1;
+    }
+
+    return 0;
+}
+
+// Finds an empty slot in one of the candidate buckets
+static int lrutrack_cuckoo_find_candidate_slot(const lrutrack_cuckoo_table_t *t,
+    const lrutrack_cuckoo_location_t *loc, uint32_t *bucket_out,
+    uint32_t *slot_out) {
+    int empty = lrutrack_cuckoo_find_empty_slot(t, loc->bucket1);
+    *bucket_out = loc->bucket1;
+    if (empty < 0) {
+        empty = lrutrack_cuckoo_find_empty_slot(t, loc->bucket2);
+        *bucket_out = loc->bucket2;
+    }
+
+    *slot_out = (uint32_t)empty;
+    return empty >= 0;
+}
+
+// Evicts the not recently used entry of the candidate buckets
+static void lrutrack_cuckoo_evict_candidate(lrutrack_cuckoo_table_t *t,
+    const lrutrack_cuckoo_location_t *loc, uint32_t *bucket_out,
+    uint32_t *slot_out) {
+    for (int round = 0; round < 2; ++round) {
+        for (uint32_t i = 0; i < LRUTRACK_CUCKOO_SLOTS * 2; ++i) {
+            uint32_t bucket = i < LRUTRACK_CUCKOO_SLOTS ? loc->bucket1 :
+                loc->bucket2;
+            uint32_t slot = i % LRUTRACK_CUCKOO_SLOTS;
+            uint64_t word = lrutrack_cuckoo_get_slot(t, bucket, slot);
+            if (word == 0)
+                continue;
+
+            uint32_t entry = (uint32_t)word;
+            if (round == 0 && atomic_exchange_explicit(&t->ref_bits[entry],
+                0, memory_order_relaxed))
+                continue;
+
+            lrutrack_cuckoo_evict_entry(t, bucket, slot, entry);
+            *bucket_out = bucket;
+            *slot_out = slot;
+            return;
+        }
+    }
+
+    assert(0 && "Candidate buckets are empty");
+}
+
+// Places a new entry in the table, moving or evicting others as needed
+#if !LRUTRACK_32BIT_KEY
+static void lrutrack_cuckoo_table_insert(lrutrack_cuckoo_table_t *t,
+    const lrutrack_cuckoo_location_t *loc, const void *key,
+    uint32_t key_length, lrutrack_value_t value, uint8_t ref_bit)
+#else
+static void lrutrack_cuckoo_table_insert(lrutrack_cuckoo_table_t *t,
+    const lrutrack_cuckoo_location_t *loc, uint32_t key,
+    lrutrack_value_t value, uint8_t ref_bit)
+#endif
+{
+    // There are as many entries as slots, so a free entry also means a free
+    // slot somewhere that cuckoo moves may bring within reach. A displacement
+    // given up half way may have moved entries out of the candidate buckets,
+    // they are searched again before evicting.
+    uint32_t bucket, slot;
+    if (!lrutrack_cuckoo_find_candidate_slot(t, loc, &bucket, &slot) &&
+        (t->first_free == UINT32_MAX ||
+            !lrutrack_cuckoo_make_room(t, loc, &bucket, &slot)) &&
+        !lrutrack_cuckoo_find_candidate_slot(t, loc, &bucket, &slot))
+        lrutrack_cuckoo_evict_candidate(t, loc, &bucket, &slot);
+
+    // Fill the entry before it is published in the slot
+    uint32_t entry = t->first_free;
+    assert(entry != UINT32_MAX);
+    t->first_free = t->next_free[entry];
+
+#if !LRUTRACK_32BIT_KEY
+    memcpy(t->keys + (size_t)entry * t->max_key_length, key, key_length);
+    atomic_store_explicit(&t->key_lengths[entry], key_length,
+        memory_order_relaxed);
+#else
+    atomic_store_explicit(&t->keys[entry], key, memory_order_relaxed);
+#endif
+    atomic_store_explicit(&t->values[entry], value, memory_order_relaxed);
+    atomic_store_explicit(&t->ref_bits[entry], ref_bit, memory_order_relaxed);
+
+    lrutrack_cuckoo_set_slot(t, bucket, slot,
+        lrutrack_cuckoo_slot_word(loc->tag, entry));
+    atomic_fetch_add_explicit(&t->count, 1, memory_order_relaxed);
+}
+
+//
+
+static void lrutrack_cuckoo_free_table(lrutrack_cuckoo_t *t,
+    lrutrack_cuckoo_table_t *table) {
+    uint32_t num_entries = table->num_entries;
+    lrutrack_cuckoo_dealloc(t, table->buckets,
+        sizeof(*table->buckets) * table->num_buckets);
+#if !LRUTRACK_32BIT_KEY
+    lrutrack_cuckoo_dealloc(t, table->keys,
+        (size_t)table->max_key_length * num_entries);
+    lrutrack_cuckoo_dealloc(t, table->key_lengths,
+        sizeof(*table->key_lengths) * num_entries);
+#else
+    lrutrack_cuckoo_dealloc(t, table->keys,
+        sizeof(*table->keys) * num_entries);
+#endif
+    lrutrack_cuckoo_dealloc(t, table->values,
+        sizeof(*table->values) * num_entries);
+    lrutrack_cuckoo_dealloc(t, table->ref_bits,
+        sizeof(*table->ref_bits) * num_entries);
+    lrutrack_cuckoo_dealloc(t, table->next_free,
+        sizeof(*table->next_free) * num_entries);
+    lrutrack_cuckoo_dealloc(t, table, sizeof(*table));
+}
+
+// Epoch callback, the node is the first member of the table
+static void lrutrack_cuckoo_free_retired_table(void *user,
+    lrutrack_epoch_node_t *node) {
+    lrutrack_cuckoo_free_table(user, (lrutrack_cuckoo_table_t *)node);
+}
+
+// Empty table, the per-tracker settings are copied from proto
+static lrutrack_cuckoo_table_t *lrutrack_cuckoo_alloc_table(
+    lrutrack_cuckoo_t *t, uint32_t num_buckets,
+    const lrutrack_cuckoo_table_t *proto) {
+    lrutrack_cuckoo_table_t *table = lrutrack_cuckoo_alloc(t,
+        sizeof(lrutrack_cuckoo_table_t), LRUTRACK_CUCKOO_CACHE_LINE);
+    if (!table)
+        return NULL;
+
+    *table = *proto;
+
+    uint32_t num_entries = num_buckets * LRUTRACK_CUCKOO_SLOTS;
+    table->num_buckets = num_buckets;
+    table->num_entries = num_entries;
+    table->clock_hand = 0;
+
+    table->buckets = lrutrack_cuckoo_alloc(t,
+        sizeof(*table->buckets) * num_buckets, LRUTRACK_CUCKOO_CACHE_LINE);
+#if !LRUTRACK_32BIT_KEY
+    table->keys = lrutrack_cuckoo_alloc(t,
+        (size_t)table->max_key_length * num_entries, 1);
+    table->key_lengths = lrutrack_cuckoo_alloc(t,
+        sizeof(*table->key_lengths) * num_entries,
+        sizeof(*table->key_lengths));
+#else
+    table->keys = lrutrack_cuckoo_alloc(t, sizeof(*table->keys) * num_entries,
+        sizeof(*table->keys));
+#endif
+    table->values = lrutrack_cuckoo_alloc(t,
+        sizeof(*table->values) * num_entries, sizeof(*table->values));
+    table->ref_bits = lrutrack_cuckoo_alloc(t,
+        sizeof(*table->ref_bits) * num_entries, sizeof(*table->ref_bits));
+    table->next_free = lrutrack_cuckoo_alloc(t,
+        sizeof(*table->next_free) * num_entries, sizeof(*table->next_free));
+
+    if (!table->buckets || !table->keys || !table->values ||
+#if !LRUTRACK_32BIT_KEY
+        !table->key_lengths ||
+#endif
+        !table->ref_bits || !table->next_free) {
+        lrutrack_cuckoo_free_table(t, table);
+        return NULL;
+    }
+
+    memset(table->buckets, 0, sizeof(*table->buckets) * num_buckets);
+
+    for (uint32_t i = 0; i < num_entries; ++i) {
+#if !LRUTRACK_32BIT_KEY
+        atomic_init(&table->key_lengths[i], 0);
+#else
+        atomic_init(&table->keys[i], 0);
+#endif
+        atomic_init(&table->values[i], table->invalid_value);
+        atomic_init(&table->ref_bits[i], 0);
+        table->next_free[i] = i + 1 < num_entries ? i + 1 : UINT32_MAX;
+    }
+
+    table->first_free = 0;
+    atomic_init(&table->count, 0);
+
+    return table;
+}
+
+// Readers must be inside an epoch, writers hold the lock
+static lrutrack_cuckoo_table_t *lrutrack_cuckoo_table(lrutrack_cuckoo_t *t) {
+    return atomic_load_explicit(&t->table, memory_order_seq_cst);
+}
+
+static void lrutrack_cuckoo_writer_lock(lrutrack_cuckoo_t *t) {
+    pthread_mutex_lock(&t->lock);
+}
+
+// Frees replaced tables once no reader can see them anymore
+static void lrutrack_cuckoo_writer_unlock(lrutrack_cuckoo_t *t) {
+    lrutrack_cuckoo_table_t *table = lrutrack_cuckoo_table(t);
+    atomic_store_explicit(&t->count,
+        atomic_load_explicit(&table->count, memory_order_relaxed),
+        memory_order_relaxed);
+    lrutrack_epoch_collect(&t->epoch);
+    pthread_mutex_unlock(&t->lock);
+}
+
+//
+// Public functions
+
+lrutrack_cuckoo_t *lrutrack_cuckoo_create(uint32_t num_buckets,
+    uint32_t max_key_length, uint32_t hash_seed,
+    lrutrack_value_t invalid_value,
+    void *evict_user, lrutrack_evict_func_t evict_func,
+    const lrutrack_allocator_t *allocator) {
+    assert(lrutrack_cuckoo_is_power_of_two(num_buckets));
+    assert(num_buckets <= UINT32_MAX / LRUTRACK_CUCKOO_SLOTS);
+    assert(evict_func && allocator);
+    assert(allocator->alloc_func && allocator->dealloc_func);
+#if !LRUTRACK_32BIT_KEY
+    assert(max_key_length != 0);
+#endif
+
+    lrutrack_cuckoo_t *t = allocator->alloc_func(allocator->user,
+        sizeof(lrutrack_cuckoo_t), LRUTRACK_CUCKOO_CACHE_LINE);
+    if (!t)
+        return NULL;
+
+    memset(t, 0, sizeof(*t));
+    t->allocator = *allocator;
+
+    if (pthread_mutex_init(&t->lock, NULL) != 0) {
+        allocator->dealloc_func(allocator->user, t, sizeof(*t));
+        return NULL;
+    }
+
+    lrutrack_epoch_init(&t->epoch);
+
+    lrutrack_cuckoo_table_t proto;
+    memset(&proto, 0, sizeof(proto));
+    proto.evict_user = evict_user;
+    proto.evict_func = evict_func;
+    proto.max_key_length = max_key_length;
+    proto.seed = hash_seed;
+    proto.invalid_value = invalid_value;
+
+    lrutrack_cuckoo_table_t *table = lrutrack_cuckoo_alloc_table(t,
+        num_buckets, &proto);
+    if (!table) {
+        pthread_mutex_destroy(&t->lock);
+        allocator->dealloc_func(allocator->user, t, sizeof(*t));
+        return NULL;
+    }
+
+    atomic_init(&t->table, table);
+    atomic_init(&t->count, 0);
+
+    return t;
+}
+
+void lrutrack_cuckoo_destroy(lrutrack_cuckoo_t *t) {
+    assert(t);
+
+    lrutrack_epoch_destroy(&t->epoch);
+
+    lrutrack_cuckoo_table_t *table = lrutrack_cuckoo_table(t);
+    for (uint32_t i = 0; i < table->num_entries; ++i) {
+        lrutrack_value_t value = atomic_load_explicit(&table->values[i],
+            memory_order_relaxed);
+        if (value != table->invalid_value)
+            table->evict_func(table->evict_user, value);
+    }
+
+    lrutrack_cuckoo_free_table(t, table);
+
+    pthread_mutex_destroy(&t->lock);
+    t->allocator.dealloc_func(t->allocator.user, t, sizeof(*t));
+}
+
+#if !LRUTRACK_32BIT_KEY
+int lrutrack_cuckoo_insert(lrutrack_cuckoo_t *t, const void *key,
+    uint32_t key_length, lrutrack_value_t value)
+#else
+int lrutrack_cuckoo_insert(lrutrack_cuckoo_t *t, uint32_t key,
+    lrutrack_value_t value)
+#endif
+{
+    assert(t);
+
+    lrutrack_cuckoo_writer_lock(t);
+    lrutrack_cuckoo_table_t *table = lrutrack_cuckoo_table(t);
+    assert(value != table->invalid_value);
+
+#if !LRUTRACK_32BIT_KEY
+    assert(key && key_length != 0);
+    if (key_length > table->max_key_length) {
+        lrutrack_cuckoo_writer_unlock(t);
+        return LRUTRACK_ERROR;
+    }
+
+    lrutrack_cuckoo_location_t loc = lrutrack_cuckoo_locate(table,
+        lrutrack_cuckoo_hash(table, key, key_length));
+#else
+    lrutrack_cuckoo_location_t loc = lrutrack_cuckoo_locate(table, key);
+#endif
+
+#if !defined(NDEBUG)
+    {
+        lrutrack_value_t existing;
+        uint32_t bucket, slot;
+#if !LRUTRACK_32BIT_KEY
+        assert(lrutrack_cuckoo_lookup(table, &loc, key, key_length,
+            &existing, &bucket, &slot) == UINT32_MAX);
+#else
+        assert(lrutrack_cuckoo_lookup(table, &loc, key, &existing, &bucket,
+            &slot) == UINT32_MAX);
+#endif
+    }
+#endif
+
+#if !LRUTRACK_32BIT_KEY
+    lrutrack_cuckoo_table_insert(table, &loc, key, key_length, value, 1);
+#else
+    lrutrack_cuckoo_table_insert(table, &loc, key, value, 1);
+#endif
+
+    lrutrack_cuckoo_writer_unlock(t);
+
+    return LRUTRACK_OK;
+}
+
+#if !LRUTRACK_32BIT_KEY
+int lrutrack_cuckoo_remove(lrutrack_cuckoo_t *t, const void *key,
+    uint32_t key_length)
+#else
+int lrutrack_cuckoo_remove(lrutrack_cuckoo_t *t, uint32_t key)
+#endif
+{
+    assert(t);
+
+    lrutrack_cuckoo_writer_lock(t);
+    lrutrack_cuckoo_table_t *table = lrutrack_cuckoo_table(t);
+
+    lrutrack_value_t value;
+    uint32_t bucket, slot;
+#if !LRUTRACK_32BIT_KEY
+    assert(key != NULL && key_length != 0);
+    lrutrack_cuckoo_location_t loc = lrutrack_cuckoo_locate(table,
+        lrutrack_cuckoo_hash(table, key, key_length));
+    uint32_t entry = lrutrack_cuckoo_lookup(table, &loc, key, key_length,
+        &value, &bucket, &slot);
+#else
+    lrutrack_cuckoo_location_t loc = lrutrack_cuckoo_locate(table, key);
+    uint32_t entry = lrutrack_cuckoo_lookup(table, &loc, key, &value,
+        &bucket, &slot);
+#endif
+
+    int result = LRUTRACK_NOT_FOUND;
+    if (entry != UINT32_MAX) {
+        lrutrack_cuckoo_evict_entry(table, bucket, slot, entry);
+        result = LRUTRACK_OK;
+    }
+
+    lrutrack_cuckoo_writer_unlock(t);
+
+    return result;
+}
+
+// Optimistic read inside an epoch, so that a concurrent resize cannot free
+// the table under the reader
+#if !LRUTRACK_32BIT_KEY
+static lrutrack_value_t lrutrack_cuckoo_read(lrutrack_cuckoo_t *t,
+    const void *key, uint32_t key_length, int touch)
+#else
+static lrutrack_value_t lrutrack_cuckoo_read(lrutrack_cuckoo_t *t,
+    uint32_t key, int touch)
+#endif
+{
+    assert(t);
+
+    lrutrack_epoch_token_t token = lrutrack_epoch_enter(&t->epoch);
+    lrutrack_cuckoo_table_t *table = lrutrack_cuckoo_table(t);
+
+    lrutrack_value_t value;
+    uint32_t bucket, slot;
+#if !LRUTRACK_32BIT_KEY
+    assert(key != NULL && key_length != 0);
+    lrutrack_cuckoo_location_t loc = lrutrack_cuckoo_locate(table,
+        lrutrack_cuckoo_hash(table, key, key_length));
+    uint32_t entry = lrutrack_cuckoo_lookup(table, &loc, key, key_length,
+        &value, &bucket, &slot);
+#else
+    lrutrack_cuckoo_location_t loc = lrutrack_cuckoo_locate(table, key);
+    uint32_t entry = lrutrack_cuckoo_lookup(table, &loc, key, &value,
+        &bucket, &slot);
+#endif
+
+    // Only write when the bit changes to keep the cache line shared
+    if (touch && entry != UINT32_MAX &&
+        !atomic_load_explicit(&table->ref_bits[entry], memory_order_relaxed))
+        atomic_store_explicit(&table->ref_bits[entry], 1,
+            memory_order_relaxed);
+
+    lrutrack_epoch_exit(&t->epoch, token);
+
+    return value;
+}
+
+#if !LRUTRACK_32BIT_KEY
+lrutrack_value_t lrutrack_cuckoo_peek(lrutrack_cuckoo_t *t, const void *key,
+    uint32_t key_length) {
+    return lrutrack_cuckoo_read(t, key, key_length, 0);
+}
+
+lrutrack_value_t lrutrack_cuckoo_use(lrutrack_cuckoo_t *t, const void *key,
+    uint32_t key_length) {
+    return lrutrack_cuckoo_read(t, key, key_length, 1);
+}
+#else
+lrutrack_value_t lrutrack_cuckoo_peek(lrutrack_cuckoo_t *t, uint32_t key) {
+    return lrutrack_cuckoo_read(t, key, 0);
+}
+
+lrutrack_value_t lrutrack_cuckoo_use(lrutrack_cuckoo_t *t, uint32_t key) {
+    return lrutrack_cuckoo_read(t, key, 1);
+}
+#endif
+
+#if !LRUTRACK_32BIT_KEY
+
+//
+// c-string key helper functions
+
+int lrutrack_cuckoo_insert_strkey(lrutrack_cuckoo_t *t, const char *key,
+    lrutrack_value_t value) {
+    assert(key != NULL && strlen(key) <= UINT32_MAX);
+    return lrutrack_cuckoo_insert(t, key, (uint32_t)strlen(key), value);
+}
+
+int lrutrack_cuckoo_remove_strkey(lrutrack_cuckoo_t *t, const char *key) {
+    assert(key != NULL && strlen(key) <= UINT32_MAX);
+    return lrutrack_cuckoo_remove(t, key, (uint32_t)strlen(key));
+}
+
+lrutrack_value_t lrutrack_cuckoo_use_strkey(lrutrack_cuckoo_t *t,
+    const char *key) {
+    assert(key != NULL && strlen(key) <= UINT32_MAX);
+    return lrutrack_cuckoo_use(t, key, (uint32_t)strlen(key));
+}
+
+#endif
+
+//
+
+void lrutrack_cuckoo_remove_all(lrutrack_cuckoo_t *t) {
+    assert(t);
+
+    lrutrack_cuckoo_writer_lock(t);
+    lrutrack_cuckoo_table_t *table = lrutrack_cuckoo_table(t);
+
+    for (uint32_t b = 0; b < table->num_buckets; ++b) {
+        for (uint32_t s = 0; s < LRUTRACK_CUCKOO_SLOTS; ++s) {
+            uint64_t word = lrutrack_cuckoo_get_slot(table, b, s);
+            if (word != 0)
+                lrutrack_cuckoo_evict_entry(table, b, s, (uint32_t)word);
+        }
+    }
+
+    assert(atomic_load_explicit(&table->count, memory_order_relaxed) == 0);
+
+    lrutrack_cuckoo_writer_unlock(t);
+}
+
+int lrutrack_cuckoo_remove_lru(lrutrack_cuckoo_t *t) {
+    assert(t);
+
+    lrutrack_cuckoo_writer_lock(t);
+    int result = lrutrack_cuckoo_evict_clock(lrutrack_cuckoo_table(t));
+    lrutrack_cuckoo_writer_unlock(t);
+
+    return result;
+}
+
+//
+
+int lrutrack_cuckoo_resize(lrutrack_cuckoo_t *t, uint32_t num_buckets) {
+    assert(t);
+    assert(lrutrack_cuckoo_is_power_of_two(num_buckets));
+    assert(num_buckets <= UINT32_MAX / LRUTRACK_CUCKOO_SLOTS);
+
+    lrutrack_cuckoo_writer_lock(t);
+    lrutrack_cuckoo_table_t *old_table = lrutrack_cuckoo_table(t);
+    if (num_buckets == old_table->num_buckets) {
+        lrutrack_cuckoo_writer_unlock(t);
+        return LRUTRACK_OK;
+    }
+
+    lrutrack_cuckoo_table_t *table = lrutrack_cuckoo_alloc_table(t,
+        num_buckets, old_table);
+    if (!table) {
+        lrutrack_cuckoo_writer_unlock(t);
+        return LRUTRACK_OOM;
+    }
+
+    // The old table does not change while the lock is held, readers keep
+    // using it until the new one is published
+    for (uint32_t i = 0; i < old_table->num_entries; ++i) {
+        lrutrack_value_t value = atomic_load_explicit(&old_table->values[i],
+            memory_order_relaxed);
+        if (value == old_table->invalid_value)
+            continue;
+
+        lrutrack_cuckoo_location_t loc = lrutrack_cuckoo_locate(table,
+            lrutrack_cuckoo_entry_hash(old_table, i));
+        uint8_t ref_bit = atomic_load_explicit(&old_table->ref_bits[i],
+            memory_order_relaxed);
+#if !LRUTRACK_32BIT_KEY
+        lrutrack_cuckoo_table_insert(table, &loc,
+            lrutrack_cuckoo_entry_key(old_table, i),
+            atomic_load_explicit(&old_table->key_lengths[i],
+                memory_order_relaxed), value, ref_bit);
+#else
+        lrutrack_cuckoo_table_insert(table, &loc,
+            atomic_load_explicit(&old_table->keys[i], memory_order_relaxed),
+            value, ref_bit);
+#endif
+    }
+
+    atomic_store_explicit(&t->table, table, memory_order_seq_cst);
+    lrutrack_epoch_retire(&t->epoch, &old_table->retire, t,
+        lrutrack_cuckoo_free_retired_table);
+
+    lrutrack_cuckoo_writer_unlock(t);
+
+    return LRUTRACK_OK;
+}
+
+uint32_t lrutrack_cuckoo_num_buckets(lrutrack_cuckoo_t *t) {
+    assert(t);
+
+    lrutrack_cuckoo_writer_lock(t);
+    uint32_t num_buckets = lrutrack_cuckoo_table(t)->num_buckets;
+    lrutrack_cuckoo_writer_unlock(t);
+
+    return num_buckets;
+}
+
+uint32_t lrutrack_cuckoo_count(const lrutrack_cuckoo_t *t) {
+    return atomic_load_explicit(&t->count, memory_order_relaxed);
+}
@@ -0,0 +1,107 @@
+// Least-recently-used tracking helper in C
+// Bucketized cuckoo hashing variant with optimistic concurrent reads
+
+#ifndef LRUTRACK_CUCKOO_H
+#define LRUTRACK_CUCKOO_H
+
+#include "lrutrack.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//
+// Types:
+// Every key has two candidate buckets of four slots. A slot holds a 16-bit
+// fingerprint and an entry index. Writers are serialized by an internal lock,
+// lrutrack_cuckoo_use and lrutrack_cuckoo_peek take no lock: they validate
+// per-bucket version counters and retry if a writer got in between.
+// Recency is approximated with CLOCK reference bits, set without a lock.
+// Capacity is four entries per bucket, and an insert that finds no room
+// evicts a not recently used entry of its candidate buckets.
+// lrutrack_cuckoo_resize builds a new table while readers keep using the
+// current one, publishes it, and frees the old one once the last reader
+// that could see it has left (epoch-based reclamation).
+
+typedef struct lrutrack_cuckoo_t lrutrack_cuckoo_t;
+
+//
+//
+
+// num_buckets is a power of two. Keys are stored inline in max_key_length
+// bytes per entry so that readers never touch freed memory.
+lrutrack_cuckoo_t *lrutrack_cuckoo_create(uint32_t num_buckets,
+    uint32_t max_key_length, uint32_t hash_seed,
+    lrutrack_value_t invalid_value,
+    void *evict_user, lrutrack_evict_func_t evict_func,
+    const lrutrack_allocator_t *allocator);
+void lrutrack_cuckoo_destroy(lrutrack_cuckoo_t *t);
+
+#if !LRUTRACK_32BIT_KEY
+
+//
+// Variable-length key functions:
+
+int lrutrack_cuckoo_insert(lrutrack_cuckoo_t *t, const void *key,
+    uint32_t key_length, lrutrack_value_t value);
+
+int lrutrack_cuckoo_remove(lrutrack_cuckoo_t *t, const void *key,
+    uint32_t key_length);
+
+lrutrack_value_t lrutrack_cuckoo_use(lrutrack_cuckoo_t *t, const void *key,
+    uint32_t key_length);
+
+// Same as use, without marking the entry as recently used
+lrutrack_value_t lrutrack_cuckoo_peek(lrutrack_cuckoo_t *t, const void *key,
+    uint32_t key_length);
+
+//
+// Null-terminated string key helper functions:
+
+int lrutrack_cuckoo_insert_strkey(lrutrack_cuckoo_t *t, const char *key,
+    lrutrack_value_t value);
+
+int lrutrack_cuckoo_remove_strkey(lrutrack_cuckoo_t *t, const char *key);
+
+lrutrack_value_t lrutrack_cuckoo_use_strkey(lrutrack_cuckoo_t *t,
+    const char *key);
+
+#else
+
+//
+// 32-bit key functions:
+
+int lrutrack_cuckoo_insert(lrutrack_cuckoo_t *t, uint32_t key,
+    lrutrack_value_t value);
+int lrutrack_cuckoo_remove(lrutrack_cuckoo_t *t, uint32_t key);
+lrutrack_value_t lrutrack_cuckoo_use(lrutrack_cuckoo_t *t, uint32_t key);
+lrutrack_value_t lrutrack_cuckoo_peek(lrutrack_cuckoo_t *t, uint32_t key);
+
+#endif // LRUTRACK_32BIT_KEY
+
+//
+// Cleaning functions:
+
+void lrutrack_cuckoo_remove_all(lrutrack_cuckoo_t *t);
+
+// Advances the CLOCK hand to the next entry without its reference bit
+int lrutrack_cuckoo_remove_lru(lrutrack_cuckoo_t *t);
+
+//
+// Capacity functions:
+// Resizing blocks other writers but not readers. Shrinking evicts the
+// entries that do not fit.
+
+int lrutrack_cuckoo_resize(lrutrack_cuckoo_t *t, uint32_t num_buckets);
+uint32_t lrutrack_cuckoo_num_buckets(lrutrack_cuckoo_t *t);
+
+//
+// Statistics:
+
+uint32_t lrutrack_cuckoo_count(const lrutrack_cuckoo_t *t);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,238 @@
+// Least-recently-used tracking helper in C
+// Owner-thread delegation: one thread runs the tracker, others send requests
+
+#include "lrutrack_delegate.h"
+
+#include <sched.h>
+#include <string.h>
+#include <assert.h>
+
+#define LRUTRACK_DELEGATE_CACHE_LINE 64
+#define LRUTRACK_DELEGATE_BATCH 64 // Requests completed together
+#define LRUTRACK_DELEGATE_SPINS 64 // Polls before yielding the CPU
+
+static int lrutrack_delegate_is_power_of_two(uint32_t x) {
+    return x > 0 && (x & (x - 1)) == 0;
+}
+
+//
+
+// Ring cell. seq == position: free for the submitter claiming position,
+// seq == position + 1: holds a request for the owner.
+typedef struct lrutrack_delegate_cell_t {
+    _Atomic uint32_t seq;
+    lrutrack_delegate_request_t *request;
+} lrutrack_delegate_cell_t;
+
+typedef struct lrutrack_delegate_t {
+    // Claimed by submitters
+    _Alignas(LRUTRACK_DELEGATE_CACHE_LINE) _Atomic uint32_t tail;
+
+    // Owner only
+    _Alignas(LRUTRACK_DELEGATE_CACHE_LINE) uint32_t head;
+    uint32_t ring_mask;
+    lrutrack_delegate_cell_t *cells;
+    lrutrack_t *tracker;
+    lrutrack_allocator_t allocator;
+} lrutrack_delegate_t;
+
+//
+// Private functions
+
+static void lrutrack_delegate_execute(lrutrack_t *t,
+    lrutrack_delegate_request_t *r) {
+    switch (r->op) {
+    case LRUTRACK_DELEGATE_INSERT:
+#if !LRUTRACK_32BIT_KEY
+        r->result = lrutrack_insert(t, r->key, r->key_length, r->value);
+#else
+        r->result = lrutrack_insert(t, r->key, r->value);
+#endif
+        break;
+    case LRUTRACK_DELEGATE_REMOVE:
+#if !LRUTRACK_32BIT_KEY
+        r->result = lrutrack_remove(t, r->key, r->key_length);
+#else
+        r->result = lrutrack_remove(t, r->key);
+#endif
+        break;
+    case LRUTRACK_DELEGATE_USE:
+#if !LRUTRACK_32BIT_KEY
+        r->value = lrutrack_use(t, r->key, r->key_length);
+#else
+        r->value = lrutrack_use(t, r->key);
+#endif
+        r->result = LRUTRACK_OK;
+        break;
+    case LRUTRACK_DELEGATE_REMOVE_ALL:
+        lrutrack_remove_all(t);
+        r->result = LRUTRACK_OK;
+        break;
+    case LRUTRACK_DELEGATE_REMOVE_LRU:
+        r->result = lrutrack_remove_lru(t);
+        break;
+    default:
+        r->result = LRUTRACK_ERROR;
+        break;
+    }
+}
+
+// Next queued request, NULL when the ring is empty
+static lrutrack_delegate_request_t *lrutrack_delegate_pop(
+    lrutrack_delegate_t *d) {
+    lrutrack_delegate_cell_t *cell = &d->cells[d->head & d->ring_mask];
+    uint32_t seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+    if ((int32_t)(seq - (d->head + 1)) < 0)
+        return NULL;
+
+    lrutrack_delegate_request_t *request = cell->request;
+
+    // Free the cell for the submitter one lap ahead
+    atomic_store_explicit(&cell->seq, d->head + d->ring_mask + 1,
+        memory_order_release);
+    ++d->head;
+
+    return request;
+}
+
+//
+// Public functions
+
+lrutrack_delegate_t *lrutrack_delegate_create(uint32_t hash_table_size,
+    uint32_t num_initial_items, uint32_t hash_seed,
+    lrutrack_value_t invalid_value,
+    void *evict_user, lrutrack_evict_func_t evict_func,
+    uint32_t ring_size, const lrutrack_allocator_t *allocator) {
+    assert(allocator && allocator->alloc_func && allocator->dealloc_func);
+    assert(lrutrack_delegate_is_power_of_two(ring_size));
+
+    lrutrack_delegate_t *d = allocator->alloc_func(allocator->user,
+        sizeof(lrutrack_delegate_t), LRUTRACK_DELEGATE_CACHE_LINE);
+    if (!d)
+        return NULL;
+
+    memset(d, 0, sizeof(*d));
+
+    d->allocator = *allocator;
+    d->ring_mask = ring_size - 1;
+    atomic_init(&d->tail, 0);
+
+    d->cells = allocator->alloc_func(allocator->user,
+        sizeof(*d->cells) * ring_size, LRUTRACK_DELEGATE_CACHE_LINE);
+    if (!d->cells) {
+        allocator->dealloc_func(allocator->user, d, sizeof(*d));
+        return NULL;
+    }
+
+    for (uint32_t i = 0; i < ring_size; ++i) {
+        atomic_init(&d->cells[i].seq, i);
+        d->cells[i].request = NULL;
+    }
+
+    d->tracker = lrutrack_create_with_allocator(hash_table_size,
+        num_initial_items, hash_seed, invalid_value, evict_user, evict_func,
+        allocator);
+    if (!d->tracker) {
+        allocator->dealloc_func(allocator->user, d->cells,
+            sizeof(*d->cells) * ring_size);
+        allocator->dealloc_func(allocator->user, d, sizeof(*d));
+        return NULL;
+    }
+
+    return d;
+}
+
+void lrutrack_delegate_destroy(lrutrack_delegate_t *d) {
+    assert(d);
+
+    while (lrutrack_delegate_poll(d, UINT32_MAX) != 0)
+        ;
+
+    lrutrack_destroy(d->tracker);
+    d->allocator.dealloc_func(d->allocator.user, d->cells,
+        sizeof(*d->cells) * (d->ring_mask + 1));
+    d->allocator.dealloc_func(d->allocator.user, d, sizeof(*d));
+}
+
+uint32_t lrutrack_delegate_submit(lrutrack_delegate_t *d,
+    lrutrack_delegate_request_t *requests, uint32_t num_requests) {
+    assert(d && (requests || num_requests == 0));
+
+    uint32_t pos = atomic_load_explicit(&d->tail, memory_order_relaxed);
+
+    for (uint32_t i = 0; i < num_requests; ++i) {
+        lrutrack_delegate_cell_t *cell;
+
+        for (;;) {
+            cell = &d->cells[pos & d->ring_mask];
+            uint32_t seq = atomic_load_explicit(&cell->seq,
+                memory_order_acquire);
+            int32_t diff = (int32_t)(seq - pos);
+
+            if (diff == 0) {
+                if (atomic_compare_exchange_weak_explicit(&d->tail, &pos,
+                    pos + 1, memory_order_relaxed, memory_order_relaxed))
+                    break;
+            } else if (diff < 0) {
+                // Full, the owner has not freed the cell of the last lap
+                return i;
+            } else {
+                pos = atomic_load_explicit(&d->tail, memory_order_relaxed);
+            }
+        }
+
+        atomic_store_explicit(&requests[i].done, 0, memory_order_relaxed);
+        cell->request = &requests[i];
+        atomic_store_explicit(&cell->seq, pos + 1, memory_order_release);
+        ++pos;
+    }
+
+    return num_requests;
+}
+
+int lrutrack_delegate_done(const lrutrack_delegate_request_t *request) {
+    assert(request);
+    return atomic_load_explicit(&request->done, memory_order_acquire) != 0;
+}
+
+void lrutrack_delegate_wait(const lrutrack_delegate_request_t *request) {
+    for (uint32_t spins = 0; !lrutrack_delegate_done(request); ++spins) {
+        if (spins >= LRUTRACK_DELEGATE_SPINS)
+            sched_yield();
+    }
+}
+
+uint32_t lrutrack_delegate_poll(lrutrack_delegate_t *d,
+    uint32_t max_requests) {
+    assert(d);
+
+    lrutrack_delegate_request_t *batch[LRUTRACK_DELEGATE_BATCH];
+    uint32_t num_done = 0;
+
+    while (num_done < max_requests) {
+        uint32_t n = 0;
+        while (n < LRUTRACK_DELEGATE_BATCH && num_done + n < max_requests) {
+            lrutrack_delegate_request_t *request = lrutrack_delegate_pop(d);
+            if (!request)
+                break;
+            lrutrack_delegate_execute(d->tracker, request);
+            batch[n++] = request;
+        }
+
+        if (n == 0)
+            break;
+
+        // Completions go out together, after the whole batch ran
+        for (uint32_t i = 0; i < n; ++i)
+            atomic_store_explicit(&batch[i]->done, 1, memory_order_release);
+
+        num_done += n;
+    }
+
+    return num_done;
+}
+
+lrutrack_t *lrutrack_delegate_tracker(lrutrack_delegate_t *d) {
+    assert(d);
+    return d->tracker;
+}
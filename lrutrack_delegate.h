@@ -0,0 +1,87 @@
+// Least-recently-used tracking helper in C
+// Owner-thread delegation: one thread runs the tracker, others send requests
+
+#ifndef LRUTRACK_DELEGATE_H
+#define LRUTRACK_DELEGATE_H
+
+#include "lrutrack.h"
+
+#include <stdatomic.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//
+// Types:
+// The tracker belongs to the thread that calls lrutrack_delegate_poll. Other
+// threads fill in requests and submit them to a bounded lock-free ring
+// shared by all submitters. The owner runs requests in batches and marks a
+// batch complete once all of it ran, so neither side ever takes a lock and
+// the tracker's memory is only ever touched by the owner's core.
+//
+// Requests are owned by the submitter and must stay untouched, key bytes
+// included, until lrutrack_delegate_done reports them complete. evict_func
+// runs on the owner thread.
+
+#define LRUTRACK_DELEGATE_INSERT 0
+#define LRUTRACK_DELEGATE_REMOVE 1
+#define LRUTRACK_DELEGATE_USE 2
+#define LRUTRACK_DELEGATE_REMOVE_ALL 3
+#define LRUTRACK_DELEGATE_REMOVE_LRU 4
+
+typedef struct lrutrack_delegate_t lrutrack_delegate_t;
+
+typedef struct lrutrack_delegate_request_t {
+    uint32_t op;
+#if !LRUTRACK_32BIT_KEY
+    uint32_t key_length;
+    const void *key;
+#else
+    uint32_t key;
+#endif
+    lrutrack_value_t value; // Inserted value, or the value used
+    int result;
+    _Atomic uint32_t done;
+} lrutrack_delegate_request_t;
+
+//
+//
+
+// ring_size is a power of two, the most requests in flight
+lrutrack_delegate_t *lrutrack_delegate_create(uint32_t hash_table_size,
+    uint32_t num_initial_items, uint32_t hash_seed,
+    lrutrack_value_t invalid_value,
+    void *evict_user, lrutrack_evict_func_t evict_func,
+    uint32_t ring_size, const lrutrack_allocator_t *allocator);
+
+// Completes the requests still queued first. Called by the owner.
+void lrutrack_delegate_destroy(lrutrack_delegate_t *d);
+
+//
+// Submitter functions:
+
+// Queues requests in order and returns how many fit in the ring
+uint32_t lrutrack_delegate_submit(lrutrack_delegate_t *d,
+    lrutrack_delegate_request_t *requests, uint32_t num_requests);
+
+int lrutrack_delegate_done(const lrutrack_delegate_request_t *request);
+
+// Spins, then yields, until the owner has completed the request
+void lrutrack_delegate_wait(const lrutrack_delegate_request_t *request);
+
+//
+// Owner functions:
+
+// Runs up to max_requests queued requests, returns how many ran
+uint32_t lrutrack_delegate_poll(lrutrack_delegate_t *d,
+    uint32_t max_requests);
+
+// The tracker itself, for direct use by the owner only
+lrutrack_t *lrutrack_delegate_tracker(lrutrack_delegate_t *d);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
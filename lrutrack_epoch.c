@@ -0,0 +1,199 @@
+// Least-recently-used tracking helper in C
+// Epoch-based reclamation for memory that lock-free readers may still see
+
+#include "lrutrack_epoch.h"
+
+#include <sched.h>
+#include <string.h>
+#include <assert.h>
+
+// Threads are spread over the stripes round robin
+static _Atomic uint32_t lrutrack_epoch_next_stripe = 0;
+static _Thread_local uint32_t lrutrack_epoch_thread_stripe = UINT32_MAX;
+
+//
+// Private functions
+
+static uint32_t lrutrack_epoch_stripe_of_thread(void) {
+    if (lrutrack_epoch_thread_stripe == UINT32_MAX) {
+        lrutrack_epoch_thread_stripe = atomic_fetch_add_explicit(
+            &lrutrack_epoch_next_stripe, 1, memory_order_relaxed) %
+            LRUTRACK_EPOCH_STRIPES;
+    }
+    return lrutrack_epoch_thread_stripe;
+}
+
+static uint32_t lrutrack_epoch_num_active(lrutrack_epoch_t *domain,
+    uint32_t parity) {
+    uint32_t total = 0;
+    for (uint32_t i = 0; i < LRUTRACK_EPOCH_STRIPES; ++i) {
+        total += atomic_load_explicit(&domain->stripes[i].active[parity],
+            memory_order_seq_cst);
+    }
+    return total;
+}
+
+// Moves from epoch e to e + 1 once no reader is left in epoch e - 1, which
+// shares e + 1's counter
+static int lrutrack_epoch_try_advance(lrutrack_epoch_t *domain) {
+    uint64_t epoch = atomic_load_explicit(&domain->epoch,
+        memory_order_relaxed);
+    if (lrutrack_epoch_num_active(domain, (uint32_t)((epoch + 1) & 1)) != 0)
+        return 0;
+
+    atomic_store_explicit(&domain->epoch, epoch + 1, memory_order_seq_cst);
+    return 1;
+}
+
+// Frees nodes retired at least two epochs ago: every reader that entered
+// before they were unpublished has exited by then
+static uint32_t lrutrack_epoch_free_safe(lrutrack_epoch_t *domain) {
+    uint64_t epoch = atomic_load_explicit(&domain->epoch,
+        memory_order_relaxed);
+
+    uint32_t num_left = 0;
+    lrutrack_epoch_node_t **link = &domain->retired;
+    while (*link) {
+        lrutrack_epoch_node_t *node = *link;
+        if (node->epoch + 2 <= epoch) {
+            *link = node->next;
+            node->free_func(node->user, node);
+            atomic_fetch_sub_explicit(&domain->num_retired, 1,
+                memory_order_relaxed);
+        } else {
+            link = &node->next;
+            ++num_left;
+        }
+    }
+
+    return num_left;
+}
+
+// Moves everything retired since the last collection to the collector's
+// list. The caller holds the collector.
+static void lrutrack_epoch_take_incoming(lrutrack_epoch_t *domain) {
+    lrutrack_epoch_node_t *node = atomic_exchange_explicit(&domain->incoming,
+        NULL, memory_order_acquire);
+    while (node) {
+        lrutrack_epoch_node_t *next = node->next;
+        node->next = domain->retired;
+        domain->retired = node;
+        node = next;
+    }
+}
+
+static int lrutrack_epoch_try_lock(lrutrack_epoch_t *domain) {
+    return !atomic_load_explicit(&domain->collecting, memory_order_relaxed) &&
+        !atomic_exchange_explicit(&domain->collecting, 1,
+            memory_order_acquire);
+}
+
+static void lrutrack_epoch_unlock(lrutrack_epoch_t *domain) {
+    atomic_store_explicit(&domain->collecting, 0, memory_order_release);
+}
+
+//
+// Public functions
+
+void lrutrack_epoch_init(lrutrack_epoch_t *domain) {
+    assert(domain);
+
+    for (uint32_t i = 0; i < LRUTRACK_EPOCH_STRIPES; ++i) {
+        atomic_init(&domain->stripes[i].active[0], 0);
+        atomic_init(&domain->stripes[i].active[1], 0);
+    }
+
+    atomic_init(&domain->epoch, 0);
+    atomic_init(&domain->incoming, NULL);
+    atomic_init(&domain->collecting, 0);
+    atomic_init(&domain->num_retired, 0);
+    domain->retired = NULL;
+}
+
+void lrutrack_epoch_destroy(lrutrack_epoch_t *domain) {
+    lrutrack_epoch_synchronize(domain);
+    assert(domain->retired == NULL);
+    assert(atomic_load_explicit(&domain->incoming,
+        memory_order_relaxed) == NULL);
+}
+
+lrutrack_epoch_token_t lrutrack_epoch_enter(lrutrack_epoch_t *domain) {
+    uint32_t stripe = lrutrack_epoch_stripe_of_thread();
+    uint32_t parity = (uint32_t)(atomic_load_explicit(&domain->epoch,
+        memory_order_seq_cst) & 1);
+
+    // A reader that registers after the epoch moved on is still safe: the
+    // writer published before advancing, so the reader sees the new objects
+    atomic_fetch_add_explicit(&domain->stripes[stripe].active[parity], 1,
+        memory_order_seq_cst);
+
+    return stripe << 1 | parity;
+}
+
+void lrutrack_epoch_exit(lrutrack_epoch_t *domain,
+    lrutrack_epoch_token_t token) {
+    uint32_t stripe = token >> 1;
+    uint32_t parity = token & 1;
+    assert(stripe < LRUTRACK_EPOCH_STRIPES);
+    assert(atomic_load_explicit(&domain->stripes[stripe].active[parity],
+        memory_order_relaxed) != 0);
+
+    atomic_fetch_sub_explicit(&domain->stripes[stripe].active[parity], 1,
+        memory_order_release);
+}
+
+void lrutrack_epoch_retire(lrutrack_epoch_t *domain,
+    lrutrack_epoch_node_t *node, void *user,
+    lrutrack_epoch_free_func_t free_func) {
+    assert(domain && node && free_func);
+
+    node->epoch = atomic_load_explicit(&domain->epoch, memory_order_seq_cst);
+    node->user = user;
+    node->free_func = free_func;
+
+    atomic_fetch_add_explicit(&domain->num_retired, 1, memory_order_relaxed);
+    node->next = atomic_load_explicit(&domain->incoming,
+        memory_order_relaxed);
+    while (!atomic_compare_exchange_weak_explicit(&domain->incoming,
+        &node->next, node, memory_order_release, memory_order_relaxed))
+        ;
+
+    lrutrack_epoch_collect(domain);
+}
+
+uint32_t lrutrack_epoch_collect(lrutrack_epoch_t *domain) {
+    assert(domain);
+
+    if (!atomic_load_explicit(&domain->num_retired, memory_order_relaxed))
+        return 0;
+
+    // Another writer is on it
+    if (!lrutrack_epoch_try_lock(domain))
+        return 0;
+
+    lrutrack_epoch_take_incoming(domain);
+    lrutrack_epoch_try_advance(domain);
+    uint32_t num_left = lrutrack_epoch_free_safe(domain);
+
+    lrutrack_epoch_unlock(domain);
+
+    return num_left;
+}
+
+void lrutrack_epoch_synchronize(lrutrack_epoch_t *domain) {
+    assert(domain);
+
+    while (!lrutrack_epoch_try_lock(domain))
+        sched_yield();
+
+    for (;;) {
+        lrutrack_epoch_take_incoming(domain);
+        if (!domain->retired)
+            break;
+        if (!lrutrack_epoch_try_advance(domain))
+            sched_yield();
+        lrutrack_epoch_free_safe(domain);
+    }
+
+    lrutrack_epoch_unlock(domain);
+}
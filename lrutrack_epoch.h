@@ -0,0 +1,91 @@
+// Least-recently-used tracking helper in C
+// Epoch-based reclamation for memory that lock-free readers may still see
+
+#ifndef LRUTRACK_EPOCH_H
+#define LRUTRACK_EPOCH_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Reader counters are striped over this many cache lines
+#if !defined(LRUTRACK_EPOCH_STRIPES)
+#   define LRUTRACK_EPOCH_STRIPES 16
+#endif
+
+//
+// Types:
+// Readers bracket every access with lrutrack_epoch_enter/exit. A writer
+// first unpublishes an object, then hands it to lrutrack_epoch_retire,
+// which frees it once every reader that could have seen it has exited.
+// Writers may retire concurrently: retired objects are pushed lock-free and
+// whichever writer finds the collector free frees them. Readers need no
+// registration.
+
+typedef struct lrutrack_epoch_node_t lrutrack_epoch_node_t;
+
+typedef void (*lrutrack_epoch_free_func_t)(void *user,
+    lrutrack_epoch_node_t *node);
+
+// Embedded in the retired object, no allocation needed
+struct lrutrack_epoch_node_t {
+    lrutrack_epoch_node_t *next;
+    uint64_t epoch;
+    void *user;
+    lrutrack_epoch_free_func_t free_func;
+};
+
+typedef struct lrutrack_epoch_stripe_t {
+    _Alignas(64) _Atomic uint32_t active[2];
+} lrutrack_epoch_stripe_t;
+
+typedef struct lrutrack_epoch_t {
+    lrutrack_epoch_stripe_t stripes[LRUTRACK_EPOCH_STRIPES];
+    _Atomic uint64_t epoch;
+    _Atomic(lrutrack_epoch_node_t *) incoming; // Retired, not yet collected
+    _Atomic uint32_t collecting; // Held by the writer running a collection
+    _Atomic uint32_t num_retired;
+    lrutrack_epoch_node_t *retired; // Owned by the collector
+} lrutrack_epoch_t;
+
+// Token returned by enter, to be passed back to exit
+typedef uint32_t lrutrack_epoch_token_t;
+
+//
+//
+
+void lrutrack_epoch_init(lrutrack_epoch_t *domain);
+
+// Waits for readers and frees everything still retired
+void lrutrack_epoch_destroy(lrutrack_epoch_t *domain);
+
+//
+// Reader functions:
+
+lrutrack_epoch_token_t lrutrack_epoch_enter(lrutrack_epoch_t *domain);
+void lrutrack_epoch_exit(lrutrack_epoch_t *domain,
+    lrutrack_epoch_token_t token);
+
+//
+// Writer functions:
+
+void lrutrack_epoch_retire(lrutrack_epoch_t *domain,
+    lrutrack_epoch_node_t *node, void *user,
+    lrutrack_epoch_free_func_t free_func);
+
+// Advances the epoch if the readers allow it and frees what became safe,
+// without waiting. Returns the number of objects still retired, as seen by
+// this call; 0 if another writer is collecting.
+uint32_t lrutrack_epoch_collect(lrutrack_epoch_t *domain);
+
+// Waits until every object retired so far is freed
+void lrutrack_epoch_synchronize(lrutrack_epoch_t *domain);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,361 @@
+// Least-recently-used tracking helper in C
+// Flat-combining front-end for a single tracker shared by many threads
+
+#include "lrutrack_fc.h"
+
+#include <stdatomic.h>
+#include <sched.h>
+#include <string.h>
+#include <assert.h>
+
+#define LRUTRACK_FC_CACHE_LINE 64
+#define LRUTRACK_FC_PASSES 2 // Rescans while new operations keep arriving
+#define LRUTRACK_FC_SPINS 64 // Polls before yielding the CPU
+
+#define LRUTRACK_FC_IDLE 0
+#define LRUTRACK_FC_PENDING 1
+#define LRUTRACK_FC_DONE 2
+
+#define LRUTRACK_FC_OP_INSERT 0
+#define LRUTRACK_FC_OP_REMOVE 1
+#define LRUTRACK_FC_OP_USE 2
+#define LRUTRACK_FC_OP_REMOVE_ALL 3
+#define LRUTRACK_FC_OP_REMOVE_LRU 4
+
+//
+
+struct lrutrack_fc_thread_t {
+    // Owner sets PENDING, the combiner sets DONE once the result is stored
+    _Alignas(LRUTRACK_FC_CACHE_LINE) _Atomic uint32_t state;
+    _Atomic uint32_t attached;
+    uint32_t op;
+#if !LRUTRACK_32BIT_KEY
+    uint32_t key_length;
+    const void *key;
+#else
+    uint32_t key;
+#endif
+    lrutrack_value_t value; // Inserted value, or the value used
+    int result;
+};
+
+typedef struct lrutrack_fc_t {
+    lrutrack_fc_thread_t threads[LRUTRACK_FC_MAX_THREADS];
+
+    _Alignas(LRUTRACK_FC_CACHE_LINE) _Atomic uint32_t combining;
+    _Atomic uint32_t num_threads; // Highest attached record + 1
+    _Atomic uint64_t num_batches;
+    _Atomic uint64_t num_ops;
+    lrutrack_t *tracker;
+    lrutrack_allocator_t allocator;
+} lrutrack_fc_t;
+
+//
+// Private functions
+
+static void lrutrack_fc_execute(lrutrack_fc_t *t, lrutrack_fc_thread_t *rec) {
+    switch (rec->op) {
+    case LRUTRACK_FC_OP_INSERT:
+#if !LRUTRACK_32BIT_KEY
+        rec->result = lrutrack_insert(t->tracker, rec->key, rec->key_length,
+            rec->value);
+#else
+        rec->result = lrutrack_insert(t->tracker, rec->key, rec->value);
+#endif
+        break;
+    case LRUTRACK_FC_OP_REMOVE:
+#if !LRUTRACK_32BIT_KEY
+        rec->result = lrutrack_remove(t->tracker, rec->key, rec->key_length);
+#else
+        rec->result = lrutrack_remove(t->tracker, rec->key);
+#endif
+        break;
+    case LRUTRACK_FC_OP_USE:
+#if !LRUTRACK_32BIT_KEY
+        rec->value = lrutrack_use(t->tracker, rec->key, rec->key_length);
+#else
+        rec->value = lrutrack_use(t->tracker, rec->key);
+#endif
+        rec->result = LRUTRACK_OK;
+        break;
+    case LRUTRACK_FC_OP_REMOVE_ALL:
+        lrutrack_remove_all(t->tracker);
+        rec->result = LRUTRACK_OK;
+        break;
+    case LRUTRACK_FC_OP_REMOVE_LRU:
+        rec->result = lrutrack_remove_lru(t->tracker);
+        break;
+    default:
+        assert(0);
+        rec->result = LRUTRACK_ERROR;
+        break;
+    }
+}
+
+// Runs every published operation, the caller holds the combiner lock
+static void lrutrack_fc_combine(lrutrack_fc_t *t) {
+    uint32_t num_threads = atomic_load_explicit(&t->num_threads,
+        memory_order_acquire);
+
+    for (uint32_t pass = 0; pass < LRUTRACK_FC_PASSES; ++pass) {
+        uint32_t num_ops = 0;
+
+        for (uint32_t i = 0; i < num_threads; ++i) {
+            lrutrack_fc_thread_t *rec = &t->threads[i];
+            if (atomic_load_explicit(&rec->state, memory_order_acquire) !=
+                LRUTRACK_FC_PENDING)
+                continue;
+
+            lrutrack_fc_execute(t, rec);
+            atomic_store_explicit(&rec->state, LRUTRACK_FC_DONE,
+                memory_order_release);
+            ++num_ops;
+        }
+
+        if (num_ops == 0)
+            break;
+
+        // Only the combiner writes these
+        atomic_store_explicit(&t->num_batches, atomic_load_explicit(
+            &t->num_batches, memory_order_relaxed) + 1, memory_order_relaxed);
+        atomic_store_explicit(&t->num_ops, atomic_load_explicit(
+            &t->num_ops, memory_order_relaxed) + num_ops,
+            memory_order_relaxed);
+    }
+}
+
+// Publishes the operation in self and returns once it has been run, either
+// by another combiner or by this thread taking the lock
+static void lrutrack_fc_run(lrutrack_fc_t *t, lrutrack_fc_thread_t *self) {
+    assert(atomic_load_explicit(&self->attached, memory_order_relaxed));
+    assert(atomic_load_explicit(&self->state, memory_order_relaxed) ==
+        LRUTRACK_FC_IDLE);
+
+    atomic_store_explicit(&self->state, LRUTRACK_FC_PENDING,
+        memory_order_release);
+
+    for (uint32_t spins = 0;; ++spins) {
+        if (atomic_load_explicit(&self->state, memory_order_acquire) ==
+            LRUTRACK_FC_DONE)
+            break;
+
+        // Test before exchanging, so that waiters poll a shared line
+        if (!atomic_load_explicit(&t->combining, memory_order_relaxed) &&
+            !atomic_exchange_explicit(&t->combining, 1,
+                memory_order_acquire)) {
+            lrutrack_fc_combine(t);
+            atomic_store_explicit(&t->combining, 0, memory_order_release);
+
+            // The pass saw this record pending
+            assert(atomic_load_explicit(&self->state,
+                memory_order_relaxed) == LRUTRACK_FC_DONE);
+            break;
+        }
+
+        if (spins >= LRUTRACK_FC_SPINS)
+            sched_yield();
+    }
+
+    atomic_store_explicit(&self->state, LRUTRACK_FC_IDLE,
+        memory_order_relaxed);
+}
+
+//
+// Public functions
+
+lrutrack_fc_t *lrutrack_fc_create(uint32_t hash_table_size,
+    uint32_t num_initial_items, uint32_t hash_seed,
+    lrutrack_value_t invalid_value,
+    void *evict_user, lrutrack_evict_func_t evict_func,
+    const lrutrack_allocator_t *allocator) {
+    assert(allocator && allocator->alloc_func && allocator->dealloc_func);
+
+    lrutrack_fc_t *t = allocator->alloc_func(allocator->user,
+        sizeof(lrutrack_fc_t), LRUTRACK_FC_CACHE_LINE);
+    if (!t)
+        return NULL;
+
+    memset(t, 0, sizeof(*t));
+
+    t->allocator = *allocator;
+    atomic_init(&t->combining, 0);
+    atomic_init(&t->num_threads, 0);
+    atomic_init(&t->num_batches, 0);
+    atomic_init(&t->num_ops, 0);
+    for (uint32_t i = 0; i < LRUTRACK_FC_MAX_THREADS; ++i) {
+        atomic_init(&t->threads[i].state, LRUTRACK_FC_IDLE);
+        atomic_init(&t->threads[i].attached, 0);
+    }
+
+    t->tracker = lrutrack_create_with_allocator(hash_table_size,
+        num_initial_items, hash_seed, invalid_value, evict_user, evict_func,
+        allocator);
+    if (!t->tracker) {
+        allocator->dealloc_func(allocator->user, t, sizeof(*t));
+        return NULL;
+    }
+
+    return t;
+}
+
+void lrutrack_fc_destroy(lrutrack_fc_t *t) {
+    assert(t);
+    assert(!atomic_load_explicit(&t->combining, memory_order_relaxed));
+
+    lrutrack_destroy(t->tracker);
+    t->allocator.dealloc_func(t->allocator.user, t, sizeof(*t));
+}
+
+lrutrack_fc_thread_t *lrutrack_fc_attach(lrutrack_fc_t *t) {
+    assert(t);
+
+    for (uint32_t i = 0; i < LRUTRACK_FC_MAX_THREADS; ++i) {
+        lrutrack_fc_thread_t *rec = &t->threads[i];
+        uint32_t expected = 0;
+        if (atomic_load_explicit(&rec->attached, memory_order_relaxed) ||
+            !atomic_compare_exchange_strong_explicit(&rec->attached,
+                &expected, 1, memory_order_acquire, memory_order_relaxed))
+            continue;
+
+        // Make the record visible to combiners
+        uint32_t num_threads = atomic_load_explicit(&t->num_threads,
+            memory_order_relaxed);
+        while (num_threads < i + 1 &&
+            !atomic_compare_exchange_weak_explicit(&t->num_threads,
+                &num_threads, i + 1, memory_order_release,
+                memory_order_relaxed))
+            ;
+
+        return rec;
+    }
+
+    return NULL;
+}
+
+void lrutrack_fc_detach(lrutrack_fc_t *t, lrutrack_fc_thread_t *self) {
+    assert(t && self);
+    assert(self >= t->threads && self < t->threads + LRUTRACK_FC_MAX_THREADS);
+    assert(atomic_load_explicit(&self->state, memory_order_relaxed) ==
+        LRUTRACK_FC_IDLE);
+    (void)t;
+
+    atomic_store_explicit(&self->attached, 0, memory_order_release);
+}
+
+#if !LRUTRACK_32BIT_KEY
+int lrutrack_fc_insert(lrutrack_fc_t *t, lrutrack_fc_thread_t *self,
+    const void *key, uint32_t key_length, lrutrack_value_t value)
+#else
+int lrutrack_fc_insert(lrutrack_fc_t *t, lrutrack_fc_thread_t *self,
+    uint32_t key, lrutrack_value_t value)
+#endif
+{
+    assert(t && self);
+
+    self->op = LRUTRACK_FC_OP_INSERT;
+    self->key = key;
+#if !LRUTRACK_32BIT_KEY
+    self->key_length = key_length;
+#endif
+    self->value = value;
+    lrutrack_fc_run(t, self);
+
+    return self->result;
+}
+
+#if !LRUTRACK_32BIT_KEY
+int lrutrack_fc_remove(lrutrack_fc_t *t, lrutrack_fc_thread_t *self,
+    const void *key, uint32_t key_length)
+#else
+int lrutrack_fc_remove(lrutrack_fc_t *t, lrutrack_fc_thread_t *self,
+    uint32_t key)
+#endif
+{
+    assert(t && self);
+
+    self->op = LRUTRACK_FC_OP_REMOVE;
+    self->key = key;
+#if !LRUTRACK_32BIT_KEY
+    self->key_length = key_length;
+#endif
+    lrutrack_fc_run(t, self);
+
+    return self->result;
+}
+
+#if !LRUTRACK_32BIT_KEY
+lrutrack_value_t lrutrack_fc_use(lrutrack_fc_t *t, lrutrack_fc_thread_t *self,
+    const void *key, uint32_t key_length)
+#else
+lrutrack_value_t lrutrack_fc_use(lrutrack_fc_t *t, lrutrack_fc_thread_t *self,
+    uint32_t key)
+#endif
+{
+    assert(t && self);
+
+    self->op = LRUTRACK_FC_OP_USE;
+    self->key = key;
+#if !LRUTRACK_32BIT_KEY
+    self->key_length = key_length;
+#endif
+    lrutrack_fc_run(t, self);
+
+    return self->value;
+}
+
+#if !LRUTRACK_32BIT_KEY
+
+//
+// c-string key helper functions
+
+int lrutrack_fc_insert_strkey(lrutrack_fc_t *t, lrutrack_fc_thread_t *self,
+    const char *key, lrutrack_value_t value) {
+    assert(key != NULL && strlen(key) <= UINT32_MAX);
+    return lrutrack_fc_insert(t, self, key, (uint32_t)strlen(key), value);
+}
+
+int lrutrack_fc_remove_strkey(lrutrack_fc_t *t, lrutrack_fc_thread_t *self,
+    const char *key) {
+    assert(key != NULL && strlen(key) <= UINT32_MAX);
+    return lrutrack_fc_remove(t, self, key, (uint32_t)strlen(key));
+}
+
+lrutrack_value_t lrutrack_fc_use_strkey(lrutrack_fc_t *t,
+    lrutrack_fc_thread_t *self, const char *key) {
+    assert(key != NULL && strlen(key) <= UINT32_MAX);
+    return lrutrack_fc_use(t, self, key, (uint32_t)strlen(key));
+}
+
+#endif
+
+//
+
+void lrutrack_fc_remove_all(lrutrack_fc_t *t, lrutrack_fc_thread_t *self) {
+    assert(t && self);
+
+    self->op = LRUTRACK_FC_OP_REMOVE_ALL;
+    lrutrack_fc_run(t, self);
+}
+
+int lrutrack_fc_remove_lru(lrutrack_fc_t *t, lrutrack_fc_thread_t *self) {
+    assert(t && self);
+
+    self->op = LRUTRACK_FC_OP_REMOVE_LRU;
+    lrutrack_fc_run(t, self);
+
+    return self->result;
+}
+
+//
+
+void lrutrack_fc_stats(const lrutrack_fc_t *t, uint64_t *num_batches,
+    uint64_t *num_ops) {
+    assert(t);
+
+    if (num_batches) {
+        *num_batches = atomic_load_explicit(&t->num_batches,
+            memory_order_relaxed);
+    }
+    if (num_ops)
+        *num_ops = atomic_load_explicit(&t->num_ops, memory_order_relaxed);
+}
@@ -0,0 +1,102 @@
+// Least-recently-used tracking helper in C
+// Flat-combining front-end for a single tracker shared by many threads
+
+#ifndef LRUTRACK_FC_H
+#define LRUTRACK_FC_H
+
+#include "lrutrack.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//
+// Types:
+// Threads attach to get a publication record. An operation is published in
+// the caller's record, then whichever thread gets the combiner lock runs all
+// published operations against the one lrutrack_t in a single pass and
+// hands the results back through the records. Under contention the lock
+// changes hands once per batch instead of once per operation, and the
+// tracker's rows stay in the combiner's cache.
+//
+// evict_func runs on the combining thread, which may be any attached
+// thread. A record belongs to one thread at a time.
+
+#define LRUTRACK_FC_MAX_THREADS 64
+
+typedef struct lrutrack_fc_t lrutrack_fc_t;
+typedef struct lrutrack_fc_thread_t lrutrack_fc_thread_t;
+
+//
+//
+
+lrutrack_fc_t *lrutrack_fc_create(uint32_t hash_table_size,
+    uint32_t num_initial_items, uint32_t hash_seed,
+    lrutrack_value_t invalid_value,
+    void *evict_user, lrutrack_evict_func_t evict_func,
+    const lrutrack_allocator_t *allocator);
+void lrutrack_fc_destroy(lrutrack_fc_t *t);
+
+// NULL when LRUTRACK_FC_MAX_THREADS records are attached already
+lrutrack_fc_thread_t *lrutrack_fc_attach(lrutrack_fc_t *t);
+void lrutrack_fc_detach(lrutrack_fc_t *t, lrutrack_fc_thread_t *self);
+
+#if !LRUTRACK_32BIT_KEY
+
+//
+// Variable-length key functions:
+
+int lrutrack_fc_insert(lrutrack_fc_t *t, lrutrack_fc_thread_t *self,
+    const void *key, uint32_t key_length, lrutrack_value_t value);
+
+int lrutrack_fc_remove(lrutrack_fc_t *t, lrutrack_fc_thread_t *self,
+    const void *key, uint32_t key_length);
+
+lrutrack_value_t lrutrack_fc_use(lrutrack_fc_t *t, lrutrack_fc_thread_t *self,
+    const void *key, uint32_t key_length);
+
+//
+// Null-terminated string key helper functions:
+
+int lrutrack_fc_insert_strkey(lrutrack_fc_t *t, lrutrack_fc_thread_t *self,
+    const char *key, lrutrack_value_t value);
+
+int lrutrack_fc_remove_strkey(lrutrack_fc_t *t, lrutrack_fc_thread_t *self,
+    const char *key);
+
+lrutrack_value_t lrutrack_fc_use_strkey(lrutrack_fc_t *t,
+    lrutrack_fc_thread_t *self, const char *key);
+
+#else
+
+//
+// 32-bit key functions:
+
+int lrutrack_fc_insert(lrutrack_fc_t *t, lrutrack_fc_thread_t *self,
+    uint32_t key, lrutrack_value_t value);
+int lrutrack_fc_remove(lrutrack_fc_t *t, lrutrack_fc_thread_t *self,
+    uint32_t key);
+lrutrack_value_t lrutrack_fc_use(lrutrack_fc_t *t, lrutrack_fc_thread_t *self,
+    uint32_t key);
+
+#endif // LRUTRACK_32BIT_KEY
+
+//
+// Cleaning functions:
+
+void lrutrack_fc_remove_all(lrutrack_fc_t *t, lrutrack_fc_thread_t *self);
+int lrutrack_fc_remove_lru(lrutrack_fc_t *t, lrutrack_fc_thread_t *self);
+
+//
+// Statistics:
+
+// Combining passes that ran at least one operation, and the operations
+// they ran. Their ratio is the average batch size.
+void lrutrack_fc_stats(const lrutrack_fc_t *t, uint64_t *num_batches,
+    uint64_t *num_ops);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
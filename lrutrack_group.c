@@ -0,0 +1,220 @@
+// Least-recently-used tracking helper in C
+// Tracker groups: one entry budget and eviction order across trackers
+
+#include "lrutrack_group.h"
+
+#include <string.h>
+#include <assert.h>
+
+#define LRUTRACK_GROUP_ALIGNMENT 16
+
+typedef struct lrutrack_group_member_t {
+    lrutrack_t *tracker;
+    int skip; // Only pinned entries left, during one lrutrack_group_remove_lru
+} lrutrack_group_member_t;
+
+typedef struct lrutrack_group_t {
+    lrutrack_group_member_t *members;
+    uint32_t num_members;
+    uint32_t members_capacity;
+    uint64_t budget;
+    uint32_t clock; // Advanced by each insert and use, wraps around
+    lrutrack_allocator_t allocator;
+} lrutrack_group_t;
+
+//
+// Private functions
+
+// Wrap-around safe while stamps are less than 2^31 ticks apart
+static int lrutrack_group_is_older(uint32_t a, uint32_t b) {
+    return (int32_t)(a - b) < 0;
+}
+
+static uint32_t lrutrack_group_find(const lrutrack_group_t *g,
+    const lrutrack_t *t) {
+    for (uint32_t i = 0; i < g->num_members; ++i) {
+        if (g->members[i].tracker == t)
+            return i;
+    }
+    return UINT32_MAX;
+}
+
+// Evicts until the members hold less than the budget
+static int lrutrack_group_make_room(lrutrack_group_t *g) {
+    uint64_t count = lrutrack_group_count(g);
+    while (count >= g->budget) {
+        if (lrutrack_group_remove_lru(g) != LRUTRACK_OK)
+            return LRUTRACK_OOM;
+        count = lrutrack_group_count(g);
+    }
+    return LRUTRACK_OK;
+}
+
+//
+// Public functions
+
+lrutrack_group_t *lrutrack_group_create(uint64_t budget,
+    const lrutrack_allocator_t *allocator) {
+    assert(allocator && allocator->alloc_func && allocator->dealloc_func);
+
+    lrutrack_group_t *g = allocator->alloc_func(allocator->user, sizeof(*g),
+        LRUTRACK_GROUP_ALIGNMENT);
+    if (!g)
+        return NULL;
+
+    memset(g, 0, sizeof(*g));
+    g->budget = budget;
+    g->allocator = *allocator;
+
+    return g;
+}
+
+void lrutrack_group_destroy(lrutrack_group_t *g) {
+    assert(g);
+
+    for (uint32_t i = 0; i < g->num_members; ++i)
+        lrutrack_set_clock(g->members[i].tracker, NULL);
+
+    if (g->members) {
+        g->allocator.dealloc_func(g->allocator.user, g->members,
+            sizeof(*g->members) * g->members_capacity);
+    }
+    g->allocator.dealloc_func(g->allocator.user, g, sizeof(*g));
+}
+
+int lrutrack_group_add(lrutrack_group_t *g, lrutrack_t *t) {
+    assert(g && t);
+
+    if (lrutrack_group_find(g, t) != UINT32_MAX)
+        return LRUTRACK_ERROR;
+
+    if (g->num_members == g->members_capacity) {
+        uint32_t capacity = g->members_capacity ?
+            g->members_capacity * 2 : 8;
+        lrutrack_group_member_t *members = g->allocator.alloc_func(
+            g->allocator.user, sizeof(*members) * capacity,
+            LRUTRACK_GROUP_ALIGNMENT);
+        if (!members)
+            return LRUTRACK_OOM;
+
+        if (g->members) {
+            memcpy(members, g->members, sizeof(*members) * g->num_members);
+            g->allocator.dealloc_func(g->allocator.user, g->members,
+                sizeof(*members) * g->members_capacity);
+        }
+        g->members = members;
+        g->members_capacity = capacity;
+    }
+
+    int result = lrutrack_set_clock(t, &g->clock);
+    if (result != LRUTRACK_OK)
+        return result;
+
+    g->members[g->num_members].tracker = t;
+    g->members[g->num_members].skip = 0;
+    g->num_members++;
+
+    return LRUTRACK_OK;
+}
+
+int lrutrack_group_remove_member(lrutrack_group_t *g, lrutrack_t *t) {
+    assert(g && t);
+
+    uint32_t i = lrutrack_group_find(g, t);
+    if (i == UINT32_MAX)
+        return LRUTRACK_NOT_FOUND;
+
+    lrutrack_set_clock(t, NULL);
+    g->members[i] = g->members[--g->num_members];
+
+    return LRUTRACK_OK;
+}
+
+void lrutrack_group_set_budget(lrutrack_group_t *g, uint64_t budget) {
+    assert(g);
+    g->budget = budget;
+}
+
+#if !LRUTRACK_32BIT_KEY
+int lrutrack_group_insert(lrutrack_group_t *g, lrutrack_t *t,
+    const void *key, uint32_t key_length, lrutrack_value_t value)
+#else
+int lrutrack_group_insert(lrutrack_group_t *g, lrutrack_t *t, uint32_t key,
+    lrutrack_value_t value)
+#endif
+{
+    assert(g && lrutrack_group_find(g, t) != UINT32_MAX);
+
+    int result = lrutrack_group_make_room(g);
+    if (result != LRUTRACK_OK)
+        return result;
+
+    g->clock++;
+
+#if !LRUTRACK_32BIT_KEY
+    return lrutrack_insert(t, key, key_length, value);
+#else
+    return lrutrack_insert(t, key, value);
+#endif
+}
+
+#if !LRUTRACK_32BIT_KEY
+lrutrack_value_t lrutrack_group_use(lrutrack_group_t *g, lrutrack_t *t,
+    const void *key, uint32_t key_length)
+#else
+lrutrack_value_t lrutrack_group_use(lrutrack_group_t *g, lrutrack_t *t,
+    uint32_t key)
+#endif
+{
+    assert(g && lrutrack_group_find(g, t) != UINT32_MAX);
+
+    g->clock++;
+
+#if !LRUTRACK_32BIT_KEY
+    return lrutrack_use(t, key, key_length);
+#else
+    return lrutrack_use(t, key);
+#endif
+}
+
+int lrutrack_group_remove_lru(lrutrack_group_t *g) {
+    assert(g);
+
+    for (uint32_t i = 0; i < g->num_members; ++i)
+        g->members[i].skip = 0;
+
+    for (;;) {
+        uint32_t victim = UINT32_MAX;
+        uint32_t oldest = 0;
+        for (uint32_t i = 0; i < g->num_members; ++i) {
+            uint32_t stamp;
+            if (g->members[i].skip ||
+                lrutrack_lru_stamp(g->members[i].tracker, &stamp) !=
+                    LRUTRACK_OK)
+                continue;
+
+            if (victim == UINT32_MAX ||
+                lrutrack_group_is_older(stamp, oldest)) {
+                victim = i;
+                oldest = stamp;
+            }
+        }
+
+        if (victim == UINT32_MAX)
+            return LRUTRACK_NOT_FOUND;
+
+        if (lrutrack_remove_lru(g->members[victim].tracker) == LRUTRACK_OK)
+            return LRUTRACK_OK;
+
+        g->members[victim].skip = 1;
+    }
+}
+
+uint64_t lrutrack_group_count(const lrutrack_group_t *g) {
+    assert(g);
+
+    uint64_t count = 0;
+    for (uint32_t i = 0; i < g->num_members; ++i)
+        count += lrutrack_count(g->members[i].tracker);
+    return count;
+}
@@ -0,0 +1,71 @@
+// Least-recently-used tracking helper in C
+// Tracker groups: one entry budget and eviction order across trackers
+
+#ifndef LRUTRACK_GROUP_H
+#define LRUTRACK_GROUP_H
+
+#include "lrutrack.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//
+// Types:
+// A group joins independently created trackers under one budget of entries.
+// The group keeps a clock that its functions advance and that members stamp
+// their rows with as they are used (see lrutrack_set_clock), so the member
+// whose least recently used row has the oldest stamp holds the globally
+// least recently used entry, approximately: rows share one stamp, and
+// members used directly stamp the clock's current value without advancing
+// it. Inserting through the group evicts in that order while the members
+// together are at the budget, so capacity follows demand. Finding the
+// victim and counting the members are O(members). Groups are not thread
+// safe, and members must not be in-place trackers.
+
+typedef struct lrutrack_group_t lrutrack_group_t;
+
+//
+//
+
+lrutrack_group_t *lrutrack_group_create(uint64_t budget,
+    const lrutrack_allocator_t *allocator);
+
+// Members stay alive, their clocks are unset
+void lrutrack_group_destroy(lrutrack_group_t *g);
+
+int lrutrack_group_add(lrutrack_group_t *g, lrutrack_t *t);
+int lrutrack_group_remove_member(lrutrack_group_t *g, lrutrack_t *t);
+
+void lrutrack_group_set_budget(lrutrack_group_t *g, uint64_t budget);
+
+#if !LRUTRACK_32BIT_KEY
+
+// LRUTRACK_OOM when the budget is reached and nothing can be evicted
+int lrutrack_group_insert(lrutrack_group_t *g, lrutrack_t *t,
+    const void *key, uint32_t key_length, lrutrack_value_t value);
+
+lrutrack_value_t lrutrack_group_use(lrutrack_group_t *g, lrutrack_t *t,
+    const void *key, uint32_t key_length);
+
+#else
+
+int lrutrack_group_insert(lrutrack_group_t *g, lrutrack_t *t, uint32_t key,
+    lrutrack_value_t value);
+lrutrack_value_t lrutrack_group_use(lrutrack_group_t *g, lrutrack_t *t,
+    uint32_t key);
+
+#endif // LRUTRACK_32BIT_KEY
+
+// Evicts from the member with the oldest least recently used row, trying
+// the next oldest when a member only holds pinned entries
+int lrutrack_group_remove_lru(lrutrack_group_t *g);
+
+// Entries in all members
+uint64_t lrutrack_group_count(const lrutrack_group_t *g);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // LRUTRACK_GROUP_H
@@ -0,0 +1,62 @@
+// Least-recently-used tracking helper in C
+// Internal hashing helpers shared by the tracker implementations
+
+#ifndef LRUTRACK_HASH_H
+#define LRUTRACK_HASH_H
+
+#include <stdint.h>
+#include <string.h>
+
+// MurmurHash2, full 32 bits
+static inline uint32_t lrutrack_murmur2(const void *key, uint32_t len,
+    uint32_t seed) {
+    const uint32_t m = 0x5bd1e995;
+    const uint32_t r = 24;
+
+    uint32_t h = seed ^ (uint32_t)len;
+
+    const uint8_t *data = (const uint8_t *)key;
+
+    while (len >= 4) {
+        uint32_t k;
+        k = data[0];
+        k |= (uint32_t)data[1] << 8;
+        k |= (uint32_t)data[2] << 16;
+        k |= (uint32_t)data[3] << 24;
+
+        k *= m;
+        k ^= k >> r;
+        k *= m;
+
+        h *= m;
+        h ^= k;
+
+        data += 4;
+        len -= 4;
+    }
+
+    switch (len) {
+        case 3:
+            h ^= (uint32_t)data[2] << 16;
+            // Fall through
+        case 2:
+            h ^= (uint32_t)data[1] << 8;
+            // Fall through
+        case 1:
+            h ^= data[0];
+            h *= m;
+    };
+
+    h ^= h >> 13;
+    h *= m;
+    h ^= h >> 15;
+    return h;
+}
+
+static inline int lrutrack_cmp_keys(const void *a, uint32_t a_length,
+    const void *b, uint32_t b_length) {
+    if (a_length != b_length) return 0;
+    return memcmp(a, b, a_length) == 0 ? 1 : 0;
+}
+
+#endif
@@ -0,0 +1,568 @@
+// Least-recently-used tracking helper in C
+// Lock-free concurrent variant with CLOCK eviction
+
+#include "lrutrack_lf.h"
+#include "lrutrack_epoch.h"
+#include "lrutrack_hash.h"
+
+#include <stdatomic.h>
+#include <string.h>
+#include <assert.h>
+
+#define LRUTRACK_LF_CACHE_LINE 64
+
+static int lrutrack_lf_is_power_of_two(uint32_t x) {
+    return x > 0 && (x & (x - 1)) == 0;
+}
+
+//
+
+// Immutable once published, apart from the reference bit
+typedef struct lrutrack_lf_entry_t {
+    lrutrack_epoch_node_t retire; // First member, freed through the epoch
+    uint32_t hash;
+    lrutrack_value_t value;
+    _Atomic uint32_t referenced;
+#if !LRUTRACK_32BIT_KEY
+    uint32_t key_length;
+    uint8_t key[]; // key_length bytes
+#else
+    uint32_t key;
+#endif
+} lrutrack_lf_entry_t;
+
+// Hashes sit next to the pointers, so that lookups only follow the
+// pointer of a likely match
+typedef struct lrutrack_lf_slot_t {
+    uint32_t hash;
+    lrutrack_lf_entry_t *entry;
+} lrutrack_lf_slot_t;
+
+// Contents of a bucket, replaced as a whole by writers
+typedef struct lrutrack_lf_chain_t {
+    lrutrack_epoch_node_t retire; // First member, freed through the epoch
+    uint32_t num_entries;
+    lrutrack_lf_slot_t entries[];
+} lrutrack_lf_chain_t;
+
+typedef struct lrutrack_lf_t {
+    lrutrack_epoch_t epoch;
+    _Atomic(lrutrack_lf_chain_t *) *buckets; // NULL = empty bucket
+    uint32_t num_buckets;
+    uint32_t num_items; // Capacity
+    uint32_t seed;
+    lrutrack_value_t invalid_value;
+    void *evict_user;
+    lrutrack_evict_func_t evict_func;
+    lrutrack_allocator_t allocator;
+
+    _Alignas(LRUTRACK_LF_CACHE_LINE) _Atomic uint32_t count;
+    _Alignas(LRUTRACK_LF_CACHE_LINE) _Atomic uint32_t clock_hand;
+} lrutrack_lf_t;
+
+//
+// Memory
+
+static size_t lrutrack_lf_entry_bytesize(const lrutrack_lf_entry_t *entry) {
+#if !LRUTRACK_32BIT_KEY
+    return sizeof(lrutrack_lf_entry_t) + entry->key_length;
+#else
+    (void)entry;
+    return sizeof(lrutrack_lf_entry_t);
+#endif
+}
+
+static size_t lrutrack_lf_chain_bytesize(uint32_t num_entries) {
+    return sizeof(lrutrack_lf_chain_t) +
+        sizeof(lrutrack_lf_slot_t) * num_entries;
+}
+
+static void lrutrack_lf_free_entry(void *user, lrutrack_epoch_node_t *node) {
+    lrutrack_lf_t *t = user;
+    lrutrack_lf_entry_t *entry = (lrutrack_lf_entry_t *)node;
+    t->allocator.dealloc_func(t->allocator.user, entry,
+        lrutrack_lf_entry_bytesize(entry));
+}
+
+static void lrutrack_lf_free_chain(void *user, lrutrack_epoch_node_t *node) {
+    lrutrack_lf_t *t = user;
+    lrutrack_lf_chain_t *chain = (lrutrack_lf_chain_t *)node;
+    t->allocator.dealloc_func(t->allocator.user, chain,
+        lrutrack_lf_chain_bytesize(chain->num_entries));
+}
+
+static void lrutrack_lf_retire_entry(lrutrack_lf_t *t,
+    lrutrack_lf_entry_t *entry) {
+    lrutrack_epoch_retire(&t->epoch, &entry->retire, t,
+        lrutrack_lf_free_entry);
+}
+
+static void lrutrack_lf_retire_chain(lrutrack_lf_t *t,
+    lrutrack_lf_chain_t *chain) {
+    lrutrack_epoch_retire(&t->epoch, &chain->retire, t,
+        lrutrack_lf_free_chain);
+}
+
+// Copy of chain without entry skip (UINT32_MAX = none) and with entry add
+// appended (NULL = none). The result is NULL when nothing is left.
+static int lrutrack_lf_build(lrutrack_lf_t *t,
+    const lrutrack_lf_chain_t *chain, uint32_t skip, lrutrack_lf_entry_t *add,
+    lrutrack_lf_chain_t **result) {
+    uint32_t num_entries = chain ? chain->num_entries : 0;
+    uint32_t num_new = num_entries - (skip != UINT32_MAX) + (add != NULL);
+
+    *result = NULL;
+    if (num_new == 0)
+        return LRUTRACK_OK;
+
+    lrutrack_lf_chain_t *copy = t->allocator.alloc_func(t->allocator.user,
+        lrutrack_lf_chain_bytesize(num_new), sizeof(void *));
+    if (!copy)
+        return LRUTRACK_OOM;
+
+    uint32_t j = 0;
+    for (uint32_t i = 0; i < num_entries; ++i) {
+        if (i != skip)
+            copy->entries[j++] = chain->entries[i];
+    }
+    if (add) {
+        copy->entries[j].hash = add->hash;
+        copy->entries[j++].entry = add;
+    }
+
+    assert(j == num_new);
+    copy->num_entries = num_new;
+
+    *result = copy;
+    return LRUTRACK_OK;
+}
+
+//
+// Private functions
+
+#if !LRUTRACK_32BIT_KEY
+static uint32_t lrutrack_lf_hash(const lrutrack_lf_t *t, const void *key,
+    uint32_t key_length) {
+    return lrutrack_murmur2(key, key_length, t->seed);
+}
+
+static uint32_t lrutrack_lf_find(const lrutrack_lf_chain_t *chain,
+    uint32_t hash, const void *key, uint32_t key_length)
+#else
+static uint32_t lrutrack_lf_find(const lrutrack_lf_chain_t *chain,
+    uint32_t hash, uint32_t key)
+#endif
+{
+    if (!chain)
+        return UINT32_MAX;
+
+    for (uint32_t i = 0; i < chain->num_entries; ++i) {
+        if (chain->entries[i].hash != hash)
+            continue;
+        const lrutrack_lf_entry_t *entry = chain->entries[i].entry;
+#if !LRUTRACK_32BIT_KEY
+        if (lrutrack_cmp_keys(entry->key, entry->key_length, key, key_length))
+            return i;
+#else
+        if (entry->key == key)
+            return i;
+#endif
+    }
+
+    return UINT32_MAX;
+}
+
+// Publishes next in place of chain. On success the caller owns chain and
+// the entries it dropped, otherwise next is freed.
+static int lrutrack_lf_publish(lrutrack_lf_t *t, uint32_t bucket,
+    lrutrack_lf_chain_t *chain, lrutrack_lf_chain_t *next) {
+    if (atomic_compare_exchange_strong_explicit(&t->buckets[bucket], &chain,
+        next, memory_order_acq_rel, memory_order_relaxed))
+        return 1;
+
+    // Never published, nobody else can see it
+    if (next) {
+        t->allocator.dealloc_func(t->allocator.user, next,
+            lrutrack_lf_chain_bytesize(next->num_entries));
+    }
+    return 0;
+}
+
+// Unpublishes the entry at index of chain. LRUTRACK_NOT_FOUND when another
+// writer changed the bucket first.
+static int lrutrack_lf_unlink(lrutrack_lf_t *t, uint32_t bucket,
+    lrutrack_lf_chain_t *chain, uint32_t index) {
+    lrutrack_lf_chain_t *next;
+    int result = lrutrack_lf_build(t, chain, index, NULL, &next);
+    if (result != LRUTRACK_OK)
+        return result;
+
+    if (!lrutrack_lf_publish(t, bucket, chain, next))
+        return LRUTRACK_NOT_FOUND;
+
+    lrutrack_lf_entry_t *entry = chain->entries[index].entry;
+    t->evict_func(t->evict_user, entry->value);
+    atomic_fetch_sub_explicit(&t->count, 1, memory_order_relaxed);
+
+    lrutrack_lf_retire_chain(t, chain);
+    lrutrack_lf_retire_entry(t, entry);
+
+    return LRUTRACK_OK;
+}
+
+// CLOCK sweep over the buckets. Two laps honour reference bits, a third
+// one takes any entry so that busy readers cannot starve eviction. The
+// caller is inside the epoch.
+static int lrutrack_lf_evict(lrutrack_lf_t *t) {
+    uint32_t mask = t->num_buckets - 1;
+
+    for (uint32_t i = 0; i < t->num_buckets * 3; ++i) {
+        if (atomic_load_explicit(&t->count, memory_order_relaxed) == 0)
+            return LRUTRACK_NOT_FOUND;
+
+        int force = i >= t->num_buckets * 2;
+        uint32_t bucket = atomic_fetch_add_explicit(&t->clock_hand, 1,
+            memory_order_relaxed) & mask;
+        lrutrack_lf_chain_t *chain = atomic_load_explicit(&t->buckets[bucket],
+            memory_order_acquire);
+        if (!chain)
+            continue;
+
+        for (uint32_t j = 0; j < chain->num_entries; ++j) {
+            lrutrack_lf_entry_t *entry = chain->entries[j].entry;
+            if (!force && atomic_load_explicit(&entry->referenced,
+                memory_order_relaxed)) {
+                atomic_store_explicit(&entry->referenced, 0,
+                    memory_order_relaxed);
+                continue;
+            }
+
+            // Losing the race moves the hand on
+            int result = lrutrack_lf_unlink(t, bucket, chain, j);
+            if (result != LRUTRACK_NOT_FOUND)
+                return result;
+            break;
+        }
+    }
+
+    return LRUTRACK_NOT_FOUND;
+}
+
+//
+// Public functions
+
+lrutrack_lf_t *lrutrack_lf_create(uint32_t num_buckets, uint32_t num_items,
+    uint32_t hash_seed, lrutrack_value_t invalid_value,
+    void *evict_user, lrutrack_evict_func_t evict_func,
+    const lrutrack_allocator_t *allocator) {
+    assert(allocator && allocator->alloc_func && allocator->dealloc_func);
+    assert(lrutrack_lf_is_power_of_two(num_buckets));
+    assert(evict_func);
+
+    lrutrack_lf_t *t = allocator->alloc_func(allocator->user,
+        sizeof(lrutrack_lf_t), LRUTRACK_LF_CACHE_LINE);
+    if (!t)
+        return NULL;
+
+    memset(t, 0, sizeof(*t));
+
+    t->buckets = allocator->alloc_func(allocator->user,
+        sizeof(*t->buckets) * num_buckets, LRUTRACK_LF_CACHE_LINE);
+    if (!t->buckets) {
+        allocator->dealloc_func(allocator->user, t, sizeof(*t));
+        return NULL;
+    }
+
+    for (uint32_t i = 0; i < num_buckets; ++i)
+        atomic_init(&t->buckets[i], NULL);
+
+    lrutrack_epoch_init(&t->epoch);
+    t->num_buckets = num_buckets;
+    t->num_items = num_items;
+    t->seed = hash_seed;
+    t->invalid_value = invalid_value;
+    t->evict_user = evict_user;
+    t->evict_func = evict_func;
+    t->allocator = *allocator;
+    atomic_init(&t->count, 0);
+    atomic_init(&t->clock_hand, 0);
+
+    return t;
+}
+
+void lrutrack_lf_destroy(lrutrack_lf_t *t) {
+    assert(t);
+
+    // No readers left, everything can go right away
+    for (uint32_t i = 0; i < t->num_buckets; ++i) {
+        lrutrack_lf_chain_t *chain = atomic_load_explicit(&t->buckets[i],
+            memory_order_relaxed);
+        if (!chain)
+            continue;
+
+        for (uint32_t j = 0; j < chain->num_entries; ++j) {
+            lrutrack_lf_entry_t *entry = chain->entries[j].entry;
+            t->evict_func(t->evict_user, entry->value);
+            lrutrack_lf_free_entry(t, &entry->retire);
+        }
+        lrutrack_lf_free_chain(t, &chain->retire);
+    }
+
+    lrutrack_epoch_destroy(&t->epoch);
+
+    t->allocator.dealloc_func(t->allocator.user, t->buckets,
+        sizeof(*t->buckets) * t->num_buckets);
+    t->allocator.dealloc_func(t->allocator.user, t, sizeof(*t));
+}
+
+#if !LRUTRACK_32BIT_KEY
+int lrutrack_lf_insert(lrutrack_lf_t *t, const void *key, uint32_t key_length,
+    lrutrack_value_t value)
+#else
+int lrutrack_lf_insert(lrutrack_lf_t *t, uint32_t key, lrutrack_value_t value)
+#endif
+{
+    assert(t);
+    assert(value != t->invalid_value);
+
+#if !LRUTRACK_32BIT_KEY
+    assert(key && key_length != 0);
+    uint32_t hash = lrutrack_lf_hash(t, key, key_length);
+    size_t entry_bytesize = sizeof(lrutrack_lf_entry_t) + key_length;
+#else
+    uint32_t hash = key;
+    size_t entry_bytesize = sizeof(lrutrack_lf_entry_t);
+#endif
+
+    lrutrack_lf_entry_t *entry = t->allocator.alloc_func(t->allocator.user,
+        entry_bytesize, sizeof(void *));
+    if (!entry)
+        return LRUTRACK_OOM;
+
+    entry->hash = hash;
+    entry->value = value;
+    atomic_init(&entry->referenced, 1);
+#if !LRUTRACK_32BIT_KEY
+    entry->key_length = key_length;
+    memcpy(entry->key, key, key_length);
+#else
+    entry->key = key;
+#endif
+
+    uint32_t bucket = hash & (t->num_buckets - 1);
+    lrutrack_epoch_token_t token = lrutrack_epoch_enter(&t->epoch);
+    int result;
+
+    // Counted before it is published, so that a concurrent removal of the
+    // entry cannot take the count below zero
+    atomic_fetch_add_explicit(&t->count, 1, memory_order_relaxed);
+
+    for (;;) {
+        lrutrack_lf_chain_t *chain = atomic_load_explicit(&t->buckets[bucket],
+            memory_order_acquire);
+
+#if !LRUTRACK_32BIT_KEY
+        if (lrutrack_lf_find(chain, hash, key, key_length) != UINT32_MAX) {
+#else
+        if (lrutrack_lf_find(chain, hash, key) != UINT32_MAX) {
+#endif
+            result = LRUTRACK_ERROR;
+            break;
+        }
+
+        lrutrack_lf_chain_t *next;
+        result = lrutrack_lf_build(t, chain, UINT32_MAX, entry, &next);
+        if (result != LRUTRACK_OK)
+            break;
+
+        if (lrutrack_lf_publish(t, bucket, chain, next)) {
+            if (chain)
+                lrutrack_lf_retire_chain(t, chain);
+            break;
+        }
+    }
+
+    if (result != LRUTRACK_OK) {
+        // Never published
+        atomic_fetch_sub_explicit(&t->count, 1, memory_order_relaxed);
+        t->allocator.dealloc_func(t->allocator.user, entry, entry_bytesize);
+    } else {
+        while (atomic_load_explicit(&t->count, memory_order_relaxed) >
+            t->num_items && lrutrack_lf_evict(t) == LRUTRACK_OK)
+            ;
+    }
+
+    lrutrack_epoch_exit(&t->epoch, token);
+
+    return result;
+}
+
+#if !LRUTRACK_32BIT_KEY
+int lrutrack_lf_remove(lrutrack_lf_t *t, const void *key, uint32_t key_length)
+#else
+int lrutrack_lf_remove(lrutrack_lf_t *t, uint32_t key)
+#endif
+{
+    assert(t);
+
+#if !LRUTRACK_32BIT_KEY
+    assert(key && key_length != 0);
+    uint32_t hash = lrutrack_lf_hash(t, key, key_length);
+#else
+    uint32_t hash = key;
+#endif
+
+    uint32_t bucket = hash & (t->num_buckets - 1);
+    lrutrack_epoch_token_t token = lrutrack_epoch_enter(&t->epoch);
+    int result;
+
+    do {
+        lrutrack_lf_chain_t *chain = atomic_load_explicit(&t->buckets[bucket],
+            memory_order_acquire);
+
+#if !LRUTRACK_32BIT_KEY
+        uint32_t index = lrutrack_lf_find(chain, hash, key, key_length);
+#else
+        uint32_t index = lrutrack_lf_find(chain, hash, key);
+#endif
+        if (index == UINT32_MAX) {
+            lrutrack_epoch_exit(&t->epoch, token);
+            return LRUTRACK_NOT_FOUND;
+        }
+
+        // Lost to another writer, look again
+        result = lrutrack_lf_unlink(t, bucket, chain, index);
+    } while (result == LRUTRACK_NOT_FOUND);
+
+    lrutrack_epoch_exit(&t->epoch, token);
+
+    return result;
+}
+
+#if !LRUTRACK_32BIT_KEY
+static lrutrack_value_t lrutrack_lf_read(lrutrack_lf_t *t, const void *key,
+    uint32_t key_length, int touch)
+#else
+static lrutrack_value_t lrutrack_lf_read(lrutrack_lf_t *t, uint32_t key,
+    int touch)
+#endif
+{
+    assert(t);
+
+#if !LRUTRACK_32BIT_KEY
+    assert(key && key_length != 0);
+    uint32_t hash = lrutrack_lf_hash(t, key, key_length);
+#else
+    uint32_t hash = key;
+#endif
+
+    lrutrack_value_t value = t->invalid_value;
+    lrutrack_epoch_token_t token = lrutrack_epoch_enter(&t->epoch);
+
+    lrutrack_lf_chain_t *chain = atomic_load_explicit(
+        &t->buckets[hash & (t->num_buckets - 1)], memory_order_acquire);
+#if !LRUTRACK_32BIT_KEY
+    uint32_t index = lrutrack_lf_find(chain, hash, key, key_length);
+#else
+    uint32_t index = lrutrack_lf_find(chain, hash, key);
+#endif
+
+    if (index != UINT32_MAX) {
+        lrutrack_lf_entry_t *entry = chain->entries[index].entry;
+        value = entry->value;
+
+        // Checking first keeps hot entries' lines shared
+        if (touch && !atomic_load_explicit(&entry->referenced,
+            memory_order_relaxed))
+            atomic_store_explicit(&entry->referenced, 1, memory_order_relaxed);
+    }
+
+    lrutrack_epoch_exit(&t->epoch, token);
+
+    return value;
+}
+
+#if !LRUTRACK_32BIT_KEY
+lrutrack_value_t lrutrack_lf_use(lrutrack_lf_t *t, const void *key,
+    uint32_t key_length) {
+    return lrutrack_lf_read(t, key, key_length, 1);
+}
+
+lrutrack_value_t lrutrack_lf_peek(lrutrack_lf_t *t, const void *key,
+    uint32_t key_length) {
+    return lrutrack_lf_read(t, key, key_length, 0);
+}
+#else
+lrutrack_value_t lrutrack_lf_use(lrutrack_lf_t *t, uint32_t key) {
+    return lrutrack_lf_read(t, key, 1);
+}
+
+lrutrack_value_t lrutrack_lf_peek(lrutrack_lf_t *t, uint32_t key) {
+    return lrutrack_lf_read(t, key, 0);
+}
+#endif
+
+#if !LRUTRACK_32BIT_KEY
+
+//
+// c-string key helper functions
+
+int lrutrack_lf_insert_strkey(lrutrack_lf_t *t, const char *key,
+    lrutrack_value_t value) {
+    assert(key != NULL && strlen(key) <= UINT32_MAX);
+    return lrutrack_lf_insert(t, key, (uint32_t)strlen(key), value);
+}
+
+int lrutrack_lf_remove_strkey(lrutrack_lf_t *t, const char *key) {
+    assert(key != NULL && strlen(key) <= UINT32_MAX);
+    return lrutrack_lf_remove(t, key, (uint32_t)strlen(key));
+}
+
+lrutrack_value_t lrutrack_lf_use_strkey(lrutrack_lf_t *t, const char *key) {
+    assert(key != NULL && strlen(key) <= UINT32_MAX);
+    return lrutrack_lf_use(t, key, (uint32_t)strlen(key));
+}
+
+#endif
+
+//
+
+void lrutrack_lf_remove_all(lrutrack_lf_t *t) {
+    assert(t);
+
+    lrutrack_epoch_token_t token = lrutrack_epoch_enter(&t->epoch);
+
+    // Each bucket is emptied atomically, inserts may land behind the sweep
+    for (uint32_t i = 0; i < t->num_buckets; ++i) {
+        lrutrack_lf_chain_t *chain = atomic_exchange_explicit(&t->buckets[i],
+            NULL, memory_order_acq_rel);
+        if (!chain)
+            continue;
+
+        for (uint32_t j = 0; j < chain->num_entries; ++j) {
+            lrutrack_lf_entry_t *entry = chain->entries[j].entry;
+            t->evict_func(t->evict_user, entry->value);
+            lrutrack_lf_retire_entry(t, entry);
+        }
+        atomic_fetch_sub_explicit(&t->count, chain->num_entries,
+            memory_order_relaxed);
+        lrutrack_lf_retire_chain(t, chain);
+    }
+
+    lrutrack_epoch_exit(&t->epoch, token);
+}
+
+int lrutrack_lf_remove_lru(lrutrack_lf_t *t) {
+    assert(t);
+
+    lrutrack_epoch_token_t token = lrutrack_epoch_enter(&t->epoch);
+    int result = lrutrack_lf_evict(t);
+    lrutrack_epoch_exit(&t->epoch, token);
+
+    return result;
+}
+
+uint32_t lrutrack_lf_count(const lrutrack_lf_t *t) {
+    assert(t);
+    return atomic_load_explicit(&t->count, memory_order_relaxed);
+}
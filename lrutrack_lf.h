@@ -0,0 +1,103 @@
+// Least-recently-used tracking helper in C
+// Lock-free concurrent variant with CLOCK eviction
+
+#ifndef LRUTRACK_LF_H
+#define LRUTRACK_LF_H
+
+#include "lrutrack.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//
+// Types:
+// Every bucket points to an immutable array of entries. Writers build a
+// modified copy and publish it with a single compare-and-swap on the
+// bucket, retrying if another writer got there first, so no operation ever
+// blocks another. Lookups read one bucket pointer and scan its array,
+// which is wait-free. Replaced arrays and removed entries are freed through
+// epoch-based reclamation once no thread can still be reading them.
+//
+// Recency is approximated with a CLOCK reference bit per entry. Once the
+// tracker holds more than num_items entries, the inserting thread evicts
+// entries with a clear bit until it is back within capacity. evict_func is
+// called exactly once per removed or evicted value, on the thread whose
+// compare-and-swap unpublished it.
+//
+// All operations may be called concurrently. Inserting a key that is
+// already present fails with LRUTRACK_ERROR. The allocator must be thread
+// safe.
+
+typedef struct lrutrack_lf_t lrutrack_lf_t;
+
+//
+//
+
+// num_buckets is a power of two
+lrutrack_lf_t *lrutrack_lf_create(uint32_t num_buckets, uint32_t num_items,
+    uint32_t hash_seed, lrutrack_value_t invalid_value,
+    void *evict_user, lrutrack_evict_func_t evict_func,
+    const lrutrack_allocator_t *allocator);
+
+// Not concurrently with other calls
+void lrutrack_lf_destroy(lrutrack_lf_t *t);
+
+#if !LRUTRACK_32BIT_KEY
+
+//
+// Variable-length key functions:
+
+int lrutrack_lf_insert(lrutrack_lf_t *t, const void *key, uint32_t key_length,
+    lrutrack_value_t value);
+
+int lrutrack_lf_remove(lrutrack_lf_t *t, const void *key, uint32_t key_length);
+
+lrutrack_value_t lrutrack_lf_use(lrutrack_lf_t *t, const void *key,
+    uint32_t key_length);
+
+// Same as use, without setting the reference bit
+lrutrack_value_t lrutrack_lf_peek(lrutrack_lf_t *t, const void *key,
+    uint32_t key_length);
+
+//
+// Null-terminated string key helper functions:
+
+int lrutrack_lf_insert_strkey(lrutrack_lf_t *t, const char *key,
+    lrutrack_value_t value);
+
+int lrutrack_lf_remove_strkey(lrutrack_lf_t *t, const char *key);
+
+lrutrack_value_t lrutrack_lf_use_strkey(lrutrack_lf_t *t, const char *key);
+
+#else
+
+//
+// 32-bit key functions:
+
+int lrutrack_lf_insert(lrutrack_lf_t *t, uint32_t key, lrutrack_value_t value);
+int lrutrack_lf_remove(lrutrack_lf_t *t, uint32_t key);
+lrutrack_value_t lrutrack_lf_use(lrutrack_lf_t *t, uint32_t key);
+lrutrack_value_t lrutrack_lf_peek(lrutrack_lf_t *t, uint32_t key);
+
+#endif // LRUTRACK_32BIT_KEY
+
+//
+// Cleaning functions:
+
+void lrutrack_lf_remove_all(lrutrack_lf_t *t);
+
+// Evicts the first entry the CLOCK hand finds without its reference bit
+int lrutrack_lf_remove_lru(lrutrack_lf_t *t);
+
+//
+//
+
+// Live entries. Momentarily above capacity while inserters evict.
+uint32_t lrutrack_lf_count(const lrutrack_lf_t *t);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,611 @@
+// Least-recently-used tracking helper in C
+// Robin Hood open addressing variant
+
+#include "lrutrack_rh.h"
+#include "lrutrack_hash.h"
+
+#include <string.h>
+#include <assert.h>
+
+static int lrutrack_rh_is_power_of_two(uint32_t x) {
+    return x > 0 && (x & (x - 1)) == 0;
+}
+
+//
+
+typedef struct lrutrack_rh_slot_t {
+    uint32_t hash; // Full key hash, home slot is hash & (table_size - 1)
+    uint32_t index; // Item index, UINT32_MAX = empty slot
+} lrutrack_rh_slot_t;
+
+typedef struct lrutrack_rh_item_t {
+#if !LRUTRACK_32BIT_KEY
+    void *key;
+    uint32_t key_length;
+#else
+    uint32_t key;
+#endif
+    lrutrack_value_t value;
+    uint32_t lru_prev;
+    uint32_t lru_next; // Next free item when not in use
+} lrutrack_rh_item_t;
+
+typedef struct lrutrack_rh_t {
+    void *evict_user;
+    lrutrack_evict_func_t evict_func;
+    lrutrack_allocator_t allocator;
+    lrutrack_rh_slot_t *slots;
+    lrutrack_rh_item_t *items;
+    uint32_t table_size;
+    uint32_t num_items;
+    uint32_t count; // Items in use
+    uint32_t lru_head; // Item index
+    uint32_t lru_tail;
+    uint32_t first_free; // Item index
+    uint32_t seed;
+    lrutrack_value_t invalid_value;
+} lrutrack_rh_t;
+
+//
+// Private functions
+
+static void lrutrack_rh_check_internal_state(const lrutrack_rh_t *t) {
+    assert(t);
+    assert(lrutrack_rh_is_power_of_two(t->table_size));
+    assert((uint64_t)t->count * 100 <=
+        (uint64_t)t->table_size * LRUTRACK_RH_MAX_LOAD_PERCENT);
+    assert(t->count <= t->num_items);
+    assert(t->first_free == UINT32_MAX || t->first_free < t->num_items);
+    assert(t->lru_head == UINT32_MAX || t->lru_head < t->num_items);
+    assert(t->lru_tail == UINT32_MAX || t->lru_tail < t->num_items);
+    assert((t->lru_head == UINT32_MAX) == (t->count == 0));
+
+#if LRUTRACK_HC_TESTS
+    uint32_t num_used = 0;
+    uint32_t mask = t->table_size - 1;
+    for (uint32_t i = 0; i < t->table_size; ++i) {
+        const lrutrack_rh_slot_t *slot = &t->slots[i];
+        if (slot->index == UINT32_MAX)
+            continue;
+
+        assert(slot->index < t->num_items);
+        assert(t->items[slot->index].value != t->invalid_value);
+
+        // Robin Hood invariant: a slot is never further from its home than
+        // the previous slot plus one
+        const lrutrack_rh_slot_t *prev = &t->slots[(i - 1) & mask];
+        uint32_t dist = (i - slot->hash) & mask;
+        if (dist != 0) {
+            assert(prev->index != UINT32_MAX);
+            assert(((i - 1 - prev->hash) & mask) + 1 >= dist);
+        }
+
+        ++num_used;
+    }
+
+    assert(num_used == t->count);
+
+    uint32_t prev_iter = UINT32_MAX;
+    uint32_t iter = t->lru_head;
+    num_used = 0;
+    while (iter != UINT32_MAX) {
+        assert(iter < t->num_items);
+        assert(t->items[iter].lru_prev == prev_iter);
+        prev_iter = iter;
+        iter = t->items[iter].lru_next;
+        ++num_used;
+    }
+
+    assert(prev_iter == t->lru_tail);
+    assert(num_used == t->count);
+#endif
+}
+
+static void *lrutrack_rh_alloc(lrutrack_rh_t *t, size_t bytesize,
+    size_t alignment) {
+    return t->allocator.alloc_func(t->allocator.user, bytesize, alignment);
+}
+
+static void lrutrack_rh_dealloc(lrutrack_rh_t *t, void *ptr,
+    size_t bytesize) {
+    if (ptr)
+        t->allocator.dealloc_func(t->allocator.user, ptr, bytesize);
+}
+
+#if !LRUTRACK_32BIT_KEY
+
+static uint32_t lrutrack_rh_hash(const lrutrack_rh_t *t, const void *key,
+    uint32_t key_length) {
+    return lrutrack_murmur2(key, key_length, t->seed);
+}
+
+static uint32_t lrutrack_rh_item_hash(const lrutrack_rh_t *t,
+    const lrutrack_rh_item_t *item) {
+    return lrutrack_rh_hash(t, item->key, item->key_length);
+}
+
+#else
+
+static uint32_t lrutrack_rh_item_hash(const lrutrack_rh_t *t,
+    const lrutrack_rh_item_t *item) {
+    (void)t;
+    return item->key;
+}
+
+#endif
+
+static uint32_t lrutrack_rh_distance(const lrutrack_rh_t *t, uint32_t pos,
+    uint32_t hash) {
+    return (pos - hash) & (t->table_size - 1);
+}
+
+// Returns the slot position of a key, UINT32_MAX if not found
+#if !LRUTRACK_32BIT_KEY
+static uint32_t lrutrack_rh_find_slot(const lrutrack_rh_t *t,
+    const void *key, uint32_t key_length, uint32_t hash)
+#else
+static uint32_t lrutrack_rh_find_slot(const lrutrack_rh_t *t, uint32_t key,
+    uint32_t hash)
+#endif
+{
+    uint32_t mask = t->table_size - 1;
+    uint32_t pos = hash & mask;
+    for (uint32_t dist = 0; ; ++dist, pos = (pos + 1) & mask) {
+        const lrutrack_rh_slot_t *slot = &t->slots[pos];
+        if (slot->index == UINT32_MAX ||
+            lrutrack_rh_distance(t, pos, slot->hash) < dist) {
+            // A resident closer to its home than we are would have been
+            // displaced by the key, so the key is not in the table
+            return UINT32_MAX;
+        }
+
+        if (slot->hash == hash) {
+            const lrutrack_rh_item_t *item = &t->items[slot->index];
+#if !LRUTRACK_32BIT_KEY
+            if (lrutrack_cmp_keys(key, key_length, item->key,
+                item->key_length))
+                return pos;
+#else
+            if (item->key == key)
+                return pos;
+#endif
+        }
+    }
+}
+
+// Returns the slot position of a live item
+static uint32_t lrutrack_rh_find_item_slot(const lrutrack_rh_t *t,
+    uint32_t index) {
+    uint32_t mask = t->table_size - 1;
+    uint32_t pos = lrutrack_rh_item_hash(t, &t->items[index]) & mask;
+    while (t->slots[pos].index != index) {
+        assert(t->slots[pos].index != UINT32_MAX);
+        pos = (pos + 1) & mask;
+    }
+    return pos;
+}
+
+static void lrutrack_rh_place(lrutrack_rh_t *t, uint32_t hash,
+    uint32_t index) {
+    uint32_t mask = t->table_size - 1;
+    uint32_t pos = hash & mask;
+    uint32_t dist = 0;
+    for (;;) {
+        lrutrack_rh_slot_t *slot = &t->slots[pos];
+        if (slot->index == UINT32_MAX) {
+            slot->hash = hash;
+            slot->index = index;
+            return;
+        }
+
+        uint32_t slot_dist = lrutrack_rh_distance(t, pos, slot->hash);
+        if (slot_dist < dist) {
+            // Take from the rich, continue placing the displaced entry
+            lrutrack_rh_slot_t displaced = *slot;
+            slot->hash = hash;
+            slot->index = index;
+            hash = displaced.hash;
+            index = displaced.index;
+            dist = slot_dist;
+        }
+
+        pos = (pos + 1) & mask;
+        ++dist;
+    }
+}
+
+// Backward shift deletion, no tombstones
+static void lrutrack_rh_erase_slot(lrutrack_rh_t *t, uint32_t pos) {
+    uint32_t mask = t->table_size - 1;
+    uint32_t next = (pos + 1) & mask;
+    while (t->slots[next].index != UINT32_MAX &&
+        lrutrack_rh_distance(t, next, t->slots[next].hash) != 0) {
+        t->slots[pos] = t->slots[next];
+        pos = next;
+        next = (next + 1) & mask;
+    }
+
+    t->slots[pos].index = UINT32_MAX;
+}
+
+static int lrutrack_rh_grow_table(lrutrack_rh_t *t) {
+    uint32_t old_table_size = t->table_size;
+    lrutrack_rh_slot_t *old_slots = t->slots;
+
+    if (old_table_size > UINT32_MAX / 2)
+        return LRUTRACK_OOM;
+
+    size_t slots_bytesize = sizeof(*t->slots) * old_table_size * 2;
+    lrutrack_rh_slot_t *slots = lrutrack_rh_alloc(t, slots_bytesize,
+        sizeof(*slots));
+    if (!slots)
+        return LRUTRACK_OOM;
+
+    memset(slots, 0xff, slots_bytesize);
+
+    t->slots = slots;
+    t->table_size = old_table_size * 2;
+
+    for (uint32_t i = 0; i < old_table_size; ++i) {
+        if (old_slots[i].index != UINT32_MAX)
+            lrutrack_rh_place(t, old_slots[i].hash, old_slots[i].index);
+    }
+
+    lrutrack_rh_dealloc(t, old_slots, sizeof(*old_slots) * old_table_size);
+
+    return LRUTRACK_OK;
+}
+
+static int lrutrack_rh_grow_items(lrutrack_rh_t *t, uint32_t num_items) {
+    assert(num_items > t->num_items);
+
+    size_t items_bytesize = sizeof(*t->items) * num_items;
+    lrutrack_rh_item_t *items = lrutrack_rh_alloc(t, items_bytesize,
+        sizeof(void *));
+    if (!items)
+        return LRUTRACK_OOM;
+
+    size_t old_items_bytesize = sizeof(*t->items) * t->num_items;
+    if (t->items) {
+        memcpy(items, t->items, old_items_bytesize);
+        lrutrack_rh_dealloc(t, t->items, old_items_bytesize);
+    }
+
+    memset((uint8_t *)items + old_items_bytesize, 0,
+        items_bytesize - old_items_bytesize);
+
+    for (uint32_t i = t->num_items; i < num_items; ++i) {
+        items[i].value = t->invalid_value;
+        items[i].lru_next = i + 1;
+    }
+
+    items[num_items - 1].lru_next = t->first_free;
+    t->first_free = t->num_items;
+
+    t->items = items;
+    t->num_items = num_items;
+
+    return LRUTRACK_OK;
+}
+
+static void lrutrack_rh_lru_unlink(lrutrack_rh_t *t, uint32_t i) {
+    lrutrack_rh_item_t *item = &t->items[i];
+    if (item->lru_prev != UINT32_MAX)
+        t->items[item->lru_prev].lru_next = item->lru_next;
+    else
+        t->lru_head = item->lru_next;
+
+    if (item->lru_next != UINT32_MAX)
+        t->items[item->lru_next].lru_prev = item->lru_prev;
+    else
+        t->lru_tail = item->lru_prev;
+}
+
+static void lrutrack_rh_lru_push_head(lrutrack_rh_t *t, uint32_t i) {
+    lrutrack_rh_item_t *item = &t->items[i];
+    item->lru_prev = UINT32_MAX;
+    item->lru_next = t->lru_head;
+    if (t->lru_head != UINT32_MAX)
+        t->items[t->lru_head].lru_prev = i;
+    else
+        t->lru_tail = i;
+    t->lru_head = i;
+}
+
+// Unlinks a live item everywhere and evicts its value
+static void lrutrack_rh_evict_item(lrutrack_rh_t *t, uint32_t index,
+    uint32_t pos) {
+    lrutrack_rh_item_t *item = &t->items[index];
+    assert(item->value != t->invalid_value);
+    assert(t->slots[pos].index == index);
+
+    lrutrack_rh_erase_slot(t, pos);
+    lrutrack_rh_lru_unlink(t, index);
+
+    assert(t->evict_func);
+    t->evict_func(t->evict_user, item->value);
+
+#if !LRUTRACK_32BIT_KEY
+    lrutrack_rh_dealloc(t, item->key, item->key_length);
+    item->key = NULL;
+#endif
+
+    item->value = t->invalid_value;
+    item->lru_next = t->first_free;
+    t->first_free = index;
+    --t->count;
+}
+
+//
+// Public functions
+
+lrutrack_rh_t *lrutrack_rh_create(uint32_t table_size,
+    uint32_t num_initial_items, uint32_t hash_seed,
+    lrutrack_value_t invalid_value,
+    void *evict_user, lrutrack_evict_func_t evict_func,
+    const lrutrack_allocator_t *allocator) {
+    assert(lrutrack_rh_is_power_of_two(table_size));
+    assert(evict_func && allocator);
+    assert(allocator->alloc_func && allocator->dealloc_func);
+
+    lrutrack_rh_t *t = allocator->alloc_func(allocator->user,
+        sizeof(lrutrack_rh_t), sizeof(void *));
+    if (!t)
+        return NULL;
+
+    memset(t, 0, sizeof(*t));
+
+    t->evict_user = evict_user;
+    t->evict_func = evict_func;
+    t->allocator = *allocator;
+
+    t->seed = hash_seed;
+    t->invalid_value = invalid_value;
+
+    t->lru_head = UINT32_MAX;
+    t->lru_tail = UINT32_MAX;
+    t->first_free = UINT32_MAX;
+
+    size_t slots_bytesize = sizeof(*t->slots) * table_size;
+    t->slots = lrutrack_rh_alloc(t, slots_bytesize, sizeof(*t->slots));
+    if (!t->slots) {
+        lrutrack_rh_destroy(t);
+        return NULL;
+    }
+
+    memset(t->slots, 0xff, slots_bytesize);
+    t->table_size = table_size;
+
+    if (num_initial_items != 0 &&
+        lrutrack_rh_grow_items(t, num_initial_items) != LRUTRACK_OK) {
+        lrutrack_rh_destroy(t);
+        return NULL;
+    }
+
+    lrutrack_rh_check_internal_state(t);
+
+    return t;
+}
+
+void lrutrack_rh_destroy(lrutrack_rh_t *t) {
+    assert(t);
+
+    for (uint32_t i = 0; i < t->num_items; ++i) {
+        lrutrack_rh_item_t *item = &t->items[i];
+        if (item->value != t->invalid_value) {
+#if !LRUTRACK_32BIT_KEY
+            lrutrack_rh_dealloc(t, item->key, item->key_length);
+#endif
+            t->evict_func(t->evict_user, item->value);
+        }
+    }
+
+    lrutrack_rh_dealloc(t, t->items, sizeof(*t->items) * t->num_items);
+    lrutrack_rh_dealloc(t, t->slots, sizeof(*t->slots) * t->table_size);
+    t->allocator.dealloc_func(t->allocator.user, t, sizeof(*t));
+}
+
+#if !LRUTRACK_32BIT_KEY
+int lrutrack_rh_insert(lrutrack_rh_t *t, const void *key, uint32_t key_length,
+    lrutrack_value_t value)
+#else
+int lrutrack_rh_insert(lrutrack_rh_t *t, uint32_t key, lrutrack_value_t value)
+#endif
+{
+    lrutrack_rh_check_internal_state(t);
+    assert(value != t->invalid_value);
+
+#if !LRUTRACK_32BIT_KEY
+    assert(key && key_length != 0);
+    uint32_t hash = lrutrack_rh_hash(t, key, key_length);
+    assert(lrutrack_rh_find_slot(t, key, key_length, hash) == UINT32_MAX);
+#else
+    uint32_t hash = key;
+    assert(lrutrack_rh_find_slot(t, key, hash) == UINT32_MAX);
+#endif
+
+    if ((uint64_t)(t->count + 1) * 100 >
+        (uint64_t)t->table_size * LRUTRACK_RH_MAX_LOAD_PERCENT) {
+        if (lrutrack_rh_grow_table(t) != LRUTRACK_OK)
+            return LRUTRACK_OOM;
+    }
+
+    if (t->first_free == UINT32_MAX) {
+        uint32_t num_items = t->num_items != 0 ? t->num_items * 2 :
+            t->table_size;
+        if (lrutrack_rh_grow_items(t, num_items) != LRUTRACK_OK)
+            return LRUTRACK_OOM;
+    }
+
+    uint32_t index = t->first_free;
+    lrutrack_rh_item_t *item = &t->items[index];
+    assert(item->value == t->invalid_value);
+
+#if !LRUTRACK_32BIT_KEY
+    item->key = lrutrack_rh_alloc(t, key_length, 1);
+    if (!item->key)
+        return LRUTRACK_OOM;
+
+    memcpy(item->key, key, key_length);
+    item->key_length = key_length;
+#else
+    item->key = key;
+#endif
+
+    t->first_free = item->lru_next;
+    item->value = value;
+
+    lrutrack_rh_lru_push_head(t, index);
+    lrutrack_rh_place(t, hash, index);
+    ++t->count;
+
+    lrutrack_rh_check_internal_state(t);
+
+    return LRUTRACK_OK;
+}
+
+#if !LRUTRACK_32BIT_KEY
+int lrutrack_rh_remove(lrutrack_rh_t *t, const void *key, uint32_t key_length)
+#else
+int lrutrack_rh_remove(lrutrack_rh_t *t, uint32_t key)
+#endif
+{
+    lrutrack_rh_check_internal_state(t);
+
+#if !LRUTRACK_32BIT_KEY
+    assert(key != NULL && key_length != 0);
+    uint32_t pos = lrutrack_rh_find_slot(t, key, key_length,
+        lrutrack_rh_hash(t, key, key_length));
+#else
+    uint32_t pos = lrutrack_rh_find_slot(t, key, key);
+#endif
+
+    if (pos == UINT32_MAX)
+        return LRUTRACK_NOT_FOUND;
+
+    lrutrack_rh_evict_item(t, t->slots[pos].index, pos);
+
+    lrutrack_rh_check_internal_state(t);
+
+    return LRUTRACK_OK;
+}
+
+#if !LRUTRACK_32BIT_KEY
+lrutrack_value_t lrutrack_rh_use(lrutrack_rh_t *t, const void *key,
+    uint32_t key_length)
+#else
+lrutrack_value_t lrutrack_rh_use(lrutrack_rh_t *t, uint32_t key)
+#endif
+{
+    lrutrack_rh_check_internal_state(t);
+
+#if !LRUTRACK_32BIT_KEY
+    assert(key != NULL && key_length != 0);
+    uint32_t pos = lrutrack_rh_find_slot(t, key, key_length,
+        lrutrack_rh_hash(t, key, key_length));
+#else
+    uint32_t pos = lrutrack_rh_find_slot(t, key, key);
+#endif
+
+    if (pos == UINT32_MAX)
+        return t->invalid_value;
+
+    uint32_t index = t->slots[pos].index;
+    if (index != t->lru_head) {
+        lrutrack_rh_lru_unlink(t, index);
+        lrutrack_rh_lru_push_head(t, index);
+    }
+
+    return t->items[index].value;
+}
+
+#if !LRUTRACK_32BIT_KEY
+
+//
+// c-string key helper functions
+
+int lrutrack_rh_insert_strkey(lrutrack_rh_t *t, const char *key,
+    lrutrack_value_t value) {
+    assert(key != NULL && strlen(key) <= UINT32_MAX);
+    return lrutrack_rh_insert(t, key, (uint32_t)strlen(key), value);
+}
+
+int lrutrack_rh_remove_strkey(lrutrack_rh_t *t, const char *key) {
+    assert(key != NULL && strlen(key) <= UINT32_MAX);
+    return lrutrack_rh_remove(t, key, (uint32_t)strlen(key));
+}
+
+lrutrack_value_t lrutrack_rh_use_strkey(lrutrack_rh_t *t, const char *key) {
+    assert(key != NULL && strlen(key) <= UINT32_MAX);
+    return lrutrack_rh_use(t, key, (uint32_t)strlen(key));
+}
+
+#endif
+
+//
+
+void lrutrack_rh_remove_all(lrutrack_rh_t *t) {
+    lrutrack_rh_check_internal_state(t);
+
+    uint32_t iter = t->lru_head;
+    while (iter != UINT32_MAX) {
+        lrutrack_rh_item_t *item = &t->items[iter];
+        assert(item->value != t->invalid_value);
+
+        assert(t->evict_func);
+        t->evict_func(t->evict_user, item->value);
+
+#if !LRUTRACK_32BIT_KEY
+        lrutrack_rh_dealloc(t, item->key, item->key_length);
+        item->key = NULL;
+#endif
+
+        item->value = t->invalid_value;
+
+        uint32_t next = item->lru_next;
+        item->lru_next = t->first_free;
+        t->first_free = iter;
+        iter = next;
+    }
+
+    memset(t->slots, 0xff, sizeof(*t->slots) * t->table_size);
+
+    t->lru_head = UINT32_MAX;
+    t->lru_tail = UINT32_MAX;
+    t->count = 0;
+
+    lrutrack_rh_check_internal_state(t);
+}
+
+int lrutrack_rh_remove_lru(lrutrack_rh_t *t) {
+    lrutrack_rh_check_internal_state(t);
+
+    if (t->lru_tail == UINT32_MAX)
+        return LRUTRACK_NOT_FOUND;
+
+    uint32_t index = t->lru_tail;
+    lrutrack_rh_evict_item(t, index, lrutrack_rh_find_item_slot(t, index));
+
+    lrutrack_rh_check_internal_state(t);
+
+    return LRUTRACK_OK;
+}
+
+//
+
+uint32_t lrutrack_rh_count(const lrutrack_rh_t *t) {
+    return t->count;
+}
+
+double lrutrack_rh_mean_probe_length(const lrutrack_rh_t *t) {
+    if (t->count == 0)
+        return 0.0;
+
+    uint64_t total = 0;
+    for (uint32_t i = 0; i < t->table_size; ++i) {
+        if (t->slots[i].index != UINT32_MAX)
+            total += lrutrack_rh_distance(t, i, t->slots[i].hash) + 1;
+    }
+
+    return (double)total / t->count;
+}
@@ -0,0 +1,88 @@
+// Least-recently-used tracking helper in C
+// Robin Hood open addressing variant
+
+#ifndef LRUTRACK_RH_H
+#define LRUTRACK_RH_H
+
+#include "lrutrack.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// The table grows when an insert would take the load above this
+#if !defined(LRUTRACK_RH_MAX_LOAD_PERCENT)
+#   define LRUTRACK_RH_MAX_LOAD_PERCENT 90
+#endif
+
+//
+// Types:
+// Table slots store the full key hash as a fingerprint and the item index.
+// Each entry has its own place in the LRU list, so lrutrack_rh_remove_lru
+// evicts exactly one entry.
+
+typedef struct lrutrack_rh_t lrutrack_rh_t;
+
+//
+//
+
+lrutrack_rh_t *lrutrack_rh_create(uint32_t table_size,
+    uint32_t num_initial_items, uint32_t hash_seed,
+    lrutrack_value_t invalid_value,
+    void *evict_user, lrutrack_evict_func_t evict_func,
+    const lrutrack_allocator_t *allocator);
+void lrutrack_rh_destroy(lrutrack_rh_t *t);
+
+#if !LRUTRACK_32BIT_KEY
+
+//
+// Variable-length key functions:
+
+int lrutrack_rh_insert(lrutrack_rh_t *t, const void *key, uint32_t key_length,
+    lrutrack_value_t value);
+
+int lrutrack_rh_remove(lrutrack_rh_t *t, const void *key, uint32_t key_length);
+
+lrutrack_value_t lrutrack_rh_use(lrutrack_rh_t *t, const void *key,
+    uint32_t key_length);
+
+//
+// Null-terminated string key helper functions:
+
+int lrutrack_rh_insert_strkey(lrutrack_rh_t *t, const char *key,
+    lrutrack_value_t value);
+
+int lrutrack_rh_remove_strkey(lrutrack_rh_t *t, const char *key);
+
+lrutrack_value_t lrutrack_rh_use_strkey(lrutrack_rh_t *t, const char *key);
+
+#else
+
+//
+// 32-bit key functions:
+
+int lrutrack_rh_insert(lrutrack_rh_t *t, uint32_t key, lrutrack_value_t value);
+int lrutrack_rh_remove(lrutrack_rh_t *t, uint32_t key);
+lrutrack_value_t lrutrack_rh_use(lrutrack_rh_t *t, uint32_t key);
+
+#endif // LRUTRACK_32BIT_KEY
+
+//
+// Cleaning functions:
+
+void lrutrack_rh_remove_all(lrutrack_rh_t *t);
+int lrutrack_rh_remove_lru(lrutrack_rh_t *t);
+
+//
+// Statistics:
+
+uint32_t lrutrack_rh_count(const lrutrack_rh_t *t);
+
+// Average number of slots a successful lookup probes, 1.0 = no collisions
+double lrutrack_rh_mean_probe_length(const lrutrack_rh_t *t);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,1249 @@
+// Least-recently-used tracking helper in C
+// Sharded tracker for concurrent use, with optional NUMA placement
+
+#include "lrutrack_sharded.h"
+#include "lrutrack_hash.h"
+
+#include <stdatomic.h>
+#include <pthread.h>
+#include <string.h>
+#include <assert.h>
+
+#if defined(__linux__)
+#   include <sys/mman.h>
+#   include <sys/syscall.h>
+#   include <unistd.h>
+#endif
+
+#define LRUTRACK_SHARDED_CACHE_LINE 64
+#define LRUTRACK_SHARDED_SHARD_MULTIPLIER 0x9e3779b1u
+#define LRUTRACK_SHARDED_TOUCHES 60
+#define LRUTRACK_SHARDED_OPTIMISTIC_TRIES 8
+#define LRUTRACK_SHARDED_EVICT_BATCH 64 // Values delivered per unlock
+
+// From <numaif.h>, so that libnuma is not needed
+#define LRUTRACK_MPOL_PREFERRED 1
+#define LRUTRACK_MPOL_F_NODE 1
+#define LRUTRACK_MPOL_F_ADDR 2
+#define LRUTRACK_MPOL_F_MEMS_ALLOWED 4
+#define LRUTRACK_MAX_NUMA_NODES 1024
+
+static int lrutrack_sharded_is_power_of_two(uint32_t x) {
+    return x > 0 && (x & (x - 1)) == 0;
+}
+
+//
+
+typedef struct lrutrack_sharded_shard_t {
+    _Alignas(LRUTRACK_SHARDED_CACHE_LINE) pthread_mutex_t lock;
+    pthread_rwlock_t rwlock; // With LRUTRACK_SHARDED_RWLOCK
+    lrutrack_t *tracker;
+    struct lrutrack_sharded_t *owner;
+    lrutrack_allocator_t allocator; // Places arrays on node
+    void *last_array; // Most recent node-bound allocation
+    void *buffer; // Fixed-memory tracker storage
+    size_t buffer_size;
+    uint32_t node; // Home node, UINT32_MAX = no placement
+    uint32_t count; // Entries last added to the tracker total
+    int initialized;
+    _Atomic uint32_t *versions; // Per row, with LRUTRACK_SHARDED_NEAR_CACHE
+
+    // Odd while a writer changes rows or items, readers retry
+    _Alignas(LRUTRACK_SHARDED_CACHE_LINE) _Atomic uint32_t seq;
+
+    // Rows used by readers, applied by the next writer. Lossy when full.
+    _Alignas(LRUTRACK_SHARDED_CACHE_LINE) _Atomic uint32_t num_touches;
+    _Atomic uint32_t touches[LRUTRACK_SHARDED_TOUCHES]; // Row + 1, 0 = none
+} lrutrack_sharded_shard_t;
+
+typedef struct lrutrack_sharded_t {
+    lrutrack_allocator_t allocator;
+    lrutrack_sharded_shard_t *shards;
+    uint32_t num_shards;
+    uint32_t num_nodes;
+    uint32_t num_os_nodes; // Nodes the machine has
+    uint32_t flags;
+    uint32_t seed;
+    lrutrack_value_t invalid_value;
+    void *evict_user;
+    lrutrack_evict_func_t evict_func;
+    _Atomic uint32_t lru_hand;
+    uint32_t row_mask; // Shard hash table size - 1
+
+    // Entries over all shards
+    _Alignas(LRUTRACK_SHARDED_CACHE_LINE) _Atomic uint32_t num_entries;
+    uint32_t shard_limit; // Hard limit per shard, 0 = none
+    uint32_t high_watermark;
+    uint32_t low_watermark;
+
+    // Background evictor, with a high watermark
+    pthread_t evictor;
+    pthread_mutex_t evictor_lock;
+    pthread_cond_t evictor_cond;
+    _Atomic int evictor_pending; // Pass requested
+    _Atomic int evictor_stop;
+    int evictor_running;
+} lrutrack_sharded_t;
+
+typedef struct lrutrack_sharded_near_entry_t {
+    uint32_t hash;
+    uint32_t version; // Row version when cached
+    lrutrack_value_t value; // invalid_value = empty
+    uint32_t hits; // Since the last shard lookup
+#if !LRUTRACK_32BIT_KEY
+    uint32_t key_length;
+    uint8_t key[LRUTRACK_SHARDED_NEAR_KEY_BYTES];
+#else
+    uint32_t key;
+#endif
+} lrutrack_sharded_near_entry_t;
+
+typedef struct lrutrack_sharded_near_t {
+    lrutrack_sharded_near_entry_t *entries; // Two per set, most recent first
+    uint32_t num_sets;
+    uint64_t num_hits;
+    uint64_t num_misses;
+} lrutrack_sharded_near_t;
+
+static _Thread_local int lrutrack_sharded_thread_node_override = -1;
+
+//
+// NUMA helpers
+
+static uint32_t lrutrack_numa_num_os_nodes(void) {
+#if defined(__linux__) && defined(SYS_get_mempolicy)
+    unsigned long mask[LRUTRACK_MAX_NUMA_NODES / (8 * sizeof(unsigned long))];
+    memset(mask, 0, sizeof(mask));
+    if (syscall(SYS_get_mempolicy, NULL, mask, LRUTRACK_MAX_NUMA_NODES,
+        NULL, LRUTRACK_MPOL_F_MEMS_ALLOWED) != 0)
+        return 1;
+
+    uint32_t num_nodes = 1;
+    for (uint32_t i = 0; i < LRUTRACK_MAX_NUMA_NODES; ++i) {
+        if (mask[i / (8 * sizeof(unsigned long))] &
+            (1ul << (i % (8 * sizeof(unsigned long)))))
+            num_nodes = i + 1;
+    }
+    return num_nodes;
+#else
+    return 1;
+#endif
+}
+
+static uint32_t lrutrack_numa_current_os_node(void) {
+#if defined(__linux__) && defined(SYS_getcpu)
+    unsigned cpu = 0, node = 0;
+    if (syscall(SYS_getcpu, &cpu, &node, NULL) == 0)
+        return node;
+#endif
+    return 0;
+}
+
+#if defined(__linux__)
+
+static size_t lrutrack_numa_page_size(void) {
+    long page_size = sysconf(_SC_PAGESIZE);
+    return page_size > 0 ? (size_t)page_size : 4096;
+}
+
+static size_t lrutrack_numa_mapping_size(size_t bytesize) {
+    size_t page_size = lrutrack_numa_page_size();
+    return (bytesize + page_size - 1) & ~(page_size - 1);
+}
+
+// Anonymous mapping preferring os_node. The kernel falls back to other
+// nodes rather than failing when the node is out of memory.
+static void *lrutrack_numa_map(size_t bytesize, size_t alignment,
+    uint32_t os_node) {
+    size_t page_size = lrutrack_numa_page_size();
+    size_t size = lrutrack_numa_mapping_size(bytesize);
+    size_t extra = alignment > page_size ? alignment : 0;
+
+    uint8_t *base = mmap(NULL, size + extra, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED)
+        return NULL;
+
+    // Trim to the requested alignment
+    uint8_t *ptr = base;
+    if (extra) {
+        ptr = (uint8_t *)(((uintptr_t)base + alignment - 1) &
+            ~(uintptr_t)(alignment - 1));
+        if (ptr != base)
+            munmap(base, (size_t)(ptr - base));
+        size_t tail = (size_t)(base + size + extra - (ptr + size));
+        if (tail)
+            munmap(ptr + size, tail);
+    }
+
+#if defined(SYS_mbind)
+    unsigned long mask[LRUTRACK_MAX_NUMA_NODES / (8 * sizeof(unsigned long))];
+    memset(mask, 0, sizeof(mask));
+    mask[os_node / (8 * sizeof(unsigned long))] =
+        1ul << (os_node % (8 * sizeof(unsigned long)));
+    syscall(SYS_mbind, ptr, size, LRUTRACK_MPOL_PREFERRED, mask,
+        LRUTRACK_MAX_NUMA_NODES, 0);
+#else
+    (void)os_node;
+#endif
+
+    return ptr;
+}
+
+#endif
+
+// Shard allocator: page-sized and larger requests (hash table, items) are
+// mapped on the shard's node, the rest goes to the base allocator
+static void *lrutrack_sharded_shard_alloc(void *user, size_t bytesize,
+    size_t alignment) {
+    lrutrack_sharded_shard_t *shard = user;
+    const lrutrack_sharded_t *t = shard->owner;
+
+#if defined(__linux__)
+    if (shard->node != UINT32_MAX && bytesize >= lrutrack_numa_page_size()) {
+        void *ptr = lrutrack_numa_map(bytesize, alignment,
+            shard->node % t->num_os_nodes);
+        if (ptr)
+            shard->last_array = ptr;
+        return ptr;
+    }
+#endif
+
+    return t->allocator.alloc_func(t->allocator.user, bytesize, alignment);
+}
+
+static void lrutrack_sharded_shard_dealloc(void *user, void *ptr,
+    size_t bytesize) {
+    lrutrack_sharded_shard_t *shard = user;
+    const lrutrack_sharded_t *t = shard->owner;
+
+#if defined(__linux__)
+    if (shard->node != UINT32_MAX && bytesize >= lrutrack_numa_page_size()) {
+        if (shard->last_array == ptr)
+            shard->last_array = NULL;
+        munmap(ptr, lrutrack_numa_mapping_size(bytesize));
+        return;
+    }
+#endif
+
+    t->allocator.dealloc_func(t->allocator.user, ptr, bytesize);
+}
+
+//
+// Private functions
+
+static uint32_t lrutrack_sharded_thread_node_of(const lrutrack_sharded_t *t) {
+    assert(t->num_nodes != 0);
+    if (lrutrack_sharded_thread_node_override >= 0)
+        return (uint32_t)lrutrack_sharded_thread_node_override % t->num_nodes;
+    return lrutrack_numa_current_os_node() % t->num_nodes;
+}
+
+// The shards use the low hash bits for their rows, shard selection uses
+// the high bits
+static lrutrack_sharded_shard_t *lrutrack_sharded_select(
+    lrutrack_sharded_t *t, uint32_t hash) {
+    if (t->flags & LRUTRACK_SHARDED_NODE_LOCAL) {
+        // Shards node, node + num_nodes, node + 2 * num_nodes...
+        uint32_t node = lrutrack_sharded_thread_node_of(t);
+        uint32_t shards_on_node = (t->num_shards - node + t->num_nodes - 1) /
+            t->num_nodes;
+        uint32_t j = (uint32_t)(((uint64_t)hash * shards_on_node) >> 32);
+        return &t->shards[node + j * t->num_nodes];
+    }
+
+    return &t->shards[((uint64_t)hash * t->num_shards) >> 32];
+}
+
+static int lrutrack_sharded_defers_touches(const lrutrack_sharded_t *t) {
+    return (t->flags & (LRUTRACK_SHARDED_RWLOCK |
+        LRUTRACK_SHARDED_OPTIMISTIC)) != 0;
+}
+
+static void lrutrack_sharded_defer_touch(lrutrack_sharded_shard_t *shard,
+    uint32_t row) {
+    // Checking first keeps a full buffer read-only
+    if (atomic_load_explicit(&shard->num_touches, memory_order_relaxed) >=
+        LRUTRACK_SHARDED_TOUCHES)
+        return;
+
+    uint32_t n = atomic_fetch_add_explicit(&shard->num_touches, 1,
+        memory_order_relaxed);
+    if (n < LRUTRACK_SHARDED_TOUCHES)
+        atomic_store_explicit(&shard->touches[n], row + 1,
+            memory_order_relaxed);
+}
+
+static void lrutrack_sharded_apply_touches(lrutrack_sharded_shard_t *shard) {
+    uint32_t n = atomic_exchange_explicit(&shard->num_touches, 0,
+        memory_order_relaxed);
+    if (n > LRUTRACK_SHARDED_TOUCHES)
+        n = LRUTRACK_SHARDED_TOUCHES;
+
+    // Oldest first, so the most recent reader ends up at the LRU head
+    for (uint32_t i = 0; i < n; ++i) {
+        uint32_t row = atomic_exchange_explicit(&shard->touches[i], 0,
+            memory_order_relaxed);
+        if (row != 0)
+            lrutrack_touch_row(shard->tracker, row - 1);
+    }
+}
+
+// Exclusive access, with the recency updates readers left behind applied
+static void lrutrack_sharded_lock(lrutrack_sharded_t *t,
+    lrutrack_sharded_shard_t *shard) {
+    if (t->flags & LRUTRACK_SHARDED_RWLOCK)
+        pthread_rwlock_wrlock(&shard->rwlock);
+    else
+        pthread_mutex_lock(&shard->lock);
+
+    if (lrutrack_sharded_defers_touches(t))
+        lrutrack_sharded_apply_touches(shard);
+}
+
+static void lrutrack_sharded_unlock(lrutrack_sharded_t *t,
+    lrutrack_sharded_shard_t *shard) {
+    if (t->flags & LRUTRACK_SHARDED_RWLOCK)
+        pthread_rwlock_unlock(&shard->rwlock);
+    else
+        pthread_mutex_unlock(&shard->lock);
+}
+
+// Releases the shard after a change, then delivers the evictions it
+// deferred. Each batch is taken under the lock.
+static void lrutrack_sharded_unlock_and_evict(lrutrack_sharded_t *t,
+    lrutrack_sharded_shard_t *shard) {
+    if (!(t->flags & LRUTRACK_SHARDED_DEFER_EVICTION)) {
+        lrutrack_sharded_unlock(t, shard);
+        return;
+    }
+
+    lrutrack_value_t values[LRUTRACK_SHARDED_EVICT_BATCH];
+    for (;;) {
+        uint32_t n = lrutrack_take_evicted(shard->tracker, values,
+            LRUTRACK_SHARDED_EVICT_BATCH);
+        uint32_t num_left = lrutrack_num_evicted(shard->tracker);
+        lrutrack_sharded_unlock(t, shard);
+
+        for (uint32_t i = 0; i < n; ++i)
+            t->evict_func(t->evict_user, values[i]);
+
+        if (num_left == 0)
+            break;
+        lrutrack_sharded_lock(t, shard);
+    }
+}
+
+// Brackets changes to rows and items. Recency updates only touch the LRU
+// links, which optimistic readers never look at.
+static void lrutrack_sharded_write_begin(lrutrack_sharded_shard_t *shard) {
+    uint32_t seq = atomic_load_explicit(&shard->seq, memory_order_relaxed);
+    atomic_store_explicit(&shard->seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+}
+
+// Also publishes the change in the shard's entry count to the total
+static void lrutrack_sharded_write_end(lrutrack_sharded_t *t,
+    lrutrack_sharded_shard_t *shard) {
+    uint32_t seq = atomic_load_explicit(&shard->seq, memory_order_relaxed);
+    atomic_store_explicit(&shard->seq, seq + 1, memory_order_release);
+
+    uint32_t count = lrutrack_count(shard->tracker);
+    if (count != shard->count) {
+        // Wraps around for a decrease
+        atomic_fetch_add_explicit(&t->num_entries, count - shard->count,
+            memory_order_relaxed);
+        shard->count = count;
+    }
+}
+
+// Invalidates near cached keys of the row. Called inside the write section
+// that removes them, so a near cache refilling the key meanwhile reads the
+// new version before it can see the shard again.
+static void lrutrack_sharded_bump_row(lrutrack_sharded_shard_t *shard,
+    uint32_t row) {
+    uint32_t version = atomic_load_explicit(&shard->versions[row],
+        memory_order_relaxed);
+    atomic_store_explicit(&shard->versions[row], version + 1,
+        memory_order_release);
+}
+
+static int lrutrack_sharded_remove_lru_row(lrutrack_sharded_t *t,
+    lrutrack_sharded_shard_t *shard) {
+    if (t->flags & LRUTRACK_SHARDED_NEAR_CACHE) {
+        uint32_t row = lrutrack_lru_row(shard->tracker);
+        if (row != UINT32_MAX)
+            lrutrack_sharded_bump_row(shard, row);
+    }
+
+    return lrutrack_remove_lru(shard->tracker);
+}
+
+// Evicts LRU rows until the shard is below its hard limit. Called before
+// inserting a new key.
+static void lrutrack_sharded_make_room(lrutrack_sharded_t *t,
+    lrutrack_sharded_shard_t *shard) {
+    while (lrutrack_count(shard->tracker) >= t->shard_limit &&
+        lrutrack_sharded_remove_lru_row(t, shard) == LRUTRACK_OK)
+        ;
+}
+
+// Brings the total down to the low watermark, taking from the shards above
+// their share of it. Each lock hold evicts a bounded number of rows so that
+// foreground operations are not held up.
+static void lrutrack_sharded_evict_to_low_watermark(lrutrack_sharded_t *t) {
+    uint32_t shard_low = t->low_watermark / t->num_shards;
+
+    while (atomic_load_explicit(&t->num_entries, memory_order_relaxed) >
+        t->low_watermark &&
+        !atomic_load_explicit(&t->evictor_stop, memory_order_relaxed)) {
+        int progress = 0;
+
+        for (uint32_t i = 0; i < t->num_shards; ++i) {
+            lrutrack_sharded_shard_t *shard = &t->shards[i];
+
+            lrutrack_sharded_lock(t, shard);
+            lrutrack_sharded_write_begin(shard);
+            for (uint32_t j = 0; j < LRUTRACK_SHARDED_EVICT_BATCH &&
+                lrutrack_count(shard->tracker) > shard_low; ++j) {
+                if (lrutrack_sharded_remove_lru_row(t, shard) != LRUTRACK_OK)
+                    break;
+                progress = 1;
+            }
+            lrutrack_sharded_write_end(t, shard);
+            lrutrack_sharded_unlock_and_evict(t, shard);
+        }
+
+        if (!progress)
+            break;
+    }
+}
+
+static void *lrutrack_sharded_evictor_main(void *arg) {
+    lrutrack_sharded_t *t = arg;
+
+    for (;;) {
+        pthread_mutex_lock(&t->evictor_lock);
+        while (!atomic_load(&t->evictor_stop) &&
+            !atomic_load(&t->evictor_pending))
+            pthread_cond_wait(&t->evictor_cond, &t->evictor_lock);
+        pthread_mutex_unlock(&t->evictor_lock);
+
+        if (atomic_load(&t->evictor_stop))
+            break;
+
+        lrutrack_sharded_evict_to_low_watermark(t);
+
+        // Inserts during the pass saw it pending and did not ask again
+        atomic_store(&t->evictor_pending, 0);
+        if (atomic_load(&t->num_entries) > t->high_watermark)
+            atomic_store(&t->evictor_pending, 1);
+    }
+
+    return NULL;
+}
+
+static void lrutrack_sharded_wake_evictor(lrutrack_sharded_t *t) {
+    if (!t->evictor_running ||
+        atomic_load_explicit(&t->num_entries, memory_order_relaxed) <=
+        t->high_watermark)
+        return;
+
+    if (atomic_exchange(&t->evictor_pending, 1))
+        return;
+
+    pthread_mutex_lock(&t->evictor_lock);
+    pthread_cond_signal(&t->evictor_cond);
+    pthread_mutex_unlock(&t->evictor_lock);
+}
+
+#if !LRUTRACK_32BIT_KEY
+static uint32_t lrutrack_sharded_hash(const lrutrack_sharded_t *t,
+    const void *key, uint32_t key_length) {
+    return lrutrack_murmur2(key, key_length, t->seed);
+}
+#else
+static uint32_t lrutrack_sharded_hash(const lrutrack_sharded_t *t,
+    uint32_t key) {
+    (void)t;
+    return key * LRUTRACK_SHARDED_SHARD_MULTIPLIER;
+}
+#endif
+
+// Shard hash table row of a key. Variable-length keys hash the same way in
+// the shards, 32-bit keys are used as is.
+#if !LRUTRACK_32BIT_KEY
+static uint32_t lrutrack_sharded_row(const lrutrack_sharded_t *t,
+    uint32_t hash) {
+    return hash & t->row_mask;
+}
+#else
+static uint32_t lrutrack_sharded_row(const lrutrack_sharded_t *t,
+    uint32_t key) {
+    return key & t->row_mask;
+}
+#endif
+
+//
+// Public functions
+
+lrutrack_sharded_t *lrutrack_sharded_create(
+    const lrutrack_sharded_config_t *config, uint32_t hash_seed,
+    lrutrack_value_t invalid_value,
+    void *evict_user, lrutrack_evict_func_t evict_func,
+    const lrutrack_allocator_t *allocator) {
+    assert(config && allocator);
+    assert(allocator->alloc_func && allocator->dealloc_func);
+    assert(lrutrack_sharded_is_power_of_two(config->num_shards));
+    assert(!(config->flags & LRUTRACK_SHARDED_NODE_LOCAL) ||
+        (config->num_nodes != 0 && config->num_nodes <= config->num_shards));
+    assert(!(config->flags & LRUTRACK_SHARDED_RWLOCK) ||
+        !(config->flags & LRUTRACK_SHARDED_OPTIMISTIC));
+    assert(config->max_items == 0 || config->max_items >= config->num_shards);
+    assert(config->low_watermark <= config->high_watermark);
+    assert(config->max_items == 0 ||
+        config->high_watermark <= config->max_items);
+
+    lrutrack_sharded_t *t = allocator->alloc_func(allocator->user,
+        sizeof(lrutrack_sharded_t), LRUTRACK_SHARDED_CACHE_LINE);
+    if (!t)
+        return NULL;
+
+    memset(t, 0, sizeof(*t));
+
+    t->allocator = *allocator;
+    t->num_nodes = config->num_nodes;
+    t->num_os_nodes = lrutrack_numa_num_os_nodes();
+    t->flags = config->flags;
+    t->seed = hash_seed;
+    t->invalid_value = invalid_value;
+    t->evict_user = evict_user;
+    t->evict_func = evict_func;
+    atomic_init(&t->lru_hand, 0);
+    atomic_init(&t->num_entries, 0);
+    t->row_mask = config->hash_table_size - 1;
+    t->shard_limit = config->max_items / config->num_shards;
+    if ((t->flags & LRUTRACK_SHARDED_NEAR_CACHE) &&
+        (t->flags & LRUTRACK_SHARDED_OPTIMISTIC) &&
+        (t->shard_limit == 0 || t->shard_limit > config->num_initial_items)) {
+        // Full fixed capacity shards would evict inside lrutrack_insert,
+        // out of sight of the row versions
+        t->shard_limit = config->num_initial_items;
+    }
+    t->high_watermark = config->high_watermark;
+    t->low_watermark = config->low_watermark;
+    atomic_init(&t->evictor_pending, 0);
+    atomic_init(&t->evictor_stop, 0);
+
+    size_t shards_bytesize = sizeof(*t->shards) * config->num_shards;
+    t->shards = allocator->alloc_func(allocator->user, shards_bytesize,
+        LRUTRACK_SHARDED_CACHE_LINE);
+    if (!t->shards) {
+        lrutrack_sharded_destroy(t);
+        return NULL;
+    }
+
+    memset(t->shards, 0, shards_bytesize);
+    t->num_shards = config->num_shards;
+
+    for (uint32_t i = 0; i < config->num_shards; ++i) {
+        lrutrack_sharded_shard_t *shard = &t->shards[i];
+        shard->owner = t;
+        shard->node = t->num_nodes ? i % t->num_nodes : UINT32_MAX;
+        shard->allocator.user = shard;
+        shard->allocator.alloc_func = lrutrack_sharded_shard_alloc;
+        shard->allocator.dealloc_func = lrutrack_sharded_shard_dealloc;
+        atomic_init(&shard->seq, 0);
+        atomic_init(&shard->num_touches, 0);
+        for (uint32_t j = 0; j < LRUTRACK_SHARDED_TOUCHES; ++j)
+            atomic_init(&shard->touches[j], 0);
+
+        if (pthread_mutex_init(&shard->lock, NULL) != 0) {
+            lrutrack_sharded_destroy(t);
+            return NULL;
+        }
+
+        if (pthread_rwlock_init(&shard->rwlock, NULL) != 0) {
+            pthread_mutex_destroy(&shard->lock);
+            lrutrack_sharded_destroy(t);
+            return NULL;
+        }
+
+        shard->initialized = 1;
+
+        if (t->flags & LRUTRACK_SHARDED_OPTIMISTIC) {
+            // Readers may race with writers, so the memory must never move
+            lrutrack_config_t shard_config;
+            shard_config.hash_table_size = config->hash_table_size;
+            shard_config.num_items = config->num_initial_items;
+            shard_config.max_key_length = config->max_key_length;
+            // Room for a whole shard, as remove_all evicts all of it
+            shard_config.max_deferred =
+                (t->flags & LRUTRACK_SHARDED_DEFER_EVICTION) ?
+                config->num_initial_items : 0;
+
+            shard->buffer_size = lrutrack_required_bytes(&shard_config);
+            shard->buffer = lrutrack_sharded_shard_alloc(shard,
+                shard->buffer_size, 16);
+            if (shard->buffer) {
+                shard->tracker = lrutrack_create_in_place(shard->buffer,
+                    shard->buffer_size, &shard_config, hash_seed,
+                    invalid_value, evict_user, evict_func);
+            }
+        } else {
+            shard->tracker = lrutrack_create_with_allocator(
+                config->hash_table_size, config->num_initial_items,
+                hash_seed, invalid_value, evict_user, evict_func,
+                &shard->allocator);
+        }
+
+        if (!shard->tracker) {
+            lrutrack_sharded_destroy(t);
+            return NULL;
+        }
+
+        if (t->flags & LRUTRACK_SHARDED_DEFER_EVICTION)
+            lrutrack_set_deferred_eviction(shard->tracker, 1);
+
+        if (t->flags & LRUTRACK_SHARDED_NEAR_CACHE) {
+            shard->versions = lrutrack_sharded_shard_alloc(shard,
+                sizeof(*shard->versions) * config->hash_table_size,
+                LRUTRACK_SHARDED_CACHE_LINE);
+            if (!shard->versions) {
+                lrutrack_sharded_destroy(t);
+                return NULL;
+            }
+
+            for (uint32_t j = 0; j < config->hash_table_size; ++j)
+                atomic_init(&shard->versions[j], 0);
+        }
+    }
+
+    if (t->high_watermark != 0) {
+        if (pthread_mutex_init(&t->evictor_lock, NULL) != 0) {
+            lrutrack_sharded_destroy(t);
+            return NULL;
+        }
+
+        if (pthread_cond_init(&t->evictor_cond, NULL) != 0) {
+            pthread_mutex_destroy(&t->evictor_lock);
+            lrutrack_sharded_destroy(t);
+            return NULL;
+        }
+
+        if (pthread_create(&t->evictor, NULL, lrutrack_sharded_evictor_main,
+            t) != 0) {
+            pthread_cond_destroy(&t->evictor_cond);
+            pthread_mutex_destroy(&t->evictor_lock);
+            lrutrack_sharded_destroy(t);
+            return NULL;
+        }
+
+        t->evictor_running = 1;
+    }
+
+    return t;
+}
+
+void lrutrack_sharded_destroy(lrutrack_sharded_t *t) {
+    assert(t);
+
+    if (t->evictor_running) {
+        pthread_mutex_lock(&t->evictor_lock);
+        atomic_store(&t->evictor_stop, 1);
+        pthread_cond_signal(&t->evictor_cond);
+        pthread_mutex_unlock(&t->evictor_lock);
+
+        pthread_join(t->evictor, NULL);
+        pthread_cond_destroy(&t->evictor_cond);
+        pthread_mutex_destroy(&t->evictor_lock);
+    }
+
+    for (uint32_t i = 0; i < t->num_shards; ++i) {
+        lrutrack_sharded_shard_t *shard = &t->shards[i];
+        if (shard->tracker)
+            lrutrack_destroy(shard->tracker);
+        if (shard->versions) {
+            lrutrack_sharded_shard_dealloc(shard, shard->versions,
+                sizeof(*shard->versions) * (t->row_mask + 1));
+        }
+        if (shard->buffer) {
+            lrutrack_sharded_shard_dealloc(shard, shard->buffer,
+                shard->buffer_size);
+        }
+        if (shard->initialized) {
+            pthread_rwlock_destroy(&shard->rwlock);
+            pthread_mutex_destroy(&shard->lock);
+        }
+    }
+
+    if (t->shards) {
+        t->allocator.dealloc_func(t->allocator.user, t->shards,
+            sizeof(*t->shards) * t->num_shards);
+    }
+
+    t->allocator.dealloc_func(t->allocator.user, t, sizeof(*t));
+}
+
+// Insert and remove of a shard held exclusively, inside a write section
+#if !LRUTRACK_32BIT_KEY
+static int lrutrack_sharded_insert_locked(lrutrack_sharded_t *t,
+    lrutrack_sharded_shard_t *shard, const void *key, uint32_t key_length,
+    lrutrack_value_t value) {
+    if (t->shard_limit != 0 && lrutrack_peek(shard->tracker, key, key_length,
+        NULL) == t->invalid_value)
+        lrutrack_sharded_make_room(t, shard);
+    return lrutrack_insert(shard->tracker, key, key_length, value);
+}
+
+static int lrutrack_sharded_remove_locked(lrutrack_sharded_t *t,
+    lrutrack_sharded_shard_t *shard, uint32_t row, const void *key,
+    uint32_t key_length) {
+    int result = lrutrack_remove(shard->tracker, key, key_length);
+    if (result == LRUTRACK_OK && (t->flags & LRUTRACK_SHARDED_NEAR_CACHE))
+        lrutrack_sharded_bump_row(shard, row);
+    return result;
+}
+#else
+static int lrutrack_sharded_insert_locked(lrutrack_sharded_t *t,
+    lrutrack_sharded_shard_t *shard, uint32_t key, lrutrack_value_t value) {
+    if (t->shard_limit != 0 &&
+        lrutrack_peek(shard->tracker, key, NULL) == t->invalid_value)
+        lrutrack_sharded_make_room(t, shard);
+    return lrutrack_insert(shard->tracker, key, value);
+}
+
+static int lrutrack_sharded_remove_locked(lrutrack_sharded_t *t,
+    lrutrack_sharded_shard_t *shard, uint32_t row, uint32_t key) {
+    int result = lrutrack_remove(shard->tracker, key);
+    if (result == LRUTRACK_OK && (t->flags & LRUTRACK_SHARDED_NEAR_CACHE))
+        lrutrack_sharded_bump_row(shard, row);
+    return result;
+}
+#endif
+
+#if !LRUTRACK_32BIT_KEY
+int lrutrack_sharded_insert(lrutrack_sharded_t *t, const void *key,
+    uint32_t key_length, lrutrack_value_t value)
+#else
+int lrutrack_sharded_insert(lrutrack_sharded_t *t, uint32_t key,
+    lrutrack_value_t value)
+#endif
+{
+    assert(t);
+
+#if !LRUTRACK_32BIT_KEY
+    lrutrack_sharded_shard_t *shard = lrutrack_sharded_select(t,
+        lrutrack_sharded_hash(t, key, key_length));
+    lrutrack_sharded_lock(t, shard);
+    lrutrack_sharded_write_begin(shard);
+    int result = lrutrack_sharded_insert_locked(t, shard, key, key_length,
+        value);
+#else
+    lrutrack_sharded_shard_t *shard = lrutrack_sharded_select(t,
+        lrutrack_sharded_hash(t, key));
+    lrutrack_sharded_lock(t, shard);
+    lrutrack_sharded_write_begin(shard);
+    int result = lrutrack_sharded_insert_locked(t, shard, key, value);
+#endif
+    lrutrack_sharded_write_end(t, shard);
+    lrutrack_sharded_unlock_and_evict(t, shard);
+
+    lrutrack_sharded_wake_evictor(t);
+
+    return result;
+}
+
+#if !LRUTRACK_32BIT_KEY
+int lrutrack_sharded_remove(lrutrack_sharded_t *t, const void *key,
+    uint32_t key_length)
+#else
+int lrutrack_sharded_remove(lrutrack_sharded_t *t, uint32_t key)
+#endif
+{
+    assert(t);
+
+#if !LRUTRACK_32BIT_KEY
+    uint32_t hash = lrutrack_sharded_hash(t, key, key_length);
+    lrutrack_sharded_shard_t *shard = lrutrack_sharded_select(t, hash);
+    lrutrack_sharded_lock(t, shard);
+    lrutrack_sharded_write_begin(shard);
+    int result = lrutrack_sharded_remove_locked(t, shard,
+        lrutrack_sharded_row(t, hash), key, key_length);
+#else
+    lrutrack_sharded_shard_t *shard = lrutrack_sharded_select(t,
+        lrutrack_sharded_hash(t, key));
+    lrutrack_sharded_lock(t, shard);
+    lrutrack_sharded_write_begin(shard);
+    int result = lrutrack_sharded_remove_locked(t, shard,
+        lrutrack_sharded_row(t, key), key);
+#endif
+    lrutrack_sharded_write_end(t, shard);
+    lrutrack_sharded_unlock_and_evict(t, shard);
+
+    return result;
+}
+
+#if !LRUTRACK_32BIT_KEY
+static lrutrack_value_t lrutrack_sharded_read(lrutrack_sharded_t *t,
+    const void *key, uint32_t key_length, int touch)
+#else
+static lrutrack_value_t lrutrack_sharded_read(lrutrack_sharded_t *t,
+    uint32_t key, int touch)
+#endif
+{
+    assert(t);
+
+#if !LRUTRACK_32BIT_KEY
+    lrutrack_sharded_shard_t *shard = lrutrack_sharded_select(t,
+        lrutrack_sharded_hash(t, key, key_length));
+#   define LRUTRACK_SHARDED_PEEK(row) \
+        lrutrack_peek(shard->tracker, key, key_length, row)
+#   define LRUTRACK_SHARDED_USE() \
+        lrutrack_use(shard->tracker, key, key_length)
+#else
+    lrutrack_sharded_shard_t *shard = lrutrack_sharded_select(t,
+        lrutrack_sharded_hash(t, key));
+#   define LRUTRACK_SHARDED_PEEK(row) lrutrack_peek(shard->tracker, key, row)
+#   define LRUTRACK_SHARDED_USE() lrutrack_use(shard->tracker, key)
+#endif
+
+    lrutrack_value_t value;
+    uint32_t row;
+
+    if (t->flags & LRUTRACK_SHARDED_OPTIMISTIC) {
+        for (uint32_t i = 0; i < LRUTRACK_SHARDED_OPTIMISTIC_TRIES; ++i) {
+            uint32_t seq = atomic_load_explicit(&shard->seq,
+                memory_order_acquire);
+            if (seq & 1)
+                continue;
+
+            value = LRUTRACK_SHARDED_PEEK(&row);
+
+            atomic_thread_fence(memory_order_acquire);
+            if (atomic_load_explicit(&shard->seq, memory_order_relaxed) !=
+                seq)
+                continue;
+
+            if (touch && value != t->invalid_value)
+                lrutrack_sharded_defer_touch(shard, row);
+            return value;
+        }
+
+        // Too many writers in the way, wait for them instead
+    } else if (t->flags & LRUTRACK_SHARDED_RWLOCK) {
+        pthread_rwlock_rdlock(&shard->rwlock);
+        value = LRUTRACK_SHARDED_PEEK(&row);
+        pthread_rwlock_unlock(&shard->rwlock);
+
+        if (touch && value != t->invalid_value)
+            lrutrack_sharded_defer_touch(shard, row);
+        return value;
+    }
+
+    lrutrack_sharded_lock(t, shard);
+    value = touch ? LRUTRACK_SHARDED_USE() : LRUTRACK_SHARDED_PEEK(NULL);
+    lrutrack_sharded_unlock(t, shard);
+
+#undef LRUTRACK_SHARDED_PEEK
+#undef LRUTRACK_SHARDED_USE
+
+    return value;
+}
+
+#if !LRUTRACK_32BIT_KEY
+lrutrack_value_t lrutrack_sharded_use(lrutrack_sharded_t *t, const void *key,
+    uint32_t key_length) {
+    return lrutrack_sharded_read(t, key, key_length, 1);
+}
+
+lrutrack_value_t lrutrack_sharded_peek(lrutrack_sharded_t *t,
+    const void *key, uint32_t key_length) {
+    return lrutrack_sharded_read(t, key, key_length, 0);
+}
+#else
+lrutrack_value_t lrutrack_sharded_use(lrutrack_sharded_t *t, uint32_t key) {
+    return lrutrack_sharded_read(t, key, 1);
+}
+
+lrutrack_value_t lrutrack_sharded_peek(lrutrack_sharded_t *t, uint32_t key) {
+    return lrutrack_sharded_read(t, key, 0);
+}
+#endif
+
+#if !LRUTRACK_32BIT_KEY
+
+//
+// c-string key helper functions
+
+int lrutrack_sharded_insert_strkey(lrutrack_sharded_t *t, const char *key,
+    lrutrack_value_t value) {
+    assert(key != NULL && strlen(key) <= UINT32_MAX);
+    return lrutrack_sharded_insert(t, key, (uint32_t)strlen(key), value);
+}
+
+int lrutrack_sharded_remove_strkey(lrutrack_sharded_t *t, const char *key) {
+    assert(key != NULL && strlen(key) <= UINT32_MAX);
+    return lrutrack_sharded_remove(t, key, (uint32_t)strlen(key));
+}
+
+lrutrack_value_t lrutrack_sharded_use_strkey(lrutrack_sharded_t *t,
+    const char *key) {
+    assert(key != NULL && strlen(key) <= UINT32_MAX);
+    return lrutrack_sharded_use(t, key, (uint32_t)strlen(key));
+}
+
+#endif
+
+//
+// Batches
+
+// Runs one shard's share of a batch, the operations group[0..n) of ops
+static void lrutrack_sharded_run_group(lrutrack_sharded_t *t,
+    lrutrack_sharded_shard_t *shard, lrutrack_sharded_op_t *ops,
+    const uint32_t *rows, const uint32_t *group, uint32_t n) {
+    int writes = 0;
+    for (uint32_t i = 0; i < n; ++i) {
+        uint32_t op = ops[group[i]].op;
+        writes |= op == LRUTRACK_SHARDED_OP_INSERT ||
+            op == LRUTRACK_SHARDED_OP_REMOVE;
+    }
+
+    // The rows' locations are fixed, their contents need the lock
+    for (uint32_t i = 0; i < n; ++i)
+        lrutrack_prefetch_row(shard->tracker, rows[group[i]]);
+
+    lrutrack_sharded_lock(t, shard);
+
+    for (uint32_t i = 0; i < n; ++i)
+        lrutrack_prefetch_row_items(shard->tracker, rows[group[i]]);
+
+    if (writes)
+        lrutrack_sharded_write_begin(shard);
+
+    for (uint32_t i = 0; i < n; ++i) {
+        lrutrack_sharded_op_t *op = &ops[group[i]];
+#if !LRUTRACK_32BIT_KEY
+#   define LRUTRACK_SHARDED_OP_KEY op->key, op->key_length
+#else
+#   define LRUTRACK_SHARDED_OP_KEY op->key
+#endif
+        switch (op->op) {
+        case LRUTRACK_SHARDED_OP_INSERT:
+            op->result = lrutrack_sharded_insert_locked(t, shard,
+                LRUTRACK_SHARDED_OP_KEY, op->value);
+            break;
+        case LRUTRACK_SHARDED_OP_REMOVE:
+            op->result = lrutrack_sharded_remove_locked(t, shard,
+                rows[group[i]], LRUTRACK_SHARDED_OP_KEY);
+            break;
+        case LRUTRACK_SHARDED_OP_USE:
+        case LRUTRACK_SHARDED_OP_PEEK:
+            op->value = op->op == LRUTRACK_SHARDED_OP_USE ?
+                lrutrack_use(shard->tracker, LRUTRACK_SHARDED_OP_KEY) :
+                lrutrack_peek(shard->tracker, LRUTRACK_SHARDED_OP_KEY, NULL);
+            op->result = op->value != t->invalid_value ? LRUTRACK_OK :
+                LRUTRACK_NOT_FOUND;
+            break;
+        default:
+            assert(0);
+            op->result = LRUTRACK_ERROR;
+            break;
+        }
+#undef LRUTRACK_SHARDED_OP_KEY
+    }
+
+    if (writes) {
+        lrutrack_sharded_write_end(t, shard);
+        lrutrack_sharded_unlock_and_evict(t, shard);
+    } else {
+        lrutrack_sharded_unlock(t, shard);
+    }
+}
+
+void lrutrack_sharded_batch(lrutrack_sharded_t *t, lrutrack_sharded_op_t *ops,
+    uint32_t num_ops) {
+    assert(t);
+    assert(ops || num_ops == 0);
+
+    uint32_t shard_indices[LRUTRACK_SHARDED_BATCH_MAX];
+    uint32_t rows[LRUTRACK_SHARDED_BATCH_MAX];
+    uint32_t group[LRUTRACK_SHARDED_BATCH_MAX];
+    uint8_t grouped[LRUTRACK_SHARDED_BATCH_MAX];
+    int inserts = 0;
+
+    while (num_ops != 0) {
+        uint32_t n = num_ops < LRUTRACK_SHARDED_BATCH_MAX ? num_ops :
+            LRUTRACK_SHARDED_BATCH_MAX;
+
+        for (uint32_t i = 0; i < n; ++i) {
+            const lrutrack_sharded_op_t *op = &ops[i];
+#if !LRUTRACK_32BIT_KEY
+            assert(op->key != NULL && op->key_length != 0);
+            uint32_t hash = lrutrack_sharded_hash(t, op->key, op->key_length);
+            rows[i] = lrutrack_sharded_row(t, hash);
+#else
+            uint32_t hash = lrutrack_sharded_hash(t, op->key);
+            rows[i] = lrutrack_sharded_row(t, op->key);
+#endif
+            shard_indices[i] =
+                (uint32_t)(lrutrack_sharded_select(t, hash) - t->shards);
+            grouped[i] = 0;
+            inserts |= op->op == LRUTRACK_SHARDED_OP_INSERT;
+        }
+
+        // Shards in order of their first operation, each group in array
+        // order
+        for (uint32_t first = 0; first < n; ++first) {
+            if (grouped[first])
+                continue;
+
+            uint32_t group_size = 0;
+            for (uint32_t i = first; i < n; ++i) {
+                if (!grouped[i] && shard_indices[i] == shard_indices[first]) {
+                    grouped[i] = 1;
+                    group[group_size++] = i;
+                }
+            }
+
+            lrutrack_sharded_run_group(t, &t->shards[shard_indices[first]],
+                ops, rows, group, group_size);
+        }
+
+        ops += n;
+        num_ops -= n;
+    }
+
+    if (inserts)
+        lrutrack_sharded_wake_evictor(t);
+}
+
+//
+
+void lrutrack_sharded_remove_all(lrutrack_sharded_t *t) {
+    assert(t);
+
+    for (uint32_t i = 0; i < t->num_shards; ++i) {
+        lrutrack_sharded_shard_t *shard = &t->shards[i];
+        lrutrack_sharded_lock(t, shard);
+        lrutrack_sharded_write_begin(shard);
+        if (t->flags & LRUTRACK_SHARDED_NEAR_CACHE) {
+            for (uint32_t row = 0; row <= t->row_mask; ++row)
+                lrutrack_sharded_bump_row(shard, row);
+        }
+        lrutrack_remove_all(shard->tracker);
+        lrutrack_sharded_write_end(t, shard);
+        lrutrack_sharded_unlock_and_evict(t, shard);
+    }
+}
+
+int lrutrack_sharded_remove_lru(lrutrack_sharded_t *t) {
+    assert(t);
+
+    for (uint32_t i = 0; i < t->num_shards; ++i) {
+        uint32_t hand = atomic_fetch_add_explicit(&t->lru_hand, 1,
+            memory_order_relaxed);
+        lrutrack_sharded_shard_t *shard =
+            &t->shards[hand & (t->num_shards - 1)];
+
+        lrutrack_sharded_lock(t, shard);
+        lrutrack_sharded_write_begin(shard);
+        int result = lrutrack_sharded_remove_lru_row(t, shard);
+        lrutrack_sharded_write_end(t, shard);
+        lrutrack_sharded_unlock_and_evict(t, shard);
+
+        if (result == LRUTRACK_OK)
+            return LRUTRACK_OK;
+    }
+
+    return LRUTRACK_NOT_FOUND;
+}
+
+//
+// Near caches
+
+lrutrack_sharded_near_t *lrutrack_sharded_near_create(lrutrack_sharded_t *t,
+    uint32_t num_sets) {
+    assert(t && (t->flags & LRUTRACK_SHARDED_NEAR_CACHE));
+    assert(lrutrack_sharded_is_power_of_two(num_sets));
+
+    lrutrack_sharded_near_t *nc = t->allocator.alloc_func(t->allocator.user,
+        sizeof(lrutrack_sharded_near_t), sizeof(void *));
+    if (!nc)
+        return NULL;
+
+    memset(nc, 0, sizeof(*nc));
+
+    size_t entries_bytesize = sizeof(*nc->entries) * num_sets * 2;
+    nc->entries = t->allocator.alloc_func(t->allocator.user,
+        entries_bytesize, LRUTRACK_SHARDED_CACHE_LINE);
+    if (!nc->entries) {
+        t->allocator.dealloc_func(t->allocator.user, nc, sizeof(*nc));
+        return NULL;
+    }
+
+    memset(nc->entries, 0, entries_bytesize);
+    nc->num_sets = num_sets;
+    for (uint32_t i = 0; i < num_sets * 2; ++i)
+        nc->entries[i].value = t->invalid_value;
+
+    return nc;
+}
+
+void lrutrack_sharded_near_destroy(lrutrack_sharded_t *t,
+    lrutrack_sharded_near_t *nc) {
+    assert(t && nc);
+    t->allocator.dealloc_func(t->allocator.user, nc->entries,
+        sizeof(*nc->entries) * nc->num_sets * 2);
+    t->allocator.dealloc_func(t->allocator.user, nc, sizeof(*nc));
+}
+
+#if !LRUTRACK_32BIT_KEY
+lrutrack_value_t lrutrack_sharded_near_use(lrutrack_sharded_t *t,
+    lrutrack_sharded_near_t *nc, const void *key, uint32_t key_length)
+#else
+lrutrack_value_t lrutrack_sharded_near_use(lrutrack_sharded_t *t,
+    lrutrack_sharded_near_t *nc, uint32_t key)
+#endif
+{
+    assert(t && nc);
+
+#if !LRUTRACK_32BIT_KEY
+    assert(key != NULL && key_length != 0);
+    uint32_t hash = lrutrack_sharded_hash(t, key, key_length);
+    uint32_t row = lrutrack_sharded_row(t, hash);
+#   define LRUTRACK_SHARDED_NEAR_MATCH(entry) \
+        ((entry)->key_length == key_length && \
+            memcmp((entry)->key, key, key_length) == 0)
+#else
+    uint32_t hash = lrutrack_sharded_hash(t, key);
+    uint32_t row = lrutrack_sharded_row(t, key);
+#   define LRUTRACK_SHARDED_NEAR_MATCH(entry) ((entry)->key == key)
+#endif
+
+    const lrutrack_sharded_shard_t *shard = lrutrack_sharded_select(t, hash);
+    lrutrack_sharded_near_entry_t *set =
+        &nc->entries[(hash & (nc->num_sets - 1)) * 2];
+
+    for (uint32_t way = 0; way < 2; ++way) {
+        lrutrack_sharded_near_entry_t *entry = &set[way];
+        if (entry->value == t->invalid_value || entry->hash != hash ||
+            !LRUTRACK_SHARDED_NEAR_MATCH(entry))
+            continue;
+
+        if (atomic_load_explicit(&shard->versions[row],
+            memory_order_acquire) == entry->version &&
+            ++entry->hits < LRUTRACK_SHARDED_NEAR_REFRESH) {
+            lrutrack_value_t value = entry->value;
+            if (way == 1) {
+                lrutrack_sharded_near_entry_t tmp = set[0];
+                set[0] = set[1];
+                set[1] = tmp;
+            }
+            nc->num_hits++;
+            return value;
+        }
+
+        // Removed or due a refresh, looked up again below
+        entry->value = t->invalid_value;
+        break;
+    }
+
+#undef LRUTRACK_SHARDED_NEAR_MATCH
+
+    nc->num_misses++;
+
+    // Read before the shard: a removal after this still invalidates
+    uint32_t version = atomic_load_explicit(&shard->versions[row],
+        memory_order_acquire);
+#if !LRUTRACK_32BIT_KEY
+    lrutrack_value_t value = lrutrack_sharded_read(t, key, key_length, 1);
+    if (value == t->invalid_value ||
+        key_length > LRUTRACK_SHARDED_NEAR_KEY_BYTES)
+        return value;
+#else
+    lrutrack_value_t value = lrutrack_sharded_read(t, key, 1);
+    if (value == t->invalid_value)
+        return value;
+#endif
+
+    // Most recent first, pushing the other way out
+    if (set[0].value != t->invalid_value)
+        set[1] = set[0];
+
+    lrutrack_sharded_near_entry_t *entry = &set[0];
+    entry->hash = hash;
+    entry->version = version;
+    entry->value = value;
+    entry->hits = 0;
+#if !LRUTRACK_32BIT_KEY
+    entry->key_length = key_length;
+    memcpy(entry->key, key, key_length);
+#else
+    entry->key = key;
+#endif
+
+    return value;
+}
+
+#if !LRUTRACK_32BIT_KEY
+lrutrack_value_t lrutrack_sharded_near_use_strkey(lrutrack_sharded_t *t,
+    lrutrack_sharded_near_t *nc, const char *key) {
+    assert(key != NULL && strlen(key) <= UINT32_MAX);
+    return lrutrack_sharded_near_use(t, nc, key, (uint32_t)strlen(key));
+}
+#endif
+
+void lrutrack_sharded_near_stats(const lrutrack_sharded_near_t *nc,
+    uint64_t *num_hits, uint64_t *num_misses) {
+    assert(nc);
+    if (num_hits)
+        *num_hits = nc->num_hits;
+    if (num_misses)
+        *num_misses = nc->num_misses;
+}
+
+//
+
+void lrutrack_sharded_set_thread_node(int node) {
+    lrutrack_sharded_thread_node_override = node;
+}
+
+uint32_t lrutrack_sharded_thread_node(const lrutrack_sharded_t *t) {
+    assert(t);
+    return t->num_nodes ? lrutrack_sharded_thread_node_of(t) : 0;
+}
+
+uint32_t lrutrack_sharded_num_shards(const lrutrack_sharded_t *t) {
+    return t->num_shards;
+}
+
+uint32_t lrutrack_sharded_count(const lrutrack_sharded_t *t) {
+    assert(t);
+    return atomic_load_explicit(&t->num_entries, memory_order_relaxed);
+}
+
+uint32_t lrutrack_sharded_shard_home_node(const lrutrack_sharded_t *t,
+    uint32_t shard) {
+    assert(shard < t->num_shards);
+    return t->shards[shard].node;
+}
+
+int lrutrack_sharded_shard_memory_node(lrutrack_sharded_t *t,
+    uint32_t shard) {
+    assert(shard < t->num_shards);
+
+#if defined(__linux__) && defined(SYS_get_mempolicy)
+    lrutrack_sharded_shard_t *s = &t->shards[shard];
+    pthread_mutex_lock(&s->lock);
+    int node = -1;
+    if (s->last_array && syscall(SYS_get_mempolicy, &node, NULL, 0,
+        s->last_array, LRUTRACK_MPOL_F_NODE | LRUTRACK_MPOL_F_ADDR) != 0)
+        node = -1;
+    pthread_mutex_unlock(&s->lock);
+    return node;
+#else
+    (void)t;
+    return -1;
+#endif
+}
@@ -0,0 +1,231 @@
+// Least-recently-used tracking helper in C
+// Sharded tracker for concurrent use, with optional NUMA placement
+
+#ifndef LRUTRACK_SHARDED_H
+#define LRUTRACK_SHARDED_H
+
+#include "lrutrack.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//
+// Types:
+// Keys are spread over independent lrutrack_t shards, each behind its own
+// mutex. Recency is tracked per shard.
+//
+// With num_nodes != 0, shard i is homed on node i % num_nodes and its
+// hash table and item arrays are bound to that node's memory. Nodes past
+// the ones the machine has wrap around, so a single-node host can run a
+// multi-node layout. Small allocations (keys) use the base allocator.
+//
+// LRUTRACK_SHARDED_NODE_LOCAL selects shards among those of the calling
+// thread's node only. A key is then only visible to threads of the node
+// that inserted it, which suits workloads where each thread group owns
+// its keys.
+
+// LRUTRACK_SHARDED_RWLOCK guards shards with a reader-writer lock. Reads
+// share the lock and leave their recency updates to the next writer.
+//
+// LRUTRACK_SHARDED_OPTIMISTIC makes reads take no lock at all: they run
+// against a per-shard sequence counter and retry when a writer changed the
+// shard meanwhile, falling back to the lock after a few attempts. Recency
+// updates are deferred like with LRUTRACK_SHARDED_RWLOCK. Shards then have
+// a fixed capacity of num_initial_items entries (keys of at most
+// max_key_length bytes) and evict their LRU row when full.
+
+// LRUTRACK_SHARDED_DEFER_EVICTION runs evict_func after the shard lock is
+// released, so that slow eviction handlers do not hold up other threads
+// and may call back into the tracker.
+
+// max_items caps the entries over all shards; each shard holds at most its
+// max_items / num_shards share and an insert into a full shard evicts that
+// shard's LRU rows first. With high_watermark != 0 a background thread is
+// started which, once the total exceeds high_watermark, evicts LRU rows
+// from the shards above their share of low_watermark until the total is
+// down to it. Inserts then rarely reach the hard limit and pay for no
+// eviction themselves. evict_func is called on that thread as well, so it
+// must be thread safe.
+
+// LRUTRACK_SHARDED_NEAR_CACHE keeps a version per shard row, changed
+// whenever a key on the row is removed or evicted. Threads can then put a
+// small private cache (lrutrack_sharded_near_t) in front of the tracker,
+// which answers repeated lookups of hot keys without a lock or a shard
+// access, only reading the key's row version to validate the cached value.
+
+#define LRUTRACK_SHARDED_NODE_LOCAL 1
+#define LRUTRACK_SHARDED_RWLOCK 2
+#define LRUTRACK_SHARDED_OPTIMISTIC 4
+#define LRUTRACK_SHARDED_DEFER_EVICTION 8
+#define LRUTRACK_SHARDED_NEAR_CACHE 16
+
+// Longer keys are looked up in the shards every time
+#define LRUTRACK_SHARDED_NEAR_KEY_BYTES 44
+
+// Near cache hits of a key between shard lookups that refresh its recency
+#define LRUTRACK_SHARDED_NEAR_REFRESH 64
+
+// Batched operations
+#define LRUTRACK_SHARDED_OP_INSERT 0
+#define LRUTRACK_SHARDED_OP_REMOVE 1
+#define LRUTRACK_SHARDED_OP_USE 2
+#define LRUTRACK_SHARDED_OP_PEEK 3
+
+typedef struct lrutrack_sharded_t lrutrack_sharded_t;
+typedef struct lrutrack_sharded_near_t lrutrack_sharded_near_t;
+
+typedef struct lrutrack_sharded_op_t {
+    uint32_t op;
+#if !LRUTRACK_32BIT_KEY
+    uint32_t key_length;
+    const void *key;
+#else
+    uint32_t key;
+#endif
+    lrutrack_value_t value; // Inserted value, or the value used or peeked
+    int result; // LRUTRACK_NOT_FOUND for keys not used or peeked
+} lrutrack_sharded_op_t;
+
+typedef struct lrutrack_sharded_config_t {
+    uint32_t num_shards; // Power of two
+    uint32_t hash_table_size; // Per shard, power of two
+    uint32_t num_initial_items; // Per shard
+    uint32_t num_nodes; // 0 = no NUMA placement
+    uint32_t flags;
+    uint32_t max_key_length; // With LRUTRACK_SHARDED_OPTIMISTIC
+    uint32_t max_items; // Hard limit, 0 = none
+    uint32_t high_watermark; // Background eviction above, 0 = off
+    uint32_t low_watermark; // Background eviction target
+} lrutrack_sharded_config_t;
+
+//
+//
+
+lrutrack_sharded_t *lrutrack_sharded_create(
+    const lrutrack_sharded_config_t *config, uint32_t hash_seed,
+    lrutrack_value_t invalid_value,
+    void *evict_user, lrutrack_evict_func_t evict_func,
+    const lrutrack_allocator_t *allocator);
+void lrutrack_sharded_destroy(lrutrack_sharded_t *t);
+
+#if !LRUTRACK_32BIT_KEY
+
+//
+// Variable-length key functions:
+
+int lrutrack_sharded_insert(lrutrack_sharded_t *t, const void *key,
+    uint32_t key_length, lrutrack_value_t value);
+
+int lrutrack_sharded_remove(lrutrack_sharded_t *t, const void *key,
+    uint32_t key_length);
+
+lrutrack_value_t lrutrack_sharded_use(lrutrack_sharded_t *t, const void *key,
+    uint32_t key_length);
+
+// Same as use, without marking the key as recently used
+lrutrack_value_t lrutrack_sharded_peek(lrutrack_sharded_t *t,
+    const void *key, uint32_t key_length);
+
+//
+// Null-terminated string key helper functions:
+
+int lrutrack_sharded_insert_strkey(lrutrack_sharded_t *t, const char *key,
+    lrutrack_value_t value);
+
+int lrutrack_sharded_remove_strkey(lrutrack_sharded_t *t, const char *key);
+
+lrutrack_value_t lrutrack_sharded_use_strkey(lrutrack_sharded_t *t,
+    const char *key);
+
+#else
+
+//
+// 32-bit key functions:
+
+int lrutrack_sharded_insert(lrutrack_sharded_t *t, uint32_t key,
+    lrutrack_value_t value);
+int lrutrack_sharded_remove(lrutrack_sharded_t *t, uint32_t key);
+lrutrack_value_t lrutrack_sharded_use(lrutrack_sharded_t *t, uint32_t key);
+lrutrack_value_t lrutrack_sharded_peek(lrutrack_sharded_t *t, uint32_t key);
+
+#endif // LRUTRACK_32BIT_KEY
+
+//
+// Batches:
+// Runs the operations grouped by shard, taking each shard's lock once per
+// up to LRUTRACK_SHARDED_BATCH_MAX operations, with their rows prefetched.
+// Results are stored in the operations themselves. Operations on the same
+// shard run in array order; the batch as a whole is not atomic.
+
+#define LRUTRACK_SHARDED_BATCH_MAX 64
+
+void lrutrack_sharded_batch(lrutrack_sharded_t *t, lrutrack_sharded_op_t *ops,
+    uint32_t num_ops);
+
+//
+// Cleaning functions:
+
+void lrutrack_sharded_remove_all(lrutrack_sharded_t *t);
+
+// Evicts the LRU row of the next non-empty shard, round robin
+int lrutrack_sharded_remove_lru(lrutrack_sharded_t *t);
+
+//
+//
+
+// Entries over all shards, as of the last completed change
+uint32_t lrutrack_sharded_count(const lrutrack_sharded_t *t);
+
+//
+// Near caches:
+// Two-way set associative, num_sets a power of two. A near cache belongs
+// to one thread and must be destroyed before the tracker. Hits do not
+// update recency, so every LRUTRACK_SHARDED_NEAR_REFRESH hits on a key the
+// lookup goes to its shard instead.
+
+lrutrack_sharded_near_t *lrutrack_sharded_near_create(lrutrack_sharded_t *t,
+    uint32_t num_sets);
+void lrutrack_sharded_near_destroy(lrutrack_sharded_t *t,
+    lrutrack_sharded_near_t *nc);
+
+#if !LRUTRACK_32BIT_KEY
+lrutrack_value_t lrutrack_sharded_near_use(lrutrack_sharded_t *t,
+    lrutrack_sharded_near_t *nc, const void *key, uint32_t key_length);
+lrutrack_value_t lrutrack_sharded_near_use_strkey(lrutrack_sharded_t *t,
+    lrutrack_sharded_near_t *nc, const char *key);
+#else
+lrutrack_value_t lrutrack_sharded_near_use(lrutrack_sharded_t *t,
+    lrutrack_sharded_near_t *nc, uint32_t key);
+#endif
+
+// Lookups answered by the near cache and lookups that went to a shard
+void lrutrack_sharded_near_stats(const lrutrack_sharded_near_t *nc,
+    uint64_t *num_hits, uint64_t *num_misses);
+
+//
+// NUMA placement:
+
+// Overrides the node of the calling thread, -1 = ask the OS. Lets tests and
+// benchmarks pin threads to virtual nodes.
+void lrutrack_sharded_set_thread_node(int node);
+
+// Node the calling thread runs on, in the tracker's 0..num_nodes-1 range
+uint32_t lrutrack_sharded_thread_node(const lrutrack_sharded_t *t);
+
+uint32_t lrutrack_sharded_num_shards(const lrutrack_sharded_t *t);
+
+// Node shard is meant to live on, UINT32_MAX without NUMA placement
+uint32_t lrutrack_sharded_shard_home_node(const lrutrack_sharded_t *t,
+    uint32_t shard);
+
+// Physical node backing the shard's most recent array allocation, as
+// reported by the kernel, -1 if not known
+int lrutrack_sharded_shard_memory_node(lrutrack_sharded_t *t,
+    uint32_t shard);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,1080 @@
+#include "lrutrack.h"
+#include "lrutrack_rh.h"
+#include "lrutrack_cuckoo.h"
+#include "lrutrack_bucket.h"
+#include "lrutrack_sharded.h"
+#include "lrutrack_fc.h"
+#include "lrutrack_delegate.h"
+#include "lrutrack_lf.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <assert.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+
+#if defined(__linux__)
+#   include <linux/perf_event.h>
+#   include <sys/ioctl.h>
+#   include <sys/syscall.h>
+#   include <unistd.h>
+#endif
+
+//
+// Timing and hardware counters
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+// Data TLB read misses of the calling thread, -1 if not available
+static int tlb_counter_open(void) {
+#if defined(__linux__)
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.config = PERF_COUNT_HW_CACHE_DTLB |
+        (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+        (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+#else
+    return -1;
+#endif
+}
+
+static void tlb_counter_start(int fd) {
+#if defined(__linux__)
+    if (fd >= 0) {
+        ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+#else
+    (void)fd;
+#endif
+}
+
+static long long tlb_counter_stop(int fd) {
+#if defined(__linux__)
+    long long count = 0;
+    if (fd >= 0) {
+        ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+        if (read(fd, &count, sizeof(count)) == sizeof(count))
+            return count;
+    }
+#else
+    (void)fd;
+#endif
+    return -1;
+}
+
+//
+
+static uint32_t xorshift32(uint32_t *state) {
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+static void *malloc_wrapper(size_t sz) {
+    return malloc(sz);
+}
+
+static void free_wrapper(void *ptr) {
+    free(ptr);
+}
+
+static void *alloc_wrapper(void *user, size_t sz, size_t alignment) {
+    (void)user;
+    void *ptr = NULL;
+    if (alignment <= sizeof(void *))
+        return malloc(sz);
+    if (posix_memalign(&ptr, alignment, sz) != 0)
+        return NULL;
+    return ptr;
+}
+
+static void dealloc_wrapper(void *user, void *ptr, size_t sz) {
+    (void)user;
+    (void)sz;
+    free(ptr);
+}
+
+static const lrutrack_allocator_t allocator = {
+    NULL, alloc_wrapper, dealloc_wrapper
+};
+
+static void evict(void *user, lrutrack_value_t value) {
+    (void)value;
+    ++*(uint64_t *)user;
+}
+
+#define HASH_SEED 0xcafebabe
+#define INVALID_VALUE 0
+
+static uint32_t round_up_to_power_of_two(uint32_t x) {
+    uint32_t r = 1;
+    while (r < x)
+        r <<= 1;
+    return r;
+}
+
+//
+// Tracker variants behind a common interface
+
+typedef struct bench_backend_t {
+    const char *name;
+    void *(*create)(uint32_t num_keys, uint64_t *num_evicted);
+    void (*destroy)(void *t);
+    int (*insert)(void *t, uint32_t key, lrutrack_value_t value);
+    lrutrack_value_t (*use)(void *t, uint32_t key);
+} bench_backend_t;
+
+static void *chained_create(uint32_t num_keys, uint64_t *num_evicted) {
+    return lrutrack_create(round_up_to_power_of_two(num_keys), num_keys,
+        HASH_SEED, INVALID_VALUE, num_evicted, evict, malloc_wrapper,
+        free_wrapper);
+}
+
+static void chained_destroy(void *t) {
+    lrutrack_destroy(t);
+}
+
+static int chained_insert(void *t, uint32_t key, lrutrack_value_t value) {
+#if !LRUTRACK_32BIT_KEY
+    return lrutrack_insert(t, &key, sizeof(key), value);
+#else
+    return lrutrack_insert(t, key, value);
+#endif
+}
+
+static lrutrack_value_t chained_use(void *t, uint32_t key) {
+#if !LRUTRACK_32BIT_KEY
+    return lrutrack_use(t, &key, sizeof(key));
+#else
+    return lrutrack_use(t, key);
+#endif
+}
+
+static void *rh_create(uint32_t num_keys, uint64_t *num_evicted) {
+    // Start at the final size to measure a table at ~90% load
+    uint32_t table_size = round_up_to_power_of_two(num_keys);
+    if ((uint64_t)num_keys * 100 >
+        (uint64_t)table_size * LRUTRACK_RH_MAX_LOAD_PERCENT)
+        table_size *= 2;
+    return lrutrack_rh_create(table_size, num_keys, HASH_SEED, INVALID_VALUE,
+        num_evicted, evict, &allocator);
+}
+
+static void rh_destroy(void *t) {
+    printf("rh: mean probe length %.3f\n", lrutrack_rh_mean_probe_length(t));
+    lrutrack_rh_destroy(t);
+}
+
+static int rh_insert(void *t, uint32_t key, lrutrack_value_t value) {
+#if !LRUTRACK_32BIT_KEY
+    return lrutrack_rh_insert(t, &key, sizeof(key), value);
+#else
+    return lrutrack_rh_insert(t, key, value);
+#endif
+}
+
+static lrutrack_value_t rh_use(void *t, uint32_t key) {
+#if !LRUTRACK_32BIT_KEY
+    return lrutrack_rh_use(t, &key, sizeof(key));
+#else
+    return lrutrack_rh_use(t, key);
+#endif
+}
+
+static void *cuckoo_create(uint32_t num_keys, uint64_t *num_evicted) {
+    // Four slots per bucket, sized for ~50% load so that no key is evicted
+    return lrutrack_cuckoo_create(round_up_to_power_of_two(num_keys / 2),
+        sizeof(uint32_t), HASH_SEED, INVALID_VALUE, num_evicted, evict,
+        &allocator);
+}
+
+static void cuckoo_destroy(void *t) {
+    lrutrack_cuckoo_destroy(t);
+}
+
+static int cuckoo_insert(void *t, uint32_t key, lrutrack_value_t value) {
+#if !LRUTRACK_32BIT_KEY
+    return lrutrack_cuckoo_insert(t, &key, sizeof(key), value);
+#else
+    return lrutrack_cuckoo_insert(t, key, value);
+#endif
+}
+
+static lrutrack_value_t cuckoo_use(void *t, uint32_t key) {
+#if !LRUTRACK_32BIT_KEY
+    return lrutrack_cuckoo_use(t, &key, sizeof(key));
+#else
+    return lrutrack_cuckoo_use(t, key);
+#endif
+}
+
+static void *bucket_create(uint32_t num_keys, uint64_t *num_evicted) {
+    // Four keys per bucket on average, half of each cache line
+    return lrutrack_bucket_create(round_up_to_power_of_two(num_keys / 4),
+        num_keys, HASH_SEED, INVALID_VALUE, num_evicted, evict, &allocator);
+}
+
+static void bucket_destroy(void *t) {
+    printf("bucket: %llu entries evicted from full buckets\n",
+        (unsigned long long)lrutrack_bucket_num_conflict_evictions(t));
+    lrutrack_bucket_destroy(t);
+}
+
+static int bucket_insert(void *t, uint32_t key, lrutrack_value_t value) {
+#if !LRUTRACK_32BIT_KEY
+    return lrutrack_bucket_insert(t, &key, sizeof(key), value);
+#else
+    return lrutrack_bucket_insert(t, key, value);
+#endif
+}
+
+static lrutrack_value_t bucket_use(void *t, uint32_t key) {
+#if !LRUTRACK_32BIT_KEY
+    return lrutrack_bucket_use(t, &key, sizeof(key));
+#else
+    return lrutrack_bucket_use(t, key);
+#endif
+}
+
+// Virtual NUMA nodes for the sharded backend, wrapped onto the real ones
+static uint32_t bench_num_nodes = 2;
+
+#define BENCH_NUM_SHARDS 8
+
+static void *sharded_create(uint32_t num_keys, uint64_t *num_evicted) {
+    lrutrack_sharded_config_t config;
+    config.num_shards = BENCH_NUM_SHARDS;
+    config.hash_table_size = round_up_to_power_of_two(num_keys /
+        BENCH_NUM_SHARDS + 1);
+    config.num_initial_items = num_keys / BENCH_NUM_SHARDS + 1;
+    config.num_nodes = bench_num_nodes;
+    config.flags = 0;
+    config.max_key_length = 0;
+    config.max_items = 0;
+    config.high_watermark = 0;
+    config.low_watermark = 0;
+    return lrutrack_sharded_create(&config, HASH_SEED, INVALID_VALUE,
+        num_evicted, evict, &allocator);
+}
+
+// Reports where each shard was meant to go and where its memory landed
+static void sharded_destroy(void *t) {
+    for (uint32_t i = 0; i < lrutrack_sharded_num_shards(t); ++i) {
+        printf("sharded: shard %u home node %u, memory on node %d\n", i,
+            lrutrack_sharded_shard_home_node(t, i),
+            lrutrack_sharded_shard_memory_node(t, i));
+    }
+
+    lrutrack_sharded_destroy(t);
+}
+
+static int sharded_insert(void *t, uint32_t key, lrutrack_value_t value) {
+#if !LRUTRACK_32BIT_KEY
+    return lrutrack_sharded_insert(t, &key, sizeof(key), value);
+#else
+    return lrutrack_sharded_insert(t, key, value);
+#endif
+}
+
+static lrutrack_value_t sharded_use(void *t, uint32_t key) {
+#if !LRUTRACK_32BIT_KEY
+    return lrutrack_sharded_use(t, &key, sizeof(key));
+#else
+    return lrutrack_sharded_use(t, key);
+#endif
+}
+
+static void *lf_create(uint32_t num_keys, uint64_t *num_evicted) {
+    // Two entries per bucket on average, room for every key
+    return lrutrack_lf_create(round_up_to_power_of_two(num_keys / 2),
+        num_keys, HASH_SEED, INVALID_VALUE, num_evicted, evict, &allocator);
+}
+
+static void lf_destroy(void *t) {
+    lrutrack_lf_destroy(t);
+}
+
+static int lf_insert(void *t, uint32_t key, lrutrack_value_t value) {
+#if !LRUTRACK_32BIT_KEY
+    return lrutrack_lf_insert(t, &key, sizeof(key), value);
+#else
+    return lrutrack_lf_insert(t, key, value);
+#endif
+}
+
+static lrutrack_value_t lf_use(void *t, uint32_t key) {
+#if !LRUTRACK_32BIT_KEY
+    return lrutrack_lf_use(t, &key, sizeof(key));
+#else
+    return lrutrack_lf_use(t, key);
+#endif
+}
+
+static const bench_backend_t backends[] = {
+    { "chained", chained_create, chained_destroy, chained_insert,
+        chained_use },
+    { "rh", rh_create, rh_destroy, rh_insert, rh_use },
+    { "cuckoo", cuckoo_create, cuckoo_destroy, cuckoo_insert, cuckoo_use },
+    { "bucket", bucket_create, bucket_destroy, bucket_insert, bucket_use },
+    { "sharded", sharded_create, sharded_destroy, sharded_insert,
+        sharded_use },
+    { "lf", lf_create, lf_destroy, lf_insert, lf_use },
+};
+
+#define NUM_BACKENDS (sizeof(backends) / sizeof(backends[0]))
+
+//
+
+static int run_backend(const bench_backend_t *backend, uint32_t num_keys,
+    uint32_t num_lookups) {
+    uint64_t num_evicted = 0;
+    void *t = backend->create(num_keys, &num_evicted);
+    if (!t)
+        return 0;
+
+    printf("%s: keys %u, lookups %u, huge pages %s\n", backend->name,
+        num_keys, num_lookups, LRUTRACK_HUGE_PAGES ? "on" : "off");
+
+    double start = now_seconds();
+    for (uint32_t i = 0; i < num_keys; ++i) {
+        if (backend->insert(t, i, i + 1) != LRUTRACK_OK) {
+            backend->destroy(t);
+            return 0;
+        }
+    }
+
+    double elapsed = now_seconds() - start;
+    printf("%s: insert %.1f ns/op\n", backend->name,
+        elapsed * 1e9 / num_keys);
+
+    int tlb_fd = tlb_counter_open();
+    uint32_t rng = HASH_SEED;
+    uint64_t checksum = 0;
+
+    start = now_seconds();
+    tlb_counter_start(tlb_fd);
+    for (uint32_t i = 0; i < num_lookups; ++i)
+        checksum += backend->use(t, xorshift32(&rng) % num_keys);
+    long long tlb_misses = tlb_counter_stop(tlb_fd);
+    elapsed = now_seconds() - start;
+
+    printf("%s: use %.1f ns/op", backend->name,
+        elapsed * 1e9 / num_lookups);
+    if (tlb_misses >= 0) {
+        printf(", %.3f dTLB misses/op",
+            (double)tlb_misses / num_lookups);
+    } else {
+        printf(", dTLB counter not available");
+    }
+
+    printf(" (checksum %llu)\n", (unsigned long long)checksum);
+
+#if defined(__linux__)
+    if (tlb_fd >= 0)
+        close(tlb_fd);
+#endif
+
+    backend->destroy(t);
+    assert(num_evicted == num_keys);
+
+    return 1;
+}
+
+//
+// Read-mostly mix on the sharded tracker, 95% use and 5% remove + insert
+
+#define MIX_NUM_SHARDS 16
+#define MIX_WRITE_PERCENT 5
+
+typedef struct mix_thread_t {
+    lrutrack_sharded_t *t;
+    uint32_t num_keys;
+    uint32_t num_ops;
+    uint32_t seed;
+    int near_cache;
+    uint64_t checksum;
+} mix_thread_t;
+
+#define MIX_NEAR_SETS 256
+
+static void *mix_thread(void *arg) {
+    mix_thread_t *ctx = arg;
+    lrutrack_sharded_near_t *nc = NULL;
+    if (ctx->near_cache)
+        nc = lrutrack_sharded_near_create(ctx->t, MIX_NEAR_SETS);
+    uint32_t rng = ctx->seed;
+    for (uint32_t i = 0; i < ctx->num_ops; ++i) {
+        uint32_t key = xorshift32(&rng) % ctx->num_keys;
+        if (xorshift32(&rng) % 100 < MIX_WRITE_PERCENT) {
+#if !LRUTRACK_32BIT_KEY
+            if (lrutrack_sharded_remove(ctx->t, &key, sizeof(key)) ==
+                LRUTRACK_OK)
+                lrutrack_sharded_insert(ctx->t, &key, sizeof(key), key + 1);
+#else
+            if (lrutrack_sharded_remove(ctx->t, key) == LRUTRACK_OK)
+                lrutrack_sharded_insert(ctx->t, key, key + 1);
+#endif
+        } else if (nc) {
+#if !LRUTRACK_32BIT_KEY
+            ctx->checksum += lrutrack_sharded_near_use(ctx->t, nc, &key,
+                sizeof(key));
+#else
+            ctx->checksum += lrutrack_sharded_near_use(ctx->t, nc, key);
+#endif
+        } else {
+#if !LRUTRACK_32BIT_KEY
+            ctx->checksum += lrutrack_sharded_use(ctx->t, &key, sizeof(key));
+#else
+            ctx->checksum += lrutrack_sharded_use(ctx->t, key);
+#endif
+        }
+    }
+
+    if (nc)
+        lrutrack_sharded_near_destroy(ctx->t, nc);
+    return NULL;
+}
+
+#define MIX_MAX_THREADS 64
+
+static int run_mix(uint32_t num_keys, uint32_t num_ops, uint32_t num_threads) {
+    static const struct {
+        const char *name;
+        uint32_t flags;
+    } modes[] = {
+        { "mutex", 0 },
+        { "rwlock", LRUTRACK_SHARDED_RWLOCK },
+        { "seqlock", LRUTRACK_SHARDED_OPTIMISTIC },
+        { "near", LRUTRACK_SHARDED_NEAR_CACHE },
+    };
+
+    if (num_threads == 0 || num_threads > MIX_MAX_THREADS)
+        return 0;
+
+    for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); ++m) {
+        // Room for twice the expected keys per shard, so that fixed
+        // capacity shards do not evict
+        uint32_t per_shard = num_keys / MIX_NUM_SHARDS + 1;
+        lrutrack_sharded_config_t config;
+        config.num_shards = MIX_NUM_SHARDS;
+        config.hash_table_size = round_up_to_power_of_two(per_shard);
+        config.num_initial_items = per_shard * 2;
+        config.num_nodes = 0;
+        config.flags = modes[m].flags;
+        config.max_key_length = sizeof(uint32_t);
+        config.max_items = 0;
+        config.high_watermark = 0;
+        config.low_watermark = 0;
+
+        uint64_t num_evicted = 0;
+        lrutrack_sharded_t *t = lrutrack_sharded_create(&config, HASH_SEED,
+            INVALID_VALUE, &num_evicted, evict, &allocator);
+        if (!t)
+            return 0;
+
+        for (uint32_t i = 0; i < num_keys; ++i)
+            sharded_insert(t, i, i + 1);
+
+        mix_thread_t ctx[MIX_MAX_THREADS];
+        pthread_t threads[MIX_MAX_THREADS];
+
+        double start = now_seconds();
+        for (uint32_t i = 0; i < num_threads; ++i) {
+            ctx[i].t = t;
+            ctx[i].num_keys = num_keys;
+            ctx[i].num_ops = num_ops / num_threads;
+            ctx[i].seed = HASH_SEED + i;
+            ctx[i].near_cache =
+                (modes[m].flags & LRUTRACK_SHARDED_NEAR_CACHE) != 0;
+            ctx[i].checksum = 0;
+            pthread_create(&threads[i], NULL, mix_thread, &ctx[i]);
+        }
+
+        uint64_t checksum = 0;
+        for (uint32_t i = 0; i < num_threads; ++i) {
+            pthread_join(threads[i], NULL);
+            checksum += ctx[i].checksum;
+        }
+
+        double elapsed = now_seconds() - start;
+        printf("mix %s: %u threads, %.2f Mops/s (checksum %llu)\n",
+            modes[m].name, num_threads, num_ops / elapsed * 1e-6,
+            (unsigned long long)checksum);
+
+        lrutrack_sharded_destroy(t);
+    }
+
+    return 1;
+}
+
+//
+// Requests of BATCH_KEYS lookups on the sharded tracker, one call per key
+// against one lrutrack_sharded_batch per request
+
+#define BATCH_KEYS 32
+
+typedef struct batch_thread_t {
+    lrutrack_sharded_t *t;
+    uint32_t num_keys;
+    uint32_t num_requests;
+    uint32_t seed;
+    int batched;
+    uint64_t checksum;
+} batch_thread_t;
+
+static void *batch_thread(void *arg) {
+    batch_thread_t *ctx = arg;
+    uint32_t rng = ctx->seed;
+    uint32_t keys[BATCH_KEYS];
+    lrutrack_sharded_op_t ops[BATCH_KEYS];
+
+    for (uint32_t r = 0; r < ctx->num_requests; ++r) {
+        for (uint32_t i = 0; i < BATCH_KEYS; ++i)
+            keys[i] = xorshift32(&rng) % ctx->num_keys;
+
+        if (!ctx->batched) {
+            for (uint32_t i = 0; i < BATCH_KEYS; ++i)
+                ctx->checksum += sharded_use(ctx->t, keys[i]);
+            continue;
+        }
+
+        for (uint32_t i = 0; i < BATCH_KEYS; ++i) {
+            ops[i].op = LRUTRACK_SHARDED_OP_USE;
+#if !LRUTRACK_32BIT_KEY
+            ops[i].key = &keys[i];
+            ops[i].key_length = sizeof(keys[i]);
+#else
+            ops[i].key = keys[i];
+#endif
+        }
+
+        lrutrack_sharded_batch(ctx->t, ops, BATCH_KEYS);
+        for (uint32_t i = 0; i < BATCH_KEYS; ++i)
+            ctx->checksum += ops[i].value;
+    }
+
+    return NULL;
+}
+
+static int run_batch(uint32_t num_keys, uint32_t num_ops,
+    uint32_t num_threads) {
+    if (num_threads == 0 || num_threads > MIX_MAX_THREADS)
+        return 0;
+
+    for (int batched = 0; batched < 2; ++batched) {
+        uint32_t per_shard = num_keys / MIX_NUM_SHARDS + 1;
+        lrutrack_sharded_config_t config;
+        memset(&config, 0, sizeof(config));
+        config.num_shards = MIX_NUM_SHARDS;
+        config.hash_table_size = round_up_to_power_of_two(per_shard);
+        config.num_initial_items = per_shard;
+
+        uint64_t num_evicted = 0;
+        lrutrack_sharded_t *t = lrutrack_sharded_create(&config, HASH_SEED,
+            INVALID_VALUE, &num_evicted, evict, &allocator);
+        if (!t)
+            return 0;
+
+        for (uint32_t i = 0; i < num_keys; ++i)
+            sharded_insert(t, i, i + 1);
+
+        batch_thread_t ctx[MIX_MAX_THREADS];
+        pthread_t threads[MIX_MAX_THREADS];
+
+        double start = now_seconds();
+        for (uint32_t i = 0; i < num_threads; ++i) {
+            ctx[i].t = t;
+            ctx[i].num_keys = num_keys;
+            ctx[i].num_requests = num_ops / num_threads / BATCH_KEYS;
+            ctx[i].seed = HASH_SEED + i;
+            ctx[i].batched = batched;
+            ctx[i].checksum = 0;
+            pthread_create(&threads[i], NULL, batch_thread, &ctx[i]);
+        }
+
+        uint64_t checksum = 0;
+        for (uint32_t i = 0; i < num_threads; ++i) {
+            pthread_join(threads[i], NULL);
+            checksum += ctx[i].checksum;
+        }
+
+        double elapsed = now_seconds() - start;
+        printf("batch %s: %u threads, %.2f Mops/s (checksum %llu)\n",
+            batched ? "batched" : "single", num_threads,
+            num_ops / elapsed * 1e-6, (unsigned long long)checksum);
+
+        lrutrack_sharded_destroy(t);
+    }
+
+    return 1;
+}
+
+//
+// Write-heavy contention on one tracker: a mutex around lrutrack_t against
+// the flat-combining front-end. Each op uses a key and inserts it on a miss,
+// half of the time after removing it.
+
+typedef struct contended_thread_t {
+    lrutrack_t *t;
+    pthread_mutex_t *lock;
+    lrutrack_fc_t *fc;
+    uint32_t num_keys;
+    uint32_t num_ops;
+    uint32_t seed;
+} contended_thread_t;
+
+static void *contended_thread(void *arg) {
+    contended_thread_t *ctx = arg;
+    lrutrack_fc_thread_t *self = ctx->fc ? lrutrack_fc_attach(ctx->fc) : NULL;
+    uint32_t rng = ctx->seed;
+
+    for (uint32_t i = 0; i < ctx->num_ops; ++i) {
+        uint32_t key = xorshift32(&rng) % ctx->num_keys;
+        int remove = xorshift32(&rng) & 1;
+        if (self) {
+#if !LRUTRACK_32BIT_KEY
+            if (remove)
+                lrutrack_fc_remove(ctx->fc, self, &key, sizeof(key));
+            else if (lrutrack_fc_use(ctx->fc, self, &key, sizeof(key)) ==
+                INVALID_VALUE)
+                lrutrack_fc_insert(ctx->fc, self, &key, sizeof(key), key + 1);
+#else
+            if (remove)
+                lrutrack_fc_remove(ctx->fc, self, key);
+            else if (lrutrack_fc_use(ctx->fc, self, key) == INVALID_VALUE)
+                lrutrack_fc_insert(ctx->fc, self, key, key + 1);
+#endif
+        } else {
+            pthread_mutex_lock(ctx->lock);
+#if !LRUTRACK_32BIT_KEY
+            if (remove)
+                lrutrack_remove(ctx->t, &key, sizeof(key));
+            else if (lrutrack_use(ctx->t, &key, sizeof(key)) == INVALID_VALUE)
+                lrutrack_insert(ctx->t, &key, sizeof(key), key + 1);
+#else
+            if (remove)
+                lrutrack_remove(ctx->t, key);
+            else if (lrutrack_use(ctx->t, key) == INVALID_VALUE)
+                lrutrack_insert(ctx->t, key, key + 1);
+#endif
+            pthread_mutex_unlock(ctx->lock);
+        }
+    }
+
+    if (self)
+        lrutrack_fc_detach(ctx->fc, self);
+    return NULL;
+}
+
+// Same ops through an owner thread, submitted DELEGATE_BATCH at a time.
+// Misses of a batch are inserted by a follow-up batch.
+
+#define DELEGATE_BATCH 16
+
+typedef struct delegate_thread_t {
+    lrutrack_delegate_t *d;
+    uint32_t num_keys;
+    uint32_t num_ops;
+    uint32_t seed;
+} delegate_thread_t;
+
+static void delegate_run(lrutrack_delegate_t *d,
+    lrutrack_delegate_request_t *requests, uint32_t num_requests) {
+    uint32_t num_submitted = 0;
+    while (num_submitted < num_requests) {
+        num_submitted += lrutrack_delegate_submit(d,
+            requests + num_submitted, num_requests - num_submitted);
+    }
+    for (uint32_t i = 0; i < num_requests; ++i)
+        lrutrack_delegate_wait(&requests[i]);
+}
+
+static void *delegate_thread(void *arg) {
+    delegate_thread_t *ctx = arg;
+    lrutrack_delegate_request_t requests[DELEGATE_BATCH];
+    lrutrack_delegate_request_t inserts[DELEGATE_BATCH];
+    uint32_t keys[DELEGATE_BATCH];
+    uint32_t rng = ctx->seed;
+
+    for (uint32_t done = 0; done < ctx->num_ops; done += DELEGATE_BATCH) {
+        for (uint32_t i = 0; i < DELEGATE_BATCH; ++i) {
+            keys[i] = xorshift32(&rng) % ctx->num_keys;
+            requests[i].op = xorshift32(&rng) & 1 ?
+                LRUTRACK_DELEGATE_REMOVE : LRUTRACK_DELEGATE_USE;
+#if !LRUTRACK_32BIT_KEY
+            requests[i].key = &keys[i];
+            requests[i].key_length = sizeof(keys[i]);
+#else
+            requests[i].key = keys[i];
+#endif
+        }
+        delegate_run(ctx->d, requests, DELEGATE_BATCH);
+
+        uint32_t num_inserts = 0;
+        for (uint32_t i = 0; i < DELEGATE_BATCH; ++i) {
+            if (requests[i].op != LRUTRACK_DELEGATE_USE ||
+                requests[i].value != INVALID_VALUE)
+                continue;
+            lrutrack_delegate_request_t *insert = &inserts[num_inserts++];
+            insert->op = LRUTRACK_DELEGATE_INSERT;
+#if !LRUTRACK_32BIT_KEY
+            insert->key = &keys[i];
+            insert->key_length = sizeof(keys[i]);
+#else
+            insert->key = keys[i];
+#endif
+            insert->value = keys[i] + 1;
+        }
+        delegate_run(ctx->d, inserts, num_inserts);
+    }
+
+    return NULL;
+}
+
+typedef struct delegate_owner_t {
+    lrutrack_delegate_t *d;
+    atomic_int stop;
+} delegate_owner_t;
+
+static void *delegate_owner(void *arg) {
+    delegate_owner_t *owner = arg;
+    while (!atomic_load_explicit(&owner->stop, memory_order_relaxed)) {
+        if (lrutrack_delegate_poll(owner->d, UINT32_MAX) == 0)
+            sched_yield();
+    }
+    return NULL;
+}
+
+static int run_delegate(uint32_t num_keys, uint32_t num_ops,
+    uint32_t num_threads) {
+    uint64_t num_evicted = 0;
+    lrutrack_delegate_t *d = lrutrack_delegate_create(
+        round_up_to_power_of_two(num_keys), num_keys, HASH_SEED,
+        INVALID_VALUE, &num_evicted, evict, 1024, &allocator);
+    if (!d)
+        return 0;
+
+    delegate_owner_t owner;
+    owner.d = d;
+    atomic_init(&owner.stop, 0);
+
+    delegate_thread_t ctx[MIX_MAX_THREADS];
+    pthread_t threads[MIX_MAX_THREADS];
+    pthread_t owner_thread;
+
+    double start = now_seconds();
+    pthread_create(&owner_thread, NULL, delegate_owner, &owner);
+    for (uint32_t i = 0; i < num_threads; ++i) {
+        ctx[i].d = d;
+        ctx[i].num_keys = num_keys;
+        ctx[i].num_ops = num_ops / num_threads;
+        ctx[i].seed = HASH_SEED + i;
+        pthread_create(&threads[i], NULL, delegate_thread, &ctx[i]);
+    }
+
+    for (uint32_t i = 0; i < num_threads; ++i)
+        pthread_join(threads[i], NULL);
+
+    double elapsed = now_seconds() - start;
+    atomic_store(&owner.stop, 1);
+    pthread_join(owner_thread, NULL);
+
+    printf("contended delegate: %u threads + owner, %.2f Mops/s\n",
+        num_threads, num_ops / elapsed * 1e-6);
+
+    lrutrack_delegate_destroy(d);
+    return 1;
+}
+
+static int run_contended(uint32_t num_keys, uint32_t num_ops,
+    uint32_t num_threads) {
+    if (num_threads == 0 || num_threads > MIX_MAX_THREADS)
+        return 0;
+
+    for (int use_fc = 0; use_fc < 2; ++use_fc) {
+        uint32_t hash_table_size = round_up_to_power_of_two(num_keys);
+        uint64_t num_evicted = 0;
+        pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+        lrutrack_t *t = NULL;
+        lrutrack_fc_t *fc = NULL;
+
+        if (use_fc) {
+            fc = lrutrack_fc_create(hash_table_size, num_keys, HASH_SEED,
+                INVALID_VALUE, &num_evicted, evict, &allocator);
+        } else {
+            t = lrutrack_create_with_allocator(hash_table_size, num_keys,
+                HASH_SEED, INVALID_VALUE, &num_evicted, evict, &allocator);
+        }
+        if (!t && !fc)
+            return 0;
+
+        contended_thread_t ctx[MIX_MAX_THREADS];
+        pthread_t threads[MIX_MAX_THREADS];
+
+        double start = now_seconds();
+        for (uint32_t i = 0; i < num_threads; ++i) {
+            ctx[i].t = t;
+            ctx[i].lock = &lock;
+            ctx[i].fc = fc;
+            ctx[i].num_keys = num_keys;
+            ctx[i].num_ops = num_ops / num_threads;
+            ctx[i].seed = HASH_SEED + i;
+            pthread_create(&threads[i], NULL, contended_thread, &ctx[i]);
+        }
+
+        for (uint32_t i = 0; i < num_threads; ++i)
+            pthread_join(threads[i], NULL);
+
+        double elapsed = now_seconds() - start;
+        printf("contended %s: %u threads, %.2f Mops/s", use_fc ? "fc" : "mutex",
+            num_threads, num_ops / elapsed * 1e-6);
+
+        if (fc) {
+            uint64_t num_batches = 0, num_combined = 0;
+            lrutrack_fc_stats(fc, &num_batches, &num_combined);
+            printf(", %.2f ops per batch", num_batches ?
+                (double)num_combined / (double)num_batches : 0.0);
+            lrutrack_fc_destroy(fc);
+        } else {
+            lrutrack_destroy(t);
+        }
+        printf("\n");
+    }
+
+    return run_delegate(num_keys, num_ops, num_threads);
+}
+
+//
+// Read scaling of the lock-free tracker: the same 95% use, 5% remove +
+// insert mix with 1, 2, 4... threads
+
+static void lf_atomic_evict(void *user, lrutrack_value_t value) {
+    (void)value;
+    atomic_fetch_add_explicit((_Atomic uint64_t *)user, 1,
+        memory_order_relaxed);
+}
+
+typedef struct scaling_thread_t {
+    lrutrack_lf_t *t;
+    uint32_t num_keys;
+    uint32_t num_ops;
+    uint32_t seed;
+    uint64_t checksum;
+} scaling_thread_t;
+
+static void *scaling_thread(void *arg) {
+    scaling_thread_t *ctx = arg;
+    uint32_t rng = ctx->seed;
+    for (uint32_t i = 0; i < ctx->num_ops; ++i) {
+        uint32_t key = xorshift32(&rng) % ctx->num_keys;
+        if (xorshift32(&rng) % 100 < MIX_WRITE_PERCENT) {
+#if !LRUTRACK_32BIT_KEY
+            if (lrutrack_lf_remove(ctx->t, &key, sizeof(key)) == LRUTRACK_OK)
+                lrutrack_lf_insert(ctx->t, &key, sizeof(key), key + 1);
+#else
+            if (lrutrack_lf_remove(ctx->t, key) == LRUTRACK_OK)
+                lrutrack_lf_insert(ctx->t, key, key + 1);
+#endif
+        } else {
+#if !LRUTRACK_32BIT_KEY
+            ctx->checksum += lrutrack_lf_use(ctx->t, &key, sizeof(key));
+#else
+            ctx->checksum += lrutrack_lf_use(ctx->t, key);
+#endif
+        }
+    }
+    return NULL;
+}
+
+static int run_scaling(uint32_t num_keys, uint32_t num_ops,
+    uint32_t max_threads) {
+    if (max_threads == 0 || max_threads > MIX_MAX_THREADS)
+        return 0;
+
+    for (uint32_t num_threads = 1; num_threads <= max_threads;
+        num_threads *= 2) {
+        _Atomic uint64_t num_evicted = 0;
+        lrutrack_lf_t *t = lrutrack_lf_create(
+            round_up_to_power_of_two(num_keys / 2), num_keys, HASH_SEED,
+            INVALID_VALUE, (void *)&num_evicted, lf_atomic_evict, &allocator);
+        if (!t)
+            return 0;
+
+        for (uint32_t i = 0; i < num_keys; ++i)
+            lf_insert(t, i, i + 1);
+
+        scaling_thread_t ctx[MIX_MAX_THREADS];
+        pthread_t threads[MIX_MAX_THREADS];
+
+        double start = now_seconds();
+        for (uint32_t i = 0; i < num_threads; ++i) {
+            ctx[i].t = t;
+            ctx[i].num_keys = num_keys;
+            ctx[i].num_ops = num_ops / num_threads;
+            ctx[i].seed = HASH_SEED + i;
+            ctx[i].checksum = 0;
+            pthread_create(&threads[i], NULL, scaling_thread, &ctx[i]);
+        }
+
+        for (uint32_t i = 0; i < num_threads; ++i)
+            pthread_join(threads[i], NULL);
+
+        double elapsed = now_seconds() - start;
+        printf("scaling lf: %u threads, %.2f Mops/s\n", num_threads,
+            num_ops / elapsed * 1e-6);
+
+        lrutrack_lf_destroy(t);
+    }
+
+    return 1;
+}
+
+//
+// Loading num_keys keys into one tracker: inserting them one by one against
+// lrutrack_build_parallel with 1, 2, 4... tasks
+
+static int run_build(uint32_t num_keys, uint32_t max_tasks) {
+    uint32_t *key_storage = malloc(sizeof(*key_storage) * num_keys);
+    lrutrack_value_t *values = malloc(sizeof(*values) * num_keys);
+#if !LRUTRACK_32BIT_KEY
+    const void **keys = malloc(sizeof(*keys) * num_keys);
+    uint32_t *key_lengths = malloc(sizeof(*key_lengths) * num_keys);
+    if (!keys || !key_lengths)
+        return 0;
+#endif
+    if (!key_storage || !values)
+        return 0;
+
+    for (uint32_t i = 0; i < num_keys; ++i) {
+        key_storage[i] = i;
+        values[i] = i + 1;
+#if !LRUTRACK_32BIT_KEY
+        keys[i] = &key_storage[i];
+        key_lengths[i] = sizeof(key_storage[i]);
+#endif
+    }
+
+    uint32_t hash_table_size = round_up_to_power_of_two(num_keys);
+
+    for (uint32_t num_tasks = 0; num_tasks <= max_tasks;
+        num_tasks = num_tasks ? num_tasks * 2 : 1) {
+        uint64_t num_evicted = 0;
+        lrutrack_t *t = lrutrack_create_with_allocator(hash_table_size, 0,
+            HASH_SEED, INVALID_VALUE, &num_evicted, evict, &allocator);
+        if (!t)
+            return 0;
+
+        double start = now_seconds();
+        if (num_tasks == 0) {
+            for (uint32_t i = 0; i < num_keys; ++i)
+                chained_insert(t, key_storage[i], values[i]);
+        } else {
+#if !LRUTRACK_32BIT_KEY
+            int result = lrutrack_build_parallel(t, keys, key_lengths, values,
+                num_keys, num_tasks, NULL);
+#else
+            int result = lrutrack_build_parallel(t, key_storage, values,
+                num_keys, num_tasks, NULL);
+#endif
+            if (result != LRUTRACK_OK)
+                return 0;
+        }
+        double build_elapsed = now_seconds() - start;
+
+        // Serial, the counting eviction callback is not thread safe
+        start = now_seconds();
+        lrutrack_destroy(t);
+        double destroy_elapsed = now_seconds() - start;
+
+        printf("build %s %u: %.1f ms, destroy %.1f ms\n",
+            num_tasks ? "parallel" : "insert", num_tasks,
+            build_elapsed * 1e3, destroy_elapsed * 1e3);
+        assert(num_evicted == num_keys);
+    }
+
+#if !LRUTRACK_32BIT_KEY
+    free(keys);
+    free(key_lengths);
+#endif
+    free(key_storage);
+    free(values);
+    return 1;
+}
+
+// Usage: lrutbench [num_keys] [num_lookups] [backend] [num_numa_nodes]
+//        lrutbench [num_keys] [num_ops] mix|batch|contended|scaling
+//            [num_threads]
+//        lrutbench [num_keys] 0 build [max_tasks]
+int main(int argc, char **argv) {
+    uint32_t num_keys = argc > 1 ? (uint32_t)strtoul(argv[1], NULL, 0) :
+        1u << 22;
+    uint32_t num_lookups = argc > 2 ? (uint32_t)strtoul(argv[2], NULL, 0) :
+        1u << 24;
+    const char *backend_name = argc > 3 ? argv[3] : NULL;
+
+    if (num_keys == 0)
+        return EXIT_FAILURE;
+
+    if (backend_name && strcmp(backend_name, "mix") == 0) {
+        uint32_t num_threads = argc > 4 ?
+            (uint32_t)strtoul(argv[4], NULL, 0) : 4;
+        return run_mix(num_keys, num_lookups, num_threads) ? EXIT_SUCCESS :
+            EXIT_FAILURE;
+    }
+
+    if (backend_name && strcmp(backend_name, "batch") == 0) {
+        uint32_t num_threads = argc > 4 ?
+            (uint32_t)strtoul(argv[4], NULL, 0) : 4;
+        return run_batch(num_keys, num_lookups, num_threads) ? EXIT_SUCCESS :
+            EXIT_FAILURE;
+    }
+
+    if (backend_name && strcmp(backend_name, "build") == 0) {
+        uint32_t max_tasks = argc > 4 ?
+            (uint32_t)strtoul(argv[4], NULL, 0) : 4;
+        return run_build(num_keys, max_tasks) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    if (backend_name && strcmp(backend_name, "scaling") == 0) {
+        uint32_t num_threads = argc > 4 ?
+            (uint32_t)strtoul(argv[4], NULL, 0) : 4;
+        return run_scaling(num_keys, num_lookups, num_threads) ?
+            EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    if (backend_name && strcmp(backend_name, "contended") == 0) {
+        uint32_t num_threads = argc > 4 ?
+            (uint32_t)strtoul(argv[4], NULL, 0) : 4;
+        return run_contended(num_keys, num_lookups, num_threads) ?
+            EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    if (argc > 4)
+        bench_num_nodes = (uint32_t)strtoul(argv[4], NULL, 0);
+
+    for (size_t i = 0; i < NUM_BACKENDS; ++i) {
+        if (backend_name && strcmp(backend_name, backends[i].name) != 0)
+            continue;
+        if (!run_backend(&backends[i], num_keys, num_lookups))
+            return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -1,8 +1,20 @@
 #include "lrutrack.h"
+#include "lrutrack_rh.h"
+#include "lrutrack_cuckoo.h"
+#include "lrutrack_bucket.h"
+#include "lrutrack_sharded.h"
+#include "lrutrack_fc.h"
+#include "lrutrack_delegate.h"
+#include "lrutrack_lf.h"
+#include "lrutrack_group.h"
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
 
 typedef struct tracked_allocation_t tracked_allocation_t;
 typedef struct tracked_allocation_t {
@@ -55,6 +67,36 @@ static void free_wrapper(void *ptr) {
     free(ptr);
 }
 
+// Sized allocator, no bookkeeping needed to know what is freed
+typedef struct sized_arena_t {
+    size_t bytes_allocated;
+    size_t num_allocations;
+} sized_arena_t;
+
+static void *sized_alloc(void *user, size_t sz, size_t alignment) {
+    sized_arena_t *arena = user;
+    void *ptr = NULL;
+    if (alignment <= sizeof(void *))
+        ptr = malloc(sz);
+    else if (posix_memalign(&ptr, alignment, sz) != 0)
+        ptr = NULL;
+    if (!ptr)
+        return NULL;
+
+    assert(((uintptr_t)ptr & (alignment - 1)) == 0);
+    arena->bytes_allocated += sz;
+    arena->num_allocations++;
+    return ptr;
+}
+
+static void sized_dealloc(void *user, void *ptr, size_t sz) {
+    sized_arena_t *arena = user;
+    assert(ptr && arena->bytes_allocated >= sz && arena->num_allocations > 0);
+    arena->bytes_allocated -= sz;
+    arena->num_allocations--;
+    free(ptr);
+}
+
 #if LRUTRACK_32BIT_KEY
 
 #define FNV_32_PRIME ((uint32_t)0x01000193)
@@ -73,8 +115,11 @@ static uint32_t fnv32a_str(const char *str, uint32_t seed) {
 
 //
 
+static lrutrack_value_t last_evicted = 0;
+
 static void evict(void *user, lrutrack_value_t value) {
     printf("Evicting %u\n", value);
+    last_evicted = value;
 }
 
 #define HASH_SEED 0xcafebabe
@@ -114,14 +159,47 @@ static void _use(lrutrack_t *t, const char *key, lrutrack_value_t expected_value
 #define HASH_TABLE_SIZE 256
 #define NUM_INITIAL_ITEMS 2
 
-int main() {
-    printf("lrutrack_create\n");
-    lrutrack_t *t = lrutrack_create(HASH_TABLE_SIZE, NUM_INITIAL_ITEMS, HASH_SEED,
-        INVALID_VALUE, NULL, evict, malloc_wrapper, free_wrapper);
-    if (!t) {
-        return EXIT_FAILURE;
-    }
+static int test_in_place(void) {
+    printf("lrutrack_create_in_place\n");
+    lrutrack_config_t config = { .hash_table_size = 16, .num_items = 4,
+        .max_key_length = 8 };
+    static uint64_t buffer[1024];
+    assert(lrutrack_required_bytes(&config) <= sizeof(buffer));
+
+    lrutrack_t *t = lrutrack_create_in_place(buffer, sizeof(buffer), &config,
+        HASH_SEED, INVALID_VALUE, NULL, evict);
+    if (!t)
+        return 0;
 
+    _insert(t, "123", 123);
+    _insert(t, "234", 234);
+    _insert(t, "345", 345);
+    _insert(t, "456", 456);
+    _use(t, "123", 123);
+    _insert(t, "567", 567); // Evicts
+    _insert(t, "678", 678);
+    _use(t, "123", 123);
+    _use(t, "678", 678);
+#if !LRUTRACK_32BIT_KEY
+    // Full, a rejected key evicts nothing
+    assert(lrutrack_count(t) == config.num_items);
+    last_evicted = INVALID_VALUE;
+    int result = lrutrack_insert_strkey(t, "too long key", 1);
+    assert(result == LRUTRACK_ERROR);
+    (void)result;
+    assert(lrutrack_count(t) == config.num_items);
+    assert(last_evicted == INVALID_VALUE);
+    _use(t, "123", 123);
+#endif
+
+    printf("lrutrack_destroy\n");
+    lrutrack_destroy(t);
+
+    assert(total_bytes_allocated == 0);
+    return 1;
+}
+
+static void test_sequence(lrutrack_t *t) {
     _insert(t, "123", 123);
     _use(t, "123", 123);
     _insert(t, "234", 234);
@@ -143,6 +221,1939 @@ int main() {
     _remove(t, "456");
     _use(t, "345", 345);
     _use(t, "456", 456);
+}
+
+static int test_allocator(void) {
+    printf("lrutrack_create_with_allocator\n");
+    sized_arena_t arena = { 0, 0 };
+    lrutrack_allocator_t allocator = { &arena, sized_alloc, sized_dealloc };
+    lrutrack_t *t = lrutrack_create_with_allocator(HASH_TABLE_SIZE,
+        NUM_INITIAL_ITEMS, HASH_SEED, INVALID_VALUE, NULL, evict, &allocator);
+    if (!t)
+        return 0;
+
+    test_sequence(t);
+
+    printf("lrutrack_compact\n");
+    while (lrutrack_compact(t, 1) == LRUTRACK_IN_PROGRESS) {
+        _use(t, "789", 789);
+    }
+    _use(t, "890", 890);
+
+    printf("lrutrack_shrink_to_fit\n");
+    size_t bytes_before_shrink = arena.bytes_allocated;
+    lrutrack_shrink_to_fit(t);
+    assert(arena.bytes_allocated < bytes_before_shrink);
+    (void)bytes_before_shrink;
+    _use(t, "345", 345);
+    _use(t, "890", 890);
+
+    printf("lrutrack_reserve\n");
+    lrutrack_reserve(t, 64);
+    _insert(t, "901", 901);
+    _use(t, "890", 890);
+
+    printf("lrutrack_destroy\n");
+    lrutrack_destroy(t);
+
+    assert(arena.bytes_allocated == 0);
+    assert(arena.num_allocations == 0);
+    return 1;
+}
+
+#if !LRUTRACK_32BIT_KEY
+#   define RH_KEY(str) str, (uint32_t)strlen(str)
+#else
+#   define RH_KEY(str) fnv32a_str(str, HASH_SEED)
+#endif
+
+// Handles act on their own insert only
+static int test_handles(void) {
+    printf("lrutrack handles\n");
+    sized_arena_t arena = { 0, 0 };
+    lrutrack_allocator_t allocator = { &arena, sized_alloc, sized_dealloc };
+    lrutrack_t *t = lrutrack_create_with_allocator(64, 4, HASH_SEED,
+        INVALID_VALUE, NULL, evict, &allocator);
+    if (!t)
+        return 0;
+
+    lrutrack_handle_t h1, h2, h3;
+    int result = lrutrack_insert_handle(t, RH_KEY("1"), 1, &h1);
+    assert(result == LRUTRACK_OK);
+    result = lrutrack_insert_handle(t, RH_KEY("2"), 2, &h2);
+    assert(result == LRUTRACK_OK);
+    result = lrutrack_insert_handle(t, RH_KEY("3"), 3, &h3);
+    assert(result == LRUTRACK_OK);
+
+    // Marks 1 as recently used
+    lrutrack_value_t value = lrutrack_use_handle(t, h1);
+    assert(value == 1);
+    result = lrutrack_remove_lru(t);
+    assert(result == LRUTRACK_OK);
+    assert(last_evicted == 2);
+    value = lrutrack_use_handle(t, h2);
+    assert(value == INVALID_VALUE);
+    result = lrutrack_remove_handle(t, h2);
+    assert(result == LRUTRACK_NOT_FOUND);
+
+    result = lrutrack_remove_handle(t, h3);
+    assert(result == LRUTRACK_OK);
+    assert(last_evicted == 3);
+    value = lrutrack_use(t, RH_KEY("3"));
+    assert(value == INVALID_VALUE);
+
+    // The freed item is reused, the old handle stays stale
+    lrutrack_handle_t h4;
+    result = lrutrack_insert_handle(t, RH_KEY("4"), 4, &h4);
+    assert(result == LRUTRACK_OK);
+    assert(h4.index == h3.index);
+    value = lrutrack_use_handle(t, h3);
+    assert(value == INVALID_VALUE);
+    value = lrutrack_use_handle(t, h4);
+    assert(value == 4);
+
+    // Moved items leave their handles stale, keys still work
+    result = lrutrack_remove(t, RH_KEY("1"));
+    assert(result == LRUTRACK_OK);
+    while (lrutrack_compact(t, 1) != LRUTRACK_OK)
+        ;
+    if (h4.index != 0) {
+        value = lrutrack_use_handle(t, h4);
+        assert(value == INVALID_VALUE);
+        value = lrutrack_use(t, RH_KEY("4"));
+        assert(value == 4);
+    }
+    (void)value;
+    (void)result;
+
+    lrutrack_destroy(t);
+    assert(arena.bytes_allocated == 0);
+    return 1;
+}
+
+// Pinned entries survive eviction until unpinned
+static int test_pinning(void) {
+    printf("lrutrack pinning\n");
+    sized_arena_t arena = { 0, 0 };
+    lrutrack_allocator_t allocator = { &arena, sized_alloc, sized_dealloc };
+    // A single row, so that pinned and unpinned items share it
+    lrutrack_t *t = lrutrack_create_with_allocator(1, 4, HASH_SEED,
+        INVALID_VALUE, NULL, evict, &allocator);
+    if (!t)
+        return 0;
+
+    lrutrack_handle_t h2;
+    _insert(t, "1", 1);
+    int result = lrutrack_insert_handle(t, RH_KEY("2"), 2, &h2);
+    assert(result == LRUTRACK_OK);
+    _insert(t, "3", 3);
+
+    result = lrutrack_pin(t, RH_KEY("1"));
+    assert(result == LRUTRACK_OK);
+    result = lrutrack_pin_handle(t, h2);
+    assert(result == LRUTRACK_OK);
+    result = lrutrack_pin(t, RH_KEY("2"));
+    assert(result == LRUTRACK_OK);
+    result = lrutrack_pin(t, RH_KEY("4"));
+    assert(result == LRUTRACK_NOT_FOUND);
+    assert(lrutrack_num_pinned(t) == 2);
+
+    result = lrutrack_remove_lru(t);
+    assert(result == LRUTRACK_OK);
+    assert(last_evicted == 3);
+    result = lrutrack_remove_lru(t);
+    assert(result == LRUTRACK_NOT_FOUND);
+    lrutrack_value_t value = lrutrack_use(t, RH_KEY("1"));
+    assert(value == 1);
+
+    // Pins nest
+    result = lrutrack_unpin_handle(t, h2);
+    assert(result == LRUTRACK_OK);
+    result = lrutrack_remove_lru(t);
+    assert(result == LRUTRACK_NOT_FOUND);
+    result = lrutrack_unpin(t, RH_KEY("2"));
+    assert(result == LRUTRACK_OK);
+    result = lrutrack_unpin(t, RH_KEY("2"));
+    assert(result == LRUTRACK_ERROR);
+    result = lrutrack_remove_lru(t);
+    assert(result == LRUTRACK_OK);
+    assert(last_evicted == 2);
+    value = lrutrack_use_handle(t, h2);
+    assert(value == INVALID_VALUE);
+    (void)value;
+
+    // Explicit removal drops the pins
+    result = lrutrack_remove(t, RH_KEY("1"));
+    assert(result == LRUTRACK_OK);
+    assert(lrutrack_num_pinned(t) == 0);
+
+    // Pins follow their items through growth and shrinking
+    _insert(t, "5", 5);
+    result = lrutrack_pin(t, RH_KEY("5"));
+    assert(result == LRUTRACK_OK);
+    result = lrutrack_reserve(t, 64);
+    assert(result == LRUTRACK_OK);
+    _insert(t, "6", 6);
+    result = lrutrack_shrink_to_fit(t);
+    assert(result == LRUTRACK_OK);
+    assert(lrutrack_num_pinned(t) == 1);
+    result = lrutrack_remove_lru(t);
+    assert(result == LRUTRACK_OK);
+    assert(last_evicted == 6);
+    result = lrutrack_remove_lru(t);
+    assert(result == LRUTRACK_NOT_FOUND);
+    lrutrack_destroy(t);
+    assert(arena.bytes_allocated == 0);
+
+    // A full in-place tracker evicts around pinned rows, or fails
+    lrutrack_config_t config = { .hash_table_size = 16, .num_items = 2,
+        .max_key_length = 8 };
+    static uint64_t buffer[1024];
+    assert(lrutrack_required_bytes(&config) <= sizeof(buffer));
+    t = lrutrack_create_in_place(buffer, sizeof(buffer), &config, HASH_SEED,
+        INVALID_VALUE, NULL, evict);
+    if (!t)
+        return 0;
+
+    _insert(t, "1", 1);
+    _insert(t, "2", 2);
+    result = lrutrack_pin(t, RH_KEY("1"));
+    assert(result == LRUTRACK_OK);
+    _insert(t, "3", 3); // Evicts 2
+    assert(last_evicted == 2);
+    result = lrutrack_pin(t, RH_KEY("3"));
+    assert(result == LRUTRACK_OK);
+    result = lrutrack_insert(t, RH_KEY("4"), 4);
+    assert(result == LRUTRACK_OOM);
+    result = lrutrack_unpin(t, RH_KEY("1"));
+    assert(result == LRUTRACK_OK);
+    _insert(t, "4", 4); // Evicts 1
+    assert(last_evicted == 1);
+    _use(t, "3", 3);
+    (void)result;
+
+    lrutrack_destroy(t);
+    return 1;
+}
+
+static void expect_lru(lrutrack_t *t, lrutrack_value_t expected_value) {
+    int result = lrutrack_remove_lru(t);
+    assert(result == LRUTRACK_OK);
+    assert(last_evicted == expected_value);
+    (void)result;
+    (void)expected_value;
+}
+
+// Compaction packs the live items at the front, most recently used rows
+// first, and keeps their keys, values and LRU order
+static int test_compaction(void) {
+    printf("lrutrack_compact layout\n");
+    sized_arena_t arena = { 0, 0 };
+    lrutrack_allocator_t allocator = { &arena, sized_alloc, sized_dealloc };
+    lrutrack_t *t = lrutrack_create_with_allocator(HASH_TABLE_SIZE, 8,
+        HASH_SEED, INVALID_VALUE, NULL, evict, &allocator);
+    if (!t)
+        return 0;
+
+    static const char *const keys[] = { "1", "2", "3", "4", "5", "6", "7",
+        "8" };
+    lrutrack_handle_t handles[8];
+    int result;
+    for (uint32_t i = 0; i < 8; ++i) {
+        result = lrutrack_insert_handle(t, RH_KEY(keys[i]), i + 1,
+            &handles[i]);
+        assert(result == LRUTRACK_OK);
+    }
+
+    // One key per row, so the expected order is the row order
+    for (uint32_t i = 0; i < 8; ++i) {
+        for (uint32_t j = 0; j < i; ++j)
+            assert(handles[i].row != handles[j].row);
+    }
+
+    // Holes at items 1 and 4, LRU order away from the insert order
+    result = lrutrack_remove(t, RH_KEY("2"));
+    assert(result == LRUTRACK_OK);
+    result = lrutrack_remove(t, RH_KEY("5"));
+    assert(result == LRUTRACK_OK);
+    lrutrack_value_t value;
+    static const uint32_t used[] = { 3, 1, 7 };
+    for (uint32_t i = 0; i < 3; ++i) {
+        value = lrutrack_use(t, RH_KEY(keys[used[i] - 1]));
+        assert(value == used[i]);
+    }
+
+    while ((result = lrutrack_compact(t, 1)) == LRUTRACK_IN_PROGRESS)
+        ;
+    assert(result == LRUTRACK_OK);
+    assert(lrutrack_count(t) == 6);
+
+    // Item k holds the k-th most recently used entry. Handles go stale when
+    // their item moves, but the generation moves along with it. Checked
+    // least recently used first, so that the order stays as it was.
+    static const uint32_t mru_order[] = { 7, 1, 3, 8, 6, 4 };
+    for (uint32_t k = 6; k-- > 0;) {
+        lrutrack_handle_t moved = handles[mru_order[k] - 1];
+        moved.index = k;
+        value = lrutrack_use_handle(t, moved);
+        assert(value == mru_order[k]);
+    }
+
+    for (uint32_t k = 0; k < 6; ++k) {
+        uint32_t row;
+        value = lrutrack_peek(t, RH_KEY(keys[mru_order[k] - 1]), &row);
+        assert(value == mru_order[k]);
+        assert(row == handles[mru_order[k] - 1].row);
+        (void)row;
+    }
+
+    // Only the items past the live ones are free
+    lrutrack_handle_t h9;
+    result = lrutrack_insert_handle(t, RH_KEY("9"), 9, &h9);
+    assert(result == LRUTRACK_OK);
+    assert(h9.index >= 6);
+    (void)value;
+    (void)result;
+
+    for (uint32_t k = 6; k-- > 0;)
+        expect_lru(t, mru_order[k]);
+    expect_lru(t, 9);
+
+    lrutrack_destroy(t);
+    assert(arena.bytes_allocated == 0);
+    return 1;
+}
+
+// Lower priorities are evicted first, aged rows drop down
+static int test_priorities(void) {
+    printf("lrutrack priorities\n");
+    sized_arena_t arena = { 0, 0 };
+    lrutrack_allocator_t allocator = { &arena, sized_alloc, sized_dealloc };
+    lrutrack_t *t = lrutrack_create_with_allocator(1024, 4, HASH_SEED,
+        INVALID_VALUE, NULL, evict, &allocator);
+    if (!t)
+        return 0;
+
+    _insert(t, "1", 1);
+    _insert(t, "2", 2);
+    _insert(t, "3", 3);
+    _insert(t, "4", 4);
+    int result = lrutrack_set_priority(t, RH_KEY("1"), 2);
+    assert(result == LRUTRACK_OK);
+    result = lrutrack_set_priority(t, RH_KEY("2"), 1);
+    assert(result == LRUTRACK_OK);
+    result = lrutrack_set_priority(t, RH_KEY("5"), 1);
+    assert(result == LRUTRACK_NOT_FOUND);
+    expect_lru(t, 3);
+    expect_lru(t, 4);
+    expect_lru(t, 2);
+    expect_lru(t, 1);
+    result = lrutrack_remove_lru(t);
+    assert(result == LRUTRACK_NOT_FOUND);
+
+    // Each eviction below drops the LRU row of priority 1
+    lrutrack_handle_t h1;
+    result = lrutrack_insert_handle(t, RH_KEY("1"), 1, &h1);
+    assert(result == LRUTRACK_OK);
+    result = lrutrack_set_priority_handle(t, h1, 1);
+    assert(result == LRUTRACK_OK);
+    lrutrack_set_priority_aging(t, 1, 1);
+    _insert(t, "2", 2);
+    _insert(t, "3", 3);
+    expect_lru(t, 2);
+    _insert(t, "4", 4);
+    expect_lru(t, 3);
+    expect_lru(t, 1);
+    expect_lru(t, 4);
+
+    // Using an aged entry lifts its row back
+    result = lrutrack_insert_handle(t, RH_KEY("1"), 1, &h1);
+    assert(result == LRUTRACK_OK);
+    result = lrutrack_set_priority_handle(t, h1, 1);
+    assert(result == LRUTRACK_OK);
+    _insert(t, "2", 2);
+    _insert(t, "3", 3);
+    expect_lru(t, 2);
+    lrutrack_value_t value = lrutrack_use_handle(t, h1);
+    assert(value == 1);
+    (void)value;
+    (void)result;
+    lrutrack_set_priority_aging(t, 1, 0);
+    _insert(t, "4", 4);
+    expect_lru(t, 3);
+    expect_lru(t, 4);
+    expect_lru(t, 1);
+
+    lrutrack_destroy(t);
+    assert(arena.bytes_allocated == 0);
+    return 1;
+}
+
+// Tenants over quota lose their own entries first
+static int test_tenants(void) {
+    printf("lrutrack tenants\n");
+    sized_arena_t arena = { 0, 0 };
+    lrutrack_allocator_t allocator = { &arena, sized_alloc, sized_dealloc };
+    lrutrack_t *t = lrutrack_create_with_allocator(1024, 2, HASH_SEED,
+        INVALID_VALUE, NULL, evict, &allocator);
+    if (!t)
+        return 0;
+
+    _insert(t, "1", 1);
+    if (lrutrack_enable_tenants(t, 3) != LRUTRACK_OK) {
+        lrutrack_destroy(t);
+        return 0;
+    }
+    int result = lrutrack_enable_tenants(t, 3);
+    assert(result == LRUTRACK_ERROR);
+    _insert(t, "2", 2);
+    _insert(t, "3", 3);
+    _insert(t, "4", 4);
+    _insert(t, "5", 5);
+    assert(lrutrack_tenant_usage(t, 0) == 5);
+    result = lrutrack_set_tenant(t, RH_KEY("3"), 1, 2);
+    assert(result == LRUTRACK_OK);
+    result = lrutrack_set_tenant(t, RH_KEY("4"), 1, 2);
+    assert(result == LRUTRACK_OK);
+    result = lrutrack_set_tenant(t, RH_KEY("5"), 1, 2);
+    assert(result == LRUTRACK_OK);
+    assert(lrutrack_tenant_usage(t, 1) == 6);
+
+    lrutrack_set_tenant_quota(t, 1, 4);
+    _use(t, "3", 3);
+    expect_lru(t, 4);
+    assert(lrutrack_tenant_usage(t, 1) == 4);
+    expect_lru(t, 1); // Within quota, the LRU row goes
+    assert(lrutrack_tenant_usage(t, 0) == 1);
+
+    // Pinned entries of an over quota tenant are passed over
+    result = lrutrack_pin(t, RH_KEY("5"));
+    assert(result == LRUTRACK_OK);
+    lrutrack_set_tenant_quota(t, 1, 0);
+    expect_lru(t, 3);
+    expect_lru(t, 2);
+    assert(lrutrack_tenant_usage(t, 0) == 0);
+    result = lrutrack_unpin(t, RH_KEY("5"));
+    assert(result == LRUTRACK_OK);
+
+    // Items moved by compaction and shrinking keep their tenants
+    lrutrack_handle_t h6;
+    result = lrutrack_insert_handle(t, RH_KEY("6"), 6, &h6);
+    assert(result == LRUTRACK_OK);
+    result = lrutrack_set_tenant_handle(t, h6, 2, 3);
+    assert(result == LRUTRACK_OK);
+    _insert(t, "7", 7);
+    lrutrack_set_tenant_quota(t, 1, 2);
+    while (lrutrack_compact(t, 1) != LRUTRACK_OK)
+        ;
+    result = lrutrack_shrink_to_fit(t);
+    assert(result == LRUTRACK_OK);
+    (void)result;
+    assert(lrutrack_tenant_usage(t, 0) == 1);
+    assert(lrutrack_tenant_usage(t, 1) == 2);
+    assert(lrutrack_tenant_usage(t, 2) == 3);
+    lrutrack_set_tenant_quota(t, 2, 2);
+    expect_lru(t, 6);
+    expect_lru(t, 5);
+    expect_lru(t, 7);
+
+    lrutrack_destroy(t);
+    assert(arena.bytes_allocated == 0);
+    return 1;
+}
+
+// Capacity flows to the member whose entries are used
+static int test_group(void) {
+    printf("lrutrack_group_create\n");
+    sized_arena_t arena = { 0, 0 };
+    lrutrack_allocator_t allocator = { &arena, sized_alloc, sized_dealloc };
+    lrutrack_group_t *g = lrutrack_group_create(3, &allocator);
+    lrutrack_t *a = lrutrack_create_with_allocator(64, 4, HASH_SEED,
+        INVALID_VALUE, NULL, evict, &allocator);
+    lrutrack_t *b = lrutrack_create_with_allocator(64, 4, HASH_SEED,
+        INVALID_VALUE, NULL, evict, &allocator);
+    if (!g || !a || !b ||
+        lrutrack_group_add(g, a) != LRUTRACK_OK ||
+        lrutrack_group_add(g, b) != LRUTRACK_OK) {
+        if (g)
+            lrutrack_group_destroy(g);
+        if (a)
+            lrutrack_destroy(a);
+        if (b)
+            lrutrack_destroy(b);
+        return 0;
+    }
+
+    int result = lrutrack_group_add(g, a);
+    assert(result == LRUTRACK_ERROR);
+    result = lrutrack_group_insert(g, a, RH_KEY("1"), 1);
+    assert(result == LRUTRACK_OK);
+    result = lrutrack_group_insert(g, b, RH_KEY("1"), 11);
+    assert(result == LRUTRACK_OK);
+    result = lrutrack_group_insert(g, a, RH_KEY("2"), 2);
+    assert(result == LRUTRACK_OK);
+    result = lrutrack_group_insert(g, b, RH_KEY("2"), 12);
+    assert(result == LRUTRACK_OK);
+    assert(last_evicted == 1);
+    lrutrack_value_t value = lrutrack_group_use(g, b, RH_KEY("1"));
+    assert(value == 11);
+    (void)value;
+    result = lrutrack_group_insert(g, a, RH_KEY("3"), 3);
+    assert(result == LRUTRACK_OK);
+    assert(last_evicted == 2);
+    result = lrutrack_group_insert(g, b, RH_KEY("3"), 13);
+    assert(result == LRUTRACK_OK);
+    assert(last_evicted == 12);
+    assert(lrutrack_group_count(g) == 3);
+    assert(lrutrack_count(b) == 2);
+
+    // A member holding only pinned entries passes eviction on
+    result = lrutrack_pin(b, RH_KEY("1"));
+    assert(result == LRUTRACK_OK);
+    result = lrutrack_pin(b, RH_KEY("3"));
+    assert(result == LRUTRACK_OK);
+    result = lrutrack_group_remove_lru(g);
+    assert(result == LRUTRACK_OK);
+    assert(last_evicted == 3);
+    result = lrutrack_group_remove_lru(g);
+    assert(result == LRUTRACK_NOT_FOUND);
+
+    result = lrutrack_group_remove_member(g, b);
+    assert(result == LRUTRACK_OK);
+    result = lrutrack_group_remove_member(g, b);
+    assert(result == LRUTRACK_NOT_FOUND);
+    assert(lrutrack_group_count(g) == 0);
+    (void)result;
+
+    lrutrack_group_destroy(g);
+    lrutrack_destroy(a);
+    lrutrack_destroy(b);
+    assert(arena.bytes_allocated == 0);
+    return 1;
+}
+
+static int test_robin_hood(void) {
+    printf("lrutrack_rh_create\n");
+    sized_arena_t arena = { 0, 0 };
+    lrutrack_allocator_t allocator = { &arena, sized_alloc, sized_dealloc };
+    lrutrack_rh_t *t = lrutrack_rh_create(4, 0, HASH_SEED, INVALID_VALUE,
+        NULL, evict, &allocator);
+    if (!t)
+        return 0;
+
+    // Grows the table several times
+    char key[16];
+    for (lrutrack_value_t i = 1; i <= 100; ++i) {
+        snprintf(key, sizeof(key), "%u", i);
+        if (lrutrack_rh_insert(t, RH_KEY(key), i) != LRUTRACK_OK) {
+            lrutrack_rh_destroy(t);
+            return 0;
+        }
+    }
+
+    assert(lrutrack_rh_count(t) == 100);
+    lrutrack_value_t value;
+    for (lrutrack_value_t i = 1; i <= 100; ++i) {
+        snprintf(key, sizeof(key), "%u", i);
+        value = lrutrack_rh_use(t, RH_KEY(key));
+        assert(value == i);
+    }
+
+    value = lrutrack_rh_use(t, RH_KEY("1"));
+    assert(value == 1);
+    lrutrack_rh_remove_lru(t);
+    assert(last_evicted == 2);
+    int result = lrutrack_rh_remove(t, RH_KEY("3"));
+    assert(result == LRUTRACK_OK);
+    result = lrutrack_rh_remove(t, RH_KEY("3"));
+    assert(result == LRUTRACK_NOT_FOUND);
+    value = lrutrack_rh_use(t, RH_KEY("4"));
+    assert(value == 4);
+    assert(lrutrack_rh_count(t) == 98);
+    (void)value;
+    (void)result;
+
+    printf("lrutrack_rh_destroy\n");
+    lrutrack_rh_destroy(t);
+
+    assert(arena.bytes_allocated == 0);
+    return 1;
+}
+
+typedef struct cuckoo_reader_t {
+    lrutrack_cuckoo_t *t;
+    atomic_int stop;
+    uint64_t num_lookups;
+} cuckoo_reader_t;
+
+// Keys 1..16 stay in the table while the writer churns the others
+static void *cuckoo_reader(void *arg) {
+    cuckoo_reader_t *reader = arg;
+    char key[16];
+    while (!atomic_load(&reader->stop)) {
+        for (lrutrack_value_t i = 1; i <= 16; ++i) {
+            snprintf(key, sizeof(key), "%u", i);
+            lrutrack_value_t value = lrutrack_cuckoo_use(reader->t,
+                RH_KEY(key));
+            assert(value == i);
+            (void)value;
+            reader->num_lookups++;
+        }
+    }
+    return NULL;
+}
+
+static void cuckoo_evict(void *user, lrutrack_value_t value) {
+    (void)user;
+    last_evicted = value;
+}
+
+static int test_cuckoo(void) {
+    printf("lrutrack_cuckoo_create\n");
+    sized_arena_t arena = { 0, 0 };
+    lrutrack_allocator_t allocator = { &arena, sized_alloc, sized_dealloc };
+    lrutrack_cuckoo_t *t = lrutrack_cuckoo_create(64, 8, HASH_SEED,
+        INVALID_VALUE, NULL, cuckoo_evict, &allocator);
+    if (!t)
+        return 0;
+
+    char key[16];
+    for (lrutrack_value_t i = 1; i <= 200; ++i) {
+        snprintf(key, sizeof(key), "%u", i);
+        if (lrutrack_cuckoo_insert(t, RH_KEY(key), i) != LRUTRACK_OK) {
+            lrutrack_cuckoo_destroy(t);
+            return 0;
+        }
+    }
+
+    assert(lrutrack_cuckoo_count(t) == 200);
+    for (lrutrack_value_t i = 1; i <= 200; ++i) {
+        snprintf(key, sizeof(key), "%u", i);
+        assert(lrutrack_cuckoo_peek(t, RH_KEY(key)) == i);
+    }
+
+    // All reference bits are set, the first CLOCK sweep clears them
+    int result = lrutrack_cuckoo_remove_lru(t);
+    assert(result == LRUTRACK_OK);
+    assert(lrutrack_cuckoo_count(t) == 199);
+    result = lrutrack_cuckoo_remove(t, RH_KEY("300"));
+    assert(result == LRUTRACK_NOT_FOUND);
+    for (lrutrack_value_t i = 17; i <= 200; ++i) {
+        snprintf(key, sizeof(key), "%u", i);
+        if (i != last_evicted) {
+            result = lrutrack_cuckoo_remove(t, RH_KEY(key));
+            assert(result == LRUTRACK_OK);
+        }
+    }
+
+    // Full table: inserts evict instead of failing
+    lrutrack_cuckoo_remove_all(t);
+    for (lrutrack_value_t i = 1; i <= 1000; ++i) {
+        snprintf(key, sizeof(key), "%u", i);
+        result = lrutrack_cuckoo_insert(t, RH_KEY(key), i);
+        assert(result == LRUTRACK_OK);
+    }
+    assert(lrutrack_cuckoo_count(t) > 64 * 4 * 9 / 10);
+    lrutrack_cuckoo_remove_all(t);
+
+    for (lrutrack_value_t i = 1; i <= 16; ++i) {
+        snprintf(key, sizeof(key), "%u", i);
+        lrutrack_cuckoo_insert(t, RH_KEY(key), i);
+    }
+
+    result = lrutrack_cuckoo_resize(t, 128);
+    assert(result == LRUTRACK_OK);
+    assert(lrutrack_cuckoo_num_buckets(t) == 128);
+    assert(lrutrack_cuckoo_count(t) == 16);
+
+    printf("lrutrack_cuckoo concurrent readers\n");
+    cuckoo_reader_t reader = { t, 0, 0 };
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, cuckoo_reader, &reader) != 0) {
+        lrutrack_cuckoo_destroy(t);
+        return 0;
+    }
+
+    // Enough live keys to keep entries moving between buckets
+    for (lrutrack_value_t i = 17; i <= 20000; ++i) {
+        snprintf(key, sizeof(key), "%u", i);
+        lrutrack_cuckoo_insert(t, RH_KEY(key), i);
+        if (i >= 17 + 200) {
+            snprintf(key, sizeof(key), "%u", i - 200);
+            result = lrutrack_cuckoo_remove(t, RH_KEY(key));
+            assert(result == LRUTRACK_OK);
+        }
+
+        // Readers keep going on the old table while it is replaced
+        if (i % 1000 == 0) {
+            result = lrutrack_cuckoo_resize(t, i % 2000 == 0 ? 256 : 128);
+            assert(result == LRUTRACK_OK);
+        }
+    }
+
+    atomic_store(&reader.stop, 1);
+    pthread_join(thread, NULL);
+    assert(reader.num_lookups > 0);
+    (void)result;
+
+    printf("lrutrack_cuckoo_destroy\n");
+    lrutrack_cuckoo_destroy(t);
+
+    assert(arena.bytes_allocated == 0);
+    return 1;
+}
+
+// Shadow of the keys a small cuckoo table should hold, kept by the eviction
+// callback
+typedef struct cuckoo_shadow_t {
+    uint8_t present[65];
+    uint32_t count;
+} cuckoo_shadow_t;
+
+static void cuckoo_shadow_evict(void *user, lrutrack_value_t value) {
+    cuckoo_shadow_t *shadow = user;
+    assert(value >= 1 && value <= 64);
+    assert(shadow->present[value]);
+    shadow->present[value] = 0;
+    shadow->count--;
+}
+
+// Tables of a few buckets with free entries out of reach make displacement
+// searches fail. Every eviction must then be of a live entry, once.
+static int test_cuckoo_displacement(void) {
+    printf("lrutrack_cuckoo displacement\n");
+    sized_arena_t arena = { 0, 0 };
+    lrutrack_allocator_t allocator = { &arena, sized_alloc, sized_dealloc };
+    static const uint32_t num_buckets[] = { 1, 2, 4, 8 };
+    char key[16];
+    for (uint32_t b = 0; b < sizeof(num_buckets) / sizeof(*num_buckets);
+        ++b) {
+        cuckoo_shadow_t shadow;
+        memset(&shadow, 0, sizeof(shadow));
+        lrutrack_cuckoo_t *t = lrutrack_cuckoo_create(num_buckets[b], 8,
+            HASH_SEED, INVALID_VALUE, &shadow, cuckoo_shadow_evict,
+            &allocator);
+        if (!t)
+            return 0;
+
+        uint32_t state = 0x12345678u;
+        for (uint32_t i = 0; i < 20000; ++i) {
+            state ^= state << 13;
+            state ^= state >> 17;
+            state ^= state << 5;
+            lrutrack_value_t k = 1 + state % 64;
+            snprintf(key, sizeof(key), "%u", k);
+            int result;
+            if (shadow.present[k]) {
+                // Removal goes through the eviction callback too
+                result = lrutrack_cuckoo_remove(t, RH_KEY(key));
+                assert(!shadow.present[k]);
+            } else {
+                shadow.present[k] = 1;
+                shadow.count++;
+                result = lrutrack_cuckoo_insert(t, RH_KEY(key), k);
+            }
+            assert(result == LRUTRACK_OK);
+            assert(lrutrack_cuckoo_count(t) == shadow.count);
+            (void)result;
+
+            for (lrutrack_value_t j = 1; j <= 64; ++j) {
+                snprintf(key, sizeof(key), "%u", j);
+                lrutrack_value_t value = lrutrack_cuckoo_peek(t, RH_KEY(key));
+                assert(value == (shadow.present[j] ? j : INVALID_VALUE));
+                (void)value;
+            }
+        }
+
+        lrutrack_cuckoo_destroy(t);
+    }
+
+    assert(arena.bytes_allocated == 0);
+    return 1;
+}
+
+static int test_bucket(void) {
+    printf("lrutrack_bucket_create\n");
+    sized_arena_t arena = { 0, 0 };
+    lrutrack_allocator_t allocator = { &arena, sized_alloc, sized_dealloc };
+    lrutrack_bucket_t *t = lrutrack_bucket_create(1, 0, HASH_SEED,
+        INVALID_VALUE, NULL, evict, &allocator);
+    if (!t)
+        return 0;
+
+    // One bucket: recency inside it decides every eviction
+    char key[16];
+    for (lrutrack_value_t i = 1; i <= LRUTRACK_BUCKET_SLOTS; ++i) {
+        snprintf(key, sizeof(key), "%u", i);
+        if (lrutrack_bucket_insert(t, RH_KEY(key), i) != LRUTRACK_OK) {
+            lrutrack_bucket_destroy(t);
+            return 0;
+        }
+    }
+
+    lrutrack_value_t value = lrutrack_bucket_use(t, RH_KEY("1"));
+    assert(value == 1);
+    int result = lrutrack_bucket_insert(t, RH_KEY("9"), 9);
+    assert(result == LRUTRACK_OK);
+    assert(last_evicted == 2);
+    assert(lrutrack_bucket_num_conflict_evictions(t) == 1);
+    value = lrutrack_bucket_use(t, RH_KEY("2"));
+    assert(value == INVALID_VALUE);
+
+    // The first sweep clears the bucket's reference bit
+    result = lrutrack_bucket_remove_lru(t);
+    assert(result == LRUTRACK_OK);
+    assert(last_evicted == 3);
+    result = lrutrack_bucket_remove(t, RH_KEY("4"));
+    assert(result == LRUTRACK_OK);
+    result = lrutrack_bucket_remove(t, RH_KEY("4"));
+    assert(result == LRUTRACK_NOT_FOUND);
+    value = lrutrack_bucket_use(t, RH_KEY("5"));
+    assert(value == 5);
+    result = lrutrack_bucket_remove_lru(t);
+    assert(result == LRUTRACK_OK);
+    assert(last_evicted == 6);
+    assert(lrutrack_bucket_count(t) == LRUTRACK_BUCKET_SLOTS - 3);
+
+    lrutrack_bucket_remove_all(t);
+    assert(lrutrack_bucket_count(t) == 0);
+    result = lrutrack_bucket_remove_lru(t);
+    assert(result == LRUTRACK_NOT_FOUND);
+    (void)value;
+    (void)result;
+
+    printf("lrutrack_bucket_destroy\n");
+    lrutrack_bucket_destroy(t);
+
+    assert(arena.bytes_allocated == 0);
+    return 1;
+}
+
+typedef struct deferred_counter_t {
+    uint32_t num_evicted;
+    lrutrack_value_t last_evicted;
+    lrutrack_sharded_t *sharded; // Called back from the handler if set
+} deferred_counter_t;
+
+static void deferred_evict(void *user, lrutrack_value_t value) {
+    deferred_counter_t *counter = user;
+    counter->num_evicted++;
+    counter->last_evicted = value;
+
+    // Deadlocks if the shard lock were still held
+    if (counter->sharded)
+        lrutrack_sharded_peek(counter->sharded, RH_KEY("1"));
+}
+
+static int test_deferred_eviction(void) {
+    printf("lrutrack deferred eviction\n");
+    deferred_counter_t counter = { 0, 0, NULL };
+    lrutrack_t *t = lrutrack_create(HASH_TABLE_SIZE, 4, HASH_SEED,
+        INVALID_VALUE, &counter, deferred_evict, malloc_wrapper,
+        free_wrapper);
+    if (!t)
+        return 0;
+
+    lrutrack_set_deferred_eviction(t, 1);
+    char key[16];
+    int result;
+    for (lrutrack_value_t i = 1; i <= 40; ++i) {
+        snprintf(key, sizeof(key), "%u", i);
+        result = lrutrack_insert(t, RH_KEY(key), i);
+        assert(result == LRUTRACK_OK);
+    }
+    assert(lrutrack_count(t) == 40);
+
+    result = lrutrack_remove(t, RH_KEY("1"));
+    assert(result == LRUTRACK_OK);
+    while (lrutrack_remove_lru(t) == LRUTRACK_OK)
+        ;
+    assert(lrutrack_count(t) == 0);
+    assert(counter.num_evicted == 0);
+    assert(lrutrack_num_evicted(t) == 40);
+
+    // Oldest first
+    lrutrack_value_t values[8];
+    uint32_t num_taken = lrutrack_take_evicted(t, values, 8);
+    assert(num_taken == 8);
+    assert(values[0] == 1);
+    (void)num_taken;
+    assert(lrutrack_num_evicted(t) == 32);
+    lrutrack_flush_evicted(t);
+    assert(counter.num_evicted == 32);
+    assert(lrutrack_num_evicted(t) == 0);
+
+    // Turning deferral off delivers the queue
+    result = lrutrack_insert(t, RH_KEY("1"), 1);
+    assert(result == LRUTRACK_OK);
+    result = lrutrack_remove(t, RH_KEY("1"));
+    assert(result == LRUTRACK_OK);
+    assert(counter.num_evicted == 32);
+    lrutrack_set_deferred_eviction(t, 0);
+    assert(counter.num_evicted == 33);
+
+    result = lrutrack_insert(t, RH_KEY("2"), 2);
+    assert(result == LRUTRACK_OK);
+    lrutrack_remove_all(t);
+    assert(counter.num_evicted == 34);
+    lrutrack_destroy(t);
+    assert(total_bytes_allocated == 0);
+
+    // In place, the queue is bounded and falls back to evict_func
+    counter.num_evicted = 0;
+    lrutrack_config_t config = { .hash_table_size = 16, .num_items = 4,
+        .max_key_length = 8, .max_deferred = 2 };
+    static uint64_t buffer[1024];
+    assert(lrutrack_required_bytes(&config) <= sizeof(buffer));
+    t = lrutrack_create_in_place(buffer, sizeof(buffer), &config, HASH_SEED,
+        INVALID_VALUE, &counter, deferred_evict);
+    if (!t)
+        return 0;
+
+    lrutrack_set_deferred_eviction(t, 1);
+    for (lrutrack_value_t i = 1; i <= 4; ++i) {
+        snprintf(key, sizeof(key), "%u", i);
+        result = lrutrack_insert(t, RH_KEY(key), i);
+        assert(result == LRUTRACK_OK);
+    }
+    lrutrack_remove_all(t);
+    assert(lrutrack_num_evicted(t) == 2);
+    assert(counter.num_evicted == 2);
+
+    lrutrack_destroy(t);
+    assert(counter.num_evicted == 4);
+
+    // The sharded tracker delivers after unlocking
+    printf("lrutrack_sharded deferred eviction\n");
+    static const uint32_t modes[] = { 0, LRUTRACK_SHARDED_OPTIMISTIC };
+    for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); ++m) {
+        sized_arena_t arena = { 0, 0 };
+        lrutrack_allocator_t allocator = { &arena, sized_alloc,
+            sized_dealloc };
+        lrutrack_sharded_config_t sharded_config = { .num_shards = 2,
+            .hash_table_size = 64, .num_initial_items = 100,
+            .flags = modes[m] | LRUTRACK_SHARDED_DEFER_EVICTION,
+            .max_key_length = 8 };
+        counter.num_evicted = 0;
+        lrutrack_sharded_t *sharded = lrutrack_sharded_create(
+            &sharded_config, HASH_SEED, INVALID_VALUE, &counter,
+            deferred_evict, &allocator);
+        if (!sharded)
+            return 0;
+        counter.sharded = sharded;
+
+        for (lrutrack_value_t i = 1; i <= 120; ++i) {
+            snprintf(key, sizeof(key), "%u", i);
+            result = lrutrack_sharded_insert(sharded, RH_KEY(key), i);
+            assert(result == LRUTRACK_OK);
+        }
+        result = lrutrack_sharded_remove(sharded, RH_KEY("120"));
+        assert(result == LRUTRACK_OK);
+        assert(counter.num_evicted == 1 && counter.last_evicted == 120);
+        result = lrutrack_sharded_remove_lru(sharded);
+        assert(result == LRUTRACK_OK);
+        lrutrack_sharded_remove_all(sharded);
+        assert(counter.num_evicted == 120);
+
+        counter.sharded = NULL;
+        lrutrack_sharded_destroy(sharded);
+        assert(arena.bytes_allocated == 0);
+    }
+    (void)result;
+
+    return 1;
+}
+
+static int test_sharded(void) {
+    printf("lrutrack_sharded_create\n");
+    sized_arena_t arena = { 0, 0 };
+    lrutrack_allocator_t allocator = { &arena, sized_alloc, sized_dealloc };
+    lrutrack_sharded_config_t config = { .num_shards = 4,
+        .hash_table_size = 16, .num_initial_items = 2, .num_nodes = 2,
+        .flags = LRUTRACK_SHARDED_NODE_LOCAL };
+    lrutrack_sharded_t *t = lrutrack_sharded_create(&config, HASH_SEED,
+        INVALID_VALUE, NULL, evict, &allocator);
+    if (!t)
+        return 0;
+
+    for (uint32_t i = 0; i < lrutrack_sharded_num_shards(t); ++i)
+        assert(lrutrack_sharded_shard_home_node(t, i) == i % 2);
+
+    // Node-local shards: keys of one node are not visible from the other
+    char key[16];
+    lrutrack_sharded_set_thread_node(0);
+    assert(lrutrack_sharded_thread_node(t) == 0);
+    int result;
+    for (lrutrack_value_t i = 1; i <= 100; ++i) {
+        snprintf(key, sizeof(key), "%u", i);
+        result = lrutrack_sharded_insert(t, RH_KEY(key), i);
+        assert(result == LRUTRACK_OK);
+    }
+
+    lrutrack_sharded_set_thread_node(1);
+    lrutrack_value_t value = lrutrack_sharded_use(t, RH_KEY("1"));
+    assert(value == INVALID_VALUE);
+    result = lrutrack_sharded_insert(t, RH_KEY("1"), 1001);
+    assert(result == LRUTRACK_OK);
+    value = lrutrack_sharded_use(t, RH_KEY("1"));
+    assert(value == 1001);
+
+    lrutrack_sharded_set_thread_node(0);
+    for (lrutrack_value_t i = 1; i <= 100; ++i) {
+        snprintf(key, sizeof(key), "%u", i);
+        value = lrutrack_sharded_use(t, RH_KEY(key));
+        assert(value == i);
+    }
+
+    result = lrutrack_sharded_remove(t, RH_KEY("2"));
+    assert(result == LRUTRACK_OK);
+    result = lrutrack_sharded_remove(t, RH_KEY("2"));
+    assert(result == LRUTRACK_NOT_FOUND);
+    result = lrutrack_sharded_remove_lru(t);
+    assert(result == LRUTRACK_OK);
+    lrutrack_sharded_set_thread_node(-1);
+
+    lrutrack_sharded_remove_all(t);
+    result = lrutrack_sharded_remove_lru(t);
+    assert(result == LRUTRACK_NOT_FOUND);
+    (void)value;
+    (void)result;
+
+    printf("lrutrack_sharded_destroy\n");
+    lrutrack_sharded_destroy(t);
+
+    assert(arena.bytes_allocated == 0);
+    return 1;
+}
+
+// Deferred recency updates must be applied before the next eviction
+static int test_sharded_read_modes(void) {
+    static const uint32_t modes[] = { 0, LRUTRACK_SHARDED_RWLOCK,
+        LRUTRACK_SHARDED_OPTIMISTIC };
+
+    for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); ++m) {
+        printf("lrutrack_sharded read mode %u\n", modes[m]);
+        sized_arena_t arena = { 0, 0 };
+        lrutrack_allocator_t allocator = { &arena, sized_alloc,
+            sized_dealloc };
+        lrutrack_sharded_config_t config = { .num_shards = 1,
+            .hash_table_size = 64, .num_initial_items = 8,
+            .flags = modes[m], .max_key_length = 8 };
+        lrutrack_sharded_t *t = lrutrack_sharded_create(&config, HASH_SEED,
+            INVALID_VALUE, NULL, evict, &allocator);
+        if (!t)
+            return 0;
+
+        // Keys 1 and 2 are on different rows of a 64-row table
+        int result = lrutrack_sharded_insert(t, RH_KEY("1"), 1);
+        assert(result == LRUTRACK_OK);
+        result = lrutrack_sharded_insert(t, RH_KEY("2"), 2);
+        assert(result == LRUTRACK_OK);
+        assert(lrutrack_sharded_peek(t, RH_KEY("1")) == 1);
+        lrutrack_value_t value = lrutrack_sharded_use(t, RH_KEY("1"));
+        assert(value == 1);
+        value = lrutrack_sharded_use(t, RH_KEY("3"));
+        assert(value == INVALID_VALUE);
+        result = lrutrack_sharded_remove_lru(t);
+        assert(result == LRUTRACK_OK);
+        assert(last_evicted == 2);
+        assert(lrutrack_sharded_peek(t, RH_KEY("2")) == INVALID_VALUE);
+
+        // Fixed capacity shards evict instead of growing
+        char key[16];
+        for (lrutrack_value_t i = 10; i < 30; ++i) {
+            snprintf(key, sizeof(key), "%u", i);
+            result = lrutrack_sharded_insert(t, RH_KEY(key), i);
+            assert(result == LRUTRACK_OK);
+            value = lrutrack_sharded_use(t, RH_KEY(key));
+            assert(value == i);
+        }
+        (void)value;
+        (void)result;
+
+        lrutrack_sharded_destroy(t);
+        assert(arena.bytes_allocated == 0);
+    }
+
+    return 1;
+}
+
+#if !LRUTRACK_32BIT_KEY
+#   define SHARDED_OP(o, str, v) { o, (uint32_t)strlen(str), str, v, -1 }
+#else
+#   define SHARDED_OP(o, str, v) { o, fnv32a_str(str, HASH_SEED), v, -1 }
+#endif
+
+// Batches run over several shards and chunks, in array order per key
+static int test_sharded_batch(void) {
+    static const uint32_t modes[] = { 0, LRUTRACK_SHARDED_OPTIMISTIC };
+
+    for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); ++m) {
+        printf("lrutrack_sharded batch mode %u\n", modes[m]);
+        sized_arena_t arena = { 0, 0 };
+        lrutrack_allocator_t allocator = { &arena, sized_alloc,
+            sized_dealloc };
+        lrutrack_sharded_config_t config = { .num_shards = 4,
+            .hash_table_size = 64, .num_initial_items = 64,
+            .flags = modes[m], .max_key_length = 8 };
+        lrutrack_sharded_t *t = lrutrack_sharded_create(&config, HASH_SEED,
+            INVALID_VALUE, NULL, evict, &allocator);
+        if (!t)
+            return 0;
+
+        // More than one chunk
+        static char keys[100][8];
+        lrutrack_sharded_op_t ops[100];
+        for (uint32_t i = 0; i < 100; ++i) {
+            snprintf(keys[i], sizeof(keys[i]), "%u", i);
+            lrutrack_sharded_op_t op = SHARDED_OP(LRUTRACK_SHARDED_OP_INSERT,
+                keys[i], i + 1);
+            ops[i] = op;
+        }
+
+        lrutrack_sharded_batch(t, ops, 100);
+        for (uint32_t i = 0; i < 100; ++i) {
+            assert(ops[i].result == LRUTRACK_OK);
+            ops[i].op = i & 1 ? LRUTRACK_SHARDED_OP_USE :
+                LRUTRACK_SHARDED_OP_PEEK;
+            ops[i].value = INVALID_VALUE;
+        }
+
+        lrutrack_sharded_batch(t, ops, 100);
+        for (uint32_t i = 0; i < 100; ++i) {
+            assert(ops[i].result == LRUTRACK_OK);
+            assert(ops[i].value == i + 1);
+        }
+        assert(lrutrack_sharded_count(t) == 100);
+
+        // Operations on one key see each other in order
+        lrutrack_sharded_op_t seq[] = {
+            SHARDED_OP(LRUTRACK_SHARDED_OP_REMOVE, "1", 0),
+            SHARDED_OP(LRUTRACK_SHARDED_OP_USE, "1", 0),
+            SHARDED_OP(LRUTRACK_SHARDED_OP_USE, "2", 0),
+            SHARDED_OP(LRUTRACK_SHARDED_OP_INSERT, "1", 1001),
+            SHARDED_OP(LRUTRACK_SHARDED_OP_PEEK, "1", 0),
+            SHARDED_OP(LRUTRACK_SHARDED_OP_REMOVE, "x", 0),
+            SHARDED_OP(LRUTRACK_SHARDED_OP_PEEK, "x", 0),
+        };
+
+        lrutrack_sharded_batch(t, seq, sizeof(seq) / sizeof(seq[0]));
+        assert(seq[0].result == LRUTRACK_OK);
+        assert(seq[1].result == LRUTRACK_NOT_FOUND);
+        assert(seq[1].value == INVALID_VALUE);
+        assert(seq[2].result == LRUTRACK_OK && seq[2].value == 3);
+        assert(seq[3].result == LRUTRACK_OK);
+        assert(seq[4].result == LRUTRACK_OK && seq[4].value == 1001);
+        assert(seq[5].result == LRUTRACK_NOT_FOUND);
+        assert(seq[6].result == LRUTRACK_NOT_FOUND);
+        lrutrack_value_t value = lrutrack_sharded_use(t, RH_KEY("1"));
+        assert(value == 1001);
+        (void)value;
+
+        lrutrack_sharded_destroy(t);
+        assert(arena.bytes_allocated == 0);
+    }
+
+    return 1;
+}
+
+// Near cached values must not outlive removal or eviction from the shards
+static int test_sharded_near_cache(void) {
+    static const uint32_t modes[] = { 0, LRUTRACK_SHARDED_OPTIMISTIC };
+
+    for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); ++m) {
+        printf("lrutrack_sharded near cache mode %u\n", modes[m]);
+        sized_arena_t arena = { 0, 0 };
+        lrutrack_allocator_t allocator = { &arena, sized_alloc,
+            sized_dealloc };
+        lrutrack_sharded_config_t config = { .num_shards = 2,
+            .hash_table_size = 64, .num_initial_items = 8,
+            .flags = modes[m] | LRUTRACK_SHARDED_NEAR_CACHE,
+            .max_key_length = 8 };
+        lrutrack_sharded_t *t = lrutrack_sharded_create(&config, HASH_SEED,
+            INVALID_VALUE, NULL, evict, &allocator);
+        if (!t)
+            return 0;
+
+        lrutrack_sharded_near_t *nc = lrutrack_sharded_near_create(t, 4);
+        if (!nc)
+            return 0;
+
+        int result = lrutrack_sharded_insert(t, RH_KEY("1"), 1);
+        assert(result == LRUTRACK_OK);
+        result = lrutrack_sharded_insert(t, RH_KEY("2"), 2);
+        assert(result == LRUTRACK_OK);
+        lrutrack_value_t value;
+        for (uint32_t i = 0; i < LRUTRACK_SHARDED_NEAR_REFRESH * 2; ++i) {
+            value = lrutrack_sharded_near_use(t, nc, RH_KEY("1"));
+            assert(value == 1);
+            value = lrutrack_sharded_near_use(t, nc, RH_KEY("2"));
+            assert(value == 2);
+        }
+
+        uint64_t num_hits, num_misses;
+        lrutrack_sharded_near_stats(nc, &num_hits, &num_misses);
+        assert(num_hits + num_misses == LRUTRACK_SHARDED_NEAR_REFRESH * 4);
+        assert(num_misses <= 8);
+
+        // Removed, then inserted again with another value
+        result = lrutrack_sharded_remove(t, RH_KEY("1"));
+        assert(result == LRUTRACK_OK);
+        value = lrutrack_sharded_near_use(t, nc, RH_KEY("1"));
+        assert(value == INVALID_VALUE);
+        result = lrutrack_sharded_insert(t, RH_KEY("1"), 11);
+        assert(result == LRUTRACK_OK);
+        value = lrutrack_sharded_near_use(t, nc, RH_KEY("1"));
+        assert(value == 11);
+        value = lrutrack_sharded_near_use(t, nc, RH_KEY("2"));
+        assert(value == 2);
+
+        // Evicted as the LRU entry
+        while (lrutrack_sharded_remove_lru(t) == LRUTRACK_OK)
+            ;
+        value = lrutrack_sharded_near_use(t, nc, RH_KEY("1"));
+        assert(value == INVALID_VALUE);
+        value = lrutrack_sharded_near_use(t, nc, RH_KEY("2"));
+        assert(value == INVALID_VALUE);
+
+        // Evicted by inserts into full shards
+        result = lrutrack_sharded_insert(t, RH_KEY("2"), 2);
+        assert(result == LRUTRACK_OK);
+        value = lrutrack_sharded_near_use(t, nc, RH_KEY("2"));
+        assert(value == 2);
+        char key[16];
+        for (lrutrack_value_t i = 10; i < 100; ++i) {
+            snprintf(key, sizeof(key), "%u", i);
+            result = lrutrack_sharded_insert(t, RH_KEY(key), i);
+            assert(result == LRUTRACK_OK);
+        }
+        value = lrutrack_sharded_near_use(t, nc, RH_KEY("2"));
+        assert(value == lrutrack_sharded_peek(t, RH_KEY("2")));
+
+        value = lrutrack_sharded_near_use(t, nc, RH_KEY("99"));
+        assert(value == 99);
+        lrutrack_sharded_remove_all(t);
+        value = lrutrack_sharded_near_use(t, nc, RH_KEY("99"));
+        assert(value == INVALID_VALUE);
+        (void)value;
+        (void)result;
+
+        lrutrack_sharded_near_destroy(t, nc);
+        lrutrack_sharded_destroy(t);
+        assert(arena.bytes_allocated == 0);
+    }
+
+    return 1;
+}
+
+// Thread-safe sized allocator for the concurrent trackers
+static void *atomic_alloc(void *user, size_t sz, size_t alignment) {
+    void *ptr = NULL;
+    if (alignment <= sizeof(void *))
+        ptr = malloc(sz);
+    else if (posix_memalign(&ptr, alignment, sz) != 0)
+        ptr = NULL;
+    if (ptr)
+        atomic_fetch_add((atomic_size_t *)user, sz);
+    return ptr;
+}
+
+static void atomic_dealloc(void *user, void *ptr, size_t sz) {
+    assert(ptr && atomic_load((atomic_size_t *)user) >= sz);
+    atomic_fetch_sub((atomic_size_t *)user, sz);
+    free(ptr);
+}
+
+static void counting_evict(void *user, lrutrack_value_t value) {
+    assert(value != INVALID_VALUE);
+    (void)value;
+    atomic_fetch_add((atomic_uint *)user, 1);
+}
+
+// Runs the tasks serially in reverse, counting the runs
+static void reverse_run_tasks(void *user, lrutrack_task_func_t task,
+    void *task_user, uint32_t num_tasks) {
+    for (uint32_t i = num_tasks; i-- > 0;)
+        task(task_user, i);
+    ++*(uint32_t *)user;
+}
+
+// Every value is evicted exactly once and a cleared tracker is usable
+static int test_parallel_teardown(void) {
+    printf("lrutrack parallel teardown\n");
+    atomic_size_t bytes_allocated = 0;
+    lrutrack_allocator_t allocator = { &bytes_allocated, atomic_alloc,
+        atomic_dealloc };
+    atomic_uint num_evicted = 0;
+    lrutrack_t *t = lrutrack_create_with_allocator(64, 16, HASH_SEED,
+        INVALID_VALUE, &num_evicted, counting_evict, &allocator);
+    if (!t)
+        return 0;
+
+    char key[16];
+    int result;
+    for (lrutrack_value_t i = 1; i <= 1000; ++i) {
+        snprintf(key, sizeof(key), "%u", i);
+        result = lrutrack_insert(t, RH_KEY(key), i);
+        assert(result == LRUTRACK_OK);
+    }
+
+    // Queued values are delivered along with the rest
+    lrutrack_set_deferred_eviction(t, 1);
+    for (lrutrack_value_t i = 3; i <= 1000; i += 3) {
+        snprintf(key, sizeof(key), "%u", i);
+        result = lrutrack_remove(t, RH_KEY(key));
+        assert(result == LRUTRACK_OK);
+    }
+    assert(atomic_load(&num_evicted) == 0);
+
+    lrutrack_remove_all_parallel(t, 4, NULL);
+    assert(atomic_load(&num_evicted) == 1000);
+    assert(lrutrack_count(t) == 0);
+    assert(lrutrack_num_evicted(t) == 0);
+    assert(lrutrack_lru_row(t) == UINT32_MAX);
+
+    lrutrack_set_deferred_eviction(t, 0);
+    lrutrack_value_t value;
+    for (lrutrack_value_t i = 1; i <= 100; ++i) {
+        snprintf(key, sizeof(key), "%u", i);
+        value = lrutrack_use(t, RH_KEY(key));
+        assert(value == INVALID_VALUE);
+        result = lrutrack_insert(t, RH_KEY(key), i);
+        assert(result == LRUTRACK_OK);
+        value = lrutrack_use(t, RH_KEY(key));
+        assert(value == i);
+    }
+    (void)value;
+    (void)result;
+
+    uint32_t num_runs = 0;
+    lrutrack_task_runner_t runner = { &num_runs, reverse_run_tasks };
+    lrutrack_destroy_parallel(t, 7, &runner);
+    assert(num_runs == 1);
+    assert(atomic_load(&num_evicted) == 1100);
+    assert(atomic_load(&bytes_allocated) == 0);
+    return 1;
+}
+
+#define BUILD_NUM_ENTRIES 1000
+
+typedef struct recorded_evictions_t {
+    lrutrack_value_t values[BUILD_NUM_ENTRIES];
+    uint32_t num_values;
+} recorded_evictions_t;
+
+static void recording_evict(void *user, lrutrack_value_t value) {
+    recorded_evictions_t *recorded = user;
+    assert(recorded->num_values < BUILD_NUM_ENTRIES);
+    recorded->values[recorded->num_values++] = value;
+}
+
+// A built tracker evicts in the same order as one filled by inserting
+static int test_parallel_build(void) {
+    static char key_storage[BUILD_NUM_ENTRIES][8];
+    static recorded_evictions_t inserted, built;
+#if !LRUTRACK_32BIT_KEY
+    const void *keys[BUILD_NUM_ENTRIES];
+    uint32_t key_lengths[BUILD_NUM_ENTRIES];
+#else
+    uint32_t keys[BUILD_NUM_ENTRIES];
+#endif
+    lrutrack_value_t values[BUILD_NUM_ENTRIES];
+
+    printf("lrutrack parallel build\n");
+    // Keys are copied on the build's threads
+    atomic_size_t bytes_allocated = 0;
+    lrutrack_allocator_t allocator = { &bytes_allocated, atomic_alloc,
+        atomic_dealloc };
+    lrutrack_t *a = lrutrack_create_with_allocator(128, 0, HASH_SEED,
+        INVALID_VALUE, &inserted, recording_evict, &allocator);
+    lrutrack_t *b = lrutrack_create_with_allocator(128, 16, HASH_SEED,
+        INVALID_VALUE, &built, recording_evict, &allocator);
+    if (!a || !b)
+        return 0;
+
+    int result;
+    for (uint32_t i = 0; i < BUILD_NUM_ENTRIES; ++i) {
+        // Not in key order
+        snprintf(key_storage[i], sizeof(key_storage[i]), "%u",
+            (i * 7919) % BUILD_NUM_ENTRIES);
+#if !LRUTRACK_32BIT_KEY
+        keys[i] = key_storage[i];
+        key_lengths[i] = (uint32_t)strlen(key_storage[i]);
+#else
+        keys[i] = fnv32a_str(key_storage[i], HASH_SEED);
+#endif
+        values[i] = i + 1;
+        result = lrutrack_insert(a, RH_KEY(key_storage[i]), i + 1);
+        assert(result == LRUTRACK_OK);
+    }
+
+    // Only empty trackers
+    result = lrutrack_insert(b, RH_KEY("x"), 1);
+    assert(result == LRUTRACK_OK);
+#if !LRUTRACK_32BIT_KEY
+    result = lrutrack_build_parallel(b, keys, key_lengths, values,
+        BUILD_NUM_ENTRIES, 4, NULL);
+#else
+    result = lrutrack_build_parallel(b, keys, values, BUILD_NUM_ENTRIES, 4,
+        NULL);
+#endif
+    assert(result == LRUTRACK_ERROR);
+    result = lrutrack_remove(b, RH_KEY("x"));
+    assert(result == LRUTRACK_OK);
+    built.num_values = 0;
+
+    uint32_t num_runs = 0;
+    lrutrack_task_runner_t runner = { &num_runs, reverse_run_tasks };
+#if !LRUTRACK_32BIT_KEY
+    result = lrutrack_build_parallel(b, keys, key_lengths, values,
+        BUILD_NUM_ENTRIES, 5, &runner);
+#else
+    result = lrutrack_build_parallel(b, keys, values, BUILD_NUM_ENTRIES, 5,
+        &runner);
+#endif
+    assert(result == LRUTRACK_OK);
+    assert(num_runs == 4);
+    assert(lrutrack_count(b) == BUILD_NUM_ENTRIES);
+
+    lrutrack_value_t value;
+    for (uint32_t i = 0; i < BUILD_NUM_ENTRIES; i += 10) {
+        value = lrutrack_use(b, RH_KEY(key_storage[i]));
+        assert(value == i + 1);
+    }
+    for (uint32_t i = 0; i < BUILD_NUM_ENTRIES; i += 10) {
+        value = lrutrack_use(a, RH_KEY(key_storage[i]));
+        assert(value == i + 1);
+    }
+
+    while (lrutrack_remove_lru(a) == LRUTRACK_OK)
+        ;
+    while (lrutrack_remove_lru(b) == LRUTRACK_OK)
+        ;
+    assert(inserted.num_values == BUILD_NUM_ENTRIES);
+    assert(built.num_values == BUILD_NUM_ENTRIES);
+    assert(memcmp(inserted.values, built.values, sizeof(built.values)) == 0);
+
+    // Again on threads, into the now larger item array
+#if !LRUTRACK_32BIT_KEY
+    result = lrutrack_build_parallel(b, keys, key_lengths, values,
+        BUILD_NUM_ENTRIES / 2, 3, NULL);
+#else
+    result = lrutrack_build_parallel(b, keys, values, BUILD_NUM_ENTRIES / 2, 3,
+        NULL);
+#endif
+    assert(result == LRUTRACK_OK);
+    for (uint32_t i = 0; i < BUILD_NUM_ENTRIES / 2; ++i) {
+        value = lrutrack_use(b, RH_KEY(key_storage[i]));
+        assert(value == i + 1);
+    }
+    result = lrutrack_insert(b, RH_KEY("x"), 1);
+    assert(result == LRUTRACK_OK);
+    (void)value;
+    (void)result;
+
+    built.num_values = 0;
+    lrutrack_destroy(b);
+    assert(built.num_values == BUILD_NUM_ENTRIES / 2 + 1);
+    lrutrack_destroy(a);
+    assert(atomic_load(&bytes_allocated) == 0);
+    return 1;
+}
+
+// Inserts stay within the hard limit, the background evictor brings the
+// total down to the low watermark
+static int test_sharded_watermarks(void) {
+    static const uint32_t limits[][3] = {
+        { 64, 0, 0 }, { 64, 48, 16 }, { 0, 48, 16 } };
+
+    for (size_t l = 0; l < sizeof(limits) / sizeof(limits[0]); ++l) {
+        printf("lrutrack_sharded limits %u %u %u\n", limits[l][0],
+            limits[l][1], limits[l][2]);
+        atomic_size_t bytes_allocated = 0;
+        lrutrack_allocator_t allocator = { &bytes_allocated, atomic_alloc,
+            atomic_dealloc };
+        atomic_uint num_evicted = 0;
+        lrutrack_sharded_config_t config = { .num_shards = 4,
+            .hash_table_size = 64, .num_initial_items = 8,
+            .max_items = limits[l][0], .high_watermark = limits[l][1],
+            .low_watermark = limits[l][2] };
+        lrutrack_sharded_t *t = lrutrack_sharded_create(&config, HASH_SEED,
+            INVALID_VALUE, &num_evicted, counting_evict, &allocator);
+        if (!t)
+            return 0;
+
+        char key[16];
+        for (lrutrack_value_t i = 1; i <= 1000; ++i) {
+            snprintf(key, sizeof(key), "%u", i);
+            int result = lrutrack_sharded_insert(t, RH_KEY(key), i);
+            assert(result == LRUTRACK_OK);
+            assert(config.max_items == 0 ||
+                lrutrack_sharded_count(t) <= config.max_items);
+            (void)result;
+        }
+
+        if (config.high_watermark != 0) {
+            for (uint32_t i = 0; lrutrack_sharded_count(t) >
+                config.high_watermark; ++i) {
+                assert(i < 10000000);
+                sched_yield();
+            }
+        }
+
+        assert(lrutrack_sharded_count(t) + atomic_load(&num_evicted) ==
+            1000);
+
+        lrutrack_sharded_destroy(t);
+        assert(atomic_load(&num_evicted) == 1000);
+        assert(atomic_load(&bytes_allocated) == 0);
+    }
+
+    return 1;
+}
+
+typedef struct fc_worker_t {
+    lrutrack_fc_t *t;
+    uint32_t id;
+} fc_worker_t;
+
+#define FC_NUM_WORKERS 4
+#define FC_KEYS_PER_WORKER 500
+
+// Value of key i of worker id, never INVALID_VALUE
+#define FC_VALUE(id, i) ((id) * FC_KEYS_PER_WORKER + (i) + 1)
+
+// Inserts its own keys, checks them and removes the odd ones
+static void *fc_worker(void *arg) {
+    fc_worker_t *worker = arg;
+    lrutrack_fc_thread_t *self = lrutrack_fc_attach(worker->t);
+    assert(self);
+
+    char key[16];
+    for (uint32_t i = 0; i < FC_KEYS_PER_WORKER; ++i) {
+        snprintf(key, sizeof(key), "%u-%u", worker->id, i);
+        int result = lrutrack_fc_insert(worker->t, self, RH_KEY(key),
+            FC_VALUE(worker->id, i));
+        assert(result == LRUTRACK_OK);
+        (void)result;
+    }
+
+    for (uint32_t i = 0; i < FC_KEYS_PER_WORKER; ++i) {
+        snprintf(key, sizeof(key), "%u-%u", worker->id, i);
+        lrutrack_value_t value = lrutrack_fc_use(worker->t, self, RH_KEY(key));
+        assert(value == FC_VALUE(worker->id, i));
+        (void)value;
+        if (i & 1) {
+            int result = lrutrack_fc_remove(worker->t, self, RH_KEY(key));
+            assert(result == LRUTRACK_OK);
+            (void)result;
+        }
+    }
+
+    lrutrack_fc_detach(worker->t, self);
+    return NULL;
+}
+
+static int test_fc(void) {
+    printf("lrutrack_fc_create\n");
+    sized_arena_t arena = { 0, 0 };
+    lrutrack_allocator_t allocator = { &arena, sized_alloc, sized_dealloc };
+    lrutrack_fc_t *t = lrutrack_fc_create(64, 16, HASH_SEED, INVALID_VALUE,
+        NULL, evict, &allocator);
+    if (!t)
+        return 0;
+
+    fc_worker_t workers[FC_NUM_WORKERS];
+    pthread_t threads[FC_NUM_WORKERS];
+    for (uint32_t i = 0; i < FC_NUM_WORKERS; ++i) {
+        workers[i].t = t;
+        workers[i].id = i;
+        if (pthread_create(&threads[i], NULL, fc_worker, &workers[i]) != 0)
+            return 0;
+    }
+
+    for (uint32_t i = 0; i < FC_NUM_WORKERS; ++i)
+        pthread_join(threads[i], NULL);
+
+    uint64_t num_batches = 0, num_ops = 0;
+    lrutrack_fc_stats(t, &num_batches, &num_ops);
+    assert(num_ops == FC_NUM_WORKERS * FC_KEYS_PER_WORKER * 5 / 2);
+    assert(num_batches > 0 && num_batches <= num_ops);
+
+    lrutrack_fc_thread_t *self = lrutrack_fc_attach(t);
+    assert(self);
+
+    char key[16];
+    lrutrack_value_t value;
+    for (uint32_t id = 0; id < FC_NUM_WORKERS; ++id) {
+        for (uint32_t i = 0; i < FC_KEYS_PER_WORKER; ++i) {
+            snprintf(key, sizeof(key), "%u-%u", id, i);
+            value = lrutrack_fc_use(t, self, RH_KEY(key));
+            assert(value == ((i & 1) ? INVALID_VALUE : FC_VALUE(id, i)));
+        }
+    }
+
+    // Evicts a whole row, never the one used last
+    int result = lrutrack_fc_remove_lru(t, self);
+    assert(result == LRUTRACK_OK);
+    snprintf(key, sizeof(key), "%u-%u", FC_NUM_WORKERS - 1,
+        FC_KEYS_PER_WORKER - 2);
+    value = lrutrack_fc_use(t, self, RH_KEY(key));
+    assert(value == FC_VALUE(FC_NUM_WORKERS - 1, FC_KEYS_PER_WORKER - 2));
+    lrutrack_fc_remove_all(t, self);
+    result = lrutrack_fc_remove_lru(t, self);
+    assert(result == LRUTRACK_NOT_FOUND);
+    (void)value;
+    (void)result;
+
+    lrutrack_fc_detach(t, self);
+
+    printf("lrutrack_fc_destroy\n");
+    lrutrack_fc_destroy(t);
+
+    assert(arena.bytes_allocated == 0);
+    return 1;
+}
+
+typedef struct delegate_worker_t {
+    lrutrack_delegate_t *d;
+    uint32_t id;
+    atomic_int *num_running;
+} delegate_worker_t;
+
+#define DELEGATE_NUM_WORKERS 3
+#define DELEGATE_KEYS_PER_WORKER 256
+#define DELEGATE_BATCH 16
+
+static void delegate_submit_all(lrutrack_delegate_t *d,
+    lrutrack_delegate_request_t *requests, uint32_t num_requests) {
+    uint32_t num_submitted = 0;
+    while (num_submitted < num_requests) {
+        num_submitted += lrutrack_delegate_submit(d,
+            requests + num_submitted, num_requests - num_submitted);
+    }
+    for (uint32_t i = 0; i < num_requests; ++i)
+        lrutrack_delegate_wait(&requests[i]);
+}
+
+// Inserts its keys in batches, then uses them and removes the odd ones
+static void *delegate_worker(void *arg) {
+    delegate_worker_t *worker = arg;
+    lrutrack_delegate_request_t requests[DELEGATE_BATCH * 3];
+    char keys[DELEGATE_BATCH][16];
+
+    for (uint32_t base = 0; base < DELEGATE_KEYS_PER_WORKER;
+        base += DELEGATE_BATCH) {
+        for (uint32_t i = 0; i < DELEGATE_BATCH; ++i) {
+            snprintf(keys[i], sizeof(keys[i]), "%u-%u", worker->id,
+                base + i);
+            requests[i].op = LRUTRACK_DELEGATE_INSERT;
+#if !LRUTRACK_32BIT_KEY
+            requests[i].key = keys[i];
+            requests[i].key_length = (uint32_t)strlen(keys[i]);
+#else
+            requests[i].key = RH_KEY(keys[i]);
+#endif
+            requests[i].value = FC_VALUE(worker->id, base + i);
+        }
+        delegate_submit_all(worker->d, requests, DELEGATE_BATCH);
+
+        // Each use is followed by the removal of odd keys
+        uint32_t n = 0;
+        for (uint32_t i = 0; i < DELEGATE_BATCH; ++i) {
+            assert(requests[i].result == LRUTRACK_OK);
+            lrutrack_delegate_request_t use = requests[i];
+            use.op = LRUTRACK_DELEGATE_USE;
+            use.value = INVALID_VALUE;
+            requests[DELEGATE_BATCH + n++] = use;
+            if ((base + i) & 1) {
+                lrutrack_delegate_request_t remove = use;
+                remove.op = LRUTRACK_DELEGATE_REMOVE;
+                requests[DELEGATE_BATCH + n++] = remove;
+            }
+        }
+        delegate_submit_all(worker->d, requests + DELEGATE_BATCH, n);
+
+        for (uint32_t i = 0, k = 0; i < DELEGATE_BATCH; ++i) {
+            assert(requests[DELEGATE_BATCH + k].value ==
+                FC_VALUE(worker->id, base + i));
+            k += (base + i) & 1 ? 2 : 1;
+        }
+    }
+
+    atomic_fetch_sub(worker->num_running, 1);
+    return NULL;
+}
+
+static int test_delegate(void) {
+    printf("lrutrack_delegate_create\n");
+    sized_arena_t arena = { 0, 0 };
+    lrutrack_allocator_t allocator = { &arena, sized_alloc, sized_dealloc };
+    lrutrack_delegate_t *d = lrutrack_delegate_create(64, 16, HASH_SEED,
+        INVALID_VALUE, NULL, evict, 32, &allocator);
+    if (!d)
+        return 0;
+
+    // A full ring takes no more requests until the owner polls
+    lrutrack_delegate_request_t requests[40];
+    memset(requests, 0, sizeof(requests));
+    for (uint32_t i = 0; i < 40; ++i)
+        requests[i].op = LRUTRACK_DELEGATE_REMOVE_LRU;
+    uint32_t n = lrutrack_delegate_submit(d, requests, 40);
+    assert(n == 32);
+    assert(!lrutrack_delegate_done(&requests[0]));
+    n = lrutrack_delegate_poll(d, 10);
+    assert(n == 10);
+    assert(lrutrack_delegate_done(&requests[9]));
+    assert(!lrutrack_delegate_done(&requests[10]));
+    assert(requests[0].result == LRUTRACK_NOT_FOUND);
+    n = lrutrack_delegate_poll(d, UINT32_MAX);
+    assert(n == 22);
+    n = lrutrack_delegate_poll(d, UINT32_MAX);
+    assert(n == 0);
+    (void)n;
+
+    printf("lrutrack_delegate submitter threads\n");
+    atomic_int num_running = DELEGATE_NUM_WORKERS;
+    delegate_worker_t workers[DELEGATE_NUM_WORKERS];
+    pthread_t threads[DELEGATE_NUM_WORKERS];
+    for (uint32_t i = 0; i < DELEGATE_NUM_WORKERS; ++i) {
+        workers[i].d = d;
+        workers[i].id = i;
+        workers[i].num_running = &num_running;
+        if (pthread_create(&threads[i], NULL, delegate_worker,
+            &workers[i]) != 0)
+            return 0;
+    }
+
+    // This thread owns the tracker
+    while (atomic_load(&num_running) > 0) {
+        if (lrutrack_delegate_poll(d, 64) == 0)
+            sched_yield();
+    }
+
+    for (uint32_t i = 0; i < DELEGATE_NUM_WORKERS; ++i)
+        pthread_join(threads[i], NULL);
+
+    lrutrack_t *t = lrutrack_delegate_tracker(d);
+    char key[16];
+    for (uint32_t id = 0; id < DELEGATE_NUM_WORKERS; ++id) {
+        for (uint32_t i = 0; i < DELEGATE_KEYS_PER_WORKER; ++i) {
+            snprintf(key, sizeof(key), "%u-%u", id, i);
+            lrutrack_value_t value = lrutrack_use(t, RH_KEY(key));
+            assert(value == ((i & 1) ? INVALID_VALUE : FC_VALUE(id, i)));
+            (void)value;
+        }
+    }
+
+    printf("lrutrack_delegate_destroy\n");
+    lrutrack_delegate_destroy(d);
+
+    assert(arena.bytes_allocated == 0);
+    return 1;
+}
+
+static void lf_evict(void *user, lrutrack_value_t value) {
+    assert(value != INVALID_VALUE);
+    (void)value;
+    atomic_fetch_add((atomic_uint *)user, 1);
+}
+
+#define LF_NUM_THREADS 4
+#define LF_NUM_KEYS 64
+#define LF_ROUNDS 2000
+
+// Value of version v of key k, never INVALID_VALUE
+#define LF_VALUE(k, v) (((v) << 8 | (k)) + 1)
+#define LF_KEY_OF(value) (((value) - 1) & 0xff)
+#define LF_VERSION_OF(value) (((value) - 1) >> 8)
+
+typedef struct lf_worker_t {
+    lrutrack_lf_t *t;
+    uint32_t id;
+    atomic_int *stop;
+    uint32_t num_inserted; // Successful inserts of contended keys
+    uint32_t num_removed;
+} lf_worker_t;
+
+// Key k is written by thread k % LF_NUM_THREADS only, which inserts and
+// removes ever newer versions of it
+static void *lf_writer(void *arg) {
+    lf_worker_t *worker = arg;
+    char key[16];
+    for (uint32_t v = 1; v <= LF_ROUNDS; ++v) {
+        for (uint32_t k = worker->id; k < LF_NUM_KEYS; k += LF_NUM_THREADS) {
+            snprintf(key, sizeof(key), "%u", k);
+            int result = lrutrack_lf_insert(worker->t, RH_KEY(key),
+                LF_VALUE(k, v));
+            assert(result == LRUTRACK_OK);
+            assert(lrutrack_lf_peek(worker->t, RH_KEY(key)) ==
+                LF_VALUE(k, v));
+            result = lrutrack_lf_remove(worker->t, RH_KEY(key));
+            assert(result == LRUTRACK_OK);
+            (void)result;
+        }
+    }
+    return NULL;
+}
+
+// Every value read must belong to the key, and as each key has a single
+// writer, a linearizable table never shows a reader an older version after
+// a newer one
+static void *lf_reader(void *arg) {
+    lf_worker_t *worker = arg;
+    uint32_t last_version[LF_NUM_KEYS];
+    memset(last_version, 0, sizeof(last_version));
+
+    char key[16];
+    while (!atomic_load(worker->stop)) {
+        for (uint32_t k = 0; k < LF_NUM_KEYS; ++k) {
+            snprintf(key, sizeof(key), "%u", k);
+            lrutrack_value_t value = lrutrack_lf_use(worker->t, RH_KEY(key));
+            if (value == INVALID_VALUE)
+                continue;
+            assert(LF_KEY_OF(value) == k);
+            assert(LF_VERSION_OF(value) >= last_version[k]);
+            last_version[k] = LF_VERSION_OF(value);
+        }
+    }
+    return NULL;
+}
+
+// All threads race to insert and remove the same keys
+static void *lf_racer(void *arg) {
+    lf_worker_t *worker = arg;
+    char key[16];
+    for (uint32_t round = 0; round < LF_ROUNDS; ++round) {
+        uint32_t k = round % LF_NUM_KEYS;
+        snprintf(key, sizeof(key), "race%u", k);
+        if (lrutrack_lf_insert(worker->t, RH_KEY(key),
+            LF_VALUE(k, worker->id + 1)) == LRUTRACK_OK)
+            worker->num_inserted++;
+        if (round & 1 && lrutrack_lf_remove(worker->t, RH_KEY(key)) ==
+            LRUTRACK_OK)
+            worker->num_removed++;
+    }
+    return NULL;
+}
+
+static int test_lf(void) {
+    printf("lrutrack_lf_create\n");
+    atomic_size_t bytes_allocated = 0;
+    atomic_uint num_evicted = 0;
+    lrutrack_allocator_t allocator = { &bytes_allocated, atomic_alloc,
+        atomic_dealloc };
+    lrutrack_lf_t *t = lrutrack_lf_create(16, 32, HASH_SEED, INVALID_VALUE,
+        &num_evicted, lf_evict, &allocator);
+    if (!t)
+        return 0;
+
+    int result = lrutrack_lf_insert(t, RH_KEY("1"), 1);
+    assert(result == LRUTRACK_OK);
+    result = lrutrack_lf_insert(t, RH_KEY("1"), 2);
+    assert(result == LRUTRACK_ERROR);
+    result = lrutrack_lf_insert(t, RH_KEY("2"), 2);
+    assert(result == LRUTRACK_OK);
+    lrutrack_value_t value = lrutrack_lf_use(t, RH_KEY("1"));
+    assert(value == 1);
+    assert(lrutrack_lf_peek(t, RH_KEY("2")) == 2);
+    result = lrutrack_lf_remove(t, RH_KEY("1"));
+    assert(result == LRUTRACK_OK);
+    result = lrutrack_lf_remove(t, RH_KEY("1"));
+    assert(result == LRUTRACK_NOT_FOUND);
+    assert(atomic_load(&num_evicted) == 1);
+    assert(lrutrack_lf_count(t) == 1);
+
+    // Over capacity, inserts evict entries whose reference bit is clear
+    char key[16];
+    for (lrutrack_value_t i = 10; i < 110; ++i) {
+        snprintf(key, sizeof(key), "%u", i);
+        result = lrutrack_lf_insert(t, RH_KEY(key), i);
+        assert(result == LRUTRACK_OK);
+        value = lrutrack_lf_use(t, RH_KEY("2"));
+        assert(value == 2);
+    }
+    assert(lrutrack_lf_count(t) == 32);
+    assert(atomic_load(&num_evicted) == 1 + 101 - 32);
+    value = lrutrack_lf_use(t, RH_KEY("109"));
+    assert(value == 109);
+
+    result = lrutrack_lf_remove_lru(t);
+    assert(result == LRUTRACK_OK);
+    lrutrack_lf_remove_all(t);
+    assert(lrutrack_lf_count(t) == 0);
+    result = lrutrack_lf_remove_lru(t);
+    assert(result == LRUTRACK_NOT_FOUND);
+    assert(atomic_load(&num_evicted) == 102);
+    (void)value;
+    (void)result;
+    lrutrack_lf_destroy(t);
+    assert(atomic_load(&bytes_allocated) == 0);
+
+    printf("lrutrack_lf linearizability stress\n");
+    atomic_store(&num_evicted, 0);
+    t = lrutrack_lf_create(16, 1 << 20, HASH_SEED, INVALID_VALUE,
+        &num_evicted, lf_evict, &allocator);
+    if (!t)
+        return 0;
+
+    atomic_int stop = 0;
+    lf_worker_t workers[LF_NUM_THREADS * 2];
+    pthread_t threads[LF_NUM_THREADS * 2];
+    for (uint32_t i = 0; i < LF_NUM_THREADS * 2; ++i) {
+        lf_worker_t worker = { t, i % LF_NUM_THREADS, &stop, 0, 0 };
+        workers[i] = worker;
+        if (pthread_create(&threads[i], NULL,
+            i < LF_NUM_THREADS ? lf_writer : lf_reader, &workers[i]) != 0)
+            return 0;
+    }
+
+    for (uint32_t i = 0; i < LF_NUM_THREADS; ++i)
+        pthread_join(threads[i], NULL);
+    atomic_store(&stop, 1);
+    for (uint32_t i = LF_NUM_THREADS; i < LF_NUM_THREADS * 2; ++i)
+        pthread_join(threads[i], NULL);
+
+    assert(lrutrack_lf_count(t) == 0);
+    assert(atomic_load(&num_evicted) == LF_NUM_KEYS * LF_ROUNDS);
+
+    // Each insert that won must be matched by one removal or a value
+    // left in the table
+    atomic_store(&num_evicted, 0);
+    for (uint32_t i = 0; i < LF_NUM_THREADS; ++i) {
+        lf_worker_t worker = { t, i, &stop, 0, 0 };
+        workers[i] = worker;
+        if (pthread_create(&threads[i], NULL, lf_racer, &workers[i]) != 0)
+            return 0;
+    }
+
+    uint32_t num_inserted = 0, num_removed = 0;
+    for (uint32_t i = 0; i < LF_NUM_THREADS; ++i) {
+        pthread_join(threads[i], NULL);
+        num_inserted += workers[i].num_inserted;
+        num_removed += workers[i].num_removed;
+    }
+
+    assert(num_removed == atomic_load(&num_evicted));
+    assert(num_inserted == num_removed + lrutrack_lf_count(t));
+    assert(lrutrack_lf_count(t) <= LF_NUM_KEYS);
+
+    printf("lrutrack_lf_destroy\n");
+    lrutrack_lf_destroy(t);
+    assert(atomic_load(&num_evicted) == num_inserted);
+    assert(atomic_load(&bytes_allocated) == 0);
+    return 1;
+}
+
+int main() {
+    printf("lrutrack_create\n");
+    lrutrack_t *t = lrutrack_create(HASH_TABLE_SIZE, NUM_INITIAL_ITEMS, HASH_SEED,
+        INVALID_VALUE, NULL, evict, malloc_wrapper, free_wrapper);
+    if (!t) {
+        return EXIT_FAILURE;
+    }
+
+    test_sequence(t);
 
     printf("lrutrack_destroy\n");
     lrutrack_destroy(t);
@@ -151,5 +2162,73 @@ int main() {
     assert(total_bytes_allocated == 0);
     assert(allocations_head.next == NULL);
 
+    if (!test_handles())
+        return EXIT_FAILURE;
+
+    if (!test_pinning())
+        return EXIT_FAILURE;
+
+    if (!test_priorities())
+        return EXIT_FAILURE;
+
+    if (!test_tenants())
+        return EXIT_FAILURE;
+
+    if (!test_group())
+        return EXIT_FAILURE;
+
+    if (!test_allocator())
+        return EXIT_FAILURE;
+
+    if (!test_compaction())
+        return EXIT_FAILURE;
+
+    if (!test_in_place())
+        return EXIT_FAILURE;
+
+    if (!test_deferred_eviction())
+        return EXIT_FAILURE;
+
+    if (!test_parallel_teardown())
+        return EXIT_FAILURE;
+
+    if (!test_parallel_build())
+        return EXIT_FAILURE;
+
+    if (!test_robin_hood())
+        return EXIT_FAILURE;
+
+    if (!test_cuckoo())
+        return EXIT_FAILURE;
+    if (!test_cuckoo_displacement())
+        return EXIT_FAILURE;
+
+    if (!test_bucket())
+        return EXIT_FAILURE;
+
+    if (!test_sharded())
+        return EXIT_FAILURE;
+
+    if (!test_sharded_read_modes())
+        return EXIT_FAILURE;
+
+    if (!test_sharded_near_cache())
+        return EXIT_FAILURE;
+
+    if (!test_sharded_batch())
+        return EXIT_FAILURE;
+
+    if (!test_sharded_watermarks())
+        return EXIT_FAILURE;
+
+    if (!test_fc())
+        return EXIT_FAILURE;
+
+    if (!test_delegate())
+        return EXIT_FAILURE;
+
+    if (!test_lf())
+        return EXIT_FAILURE;
+
     return EXIT_SUCCESS;
 }